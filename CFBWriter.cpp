@@ -0,0 +1,458 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "CFBWriter.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+const uint32_t kSectorSize = 512;
+const uint32_t kMiniSectorSize = 64;
+const uint32_t kMiniCutoff = 4096;                   // потоки меньше - в мини-поток
+const uint32_t kEntrySize = 128;
+const uint32_t kHeaderDifat = 109;                    // ссылок на FAT в заголовке
+const uint32_t kIdsPerSector = kSectorSize / 4;       // 128
+const uint32_t kMiniPerSector = kSectorSize / kMiniSectorSize;
+const uint32_t kMaxName = 31;                         // символов UTF-16 без нуля
+
+const uint32_t FREESECT   = 0xFFFFFFFF;
+const uint32_t ENDOFCHAIN = 0xFFFFFFFE;
+const uint32_t FATSECT    = 0xFFFFFFFD;
+const uint32_t DIFSECT    = 0xFFFFFFFC;
+const uint32_t NOSTREAM   = 0xFFFFFFFF;
+const uint32_t NONE       = 0xFFFFFFFF;
+
+const uint8_t TYPE_STORAGE = 1;
+const uint8_t TYPE_STREAM  = 2;
+const uint8_t TYPE_ROOT    = 5;
+const uint8_t COLOR_RED    = 0;
+const uint8_t COLOR_BLACK  = 1;
+
+void Put16(char* p, uint16_t v) { p[0] = (char)v; p[1] = (char)(v >> 8); }
+void Put32(char* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (8 * i)); }
+
+uint32_t DivUp(uint64_t a, uint32_t b) { return (uint32_t)((a + b - 1) / b); }
+
+// Верхний регистр для сравнения имён (ASCII, Latin-1, кириллица)
+char16_t Upper(char16_t c) {
+    if (c >= 'a' && c <= 'z') return c - 0x20;
+    if (c >= 0xE0 && c <= 0xFE && c != 0xF7) return c - 0x20;
+    if (c >= 0x430 && c <= 0x44F) return c - 0x20;
+    if (c >= 0x450 && c <= 0x45F) return c - 0x50;
+    return c;
+}
+
+} // namespace
+
+// ============================================================================
+// ПОСТРОЕНИЕ ДЕРЕВА ЭЛЕМЕНТОВ
+// ============================================================================
+
+CfbWriter::CfbWriter(const CfbWriterOptions& options) : m_options(options) {
+    memset(&m_stats, 0, sizeof(m_stats));
+    Entry root;
+    root.name = u"Root Entry";
+    root.isStorage = true;
+    root.size = 0;
+    m_entries.push_back(root);
+}
+
+// UTF-8 -> UTF-16 с проверкой длины
+bool CfbWriter::SplitName(const std::string& utf8, std::u16string& name) {
+    name.clear();
+    for (size_t i = 0; i < utf8.size();) {
+        unsigned char c = (unsigned char)utf8[i];
+        uint32_t cp;
+        int extra;
+        if (c < 0x80) { cp = c; extra = 0; }
+        else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+        else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+        else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; }
+        else { m_lastError = "Некорректный UTF-8 в имени: " + utf8; return false; }
+        if (i + extra >= utf8.size()) { m_lastError = "Некорректный UTF-8 в имени: " + utf8; return false; }
+        for (int k = 1; k <= extra; ++k) cp = (cp << 6) | ((unsigned char)utf8[i + k] & 0x3F);
+        i += 1 + extra;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            name += (char16_t)(0xD800 + (cp >> 10));
+            name += (char16_t)(0xDC00 + (cp & 0x3FF));
+        } else {
+            name += (char16_t)cp;
+        }
+    }
+    if (name.empty() || name.size() > kMaxName) {
+        m_lastError = "Имя элемента пустое или длиннее 31 символа: " + utf8;
+        return false;
+    }
+    return true;
+}
+
+// Порядок MS-CFB: сначала длина, затем посимвольно в верхнем регистре
+int CfbWriter::CompareNames(const std::u16string& a, const std::u16string& b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char16_t ca = Upper(a[i]), cb = Upper(b[i]);
+        if (ca != cb) return ca < cb ? -1 : 1;
+    }
+    return 0;
+}
+
+// Возвращает индекс элемента по пути, создавая хранилища по дороге.
+// storageLeaf - последний элемент тоже хранилище. -1 при ошибке.
+int CfbWriter::FindOrAddEntry(const std::string& path, bool storageLeaf) {
+    uint32_t current = 0;
+    size_t pos = 0;
+    while (pos <= path.size()) {
+        size_t end = path.find_first_of("\\/", pos);
+        if (end == std::string::npos) end = path.size();
+        std::string part = path.substr(pos, end - pos);
+        pos = end + 1;
+        if (part.empty()) {
+            if (end == path.size()) break;
+            continue;
+        }
+        bool last = end == path.size();
+
+        std::u16string name;
+        if (!SplitName(part, name)) return -1;
+
+        uint32_t found = NONE;
+        for (uint32_t child : m_entries[current].children) {
+            if (CompareNames(m_entries[child].name, name) == 0) { found = child; break; }
+        }
+
+        bool wantStorage = !last || storageLeaf;
+        if (found != NONE) {
+            if (m_entries[found].isStorage != wantStorage) {
+                m_lastError = "Элемент уже существует с другим типом: " + path;
+                return -1;
+            }
+            if (last && !wantStorage) {
+                m_lastError = "Поток уже добавлен: " + path;
+                return -1;
+            }
+            current = found;
+            continue;
+        }
+
+        Entry e;
+        e.name = name;
+        e.isStorage = wantStorage;
+        e.size = 0;
+        m_entries.push_back(e);
+        uint32_t index = (uint32_t)m_entries.size() - 1;
+        m_entries[current].children.push_back(index);
+        current = index;
+    }
+    if (current == 0) {
+        m_lastError = "Пустой путь";
+        return -1;
+    }
+    return (int)current;
+}
+
+bool CfbWriter::AddStorage(const std::string& path) {
+    return FindOrAddEntry(path, true) >= 0;
+}
+
+bool CfbWriter::AddStream(const std::string& path, const std::vector<char>& data) {
+    // Копия живёт в замыкании до записи файла
+    std::shared_ptr<std::vector<char>> copy(new std::vector<char>(data));
+    return AddStream(path, (uint32_t)data.size(), [copy](uint64_t offset, char* out, size_t len) {
+        memcpy(out, copy->data() + offset, len);
+    });
+}
+
+bool CfbWriter::AddStream(const std::string& path, uint32_t size, const FillFn& fill) {
+    int index = FindOrAddEntry(path, false);
+    if (index < 0) return false;
+    m_entries[index].size = size;
+    m_entries[index].fill = fill;
+    return true;
+}
+
+// ============================================================================
+// РАСКЛАДКА
+// ============================================================================
+
+// Сбалансированное дерево из отсортированного списка: корень - середина
+uint32_t CfbWriter::BuildTree(std::vector<uint32_t>& sorted, size_t lo, size_t hi, int depth, std::vector<int>& depths) {
+    if (lo >= hi) return NOSTREAM;
+    size_t mid = lo + (hi - lo) / 2;
+    uint32_t node = sorted[mid];
+    depths[mid] = depth;
+    m_entries[node].left = BuildTree(sorted, lo, mid, depth + 1, depths);
+    m_entries[node].right = BuildTree(sorted, mid + 1, hi, depth + 1, depths);
+    return node;
+}
+
+// Дочерние элементы хранилища - красно-чёрное дерево. У сбалансированного
+// по размеру дерева пустые ссылки лежат на двух соседних уровнях, поэтому
+// достаточно покрасить красным неполный нижний уровень.
+void CfbWriter::LayoutDirectory(uint32_t storage) {
+    Entry& parent = m_entries[storage];
+    std::vector<uint32_t> sorted = parent.children;
+    std::sort(sorted.begin(), sorted.end(), [this](uint32_t a, uint32_t b) {
+        return CompareNames(m_entries[a].name, m_entries[b].name) < 0;
+    });
+
+    std::vector<int> depths(sorted.size(), 0);
+    parent.child = BuildTree(sorted, 0, sorted.size(), 0, depths);
+
+    int maxDepth = 0;
+    for (int d : depths) maxDepth = (std::max)(maxDepth, d);
+    bool perfect = sorted.size() == ((size_t)1 << (maxDepth + 1)) - 1;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        m_entries[sorted[i]].color = !perfect && depths[i] == maxDepth ? COLOR_RED : COLOR_BLACK;
+    }
+
+    for (uint32_t child : sorted) {
+        if (m_entries[child].isStorage) LayoutDirectory(child);
+    }
+}
+
+// Раздаёт единицы (сектора или мини-сектора) цепочкам начиная с unitBase.
+// Подряд или по одной на цепочку по кругу (fragment). Заполняет таблицу
+// переходов (FAT/miniFAT) и владельцев единиц.
+void CfbWriter::AllocateChains(std::vector<Chain>& chains, uint32_t unitBase, std::vector<uint32_t>& table,
+                               std::vector<Owner>& owners) {
+    std::vector<uint32_t> last(chains.size(), NONE);
+    std::vector<uint32_t> done(chains.size(), 0);
+    uint32_t unit = unitBase;
+
+    auto take = [&](uint32_t c) {
+        if (last[c] == NONE) chains[c].first = unit;
+        else table[last[c]] = unit;
+        table[unit] = ENDOFCHAIN;
+        owners[unit - unitBase] = Owner{ c, done[c] };
+        last[c] = unit;
+        ++done[c];
+        ++unit;
+    };
+
+    for (size_t c = 0; c < chains.size(); ++c) {
+        if (chains[c].count == 0) chains[c].first = ENDOFCHAIN;
+    }
+
+    if (!m_options.fragment) {
+        for (uint32_t c = 0; c < chains.size(); ++c) {
+            for (uint32_t i = 0; i < chains[c].count; ++i) take(c);
+        }
+        return;
+    }
+
+    bool any = true;
+    while (any) {
+        any = false;
+        for (uint32_t c = 0; c < chains.size(); ++c) {
+            if (done[c] < chains[c].count) {
+                take(c);
+                any = true;
+            }
+        }
+    }
+}
+
+void CfbWriter::FillStreamBytes(const Entry& e, uint64_t offset, char* out, size_t len) const {
+    if (offset >= e.size) return;
+    size_t n = (size_t)(std::min)((uint64_t)len, (uint64_t)e.size - offset);
+    if (n && e.fill) e.fill(offset, out, n);
+}
+
+// ============================================================================
+// ЗАПИСЬ
+// ============================================================================
+
+bool CfbWriter::Write(const std::string& fileName) {
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    for (Entry& e : m_entries) {
+        e.left = e.right = e.child = NOSTREAM;
+        e.color = COLOR_BLACK;
+        e.start = ENDOFCHAIN;
+    }
+    LayoutDirectory(0);
+
+    // === Мини-поток: потоки меньше порога ===
+    std::vector<Chain> miniChains;
+    std::vector<Chain> chains(1, Chain{ NONE, 0, ENDOFCHAIN }); // [0] - контейнер мини-потока
+    for (uint32_t i = 1; i < m_entries.size(); ++i) {
+        const Entry& e = m_entries[i];
+        if (e.isStorage) {
+            ++m_stats.storages;
+            continue;
+        }
+        ++m_stats.streams;
+        if (e.size == 0) continue;
+        if (e.size < kMiniCutoff) {
+            miniChains.push_back(Chain{ i, DivUp(e.size, kMiniSectorSize), ENDOFCHAIN });
+            ++m_stats.miniStreams;
+        } else {
+            chains.push_back(Chain{ i, DivUp(e.size, kSectorSize), ENDOFCHAIN });
+        }
+    }
+
+    uint32_t miniUnits = 0;
+    for (const Chain& c : miniChains) miniUnits += c.count;
+    std::vector<uint32_t> miniFat(miniUnits);
+    std::vector<Owner> miniOwners(miniUnits);
+    AllocateChains(miniChains, 0, miniFat, miniOwners);
+    for (const Chain& c : miniChains) m_entries[c.entry].start = c.first;
+    chains[0].count = DivUp((uint64_t)miniUnits * kMiniSectorSize, kSectorSize);
+
+    // === Число секторов: данные + служебные; FAT и DIFAT описывают и себя ===
+    uint32_t dirSectors = DivUp((uint64_t)m_entries.size() * kEntrySize, kSectorSize);
+    uint32_t miniFatSectors = DivUp((uint64_t)miniUnits * 4, kSectorSize);
+    uint64_t dataSectors = 0;
+    for (const Chain& c : chains) dataSectors += c.count;
+
+    uint64_t fixed = (uint64_t)dirSectors + miniFatSectors + dataSectors;
+    uint32_t fatSectors = 0, difatSectors = 0;
+    for (;;) {
+        uint32_t fat = DivUp(fixed + fatSectors + difatSectors, kIdsPerSector);
+        uint32_t difat = fat > kHeaderDifat ? DivUp(fat - kHeaderDifat, kIdsPerSector - 1) : 0;
+        if (fat == fatSectors && difat == difatSectors) break;
+        fatSectors = fat;
+        difatSectors = difat;
+    }
+    uint64_t total = fixed + fatSectors + difatSectors;
+    if (total >= 0xFFFFFFF0ull) {
+        m_lastError = "Контейнер слишком большой для 512-байтовых секторов";
+        return false;
+    }
+
+    // Порядок: FAT, DIFAT, каталог, miniFAT, данные
+    uint32_t difatStart = fatSectors;
+    uint32_t dirStart = difatStart + difatSectors;
+    uint32_t miniFatStart = dirStart + dirSectors;
+    uint32_t dataStart = miniFatStart + miniFatSectors;
+
+    std::vector<uint32_t> fat((size_t)fatSectors * kIdsPerSector, FREESECT);
+    for (uint32_t i = 0; i < fatSectors; ++i) fat[i] = FATSECT;
+    for (uint32_t i = 0; i < difatSectors; ++i) fat[difatStart + i] = DIFSECT;
+    for (uint32_t i = 0; i < dirSectors; ++i) fat[dirStart + i] = i + 1 < dirSectors ? dirStart + i + 1 : ENDOFCHAIN;
+    for (uint32_t i = 0; i < miniFatSectors; ++i) fat[miniFatStart + i] = i + 1 < miniFatSectors ? miniFatStart + i + 1 : ENDOFCHAIN;
+
+    std::vector<Owner> owners((size_t)dataSectors);
+    AllocateChains(chains, dataStart, fat, owners);
+    m_entries[0].start = chains[0].first;
+    m_entries[0].size = miniUnits * kMiniSectorSize;
+    for (size_t c = 1; c < chains.size(); ++c) m_entries[chains[c].entry].start = chains[c].first;
+
+    m_stats.sectors = (uint32_t)total;
+    m_stats.fatSectors = fatSectors;
+    m_stats.difatSectors = difatSectors;
+    m_stats.miniFatSectors = miniFatSectors;
+    m_stats.dirSectors = dirSectors;
+    m_stats.fileSize = (total + 1) * kSectorSize;
+
+    FILE* f = fopen(fileName.c_str(), "wb");
+    if (!f) {
+        m_lastError = "Не удалось создать файл: " + fileName;
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    // === Заголовок ===
+    char sector[kSectorSize];
+    memset(sector, 0, sizeof(sector));
+    static const unsigned char kSignature[8] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+    memcpy(sector, kSignature, 8);
+    Put16(sector + 24, 0x003E);            // минорная версия
+    Put16(sector + 26, 0x0003);            // версия 3: сектор 512
+    Put16(sector + 28, 0xFFFE);            // порядок байт
+    Put16(sector + 30, 9);                 // 2^9 = 512
+    Put16(sector + 32, 6);                 // 2^6 = 64
+    Put32(sector + 44, fatSectors);
+    Put32(sector + 48, dirStart);
+    Put32(sector + 56, kMiniCutoff);
+    Put32(sector + 60, miniFatSectors ? miniFatStart : ENDOFCHAIN);
+    Put32(sector + 64, miniFatSectors);
+    Put32(sector + 68, difatSectors ? difatStart : ENDOFCHAIN);
+    Put32(sector + 72, difatSectors);
+    for (uint32_t i = 0; i < kHeaderDifat; ++i) Put32(sector + 76 + i * 4, i < fatSectors ? i : FREESECT);
+    bool ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+
+    // === FAT ===
+    for (uint32_t s = 0; ok && s < fatSectors; ++s) {
+        for (uint32_t i = 0; i < kIdsPerSector; ++i) Put32(sector + i * 4, fat[(size_t)s * kIdsPerSector + i]);
+        ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+    }
+
+    // === DIFAT: 127 ссылок на FAT + ссылка на следующий сектор DIFAT ===
+    for (uint32_t s = 0; ok && s < difatSectors; ++s) {
+        for (uint32_t i = 0; i < kIdsPerSector - 1; ++i) {
+            uint32_t fatIndex = kHeaderDifat + s * (kIdsPerSector - 1) + i;
+            Put32(sector + i * 4, fatIndex < fatSectors ? fatIndex : FREESECT);
+        }
+        Put32(sector + (kIdsPerSector - 1) * 4, s + 1 < difatSectors ? difatStart + s + 1 : ENDOFCHAIN);
+        ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+    }
+
+    // === Каталог ===
+    for (uint32_t s = 0; ok && s < dirSectors; ++s) {
+        memset(sector, 0, sizeof(sector));
+        for (uint32_t k = 0; k < kSectorSize / kEntrySize; ++k) {
+            char* p = sector + k * kEntrySize;
+            size_t index = (size_t)s * (kSectorSize / kEntrySize) + k;
+            if (index >= m_entries.size()) {
+                Put32(p + 68, NOSTREAM);
+                Put32(p + 72, NOSTREAM);
+                Put32(p + 76, NOSTREAM);
+                continue;
+            }
+            const Entry& e = m_entries[index];
+            for (size_t c = 0; c < e.name.size(); ++c) Put16(p + c * 2, e.name[c]);
+            Put16(p + 64, (uint16_t)((e.name.size() + 1) * 2));
+            p[66] = (char)(index == 0 ? TYPE_ROOT : e.isStorage ? TYPE_STORAGE : TYPE_STREAM);
+            p[67] = (char)(index == 0 ? COLOR_BLACK : e.color);
+            Put32(p + 68, e.left);
+            Put32(p + 72, e.right);
+            Put32(p + 76, e.isStorage ? e.child : NOSTREAM);
+            bool hasData = index == 0 || !e.isStorage;
+            Put32(p + 116, hasData ? e.start : 0);
+            Put32(p + 120, hasData ? e.size : 0);
+        }
+        ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+    }
+
+    // === miniFAT ===
+    for (uint32_t s = 0; ok && s < miniFatSectors; ++s) {
+        for (uint32_t i = 0; i < kIdsPerSector; ++i) {
+            size_t index = (size_t)s * kIdsPerSector + i;
+            Put32(sector + i * 4, index < miniFat.size() ? miniFat[index] : FREESECT);
+        }
+        ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+    }
+
+    // === Данные: сектор берёт содержимое у владельца ===
+    for (uint64_t s = 0; ok && s < dataSectors; ++s) {
+        memset(sector, 0, sizeof(sector));
+        const Owner& owner = owners[(size_t)s];
+        if (owner.chain == 0) {
+            // Сектор контейнера мини-потока: 8 мини-секторов
+            for (uint32_t k = 0; k < kMiniPerSector; ++k) {
+                size_t unit = (size_t)owner.index * kMiniPerSector + k;
+                if (unit >= miniOwners.size()) break;
+                const Owner& mini = miniOwners[unit];
+                FillStreamBytes(m_entries[miniChains[mini.chain].entry], (uint64_t)mini.index * kMiniSectorSize,
+                                sector + k * kMiniSectorSize, kMiniSectorSize);
+            }
+        } else {
+            FillStreamBytes(m_entries[chains[owner.chain].entry], (uint64_t)owner.index * kSectorSize,
+                            sector, kSectorSize);
+        }
+        ok = fwrite(sector, 1, kSectorSize, f) == kSectorSize;
+    }
+
+    if (fclose(f) != 0) ok = false;
+    if (!ok) m_lastError = "Ошибка записи файла: " + fileName;
+    return ok;
+}
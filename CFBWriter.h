@@ -0,0 +1,98 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// ============================================================================
+// Запись составного файла (Compound File Binary, MS-CFB, версия 3)
+// ============================================================================
+//
+// Переносимая реализация без COM: собирает контейнер того же формата, что
+// .md/.ert, для тестов и замеров на любой платформе. Поддерживаются
+// мини-поток (потоки до 4096 байт в 64-байтовых секторах), вложенные хранилища,
+// таблицы DIFAT для больших файлов и намеренно фрагментированные цепочки FAT.
+// Содержимое потоков запрашивается при записи, поэтому файл может быть
+// больше доступной памяти.
+
+struct CfbWriterOptions {
+    bool fragment = false; // чередовать сектора потоков: цепочки FAT становятся разрывными
+};
+
+struct CfbWriterStats {
+    uint32_t storages;
+    uint32_t streams;
+    uint32_t miniStreams;    // из них в мини-потоке
+    uint32_t sectors;        // всего 512-байтовых секторов после заголовка
+    uint32_t fatSectors;
+    uint32_t difatSectors;
+    uint32_t miniFatSectors;
+    uint32_t dirSectors;
+    uint64_t fileSize;
+};
+
+class CfbWriter {
+public:
+    // Заполняет out[0..len) содержимым потока начиная с offset
+    typedef std::function<void(uint64_t offset, char* out, size_t len)> FillFn;
+
+    explicit CfbWriter(const CfbWriterOptions& options = CfbWriterOptions());
+
+    // Пути в UTF-8 через '\' или '/', промежуточные хранилища создаются сами.
+    // Имя элемента - не длиннее 31 символа UTF-16.
+    bool AddStorage(const std::string& path);
+    bool AddStream(const std::string& path, const std::vector<char>& data);
+    bool AddStream(const std::string& path, uint32_t size, const FillFn& fill);
+
+    bool Write(const std::string& fileName);
+
+    const std::string& GetLastError() const { return m_lastError; }
+    const CfbWriterStats& GetStats() const { return m_stats; }
+
+private:
+    struct Entry {
+        std::u16string name;
+        bool isStorage;
+        uint32_t size;
+        FillFn fill;
+        std::vector<uint32_t> children; // индексы в m_entries
+        // Раскладка (заполняется при записи)
+        uint32_t left, right, child;
+        uint8_t color;
+        uint32_t start;
+    };
+
+    // Цепочка секторов: поток, мини-поток или служебная область
+    struct Chain {
+        uint32_t entry;  // индекс элемента или NONE для мини-потока
+        uint32_t count;  // число секторов
+        uint32_t first;
+    };
+
+    // Владелец сектора: цепочка и номер сектора внутри неё
+    struct Owner {
+        uint32_t chain;
+        uint32_t index;
+    };
+
+    int FindOrAddEntry(const std::string& path, bool storageLeaf);
+    bool SplitName(const std::string& utf8, std::u16string& name);
+    static int CompareNames(const std::u16string& a, const std::u16string& b);
+    uint32_t BuildTree(std::vector<uint32_t>& sorted, size_t lo, size_t hi, int depth, std::vector<int>& depths);
+    void LayoutDirectory(uint32_t storage);
+    void AllocateChains(std::vector<Chain>& chains, uint32_t unitBase, std::vector<uint32_t>& table,
+                        std::vector<Owner>& owners);
+    void FillStreamBytes(const Entry& e, uint64_t offset, char* out, size_t len) const;
+
+    CfbWriterOptions m_options;
+    std::vector<Entry> m_entries; // 0 - корень
+    std::string m_lastError;
+    CfbWriterStats m_stats;
+};
@@ -0,0 +1,56 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDCache.h"
+#include "MDHash.h"
+
+// ============================================================================
+// ОТПЕЧАТОК ФАЙЛА И ПУТЬ КЕША
+// ============================================================================
+
+bool MdGetFileFingerprint(const std::wstring& filePath, MdFileFingerprint& fp) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExW(filePath.c_str(), GetFileExInfoStandard, &attr)) return false;
+
+    fp.size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+    fp.writeTime = ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+    fp.contentHash = 0;
+
+    if (fp.size > 0) {
+        MdMappedFile file;
+        if (!file.Open(filePath)) return false;
+        fp.contentHash = MdHash64(file.Data(), (size_t)file.Size());
+    }
+    return true;
+}
+
+std::wstring MdGetCachePath(const std::wstring& filePath, const std::wstring& cacheDir, const wchar_t* extension) {
+    if (cacheDir.empty()) return filePath + extension;
+
+    CreateDirectoryW(cacheDir.c_str(), NULL);
+
+    // Имя файла в общем каталоге - хеш полного пути
+    uint64_t h = MdHash64(filePath.data(), filePath.size() * sizeof(WCHAR));
+    WCHAR name[32];
+    const WCHAR* digits = L"0123456789abcdef";
+    for (int i = 0; i < 16; ++i) name[i] = digits[(h >> (60 - i * 4)) & 0xF];
+    name[16] = 0;
+
+    std::wstring path = cacheDir;
+    if (path[path.size() - 1] != L'\\') path += L'\\';
+    return path + name + extension;
+}
+
+std::shared_ptr<MdSnapshotReader> MdOpenCache(const std::wstring& cachePath, const MdFileFingerprint& expected) {
+    auto snapshot = MdSnapshotReader::Open(cachePath);
+    if (!snapshot) return nullptr;
+
+    const MdFileFingerprint& fp = snapshot->Source();
+    if (fp.size != expected.size || fp.writeTime != expected.writeTime || fp.contentHash != expected.contentHash) 
+        return nullptr;
+    return snapshot;
+}
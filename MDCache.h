@@ -0,0 +1,24 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <windows.h>
+#include <string>
+#include "MDSnapshot.h"
+
+// Кеш разбора - это снимок (MDSnapshot.h), в заголовке которого записан
+// отпечаток исходного файла. Кеш актуален, пока отпечаток совпадает.
+
+// Отпечаток: размер + время изменения + XXH64 содержимого
+bool MdGetFileFingerprint(const std::wstring& filePath, MdFileFingerprint& fp);
+
+// Путь к файлу кеша: рядом с исходным (cacheDir пуст) или в каталоге кеша
+std::wstring MdGetCachePath(const std::wstring& filePath, const std::wstring& cacheDir,
+                            const wchar_t* extension = L".mdsnap");
+
+// Открывает кеш, если он есть и соответствует отпечатку
+std::shared_ptr<MdSnapshotReader> MdOpenCache(const std::wstring& cachePath, const MdFileFingerprint& expected);
@@ -0,0 +1,52 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDConfig.h"
+#include "MDSnapshot.h"
+#include <sstream>
+
+// Все методы только читают: снимок заполняется один раз в MDParser::PublishConfig,
+// дерево из файла снимка MdSnapshotReader строит под своей блокировкой
+
+const OLEEntry* MdConfig::FindEntry(const std::wstring& fullPath) const {
+    return MdFindEntry(m_entries, fullPath);
+}
+
+std::shared_ptr<const MdNode> MdConfig::GetRoot() const {
+    if (m_snapshot) return m_snapshot->GetTree();
+    return m_root;
+}
+
+const MdNode* MdConfig::FindObject(const std::string& id) const {
+    if (m_snapshot) return m_snapshot->FindObjectNode(id);
+    auto it = m_objects.find(id);
+    return it != m_objects.end() ? it->second : NULL;
+}
+
+std::map<std::string, const MdNode*> MdConfig::GetObjectNodes() const {
+    if (!m_snapshot) return m_objects;
+    std::map<std::string, const MdNode*> objects;
+    for (uint32_t i = 0; i < m_snapshot->ObjectCount(); ++i) {
+        const MdNode* node = m_snapshot->ObjectNode(i);
+        if (node) objects.emplace_hint(objects.end(), m_snapshot->Atom(m_snapshot->Object(i).id).str(), node);
+    }
+    return objects;
+}
+
+std::wstring MdConfig::DumpNodeToText(const MdNode* node) const {
+    if (!node) return L"";
+    std::wstringstream ss;
+    DumpMdTree(node, 0, m_idToType, m_fieldToRef, ss);
+    return ss.str();
+}
+
+bool MdConfig::ReadStream(const std::wstring& fullPath, std::vector<char>& data, MdStreamFormat& format,
+                          std::wstring& error) const {
+    if (!ReadContainerStream(m_filePath, fullPath, (size_t)-1, data, error)) return false;
+    format = data.empty() ? MD_FMT_RAW : DecodeStreamData(data);
+    return true;
+}
@@ -0,0 +1,81 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include "MDParser.h"
+
+// ============================================================================
+// Неизменяемый снимок загруженной конфигурации
+// ============================================================================
+//
+// MDParser публикует снимок по окончании загрузки (MDParser::GetConfig):
+// дерево метаданных, карты анализа и структуру контейнера. После публикации
+// снимок не меняется, поэтому любое число потоков читает его без блокировок.
+// Перезагрузка строит новое дерево и подменяет снимок атомарно; у читателей,
+// взявших прежний, он живёт, пока на него есть ссылки.
+//
+// Дерево - общее с парсером (разбор всегда строит новые узлы, правка идёт
+// по копии - MDParser::EditMetadata), карты и структура контейнера копируются. Снимок, открытый из кеша разбора или
+// .mdsnap, узлов сразу не строит: карты, модель и обратный индекс берутся
+// из файла снимка, а дерево собирается при первом GetRoot/FindObject (одно
+// на всех читателей и парсер).
+
+class MdConfig {
+public:
+    // Номер публикации: растёт с каждой загрузкой в процессе
+    unsigned long long GetGeneration() const { return m_generation; }
+    // Исходный файл конфигурации
+    const std::wstring& GetFilePath() const { return m_filePath; }
+
+    const std::vector<OLEEntry>& GetRootEntries() const { return m_entries; }
+    // Элемент контейнера по полному пути (NULL - нет такого)
+    const OLEEntry* FindEntry(const std::wstring& fullPath) const;
+
+    // Корень дерева метаданных (nullptr - метаданных нет, например .ert)
+    std::shared_ptr<const MdNode> GetRoot() const;
+    // Узел объекта по ID (NULL - нет такого)
+    const MdNode* FindObject(const std::string& id) const;
+
+    // Карты анализа: ID объекта -> тип, ID поля -> ID типа назначения
+    const std::map<std::string, std::string>& GetObjectTypes() const { return m_idToType; }
+    const std::map<std::string, std::string>& GetFieldRefs() const { return m_fieldToRef; }
+    // Обратный индекс: ID типа -> ссылающиеся на него поля и их владельцы
+    const MdRefIndex& GetReverseRefs() const { return m_refIndex; }
+    // Типизированная модель объектов и полей (MDObjects.h), nullptr - анализа не было
+    std::shared_ptr<const MdObjectModel> GetObjectModel() const { return m_model; }
+
+    // Текстовый дамп узла и его детей с пояснениями типов (как MDParser::DumpNodeToText)
+    std::wstring DumpNodeToText(const MdNode* node) const;
+
+    // Читает и декодирует поток из исходного файла. Контейнер открывается
+    // на время вызова, поэтому вызовы из разных потоков независимы;
+    // COM в вызывающем потоке должен быть инициализирован
+    bool ReadStream(const std::wstring& fullPath, std::vector<char>& data, MdStreamFormat& format,
+                    std::wstring& error) const;
+
+private:
+    friend class MDParser;
+    friend class MdContentStore;
+    MdConfig() : m_generation(0) {}
+    // Узлы объектов по ID (дерево из снимка строится)
+    std::map<std::string, const MdNode*> GetObjectNodes() const;
+
+    unsigned long long m_generation;
+    std::wstring m_filePath;
+    std::vector<OLEEntry> m_entries;
+    std::shared_ptr<const MdNode> m_root;
+    std::map<std::string, const MdNode*> m_objects; // узлы внутри m_root
+    std::shared_ptr<MdSnapshotReader> m_snapshot;   // источник дерева, пока m_root пуст
+    std::map<std::string, std::string> m_idToType;
+    std::map<std::string, std::string> m_fieldToRef;
+    MdRefIndex m_refIndex;
+    std::shared_ptr<const MdObjectModel> m_model; // общая с парсером, не меняется
+};
@@ -0,0 +1,376 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDDiff.h"
+#include "MDConfig.h"
+#include "MDHash.h"
+#include "MDThreads.h"
+#include <unordered_map>
+
+// ============================================================================
+// ХЕШИ ПОДДЕРЕВЬЕВ
+// ============================================================================
+
+static const size_t kHashChunk = 64; // объектов раздела на задачу
+
+void MdMerkleTree::Number(const MdNode* node) {
+    uint32_t index = (uint32_t)m_nodes.size();
+    m_nodes.push_back(node);
+    m_end.push_back(0);
+    for (auto& child : node->children) Number(child.get());
+    m_end[index] = (uint32_t)m_nodes.size();
+}
+
+// Узлы отрезка с конца: к моменту расчёта узла хеши его детей уже готовы.
+// Отрезок должен состоять из целых поддеревьев
+void MdMerkleTree::HashRange(uint32_t begin, uint32_t end) {
+    for (uint32_t i = end; i-- > begin;) {
+        const MdNode* node = m_nodes[i];
+        uint64_t h = MdHash64(node->value.data(), node->value.size(), (uint64_t)node->kind + 1);
+        uint64_t count = 0;
+        for (uint32_t j = i + 1; j < m_end[i]; j = m_end[j], ++count) h = mdhash_detail::Merge(h, m_hash[j]);
+        m_hash[i] = mdhash_detail::Merge(h, count);
+    }
+}
+
+bool MdMerkleTree::Build(const std::shared_ptr<const MdConfig>& config, unsigned threads) {
+    m_config = config;
+    m_nodes.clear();
+    m_end.clear();
+    m_hash.clear();
+    if (!config) {
+        m_lastError = L"Конфигурация не загружена";
+        return false;
+    }
+    std::shared_ptr<const MdNode> root = config->GetRoot();
+    if (!root) return true; // без метаданных (.ert)
+
+    Number(root.get());
+    m_hash.resize(m_nodes.size());
+
+    // Задачи - подряд идущие дети разделов порциями по kHashChunk
+    std::vector<std::pair<uint32_t, uint32_t>> tasks;
+    for (uint32_t s = 1; s < m_end[0]; s = m_end[s]) {
+        uint32_t first = s + 1, count = 0;
+        for (uint32_t c = s + 1; c < m_end[s]; c = m_end[c]) {
+            if (++count == kHashChunk) {
+                tasks.push_back(std::make_pair(first, m_end[c]));
+                first = m_end[c];
+                count = 0;
+            }
+        }
+        if (first < m_end[s]) tasks.push_back(std::make_pair(first, m_end[s]));
+    }
+    ParallelFor(tasks.size(), threads, [&](size_t t) { HashRange(tasks[t].first, tasks[t].second); });
+
+    // Разделы и корень - по готовым хешам детей
+    std::vector<uint32_t> sections;
+    for (uint32_t s = 1; s < m_end[0]; s = m_end[s]) sections.push_back(s);
+    for (size_t k = sections.size(); k-- > 0;) HashRange(sections[k], sections[k] + 1);
+    HashRange(0, 1);
+    return true;
+}
+
+// Папка - по именам и хешам элементов; поток - по байтам как хранится
+bool MdMerkleTree::AddEntries(const std::vector<OLEEntry>& entries, const StreamHashes& hashes, uint64_t& listHash) {
+    listHash = MdHash64(NULL, 0, entries.size());
+    for (auto& entry : entries) {
+        size_t index = m_streams.size();
+        Stream item = { entry.name, entry.fullPath, entry.isFolder, 0, 0 };
+        m_streams.push_back(item);
+
+        uint64_t h;
+        if (entry.isFolder) {
+            if (!AddEntries(entry.children, hashes, h)) return false;
+        } else {
+            auto it = hashes.find(entry.fullPath);
+            if (it == hashes.end()) {
+                m_lastError = L"Не удалось прочитать поток: " + entry.fullPath;
+                return false;
+            }
+            h = it->second;
+        }
+        m_streams[index].end = (uint32_t)m_streams.size();
+        m_streams[index].hash = h;
+        uint64_t nameHash = MdHash64(entry.name.data(), entry.name.size() * sizeof(wchar_t), entry.isFolder ? 2 : 1);
+        listHash = mdhash_detail::Merge(mdhash_detail::Merge(listHash, nameHash), h);
+    }
+    return true;
+}
+
+bool MdMerkleTree::Build(MDParser& parser, bool withStreams, unsigned threads) {
+    m_streams.clear();
+    m_streamRootHash = 0;
+    if (!Build(parser.GetConfig(), threads)) return false;
+    if (!withStreams) return true;
+
+    // Хеши потоков - за один проход по контейнеру, без хранения их байтов
+    StreamHashes hashes;
+    bool walked = parser.ForEachRawStream([&](const OLEEntry& entry, bool read, std::vector<char>& data) {
+        if (read) hashes[entry.fullPath] = MdHash64(data.data(), data.size());
+        return true;
+    });
+    if (!walked) {
+        m_lastError = parser.GetLastError();
+        return false;
+    }
+    return AddEntries(m_config->GetRootEntries(), hashes, m_streamRootHash);
+}
+
+// ============================================================================
+// СРАВНЕНИЕ
+// ============================================================================
+
+class MdDiffer {
+public:
+    MdDiffer(const MdMerkleTree& a, const MdMerkleTree& b, std::vector<MdDiffEntry>& entries)
+        : m_a(a), m_b(b), m_entries(entries) {
+        m_stats.nodesVisited = m_stats.streamsVisited = 0;
+    }
+
+    void DiffTree();
+    void DiffStreams();
+    const MdDiffStats& Stats() const { return m_stats; }
+
+private:
+    void DiffLists(uint32_t ia, uint32_t ib, const std::string& path, const std::string& owner, bool inEntity);
+    void DiffPair(uint32_t ia, uint32_t ib, const std::string& path, const std::string& owner, bool& ownChange);
+    void AddEntity(MdDiffKind kind, const MdNode* oldNode, const MdNode* newNode, const std::string& path,
+                   const std::string& owner);
+    void DiffFolders(uint32_t aBegin, uint32_t aEnd, uint32_t bBegin, uint32_t bEnd);
+    void AddStream(MdDiffKind kind, const MdMerkleTree::Stream& item);
+
+    std::vector<uint32_t> Children(const MdMerkleTree& t, uint32_t i) const {
+        std::vector<uint32_t> out;
+        for (uint32_t j = i + 1; j < t.m_end[i]; j = t.m_end[j]) out.push_back(j);
+        return out;
+    }
+
+    const MdMerkleTree& m_a;
+    const MdMerkleTree& m_b;
+    std::vector<MdDiffEntry>& m_entries;
+    MdDiffStats m_stats;
+};
+
+// Ключ списка - первое значение: ID, имя раздела или списка
+static const std::string* KeyOf(const MdNode* node) {
+    if (node->children.empty()) return NULL;
+    const MdNode* first = node->children[0].get();
+    return first->children.empty() && !first->value.empty() ? &first->value : NULL;
+}
+
+// Сущность - список с числовым ID
+static bool IsEntity(const MdNode* node) {
+    const std::string* key = KeyOf(node);
+    if (!key) return false;
+    for (char c : *key) {
+        if (c < '0' || c > '9') return false;
+    }
+    return true;
+}
+
+static std::string ChildPath(const std::string& path, const MdNode* node, size_t position) {
+    const std::string* key = KeyOf(node);
+    std::string part = key ? *key : "[" + std::to_string(position) + "]";
+    return path.empty() ? part : path + "/" + part;
+}
+
+void MdDiffer::AddEntity(MdDiffKind kind, const MdNode* oldNode, const MdNode* newNode, const std::string& path,
+                         const std::string& owner) {
+    const MdNode* node = newNode ? newNode : oldNode;
+    MdDiffEntry e;
+    e.kind = kind;
+    e.stream = false;
+    e.id = *KeyOf(node);
+    if (node->children.size() > 1 && node->children[1]->children.empty()) e.name = node->children[1]->value;
+    e.owner = owner;
+    e.path = path;
+    e.oldNode = oldNode;
+    e.newNode = newNode;
+
+    // Тип - по карте той конфигурации, где объект есть (в новой - приоритетнее)
+    const MdMerkleTree* trees[] = { &m_b, &m_a };
+    for (const MdMerkleTree* t : trees) {
+        const std::map<std::string, std::string>& types = t->m_config->GetObjectTypes();
+        auto it = types.find(e.id);
+        if (it != types.end()) {
+            e.type = it->second;
+            break;
+        }
+    }
+    m_entries.push_back(e);
+}
+
+// Пара сопоставленных детей; ownChange - отличие, не выраженное сущностью
+void MdDiffer::DiffPair(uint32_t ia, uint32_t ib, const std::string& path, const std::string& owner, bool& ownChange) {
+    if (m_a.m_hash[ia] == m_b.m_hash[ib]) return;
+    const MdNode* x = m_a.m_nodes[ia];
+    const MdNode* y = m_b.m_nodes[ib];
+    if (x->children.empty() || y->children.empty()) {
+        ownChange = true; // разные значения или значение стало списком
+        return;
+    }
+    if (IsEntity(y) && IsEntity(x)) {
+        AddEntity(MD_DIFF_CHANGED, x, y, path, owner);
+        DiffLists(ia, ib, path, *KeyOf(y), true);
+    } else {
+        DiffLists(ia, ib, path, owner, false);
+    }
+}
+
+void MdDiffer::DiffLists(uint32_t ia, uint32_t ib, const std::string& path, const std::string& owner, bool inEntity) {
+    std::vector<uint32_t> ca = Children(m_a, ia);
+    std::vector<uint32_t> cb = Children(m_b, ib);
+
+    // Общие начало и конец с равными хешами - без разбора
+    size_t head = 0;
+    while (head < ca.size() && head < cb.size() && m_a.m_hash[ca[head]] == m_b.m_hash[cb[head]]) head++;
+    size_t tail = 0;
+    while (tail < ca.size() - head && tail < cb.size() - head &&
+           m_a.m_hash[ca[ca.size() - 1 - tail]] == m_b.m_hash[cb[cb.size() - 1 - tail]]) {
+        tail++;
+    }
+    m_stats.nodesVisited += 2 * (head + tail);
+    size_t aEnd = ca.size() - tail, bEnd = cb.size() - tail;
+    m_stats.nodesVisited += (aEnd - head) + (bEnd - head);
+
+    // По ключам, если в обоих списках они есть у всех и не повторяются
+    bool keyed = true;
+    std::unordered_map<std::string, uint32_t> byKey;
+    for (size_t k = head; keyed && k < bEnd; ++k) {
+        const std::string* key = KeyOf(m_b.m_nodes[cb[k]]);
+        keyed = key && byKey.emplace(*key, cb[k]).second;
+    }
+    std::unordered_map<std::string, uint32_t> oldKeys;
+    for (size_t k = head; keyed && k < aEnd; ++k) {
+        const std::string* key = KeyOf(m_a.m_nodes[ca[k]]);
+        keyed = key && oldKeys.emplace(*key, ca[k]).second;
+    }
+
+    bool ownChange = false;
+    if (keyed) {
+        for (size_t k = head; k < aEnd; ++k) {
+            const MdNode* x = m_a.m_nodes[ca[k]];
+            if (byKey.count(*KeyOf(x))) continue;
+            if (IsEntity(x)) AddEntity(MD_DIFF_REMOVED, x, NULL, ChildPath(path, x, k), owner);
+            else ownChange = true;
+        }
+        for (size_t k = head; k < bEnd; ++k) {
+            const MdNode* y = m_b.m_nodes[cb[k]];
+            auto it = oldKeys.find(*KeyOf(y));
+            if (it != oldKeys.end()) {
+                DiffPair(it->second, cb[k], ChildPath(path, y, k), owner, ownChange);
+            } else if (IsEntity(y)) {
+                AddEntity(MD_DIFF_ADDED, NULL, y, ChildPath(path, y, k), owner);
+            } else {
+                ownChange = true;
+            }
+        }
+    } else {
+        size_t common = std::min(aEnd, bEnd);
+        for (size_t k = head; k < common; ++k) {
+            DiffPair(ca[k], cb[k], ChildPath(path, m_b.m_nodes[cb[k]], k), owner, ownChange);
+        }
+        for (size_t k = common; k < aEnd; ++k) {
+            const MdNode* x = m_a.m_nodes[ca[k]];
+            if (IsEntity(x)) AddEntity(MD_DIFF_REMOVED, x, NULL, ChildPath(path, x, k), owner);
+            else ownChange = true;
+        }
+        for (size_t k = common; k < bEnd; ++k) {
+            const MdNode* y = m_b.m_nodes[cb[k]];
+            if (IsEntity(y)) AddEntity(MD_DIFF_ADDED, NULL, y, ChildPath(path, y, k), owner);
+            else ownChange = true;
+        }
+    }
+
+    // Отличие вне сущностей - изменён сам список (внутри сущности она уже в отчёте)
+    if (ownChange && !inEntity) {
+        MdDiffEntry e;
+        e.kind = MD_DIFF_CHANGED;
+        e.stream = false;
+        e.owner = owner;
+        e.path = path;
+        e.oldNode = m_a.m_nodes[ia];
+        e.newNode = m_b.m_nodes[ib];
+        m_entries.push_back(e);
+    }
+}
+
+void MdDiffer::DiffTree() {
+    bool hasA = !m_a.m_nodes.empty(), hasB = !m_b.m_nodes.empty();
+    m_stats.nodesVisited += hasA && hasB ? 2 : 0;
+    if (hasA && hasB) {
+        if (m_a.m_hash[0] != m_b.m_hash[0]) DiffLists(0, 0, "", "", false);
+    } else if (hasA != hasB) {
+        // Метаданные есть только с одной стороны
+        MdDiffEntry e;
+        e.kind = hasB ? MD_DIFF_ADDED : MD_DIFF_REMOVED;
+        e.stream = false;
+        e.oldNode = hasA ? m_a.m_nodes[0] : NULL;
+        e.newNode = hasB ? m_b.m_nodes[0] : NULL;
+        m_entries.push_back(e);
+    }
+}
+
+void MdDiffer::AddStream(MdDiffKind kind, const MdMerkleTree::Stream& item) {
+    MdDiffEntry e;
+    e.kind = kind;
+    e.stream = true;
+    e.streamPath = item.fullPath;
+    e.oldNode = e.newNode = NULL;
+    m_entries.push_back(e);
+}
+
+// Элементы одной папки: [begin, end) - отрезки обхода, соседи через end
+void MdDiffer::DiffFolders(uint32_t aBegin, uint32_t aEnd, uint32_t bBegin, uint32_t bEnd) {
+    const std::vector<MdMerkleTree::Stream>& sa = m_a.m_streams;
+    const std::vector<MdMerkleTree::Stream>& sb = m_b.m_streams;
+
+    std::unordered_map<std::wstring, uint32_t> oldByName;
+    for (uint32_t i = aBegin; i < aEnd; i = sa[i].end) {
+        oldByName.emplace(sa[i].name, i);
+        m_stats.streamsVisited++;
+    }
+    std::unordered_map<std::wstring, uint32_t> newByName;
+    for (uint32_t j = bBegin; j < bEnd; j = sb[j].end) {
+        newByName.emplace(sb[j].name, j);
+        m_stats.streamsVisited++;
+    }
+
+    for (uint32_t i = aBegin; i < aEnd; i = sa[i].end) {
+        if (!newByName.count(sa[i].name)) AddStream(MD_DIFF_REMOVED, sa[i]);
+    }
+    for (uint32_t j = bBegin; j < bEnd; j = sb[j].end) {
+        auto it = oldByName.find(sb[j].name);
+        if (it == oldByName.end()) {
+            AddStream(MD_DIFF_ADDED, sb[j]);
+            continue;
+        }
+        const MdMerkleTree::Stream& x = sa[it->second];
+        if (x.hash == sb[j].hash && x.isFolder == sb[j].isFolder) continue;
+        if (x.isFolder && sb[j].isFolder) {
+            DiffFolders(it->second + 1, x.end, j + 1, sb[j].end);
+        } else {
+            AddStream(MD_DIFF_CHANGED, sb[j]);
+        }
+    }
+}
+
+void MdDiffer::DiffStreams() {
+    if (m_a.m_streamRootHash == m_b.m_streamRootHash) return;
+    DiffFolders(0, (uint32_t)m_a.m_streams.size(), 0, (uint32_t)m_b.m_streams.size());
+}
+
+bool MdDiff(const MdMerkleTree& oldTree, const MdMerkleTree& newTree, std::vector<MdDiffEntry>& entries,
+            MdDiffStats* stats) {
+    size_t before = entries.size();
+    MdDiffer differ(oldTree, newTree, entries);
+    if (oldTree.GetConfig() && newTree.GetConfig()) differ.DiffTree();
+    differ.DiffStreams();
+    if (stats) *stats = differ.Stats();
+    return entries.size() == before;
+}
@@ -0,0 +1,112 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "MDParser.h"
+
+class MdConfig;
+
+// ============================================================================
+// Структурное сравнение двух конфигураций по хешам поддеревьев
+// ============================================================================
+//
+// MdMerkleTree - хеши (XXH64) каждого поддерева метаданных и каждого потока
+// контейнера: хеш узла складывается из его значения, вида и хешей детей по
+// порядку, хеш папки - из имён и хешей её элементов. Пробелы и переносы
+// исходного текста в хеш не входят. Узлы и потоки хранятся в порядке обхода
+// в глубину, поддерево - непрерывный отрезок, поэтому хеши считаются одним
+// проходом с конца, а поддеревья объектов - параллельно.
+//
+// MdDiff спускается только в поддеревья с разными хешами: равные разделы,
+// объекты и папки пропускаются целиком, и цена сравнения определяется
+// объёмом изменений, а не размером конфигурации. Хеши строятся один раз на
+// конфигурацию, одно дерево хешей можно сравнивать с несколькими.
+//
+// Элементы списков сопоставляются по ключу - первому значению (ID объекта
+// или поля, имя раздела или списка), если ключи в списке уникальны, иначе по
+// позиции. В отчёт попадают сущности - списки с числовым ID (объекты,
+// реквизиты, значения перечислений): добавленные, удалённые и изменённые,
+// с типом объекта из карт анализа. Изменения вне сущностей (настройки
+// конфигурации) отмечаются изменением ближайшего списка.
+
+class MdMerkleTree {
+public:
+    MdMerkleTree() {}
+
+    // Хеши опубликованной конфигурации парсера (MDParser::GetConfig) и,
+    // если withStreams, потоков открытого контейнера (хешируются байты как
+    // они хранятся, без распаковки). threads - для дерева, 0 - по числу ядер
+    bool Build(MDParser& parser, bool withStreams = true, unsigned threads = 0);
+    // Только дерево метаданных
+    bool Build(const std::shared_ptr<const MdConfig>& config, unsigned threads = 0);
+
+    uint64_t GetRootHash() const { return m_hash.empty() ? 0 : m_hash[0]; }
+    size_t GetNodeCount() const { return m_nodes.size(); }
+    size_t GetStreamCount() const { return m_streams.size(); }
+    const std::shared_ptr<const MdConfig>& GetConfig() const { return m_config; }
+    const std::wstring& GetLastError() const { return m_lastError; }
+
+private:
+    friend class MdDiffer;
+
+    // Элемент контейнера в порядке обхода
+    struct Stream {
+        std::wstring name;
+        std::wstring fullPath;
+        bool isFolder;
+        uint32_t end; // за последним элементом папки
+        uint64_t hash;
+    };
+
+    void Number(const MdNode* node);
+    void HashRange(uint32_t begin, uint32_t end);
+    typedef std::unordered_map<std::wstring, uint64_t> StreamHashes; // по полному пути
+    bool AddEntries(const std::vector<OLEEntry>& entries, const StreamHashes& hashes, uint64_t& listHash);
+
+    std::shared_ptr<const MdConfig> m_config; // держит дерево и карты
+    std::vector<const MdNode*> m_nodes;       // в порядке обхода, 0 - корень
+    std::vector<uint32_t> m_end;              // за последним узлом поддерева
+    std::vector<uint64_t> m_hash;
+    std::vector<Stream> m_streams;
+    uint64_t m_streamRootHash = 0; // корневые элементы контейнера
+    std::wstring m_lastError;
+};
+
+enum MdDiffKind {
+    MD_DIFF_ADDED,
+    MD_DIFF_REMOVED,
+    MD_DIFF_CHANGED
+};
+
+struct MdDiffEntry {
+    MdDiffKind kind;
+    bool stream;         // элемент контейнера (иначе - метаданных)
+    std::string id;      // ID сущности (пусто - не сущность)
+    std::string type;    // тип объекта по картам анализа (SC, DT, ...), пусто для реквизитов
+    std::string name;    // второе значение сущности - идентификатор в конфигурации
+    std::string owner;   // ID ближайшей объемлющей сущности
+    std::string path;    // ключи от корня через '/' (1251)
+    std::wstring streamPath;        // полный путь потока или папки
+    const MdNode* oldNode;          // NULL для добавленных и потоков
+    const MdNode* newNode;          // NULL для удалённых и потоков
+};
+
+struct MdDiffStats {
+    size_t nodesVisited;   // узлов, хеши которых пришлось сравнить
+    size_t streamsVisited;
+};
+
+// Отчёт идёт по спискам сверху вниз: изменённая сущность - перед изменениями
+// внутри неё; в каждом списке сначала удалённые, затем добавленные и
+// изменённые в порядке новой конфигурации. true - различий нет
+bool MdDiff(const MdMerkleTree& oldTree, const MdMerkleTree& newTree, std::vector<MdDiffEntry>& entries,
+            MdDiffStats* stats = NULL);
@@ -0,0 +1,212 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDGraph.h"
+#include "MDConfig.h"
+
+static const uint32_t kUnvisited = 0xFFFFFFFF;
+
+MdDependencyGraph::MdDependencyGraph() : m_objectCount(0), m_words(0), m_componentCount(0) {}
+
+bool MdDependencyGraph::Build(const std::shared_ptr<const MdConfig>& config) {
+    if (!config) {
+        m_lastError = L"Конфигурация не загружена";
+        return false;
+    }
+    return Build(config->GetObjectModel());
+}
+
+// ============================================================================
+// ГРАФ
+// ============================================================================
+
+bool MdDependencyGraph::Build(const std::shared_ptr<const MdObjectModel>& model) {
+    m_model = model;
+    m_offsets.clear();
+    m_targets.clear();
+    m_component.clear();
+    m_cyclic.clear();
+    m_closure.clear();
+    m_objectCount = m_words = m_componentCount = 0;
+    if (!model) {
+        m_lastError = L"Нет модели объектов: анализ метаданных не выполнен";
+        return false;
+    }
+
+    // Рёбра объекта - по типам его реквизитов, каждое один раз
+    m_objectCount = model->objects.size();
+    m_words = (m_objectCount + 63) / 64;
+    std::vector<uint32_t> seen(m_objectCount, kUnvisited);
+    m_offsets.reserve(m_objectCount + 1);
+    for (uint32_t i = 0; i < m_objectCount; ++i) {
+        m_offsets.push_back((uint32_t)m_targets.size());
+        const MdObjectInfo& object = model->objects[i];
+        const MdFieldInfo* fields = model->FieldsOf(object);
+        for (uint32_t k = 0; k < object.fieldCount; ++k) {
+            if (!fields[k].refTarget) continue;
+            const MdObjectInfo* target = model->FindObject(fields[k].refTarget);
+            if (!target) continue;
+            uint32_t t = (uint32_t)(target - model->objects.data());
+            if (seen[t] == i) continue;
+            seen[t] = i;
+            m_targets.push_back(t);
+        }
+    }
+    m_offsets.push_back((uint32_t)m_targets.size());
+
+    FindComponents();
+    BuildClosure();
+    return true;
+}
+
+// Тарьян без рекурсии: цепочки ссылок бывают длинными. Компоненты выходят
+// в порядке от стоков к истокам - в нём же потом строится замыкание
+void MdDependencyGraph::FindComponents() {
+    const uint32_t n = (uint32_t)m_objectCount;
+    std::vector<uint32_t> index(n, kUnvisited), low(n);
+    std::vector<uint8_t> onStack(n, 0);
+    std::vector<uint32_t> stack;
+    std::vector<std::pair<uint32_t, uint32_t>> calls; // вершина, следующее ребро
+    uint32_t counter = 0;
+
+    m_component.assign(n, 0);
+    for (uint32_t s = 0; s < n; ++s) {
+        if (index[s] != kUnvisited) continue;
+        calls.push_back(std::make_pair(s, m_offsets[s]));
+        index[s] = low[s] = counter++;
+        stack.push_back(s);
+        onStack[s] = 1;
+
+        while (!calls.empty()) {
+            uint32_t v = calls.back().first;
+            uint32_t& e = calls.back().second;
+            if (e < m_offsets[v + 1]) {
+                uint32_t w = m_targets[e++];
+                if (index[w] == kUnvisited) {
+                    index[w] = low[w] = counter++;
+                    stack.push_back(w);
+                    onStack[w] = 1;
+                    calls.push_back(std::make_pair(w, m_offsets[w]));
+                } else if (onStack[w] && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            // Все рёбра v пройдены
+            calls.pop_back();
+            if (!calls.empty()) {
+                uint32_t parent = calls.back().first;
+                if (low[v] < low[parent]) low[parent] = low[v];
+            }
+            if (low[v] != index[v]) continue;
+
+            uint32_t c = (uint32_t)m_componentCount++;
+            uint32_t w, size = 0;
+            do {
+                w = stack.back();
+                stack.pop_back();
+                onStack[w] = 0;
+                m_component[w] = c;
+                size++;
+            } while (w != v);
+            m_cyclic.push_back(size > 1);
+        }
+    }
+
+    // Одиночная вершина - цикл, только если ссылается сама на себя
+    for (uint32_t v = 0; v < n; ++v) {
+        for (uint32_t e = m_offsets[v]; e < m_offsets[v + 1]; ++e) {
+            if (m_targets[e] == v) m_cyclic[m_component[v]] = 1;
+        }
+    }
+}
+
+// ============================================================================
+// ЗАМЫКАНИЕ
+// ============================================================================
+
+// Строка компоненты - её объекты и все строки компонент, на которые ссылаются
+// её объекты; компоненты-преемники к этому моменту уже готовы
+void MdDependencyGraph::BuildClosure() {
+    m_closure.assign(m_componentCount * m_words, 0);
+
+    // Объекты по компонентам (CSR)
+    std::vector<uint32_t> begin(m_componentCount + 1, 0), members(m_objectCount);
+    for (uint32_t v = 0; v < m_objectCount; ++v) begin[m_component[v] + 1]++;
+    for (size_t c = 0; c < m_componentCount; ++c) begin[c + 1] += begin[c];
+    std::vector<uint32_t> fill(begin.begin(), begin.end() - 1);
+    for (uint32_t v = 0; v < m_objectCount; ++v) members[fill[m_component[v]]++] = v;
+
+    std::vector<uint32_t> seen(m_componentCount, kUnvisited);
+    for (uint32_t c = 0; c < m_componentCount; ++c) {
+        uint64_t* row = m_closure.data() + (size_t)c * m_words;
+        for (uint32_t m = begin[c]; m < begin[c + 1]; ++m) {
+            uint32_t v = members[m];
+            row[v >> 6] |= 1ull << (v & 63);
+            for (uint32_t e = m_offsets[v]; e < m_offsets[v + 1]; ++e) {
+                uint32_t d = m_component[m_targets[e]];
+                if (d == c || seen[d] == c) continue;
+                seen[d] = c;
+                const uint64_t* from = Row(d);
+                for (size_t k = 0; k < m_words; ++k) row[k] |= from[k];
+            }
+        }
+    }
+}
+
+void MdDependencyGraph::MarkReachable(uint32_t object, std::vector<uint64_t>& bits) const {
+    const uint64_t* row = Row(m_component[object]);
+    for (size_t k = 0; k < m_words; ++k) bits[k] |= row[k];
+}
+
+void MdDependencyGraph::GetDependencies(uint32_t object, std::vector<uint32_t>& out) const {
+    out.clear();
+    if (object >= m_objectCount) return;
+    const uint64_t* row = Row(m_component[object]);
+    bool self = m_cyclic[m_component[object]] != 0;
+    for (size_t k = 0; k < m_words; ++k) {
+        uint64_t word = row[k];
+        for (uint32_t v = (uint32_t)(k * 64); word; word >>= 1, ++v) {
+            if ((word & 1) && (v != object || self)) out.push_back(v);
+        }
+    }
+}
+
+bool MdDependencyGraph::DependsOn(uint32_t object, uint32_t target) const {
+    if (object >= m_objectCount || target >= m_objectCount) return false;
+    if (object == target) return m_cyclic[m_component[object]] != 0;
+    return (Row(m_component[object])[target >> 6] >> (target & 63) & 1) != 0;
+}
+
+void MdDependencyGraph::FindUnused(std::vector<uint32_t>& out, unsigned rootKinds, unsigned candidateKinds) const {
+    out.clear();
+    if (!m_model) return;
+    const MdObjectModel& model = *m_model;
+
+    std::vector<uint64_t> used(m_words, 0);
+    for (uint32_t v = 0; v < m_objectCount; ++v) {
+        if (rootKinds & (1u << model.objects[v].kind)) MarkReachable(v, used);
+    }
+    // Поля без владельца: графы общего журнала и константы
+    for (auto& field : model.fields) {
+        if (field.owner != MD_MODEL_NONE || !field.refTarget) continue;
+        bool root = field.list == MD_FIELD_JOURNAL ? (rootKinds & (1u << MD_OBJ_JOURNAL)) != 0
+                                                   : (rootKinds & (1u << MD_OBJ_CONSTANT)) != 0;
+        const MdObjectInfo* target = root ? model.FindObject(field.refTarget) : NULL;
+        if (target) MarkReachable((uint32_t)(target - model.objects.data()), used);
+    }
+
+    for (uint32_t v = 0; v < m_objectCount; ++v) {
+        if ((candidateKinds & (1u << model.objects[v].kind)) && !(used[v >> 6] >> (v & 63) & 1)) out.push_back(v);
+    }
+}
+
+size_t MdDependencyGraph::GetMemoryBytes() const {
+    return (m_offsets.capacity() + m_targets.capacity() + m_component.capacity()) * sizeof(uint32_t) +
+           m_cyclic.capacity() + m_closure.capacity() * sizeof(uint64_t);
+}
@@ -0,0 +1,92 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "MDObjects.h"
+
+class MdConfig;
+
+// ============================================================================
+// Граф зависимостей объектов: транзитивное замыкание и неиспользуемые объекты
+// ============================================================================
+//
+// Вершины - объекты модели (MDObjects.h) с плотными номерами, совпадающими с
+// индексами в MdObjectModel::objects; ребро A -> B - у объекта A есть
+// реквизит типа B (та же связь, что в карте ID поля -> ID типа).
+//
+// Замыкание строится по компонентам сильной связности (циклы ссылок вида
+// "справочник - его владелец" сворачиваются в одну вершину): компоненты
+// обходятся от стоков к истокам, и строка компоненты - битовое множество
+// всех объектов, от которых она зависит, - собирается логическим ИЛИ строк
+// её преемников по 64 бита за операцию. После построения зависимости любого
+// объекта - готовая строка, а неиспользуемые объекты - дополнение к ИЛИ
+// строк корней.
+
+// Набор видов объектов: биты 1 << MdObjectKind
+inline unsigned MdKindBit(MdObjectKind kind) { return 1u << kind; }
+
+// Корни по умолчанию: документы, регистры, журналы (и графы общего журнала)
+const unsigned MD_ROOTS_DEFAULT = (1u << MD_OBJ_DOCUMENT) | (1u << MD_OBJ_REGISTER) | (1u << MD_OBJ_JOURNAL) |
+                                  (1u << MD_OBJ_CALC_JOURNAL);
+// Кандидаты в неиспользуемые по умолчанию: то, на что ссылаются реквизиты
+const unsigned MD_UNUSED_DEFAULT = (1u << MD_OBJ_CATALOG) | (1u << MD_OBJ_ENUM);
+
+class MdDependencyGraph {
+public:
+    MdDependencyGraph();
+
+    // Граф и замыкание по модели опубликованной конфигурации
+    bool Build(const std::shared_ptr<const MdConfig>& config);
+    bool Build(const std::shared_ptr<const MdObjectModel>& model);
+
+    const std::shared_ptr<const MdObjectModel>& GetModel() const { return m_model; }
+    size_t GetObjectCount() const { return m_objectCount; }
+    size_t GetEdgeCount() const { return m_targets.size(); }
+    size_t GetComponentCount() const { return m_componentCount; }
+    // Память замыкания и графа, байт
+    size_t GetMemoryBytes() const;
+
+    // Все объекты, от которых объект зависит транзитивно (индексы в
+    // objects по возрастанию); сам объект - только если он в цикле ссылок
+    void GetDependencies(uint32_t object, std::vector<uint32_t>& out) const;
+    bool DependsOn(uint32_t object, uint32_t target) const;
+
+    // Объекты видов candidateKinds, недостижимые из объектов видов rootKinds.
+    // Графы общего журнала - корни с журналами (MD_OBJ_JOURNAL), константы -
+    // с MD_OBJ_CONSTANT
+    void FindUnused(std::vector<uint32_t>& out, unsigned rootKinds = MD_ROOTS_DEFAULT,
+                    unsigned candidateKinds = MD_UNUSED_DEFAULT) const;
+
+    const std::wstring& GetLastError() const { return m_lastError; }
+
+private:
+    void FindComponents();
+    void BuildClosure();
+    // Объект и всё, от чего он зависит, - в множество
+    void MarkReachable(uint32_t object, std::vector<uint64_t>& bits) const;
+    const uint64_t* Row(uint32_t component) const { return m_closure.data() + (size_t)component * m_words; }
+
+    std::shared_ptr<const MdObjectModel> m_model;
+    size_t m_objectCount;
+    size_t m_words; // слов на строку замыкания
+
+    // Рёбра по объектам (CSR), без повторов
+    std::vector<uint32_t> m_offsets;
+    std::vector<uint32_t> m_targets;
+
+    // Компоненты в порядке от стоков к истокам
+    size_t m_componentCount;
+    std::vector<uint32_t> m_component; // объект -> компонента
+    std::vector<uint8_t> m_cyclic;     // компонента - цикл (объект зависит от себя)
+    std::vector<uint64_t> m_closure;   // строки по компонентам, m_words слов на строку
+
+    std::wstring m_lastError;
+};
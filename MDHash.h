@@ -0,0 +1,78 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+ 
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Быстрый 64-битный хеш содержимого (алгоритм XXH64).
+// Не криптостойкий: для отпечатков файлов и хеш-таблиц.
+
+namespace mdhash_detail {
+    const uint64_t P1 = 11400714785074694791ULL;
+    const uint64_t P2 = 14029467366897019727ULL;
+    const uint64_t P3 = 1609587929392839161ULL;
+    const uint64_t P4 = 9650029242287828579ULL;
+    const uint64_t P5 = 2870177450012600261ULL;
+
+    inline uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    inline uint64_t Read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    inline uint32_t Read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    inline uint64_t Round(uint64_t acc, uint64_t input) {
+        acc += input * P2;
+        acc = Rotl(acc, 31);
+        return acc * P1;
+    }
+    inline uint64_t Merge(uint64_t acc, uint64_t val) {
+        acc ^= Round(0, val);
+        return acc * P1 + P4;
+    }
+}
+
+inline uint64_t MdHash64(const void* data, size_t len, uint64_t seed = 0) {
+    using namespace mdhash_detail;
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = Round(v1, Read64(p)); p += 8;
+            v2 = Round(v2, Read64(p)); p += 8;
+            v3 = Round(v3, Read64(p)); p += 8;
+            v4 = Round(v4, Read64(p)); p += 8;
+        } while (p <= limit);
+        h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+        h = Merge(h, v1); h = Merge(h, v2); h = Merge(h, v3); h = Merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+
+    h += (uint64_t)len;
+    while (p + 8 <= end) {
+        h ^= Round(0, Read64(p));
+        h = Rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)Read32(p) * P1;
+        h = Rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * P5;
+        h = Rotl(h, 11) * P1;
+        p++;
+    }
+
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,85 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDObjects.h"
+#include <algorithm>
+
+uint32_t MdParseId(const std::string& value) {
+    if (value.empty() || value.size() > 9) return 0;
+    uint32_t id = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return 0;
+        id = id * 10 + (uint32_t)(c - '0');
+    }
+    return id;
+}
+
+// Первая пара с данным ID (повторные ID в дереве - первый по порядку)
+static const uint32_t* FindIndex(const std::vector<std::pair<uint32_t, uint32_t>>& ids, uint32_t id) {
+    auto it = std::lower_bound(ids.begin(), ids.end(), std::make_pair(id, (uint32_t)0));
+    return it != ids.end() && it->first == id ? &it->second : NULL;
+}
+
+const MdObjectInfo* MdObjectModel::FindObject(uint32_t id) const {
+    const uint32_t* index = FindIndex(objectIds, id);
+    return index ? &objects[*index] : NULL;
+}
+
+const MdObjectInfo* MdObjectModel::FindObject(const std::string& id) const {
+    uint32_t value = MdParseId(id);
+    return value ? FindObject(value) : NULL;
+}
+
+const MdFieldInfo* MdObjectModel::FindField(uint32_t id) const {
+    const uint32_t* index = FindIndex(fieldIds, id);
+    return index ? &fields[*index] : NULL;
+}
+
+void MdObjectModel::Append(const MdObjectModel& part) {
+    uint32_t objectBase = (uint32_t)objects.size();
+    uint32_t fieldBase = (uint32_t)fields.size();
+    uint32_t textBase = (uint32_t)text.size();
+
+    text += part.text;
+    for (MdObjectInfo object : part.objects) {
+        object.firstField += fieldBase;
+        object.identifier.offset += textBase;
+        object.synonym.offset += textBase;
+        objects.push_back(object);
+    }
+    for (MdFieldInfo field : part.fields) {
+        if (field.owner != MD_MODEL_NONE) field.owner += objectBase;
+        field.identifier.offset += textBase;
+        field.synonym.offset += textBase;
+        fields.push_back(field);
+    }
+}
+
+void MdObjectModel::BuildIndex() {
+    objectIds.clear();
+    fieldIds.clear();
+    objectIds.reserve(objects.size());
+    fieldIds.reserve(fields.size());
+    for (size_t i = 0; i < objects.size(); ++i) objectIds.push_back(std::make_pair(objects[i].id, (uint32_t)i));
+    for (size_t i = 0; i < fields.size(); ++i) fieldIds.push_back(std::make_pair(fields[i].id, (uint32_t)i));
+    // ID обычно растут в порядке дерева - тогда сортировать нечего
+    if (!std::is_sorted(objectIds.begin(), objectIds.end())) std::sort(objectIds.begin(), objectIds.end());
+    if (!std::is_sorted(fieldIds.begin(), fieldIds.end())) std::sort(fieldIds.begin(), fieldIds.end());
+}
+
+void MdObjectModel::Clear() {
+    objects.clear();
+    fields.clear();
+    text.clear();
+    objectIds.clear();
+    fieldIds.clear();
+}
+
+size_t MdObjectModel::MemoryBytes() const {
+    return objects.capacity() * sizeof(MdObjectInfo) + fields.capacity() * sizeof(MdFieldInfo) + text.capacity() +
+           (objectIds.capacity() + fieldIds.capacity()) * sizeof(std::pair<uint32_t, uint32_t>);
+}
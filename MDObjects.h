@@ -0,0 +1,126 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "MDSnapshot.h"
+
+// ============================================================================
+// Типизированная модель объектов конфигурации
+// ============================================================================
+//
+// Объекты (справочники, документы, регистры, ...) и их поля с разобранными
+// значениями: ID, идентификатор, синоним, тип, длина, точность, тип ссылки,
+// периодичность. Строится тем же проходом анализа, что и карты, в плоские
+// массивы: поля объекта идут подряд, строки лежат в общем буфере модели.
+// Потребителям не нужно помнить, что в узле поля [0] - ID, а [7] - ссылка,
+// и заново обходить дерево. Модель не ссылается на узлы дерева и не
+// меняется после построения (общая у парсера и снимков MdConfig).
+
+// Раскладка полей узла {ID, Имя, Синоним, Комментарий, Тип, Длина, Точность,
+// ID ссылки, ...}: позиции значений
+enum MdFieldPos {
+    MD_POS_ID         = 0,
+    MD_POS_IDENTIFIER = 1,
+    MD_POS_SYNONYM    = 2,
+    MD_POS_TYPE       = 4,
+    MD_POS_LENGTH     = 5,
+    MD_POS_PRECISION  = 6,
+    MD_POS_REF        = 7,
+    MD_POS_PERIODIC   = 10, // реквизит справочника: "1" - периодический
+    MD_POS_PERIOD     = 5   // заголовок регистра: код периодичности
+};
+
+enum MdObjectKind {
+    MD_OBJ_CATALOG,      // SC, SbCnts
+    MD_OBJ_DOCUMENT,     // DT, Documents
+    MD_OBJ_REGISTER,     // RG, Registers
+    MD_OBJ_JOURNAL,      // JR, Journalisters
+    MD_OBJ_CALC_JOURNAL, // CJ
+    MD_OBJ_ENUM,         // EN
+    MD_OBJ_CONSTANT,     // CN (сама константа - поле без владельца)
+    MD_OBJ_OTHER         // отчёты, обработки, нумераторы и пр.
+};
+
+// Список, в котором стоит поле
+enum MdFieldList {
+    MD_FIELD_HEAD,    // "Head Fields"
+    MD_FIELD_TABLE,   // "Table Fields"
+    MD_FIELD_PARAMS,  // "Params"
+    MD_FIELD_PROPS,   // "Props" - измерения регистра
+    MD_FIELD_FIGURES, // "Figures" - ресурсы регистра
+    MD_FIELD_FLDS,    // "Flds" - реквизиты регистра
+    MD_FIELD_ENUMVAL, // значение перечисления (типа нет)
+    MD_FIELD_CONST,   // константа (раздел Consts)
+    MD_FIELD_JOURNAL  // графа общего журнала (GenJrnlFldDef)
+};
+
+const uint32_t MD_MODEL_NONE = 0xFFFFFFFF;
+
+// Строка в MdObjectModel::text
+struct MdTextSpan {
+    uint32_t offset, length;
+};
+
+struct MdObjectInfo {
+    uint32_t id;
+    MdTextSpan identifier;
+    MdTextSpan synonym;
+    uint32_t firstField;  // поля объекта: fields[firstField .. firstField + fieldCount)
+    uint32_t fieldCount;
+    const char* prefix;   // тип в картах анализа: "SC", "DT", ...
+    uint8_t kind;         // MdObjectKind
+    uint8_t periodicity;  // регистр: код периодичности, 0 - нет
+};
+
+struct MdFieldInfo {
+    uint32_t id;
+    uint32_t owner;       // индекс объекта в objects или MD_MODEL_NONE
+    uint32_t refTarget;   // ID типа назначения, 0 - не ссылка
+    MdTextSpan identifier;
+    MdTextSpan synonym;
+    uint32_t length;
+    uint16_t precision;
+    char typeCode;        // S, N, D, B, O, ...; 0 - нет
+    uint8_t list;         // MdFieldList
+    uint8_t periodic;     // реквизит хранит историю значений
+};
+
+struct MdObjectModel {
+    std::vector<MdObjectInfo> objects; // в порядке разделов и объектов в дереве
+    std::vector<MdFieldInfo> fields;
+    std::string text;                  // идентификаторы и синонимы (1251)
+    // ID -> индекс, по возрастанию ID (строится BuildIndex)
+    std::vector<std::pair<uint32_t, uint32_t>> objectIds;
+    std::vector<std::pair<uint32_t, uint32_t>> fieldIds;
+
+    // Поиск по ID (NULL - нет такого)
+    const MdObjectInfo* FindObject(uint32_t id) const;
+    const MdObjectInfo* FindObject(const std::string& id) const;
+    const MdFieldInfo* FindField(uint32_t id) const;
+
+    const MdFieldInfo* FieldsOf(const MdObjectInfo& object) const { return fields.data() + object.firstField; }
+    MdStrRef Text(const MdTextSpan& span) const {
+        MdStrRef ref = { text.data() + span.offset, span.length };
+        return ref;
+    }
+
+    // Добавить частичную модель (индексы и смещения сдвигаются)
+    void Append(const MdObjectModel& part);
+    void BuildIndex();
+    void Clear();
+    size_t MemoryBytes() const;
+};
+
+// ID из значения узла: только десятичные цифры, иначе 0
+uint32_t MdParseId(const std::string& value);
+
+// Префикс типа из таблицы разделов анализа (постоянная строка, как в
+// MdObjectInfo::prefix); NULL - такого типа нет
+const char* MdFindTypePrefix(const MdStrRef& prefix);
@@ -6,12 +6,19 @@
  */
  
 #include "MDParser.h"
+#include "MDThreads.h"
+#include "MDCache.h"
+#include "MDConfig.h"
+#include "MDObjects.h"
+#include "MDProfile.h"
+#include "MDTrace.h"
 #include "miniz.h" 
 #include <comdef.h>
 #include <sstream>
 #include <vector>
 #include <iomanip>
 #include <algorithm>
+#include <unordered_map>
 
 // ============================================================================
 // ХЕЛПЕРЫ: ZLIB / DECRYPT
@@ -27,19 +34,62 @@ bool IsZlib(const std::vector<char>& data) {
 
 bool TryDecompress(std::vector<char>& data) {
     if (data.empty()) return false;
+    MD_PROFILE_SCOPE(MD_STAGE_INFLATE);
     size_t outSize = 0;
-    // Используем функцию из miniz.c
-    void* pDecomp = tinfl_decompress_mem_to_heap(data.data(), data.size(), &outSize, 0);
+    // Используем функцию из miniz.c: сначала с zlib-заголовком (78 xx), затем как raw deflate
+    void* pDecomp = tinfl_decompress_mem_to_heap(data.data(), data.size(), &outSize, TINFL_FLAG_PARSE_ZLIB_HEADER);
+    if (!pDecomp) pDecomp = tinfl_decompress_mem_to_heap(data.data(), data.size(), &outSize, 0);
     if (pDecomp) {
         data.assign((char*)pDecomp, (char*)pDecomp + outSize);
         free(pDecomp);
+        MdProfileCount(MD_CNT_BYTES_INFLATED, outSize);
         return true;
     }
     return false;
 }
 
+// Распаковка порциями: окно вывода ограничено, после каждой порции - onChunk
+static bool InflateChunked(const std::vector<char>& src, int flags, std::vector<char>& out, 
+                           const MdDecodeChunkFn& onChunk) {
+    const size_t kChunk = (size_t)1 << 20;
+    tinfl_decompressor decomp;
+    tinfl_init(&decomp);
+    out.resize((std::max)(src.size() * 4, kChunk));
+    size_t inPos = 0, outPos = 0;
+    for (;;) {
+        if (outPos == out.size()) out.resize(out.size() * 2);
+        size_t inSize = src.size() - inPos;
+        size_t outSize = (std::min)(kChunk, out.size() - outPos);
+        tinfl_status status = tinfl_decompress(&decomp, (const mz_uint8*)src.data() + inPos, &inSize,
+            (mz_uint8*)out.data(), (mz_uint8*)out.data() + outPos, &outSize,
+            flags | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+        if (status < 0 || status == TINFL_STATUS_NEEDS_MORE_INPUT) return false;
+        inPos += inSize;
+        outPos += outSize;
+        if (status == TINFL_STATUS_DONE) break;
+        if (!onChunk(outPos)) return false;
+    }
+    out.resize(outPos);
+    return true;
+}
+
+bool TryDecompress(std::vector<char>& data, const MdDecodeChunkFn& onChunk) {
+    if (!onChunk) return TryDecompress(data);
+    if (data.empty()) return false;
+    MD_PROFILE_SCOPE(MD_STAGE_INFLATE);
+    std::vector<char> out;
+    bool ok = InflateChunked(data, TINFL_FLAG_PARSE_ZLIB_HEADER, out, onChunk);
+    if (!ok) ok = InflateChunked(data, 0, out, onChunk); // как raw deflate
+    if (!ok) return false;
+    data.swap(out);
+    MdProfileCount(MD_CNT_BYTES_INFLATED, data.size());
+    return true;
+}
+
 void ApplyDecrypt(std::vector<char>& data, const std::string& pass) {
     if (data.size() < 8) return;
+    MD_PROFILE_SCOPE(MD_STAGE_DECRYPT);
+    MdProfileCount(MD_CNT_BYTES_DECRYPTED, data.size() - 8);
     DWORD key = 0; 
     for (char c : pass) key = key * 4 + (unsigned char)c;
     
@@ -60,7 +110,46 @@ void ApplyDecrypt(std::vector<char>& data, const std::string& pass) {
     data = output;
 }
 
+bool TryCompress(std::vector<char>& data, int level) {
+    MD_PROFILE_SCOPE(MD_STAGE_DEFLATE);
+    size_t outSize = 0;
+    int flags = (int)tdefl_create_comp_flags_from_zip_params(level, MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    void* pComp = tdefl_compress_mem_to_heap(data.data(), data.size(), &outSize, flags);
+    if (pComp) {
+        data.assign((char*)pComp, (char*)pComp + outSize);
+        free(pComp);
+        return true;
+    }
+    return false;
+}
+
+// XOR-шифрование симметрично: ключ строится так же, как в ApplyDecrypt,
+// заголовок (%w + seed) берётся из исходного потока
+void ApplyEncrypt(std::vector<char>& data, const std::vector<char>& header, const std::string& pass) {
+    if (header.size() < 8) return;
+    DWORD key = 0; 
+    for (char c : pass) key = key * 4 + (unsigned char)c;
+    
+    DWORD rndSeed = 0; 
+    memcpy(&rndSeed, &header[2], 4); 
+    key ^= rndSeed;
+    
+    std::vector<char> output; 
+    output.reserve(data.size() + 8);
+    output.insert(output.end(), header.begin(), header.begin() + 8);
+    const DWORD LCG_MUL = 0x08088405; 
+    const DWORD LCG_INC = 1;
+    
+    for (size_t i = 0; i < data.size(); ++i) {
+        char c = (char)((unsigned char)data[i] ^ (unsigned char)(key & 0xFF));
+        output.push_back(c);
+        key = key * LCG_MUL + LCG_INC;
+    }
+    data.swap(output);
+}
+
 int FindTextBrace(const std::vector<char>& data) {
+    MD_PROFILE_SCOPE(MD_STAGE_BRACE_SCAN);
     size_t limit = (std::min)((size_t)4096, data.size());
     for (size_t i = 0; i < limit; ++i) { 
         if (data[i] == '{') return (int)i; 
@@ -68,15 +157,401 @@ int FindTextBrace(const std::vector<char>& data) {
     return -1;
 }
 
+MdStreamFormat DecodeStreamData(std::vector<char>& data) {
+    return DecodeStreamData(data, MdDecodeChunkFn());
+}
+
+MdStreamFormat DecodeStreamData(std::vector<char>& data, const MdDecodeChunkFn& onChunk) {
+    // 1. ZLib?
+    if (IsZlib(data)) {
+        if (TryDecompress(data, onChunk)) return MD_FMT_ZLIB;
+    }
+    // 2. ZLib + Offset 8?
+    if (data.size() > 8) {
+        std::vector<char> copyOffset(data.begin() + 8, data.end());
+        if (IsZlib(copyOffset)) {
+            if (TryDecompress(copyOffset, onChunk)) {
+                data.swap(copyOffset);
+                return MD_FMT_ZLIB_OFFSET8;
+            }
+        }
+    }
+    // 3. Encrypted?
+    if (data.size() > 8 && 
+        (unsigned char)data[0] == 0x25 && (unsigned char)data[1] == 0x77) {
+        std::vector<char> copyEnc = data;
+        ApplyDecrypt(copyEnc, ""); 
+        if (IsZlib(copyEnc)) {
+            if (TryDecompress(copyEnc, onChunk)) {
+                data.swap(copyEnc);
+                return MD_FMT_ENCRYPTED;
+            }
+        }
+    }
+    // 4. Pure Text?
+    if (FindTextBrace(data) != -1) return MD_FMT_TEXT;
+
+    return MD_FMT_RAW;
+}
+
+MdStreamFormat DetectStreamFormat(const std::vector<char>& raw) {
+    if (IsZlib(raw)) return MD_FMT_ZLIB;
+    if (raw.size() > 8) {
+        std::vector<char> head(raw.begin() + 8, raw.begin() + 10);
+        if (IsZlib(head)) return MD_FMT_ZLIB_OFFSET8;
+    }
+    if (raw.size() > 8 && 
+        (unsigned char)raw[0] == 0x25 && (unsigned char)raw[1] == 0x77) {
+        std::vector<char> copyEnc = raw;
+        ApplyDecrypt(copyEnc, ""); 
+        if (IsZlib(copyEnc)) return MD_FMT_ENCRYPTED;
+    }
+    if (FindTextBrace(raw) != -1) return MD_FMT_TEXT;
+    return MD_FMT_RAW;
+}
+
+bool EncodeStreamData(const std::vector<char>& plain, const std::vector<char>& original, 
+                      int level, bool encrypt, std::vector<char>& out) {
+    out = plain;
+    switch (DetectStreamFormat(original)) {
+    case MD_FMT_ZLIB:
+        return TryCompress(out, level);
+    case MD_FMT_ZLIB_OFFSET8:
+        // Заголовок: размер распакованных данных (4 байта, little-endian) и
+        // резерв; резерв переносится из исходного потока, размер - новый
+        if (!TryCompress(out, level)) return false;
+        out.insert(out.begin(), original.begin(), original.begin() + 8);
+        for (int i = 0; i < 4; ++i) out[i] = (char)(((uint32_t)plain.size() >> (i * 8)) & 0xFF);
+        return true;
+    case MD_FMT_ENCRYPTED:
+        if (!TryCompress(out, level)) return false;
+        if (encrypt) ApplyEncrypt(out, original, "");
+        return true;
+    default:
+        return true; // текст и неизвестные данные пишутся как есть
+    }
+}
+
+// ============================================================================
+// КЕШ ДЕКОДИРОВАННЫХ ПОТОКОВ (LRU)
+// ============================================================================
+
+MdStreamCache::MdStreamCache(size_t budget)
+    : m_bytes(0), m_budget(budget), m_hits(0), m_misses(0), m_evictions(0) {}
+
+std::shared_ptr<const MdDecodedStream> MdStreamCache::Find(const std::wstring& key) {
+    auto it = m_index.find(key);
+    if (it == m_index.end()) {
+        m_misses++;
+        return nullptr;
+    }
+    m_hits++;
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return it->second->second;
+}
+
+void MdStreamCache::Insert(const std::wstring& key, const std::shared_ptr<const MdDecodedStream>& value) {
+    Erase(key);
+    size_t size = value->data.size();
+    if (size > m_budget) return;
+
+    Evict(m_budget - size);
+    m_lru.push_front(std::make_pair(key, value));
+    m_index[key] = m_lru.begin();
+    m_bytes += size;
+}
+
+void MdStreamCache::Erase(const std::wstring& key) {
+    auto it = m_index.find(key);
+    if (it == m_index.end()) return;
+    m_bytes -= it->second->second->data.size();
+    m_lru.erase(it->second);
+    m_index.erase(it);
+}
+
+void MdStreamCache::Clear() {
+    m_lru.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
+
+void MdStreamCache::SetBudget(size_t budget) {
+    m_budget = budget;
+    Evict(budget);
+}
+
+// Вытесняет с конца очереди, пока объём больше budget
+void MdStreamCache::Evict(size_t budget) {
+    while (m_bytes > budget && !m_lru.empty()) {
+        auto& last = m_lru.back();
+        m_bytes -= last.second->data.size();
+        m_index.erase(last.first);
+        m_lru.pop_back();
+        m_evictions++;
+    }
+}
+
+MdStreamCacheStats MdStreamCache::GetStats() const {
+    MdStreamCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.count = m_index.size();
+    stats.bytes = m_bytes;
+    stats.budget = m_budget;
+    return stats;
+}
+
+// ============================================================================
+// УЧЁТ ПАМЯТИ
+// ============================================================================
+//
+// Оценка, а не точный счёт кучи: размеры структур плюс заголовок блока кучи.
+// Строки учитываются, только если вышли за встроенный буфер (SSO).
+
+static const size_t kHeapOverhead = 16;   // заголовок блока кучи
+static const size_t kSharedOverhead = 16; // счётчики make_shared рядом с объектом
+static const size_t kMapNodeOverhead = 32; // узел std::map: три указателя и цвет
+
+// Разбор прерван: превышен предел памяти (lastError заполнен в ChargeMemory)
+struct MdMemoryLimitExceeded {};
+
+template<class S>
+static size_t StringHeapBytes(const S& s) {
+    return s.capacity() > S().capacity() ? (s.capacity() + 1) * sizeof(typename S::value_type) + kHeapOverhead : 0;
+}
+
+static size_t NodeBytes(const MdNode& node) {
+    size_t bytes = sizeof(MdNode) + kSharedOverhead + kHeapOverhead;
+    if (node.children.capacity()) bytes += node.children.capacity() * sizeof(node.children[0]) + kHeapOverhead;
+    return bytes;
+}
+
+static size_t NodeStringBytes(const MdNode& node) {
+    return StringHeapBytes(node.value) + StringHeapBytes(node.wsBefore) + 
+           StringHeapBytes(node.wsAfter) + StringHeapBytes(node.wsClose);
+}
+
+static size_t MapValueBytes(const std::string& value) { return StringHeapBytes(value); }
+static size_t MapValueBytes(const std::shared_ptr<MdNode>&) { return 0; }
+
+template<class M>
+static size_t MapBytes(const M& map) {
+    size_t bytes = 0;
+    for (auto& item : map) {
+        bytes += sizeof(item) + kMapNodeOverhead + kHeapOverhead + 
+                 StringHeapBytes(item.first) + MapValueBytes(item.second);
+    }
+    return bytes;
+}
+
+static size_t RefIndexBytes(const MdRefIndex& index) {
+    size_t bytes = index.offsets.capacity() * sizeof(uint32_t) + index.sources.capacity() * sizeof(MdRefSource) +
+                   (index.targets.capacity() + index.names.capacity()) * sizeof(std::string) + 4 * kHeapOverhead;
+    for (auto& s : index.targets) bytes += StringHeapBytes(s);
+    for (auto& s : index.names) bytes += StringHeapBytes(s);
+    return bytes;
+}
+
+static size_t EntriesBytes(const std::vector<OLEEntry>& entries) {
+    size_t bytes = entries.capacity() * sizeof(OLEEntry);
+    for (auto& entry : entries) {
+        bytes += StringHeapBytes(entry.name) + StringHeapBytes(entry.fullPath) + EntriesBytes(entry.children);
+    }
+    return bytes;
+}
+
+// Учитывает выделение в поле разбивки. При превышении предела сначала
+// уступает кеш потоков, затем возвращает false
+bool MDParser::ChargeMemory(size_t& field, size_t bytes) {
+    field += bytes;
+    m_memory.total += bytes;
+
+    size_t used = m_memory.total + m_streamCache.Bytes();
+    if (m_memory.limit && used > m_memory.limit) {
+        m_streamCache.Trim(m_memory.limit > m_memory.total ? m_memory.limit - m_memory.total : 0);
+        used = m_memory.total + m_streamCache.Bytes();
+    }
+    if (used > m_memory.peak) m_memory.peak = used;
+    if (m_memory.limit && used > m_memory.limit) {
+        lastError = L"Превышен предел памяти: " + std::to_wstring((unsigned long long)(used >> 20)) + 
+            L" МБ при пределе " + std::to_wstring((unsigned long long)(m_memory.limit >> 20)) + L" МБ";
+        return false;
+    }
+    return true;
+}
+
+void MDParser::ReleaseMemory(size_t& field, size_t bytes) {
+    bytes = (std::min)(bytes, field);
+    field -= bytes;
+    m_memory.total -= bytes;
+}
+
+// Сколько ещё можно занять (кеш потоков уступит своё)
+size_t MDParser::MemoryHeadroom() const {
+    if (!m_memory.limit) return (size_t)-1;
+    return m_memory.limit > m_memory.total ? m_memory.limit - m_memory.total : 0;
+}
+
+void MDParser::ResetMemory(bool keepPeak) {
+    MdMemoryStats fresh = MdMemoryStats();
+    fresh.limit = m_memory.limit;
+    if (keepPeak) fresh.peak = m_memory.peak;
+    m_memory = fresh;
+}
+
+void MDParser::ChargeTreeMemory(const MdNode* node) {
+    if (!node) return;
+    m_memory.nodes++;
+    ChargeMemory(m_memory.nodeBytes, NodeBytes(*node));
+    ChargeMemory(m_memory.stringBytes, NodeStringBytes(*node));
+    for (auto& child : node->children) ChargeTreeMemory(child.get());
+}
+
+bool MDParser::UpdateIndexMemory() {
+    ReleaseMemory(m_memory.indexBytes, m_memory.indexBytes);
+    return ChargeMemory(m_memory.indexBytes, MapBytes(objectIndex) + MapBytes(m_idToType) + MapBytes(m_fieldToRef) +
+                                             RefIndexBytes(m_refIndex) + (m_model ? m_model->MemoryBytes() : 0));
+}
+
+bool MDParser::UpdateEntriesMemory() {
+    ReleaseMemory(m_memory.oleBytes, m_memory.oleBytes);
+    return ChargeMemory(m_memory.oleBytes, EntriesBytes(rootEntries));
+}
+
+MdMemoryStats MDParser::GetMemoryStats() const {
+    MdMemoryStats stats = m_memory;
+    stats.decodedBytes += m_streamCache.Bytes();
+    stats.total += m_streamCache.Bytes();
+    if (stats.total > stats.peak) stats.peak = stats.total;
+    return stats;
+}
+
+void MDParser::SetMemoryLimit(size_t bytes) {
+    m_memory.limit = bytes;
+}
+
+// ============================================================================
+// ЗАГРУЗКА С ХОДОМ И ОТМЕНОЙ
+// ============================================================================
+
+// Отчёт о ходе и проверка отмены в разборе - раз на столько узлов
+static const unsigned kLoadChunkNodes = 16384;
+
+static const wchar_t* const kMetaStreamPath = L"Metadata\\Main MetaData Stream";
+
+const OLEEntry* MdFindEntry(const std::vector<OLEEntry>& entries, const std::wstring& fullPath) {
+    for (auto& entry : entries) {
+        if (entry.fullPath == fullPath) return &entry;
+        // Спускаемся только в папку, которая является префиксом пути
+        if (entry.isFolder && fullPath.size() > entry.fullPath.size() &&
+            fullPath[entry.fullPath.size()] == L'\\' && fullPath.compare(0, entry.fullPath.size(), entry.fullPath) == 0) {
+            return MdFindEntry(entry.children, fullPath);
+        }
+    }
+    return NULL;
+}
+
+// Загрузка отменена (в разборе - исключением из LoadCheckpoint)
+struct MdLoadCancelled {};
+
+struct MDParser::LoadControl {
+    std::shared_ptr<MdCancelToken> cancel;
+    MdLoadProgressFn progress;
+    MdLoadProgress state;
+    const char* text;  // начало разбираемого текста
+    size_t nodesBase;  // узлов было до разбора (прежнее дерево)
+    unsigned ticks;
+};
+
+void MDParser::ReportLoad(MdLoadPhase phase) {
+    if (!m_load) return;
+    m_load->state.phase = phase;
+    if (m_load->progress) m_load->progress(m_load->state);
+}
+
+bool MDParser::LoadCancelled() const {
+    return m_load && m_load->cancel && m_load->cancel->IsCancelled();
+}
+
+void MDParser::LoadCheckpoint(const char* ptr) {
+    m_load->state.parsedBytes = (unsigned long long)(ptr - m_load->text);
+    m_load->state.nodes = m_memory.nodes - m_load->nodesBase;
+    ReportLoad(MD_LOAD_PARSE);
+    if (LoadCancelled()) throw MdLoadCancelled();
+}
+
+bool MDParser::Load(const std::wstring& filePath, const MdLoadOptions& options,
+                    const std::shared_ptr<MdCancelToken>& cancel, const MdLoadProgressFn& progress) {
+    LoadControl control;
+    control.cancel = cancel;
+    control.progress = progress;
+    memset(&control.state, 0, sizeof(control.state));
+    control.text = NULL;
+    control.nodesBase = 0;
+    control.ticks = 0;
+    m_load = &control;
+
+    ReportLoad(MD_LOAD_OPEN);
+    bool ok;
+    if (options.useCache) {
+        ok = OpenCached(filePath, options.cacheDir, options.open);
+    } else {
+        ok = Open(filePath, options.open) && LoadOptionalMetadata();
+        if (ok && !root && !LoadCancelled()) PublishConfig();
+    }
+
+    bool cancelled = LoadCancelled();
+    if (ok && !cancelled) ReportLoad(MD_LOAD_DONE);
+    m_load = NULL;
+
+    if (cancelled) {
+        Close();
+        lastError = L"Загрузка отменена";
+        return false;
+    }
+    return ok;
+}
+
+void MDParser::LoadAsync(const std::wstring& filePath, const MdLoadOptions& options,
+                         const MdLoadProgressFn& progress, const MdLoadDoneFn& done) {
+    CancelLoad();
+    WaitLoad();
+
+    auto cancel = std::make_shared<MdCancelToken>();
+    m_loadCancel = cancel;
+    m_loading = true;
+    m_loadThread = std::thread([this, filePath, options, cancel, progress, done]() {
+        CoInitialize(NULL); // COM - свой в рабочем потоке
+        bool ok = Load(filePath, options, cancel, progress);
+        std::wstring error = ok ? std::wstring() : lastError;
+        m_loading = false;  // дальше поток парсер не трогает
+        if (done) done(ok, error);
+        CoUninitialize();
+    });
+}
+
+void MDParser::CancelLoad() {
+    if (m_loadCancel) m_loadCancel->Cancel();
+}
+
+void MDParser::WaitLoad() {
+    if (m_loadThread.joinable()) m_loadThread.join();
+    m_loadCancel.reset();
+}
+
 // ============================================================================
 // REALIZATION: MDParser
 // ============================================================================
 
-MDParser::MDParser() {
+MDParser::MDParser() : m_streamCache(MdOpenOptions().memoryBudget), m_memory(), m_treeAllocs(0), m_analyzeThreads(1), m_load(NULL),
+                       m_loading(false) {
     CoInitialize(NULL);
 }
 
 MDParser::~MDParser() {
+    CancelLoad();
+    WaitLoad();
     Close();
     CoUninitialize();
 }
@@ -86,9 +561,18 @@ void MDParser::Close() {
     currentFilePath.clear();
     // Очистка структур парсера
     root.reset();
+    m_editRoot.reset();
     objectIndex.clear();
     m_idToType.clear();
     m_fieldToRef.clear();
+    m_refIndex.Clear();
+    m_model.reset();
+    m_metaPrefix.clear();
+    m_metaSuffix.clear();
+    m_pendingStreams.clear();
+    m_streamCache.Clear();
+    m_cache.reset();
+    ResetMemory(true);
 }
 
 std::wstring MDParser::GetLastError() const {
@@ -99,34 +583,510 @@ const std::vector<OLEEntry>& MDParser::GetRootEntries() const {
     return rootEntries;
 }
 
-std::shared_ptr<MdNode> MDParser::GetParsedRoot() const {
+std::shared_ptr<const MdNode> MDParser::GetParsedRoot() {
+    EnsureMetadata();
     return root;
 }
 
-bool MDParser::Open(const std::wstring& filePath) {
+const std::map<std::string, std::string>& MDParser::GetObjectTypes() {
+    return m_idToType;
+}
+
+const std::map<std::string, std::string>& MDParser::GetFieldRefs() {
+    return m_fieldToRef;
+}
+
+const MdRefIndex& MDParser::GetReverseRefs() {
+    return m_refIndex;
+}
+
+std::shared_ptr<const MdObjectModel> MDParser::GetObjectModel() {
+    return m_model;
+}
+
+// Снимок открыт: карты, модель и обратный индекс берутся из него, дерево -
+// только по требованию (EnsureMetadata). Снимку версии 1.0 без анализа
+// нужно дерево: анализ повторяется по нему
+void MDParser::RestoreCache(const std::shared_ptr<MdSnapshotReader>& cache) {
+    m_cache = cache;
+    UpdateEntriesMemory();
+    MdStrRef prefix = cache->MetaPrefix(), suffix = cache->MetaSuffix();
+    m_metaPrefix.assign(prefix.data, prefix.len);
+    m_metaSuffix.assign(suffix.data, suffix.len);
+    if (!cache->HasRoot()) return;
+    cache->RestoreMaps(m_idToType, m_fieldToRef);
+    if (cache->RestoreAnalysis(m_model, m_refIndex)) UpdateIndexMemory();
+    else EnsureMetadata();
+}
+
+// Дерево из снимка: общее с опубликованным MdConfig и другими читателями снимка
+void MDParser::EnsureMetadata() {
+    if (root || !m_cache || !m_cache->HasRoot()) return;
+    m_cache->Materialize(root, objectIndex);
+    if (root && !m_model) ScanSections();
+    ChargeTreeMemory(root.get());
+    UpdateIndexMemory();
+}
+
+bool MDParser::OpenCached(const std::wstring& filePath, const std::wstring& cacheDir, const MdOpenOptions& options) {
+    MdFileFingerprint fp;
+    if (!MdGetFileFingerprint(filePath, fp)) {
+        if (!Open(filePath, options) || !LoadOptionalMetadata()) return false;
+        if (LoadCancelled()) return false;
+        if (!root) PublishConfig();
+        return true;
+    }
+
+    std::wstring cachePath = MdGetCachePath(filePath, cacheDir);
+    auto view = MdOpenCache(cachePath, fp);
+    std::vector<OLEEntry> entries;
+    if (view) {
+        view->RestoreEntries(entries);
+        // Кеш без дерева у файла с потоком метаданных - след прежнего сбоя разбора
+        if (!view->HasRoot() && MdFindEntry(entries, kMetaStreamPath)) view.reset();
+    }
+    MdProfileCount(view ? MD_CNT_PARSE_CACHE_HITS : MD_CNT_PARSE_CACHE_MISSES);
+    if (view) {
+        Close();
+        ResetMemory(false);
+        currentFilePath = filePath;
+        rootEntries.swap(entries);
+        RestoreCache(view);
+        PublishConfig();
+        return true;
+    }
+
+    // Сбой разбора в кеш не пишется: иначе он закрепился бы до смены файла
+    if (!Open(filePath, options) || !LoadOptionalMetadata()) return false;
+    if (LoadCancelled()) return false; // неполный разбор в кеш не пишется
+    if (!root) PublishConfig(); // с деревом уже опубликован разбором
+    MdWriteSnapshot(cachePath, fp, filePath, root.get(), rootEntries, objectIndex, m_idToType, m_fieldToRef, 
+                    m_refIndex, m_model.get(), m_metaPrefix, m_metaSuffix);
+    return true;
+}
+
+bool MDParser::SaveSnapshot(const std::wstring& snapshotPath) {
+    if (currentFilePath.empty()) {
+        lastError = L"Ошибка: файл не открыт";
+        return false;
+    }
+    EnsureMetadata();
+
+    MdFileFingerprint fp = { 0, 0, 0 };
+    if (m_cache) fp = m_cache->Source();
+    else MdGetFileFingerprint(currentFilePath, fp);
+
+    if (!MdWriteSnapshot(snapshotPath, fp, currentFilePath, root.get(), rootEntries, objectIndex, 
+                         m_idToType, m_fieldToRef, m_refIndex, m_model.get(), m_metaPrefix, m_metaSuffix)) {
+        lastError = L"Не удалось записать снимок";
+        return false;
+    }
+    return true;
+}
+
+bool MDParser::OpenSnapshot(const std::wstring& snapshotPath) {
+    std::wstring error;
+    auto snapshot = MdSnapshotReader::Open(snapshotPath, &error);
+    if (!snapshot) {
+        lastError = error;
+        return false;
+    }
     Close();
-    currentFilePath = filePath;
+    ResetMemory(false);
+    currentFilePath = snapshot->SourcePath();
+    snapshot->RestoreEntries(rootEntries);
+    RestoreCache(snapshot);
+    PublishConfig();
+    return true;
+}
 
-    IStorage* pRootStorage = NULL;
-    
-    HRESULT hr = StgOpenStorage(filePath.c_str(), NULL, 
-        STGM_READ | STGM_SHARE_DENY_NONE | STGM_DIRECT, 
-        NULL, 0, &pRootStorage);
+std::shared_ptr<MdSnapshotReader> MDParser::GetSnapshot() const {
+    return m_cache;
+}
+
+std::shared_ptr<const MdConfig> MDParser::GetConfig() const {
+    return std::atomic_load(&m_config);
+}
+
+void MDParser::PublishConfig() {
+    static std::atomic<unsigned long long> s_generation(0);
+
+    // Дерево не копируется: следующий разбор строит новые узлы, а не меняет эти.
+    // Не построенное из снимка дерево снимок MdConfig строит сам при обращении
+    std::shared_ptr<MdConfig> config(new MdConfig());
+    config->m_generation = ++s_generation;
+    config->m_filePath = currentFilePath;
+    config->m_entries = rootEntries;
+    if (!root && m_cache && m_cache->HasRoot()) config->m_snapshot = m_cache;
+    config->m_root = root;
+    for (auto& item : objectIndex) {
+        config->m_objects.emplace_hint(config->m_objects.end(), item.first, item.second.get());
+    }
+    config->m_idToType = m_idToType;
+    config->m_fieldToRef = m_fieldToRef;
+    config->m_refIndex = m_refIndex;
+    config->m_model = m_model;
+    std::atomic_store(&m_config, std::shared_ptr<const MdConfig>(config));
+}
+
+// Поток метаданных есть не всегда (например, .ert): его отсутствие - не
+// ошибка, а сбой разбора (предел памяти, повреждённый поток) закрывает файл
+bool MDParser::LoadOptionalMetadata() {
+    if (!MdFindEntry(rootEntries, kMetaStreamPath)) return true;
+    if (LoadMetadata()) return true;
+    std::wstring error = lastError;
+    Close();
+    lastError = error;
+    return false;
+}
+
+bool MDParser::LoadMetadata() {
+    if (m_cache) {
+        EnsureMetadata();
+        return root != nullptr;
+    }
+
+    std::vector<char> data;
+    ReportLoad(MD_LOAD_READ);
+    if (!ReadRawStream(kMetaStreamPath, data)) return false;
+    if (m_load) m_load->state.rawBytes = data.size();
+    size_t rawSize = data.capacity();
+    if (!ChargeMemory(m_memory.rawBytes, rawSize)) {
+        ReleaseMemory(m_memory.rawBytes, rawSize);
+        return false;
+    }
+
+    // Во время загрузки (Load) распаковка идёт порциями с отчётом и отменой
+    MdDecodeChunkFn onChunk;
+    if (m_load) {
+        ReportLoad(MD_LOAD_DECODE);
+        onChunk = [this](size_t produced) {
+            m_load->state.decodedBytes = produced;
+            ReportLoad(MD_LOAD_DECODE);
+            return !LoadCancelled();
+        };
+    }
+
+    // Во время распаковки живут оба буфера
+    bool decoded = !data.empty() && DecodeStreamData(data, onChunk) != MD_FMT_RAW;
+    size_t decodedSize = data.capacity();
+    if (LoadCancelled()) {
+        ReleaseMemory(m_memory.rawBytes, rawSize);
+        lastError = L"Загрузка отменена";
+        return false;
+    }
+    if (m_load) m_load->state.decodedBytes = data.size();
+    bool ok = ChargeMemory(m_memory.decodedBytes, decodedSize);
+    ReleaseMemory(m_memory.rawBytes, rawSize);
+
+    if (ok && !decoded) {
+        lastError = L"Неизвестный формат потока метаданных";
+        ok = false;
+    }
+    if (ok) ok = ParseMetadataText(data);
+    ReleaseMemory(m_memory.decodedBytes, decodedSize);
+    return ok;
+}
+
+bool MDParser::ParseMetadataText(std::vector<char>& data, bool analyze) {
+    int bracePos = FindTextBrace(data);
+    if (bracePos == -1) {
+        lastError = L"Ошибка: данные распакованы, но не найден корневой элемент '{'";
+        return false;
+    }
+
+    data.push_back('\0'); // ParseString идёт до терминатора
+    const char* ptr = data.data() + bracePos;
+    // Прежнее дерево живёт до конца разбора и входит в пик
+    MdMemoryStats before = m_memory;
+    if (m_load) {
+        m_load->text = ptr;
+        m_load->nodesBase = m_memory.nodes;
+        m_load->state.textBytes = data.size() - 1 - bracePos;
+        ReportLoad(MD_LOAD_PARSE);
+    }
+    try {
+        std::shared_ptr<MdNode> tree;
+        {
+            MD_PROFILE_SCOPE(MD_STAGE_PARSE);
+            m_treeAllocs = 0;
+            tree = ParseString(ptr);
+        }
+        if (m_load) {
+            m_load->state.parsedBytes = m_load->state.textBytes;
+            m_load->state.nodes = m_memory.nodes - m_load->nodesBase;
+            ReportLoad(analyze ? MD_LOAD_ANALYZE : MD_LOAD_PARSE);
+        }
+        root = tree;
+        m_editRoot.reset(); // правка прежнего дерева теряет смысл
+        ReleaseTreeMemory(before.nodes, before.nodeBytes, before.stringBytes);
+        if (MdProfileEnabled()) {
+            size_t nodes = CountNodes(root.get());
+            MdProfileCount(MD_CNT_BYTES_PARSED, data.size() - 1 - bracePos);
+            MdProfileCount(MD_CNT_NODES, nodes);
+            MdProfileCount(MD_CNT_TREE_ALLOCS, m_treeAllocs);
+        }
+        if (analyze) AnalyzeStructure();
+        m_metaPrefix.assign(data.data(), bracePos);
+        m_metaSuffix.assign(ptr, (const char*)data.data() + data.size() - 1);
+        if (analyze && !UpdateIndexMemory()) throw MdMemoryLimitExceeded();
+        if (analyze) PublishConfig();
+    } catch (const MdMemoryLimitExceeded&) {
+        // Загрузка прерывается целиком: дерево и карты освобождаются
+        DropMetadata();
+        return false;
+    } catch (const MdLoadCancelled&) {
+        DropMetadata();
+        lastError = L"Загрузка отменена";
+        return false;
+    } catch (...) {
+        DropMetadata();
+        lastError = L"Ошибка парсинга структуры";
+        return false;
+    }
+    return true;
+}
 
+size_t CountNodes(const MdNode* node) {
+    if (!node) return 0;
+    size_t count = 1;
+    for (auto& child : node->children) count += CountNodes(child.get());
+    return count;
+}
+
+void MDParser::AnalyzeMetadata(bool publish) {
+    EnsureMetadata();
+    AnalyzeStructure();
+    UpdateIndexMemory();
+    if (publish) PublishConfig();
+}
+
+// Контейнер на чтение: напрямую, иначе в режиме транзакций
+static HRESULT OpenContainer(const std::wstring& filePath, IStorage** ppRoot) {
+    HRESULT hr = StgOpenStorage(filePath.c_str(), NULL, 
+        STGM_READ | STGM_SHARE_DENY_NONE | STGM_DIRECT, NULL, 0, ppRoot);
     if (FAILED(hr)) {
         hr = StgOpenStorage(filePath.c_str(), NULL, 
-            STGM_READ | STGM_SHARE_DENY_NONE | STGM_TRANSACTED, 
-            NULL, 0, &pRootStorage);
+            STGM_READ | STGM_SHARE_DENY_NONE | STGM_TRANSACTED, NULL, 0, ppRoot);
     }
+    return hr;
+}
+
+bool MDParser::Open(const std::wstring& filePath, const MdOpenOptions& options) {
+    MD_PROFILE_SCOPE(MD_STAGE_OPEN);
+    Close();
+    ResetMemory(false);
+    currentFilePath = filePath;
+
+    IStorage* pRootStorage = NULL;
+    
+    HRESULT hr = OpenContainer(filePath, &pRootStorage);
 
     if (FAILED(hr)) {
         lastError = L"Не удалось открыть файл. Код ошибки: " + std::to_wstring((long)hr);
         return false;
     }
 
-    ReadStorage(pRootStorage, rootEntries, L"");
-    pRootStorage->Release();
-    return true;
+    m_streamCache.SetBudget(options.memoryBudget);
+    {
+        MD_PROFILE_SCOPE(MD_STAGE_ENUMERATE);
+        ReadStorage(pRootStorage, rootEntries, L"");
+    }
+    if (!UpdateEntriesMemory()) {
+        pRootStorage->Release();
+        Close();
+        return false;
+    }
+    if (options.prefetchAll) PrefetchStreams(pRootStorage, options);
+    pRootStorage->Release();
+    return true;
+}
+
+// Читает поток целиком
+static bool ReadStreamBytes(IStream* pStream, std::vector<char>& data) {
+    STATSTG stat;
+    if (FAILED(pStream->Stat(&stat, STATFLAG_NONAME))) return false;
+
+    ULONG size = stat.cbSize.LowPart;
+    data.resize(size);
+    if (size == 0) return true;
+
+    ULONG bytesRead = 0;
+    if (FAILED(pStream->Read(data.data(), size, &bytesRead)) || bytesRead == 0) {
+        data.clear();
+        return false;
+    }
+    if (bytesRead < size) data.resize(bytesRead);
+    return true;
+}
+
+// Один проход по контейнеру: читает потоки, пока не исчерпан бюджет
+void MDParser::ReadAllStreams(IStorage* pStorage, const std::vector<OLEEntry>& entries, size_t& budget,
+                              std::vector<std::pair<std::wstring, MdDecodedStream>>& items) {
+    for (auto& entry : entries) {
+        if (budget == 0) return;
+
+        if (entry.isFolder) {
+            IStorage* pSub = NULL;
+            if (pStorage->OpenStorage(entry.name.c_str(), NULL, 
+                STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pSub) == S_OK) {
+                ReadAllStreams(pSub, entry.children, budget, items);
+                pSub->Release();
+            }
+            continue;
+        }
+
+        if (entry.size > budget) continue; // не поместится - останется ленивым
+
+        IStream* pStream = NULL;
+        if (FAILED(pStorage->OpenStream(entry.name.c_str(), NULL, 
+            STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &pStream))) continue;
+
+        items.push_back(std::make_pair(entry.fullPath, MdDecodedStream()));
+        MdDecodedStream& item = items.back().second;
+        item.format = MD_FMT_RAW;
+        if (ReadStreamBytes(pStream, item.data)) {
+            budget -= (std::min)(budget, item.data.size());
+            MdProfileCount(MD_CNT_STREAMS_READ);
+            MdProfileCount(MD_CNT_BYTES_READ, item.data.size());
+        } else {
+            items.pop_back();
+        }
+        pStream->Release();
+    }
+}
+
+// Обход для ForEachRawStream. pStorage = NULL - папка не открылась: её
+// потоки передаются как непрочитанные
+bool MDParser::WalkRawStreams(IStorage* pStorage, const std::vector<OLEEntry>& entries, const MdRawStreamFn& fn) {
+    for (auto& entry : entries) {
+        if (entry.isFolder) {
+            IStorage* pSub = NULL;
+            if (pStorage && FAILED(pStorage->OpenStorage(entry.name.c_str(), NULL, 
+                STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pSub))) {
+                pSub = NULL;
+                lastError = L"Ошибка: Не удалось открыть папку [" + entry.name + L"]";
+            }
+            bool go;
+            try {
+                go = WalkRawStreams(pSub, entry.children, fn);
+            } catch (...) {
+                if (pSub) pSub->Release();
+                throw;
+            }
+            if (pSub) pSub->Release();
+            if (!go) return false;
+            continue;
+        }
+
+        std::vector<char> data;
+        bool read = false;
+        if (pStorage) {
+            MD_PROFILE_SCOPE(MD_STAGE_READ);
+            IStream* pStream = NULL;
+            if (entry.size > MemoryHeadroom()) {
+                lastError = L"Поток больше свободной памяти в пределах лимита: " + entry.fullPath;
+            } else if (FAILED(pStorage->OpenStream(entry.name.c_str(), NULL, 
+                       STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &pStream))) {
+                lastError = L"Ошибка открытия потока";
+            } else {
+                read = ReadStreamBytes(pStream, data);
+                pStream->Release();
+                if (read) {
+                    MdProfileCount(MD_CNT_STREAMS_READ);
+                    MdProfileCount(MD_CNT_BYTES_READ, data.size());
+                } else {
+                    lastError = L"Ошибка чтения (Read)";
+                }
+            }
+        }
+        if (!fn(entry, read, data)) return false;
+    }
+    return true;
+}
+
+bool MDParser::ForEachRawStream(const MdRawStreamFn& fn) {
+    if (currentFilePath.empty()) {
+        lastError = L"Ошибка: файл не открыт";
+        return false;
+    }
+    IStorage* pRoot = NULL;
+    if (FAILED(OpenContainer(currentFilePath, &pRoot))) {
+        lastError = L"Ошибка: Не удалось открыть файл-контейнер";
+        return false;
+    }
+    bool ok;
+    try {
+        ok = WalkRawStreams(pRoot, rootEntries, fn);
+    } catch (...) {
+        pRoot->Release();
+        throw;
+    }
+    pRoot->Release();
+    return ok;
+}
+
+void MDParser::PrefetchStreams(IStorage* pRoot, const MdOpenOptions& options) {
+    // Чтение - последовательно (COM), декодирование - параллельно
+    // Предварительное чтение не выходит за предел памяти: остальное - лениво
+    std::vector<std::pair<std::wstring, MdDecodedStream>> items;
+    size_t budget = (std::min)(options.memoryBudget, MemoryHeadroom());
+    {
+        MD_PROFILE_SCOPE(MD_STAGE_READ);
+        ReadAllStreams(pRoot, rootEntries, budget, items);
+    }
+    size_t rawSize = 0;
+    for (auto& item : items) rawSize += item.second.data.size();
+    ChargeMemory(m_memory.rawBytes, rawSize);
+
+    ParallelFor(items.size(), options.threads, [&items](size_t i) {
+        MdDecodedStream& item = items[i].second;
+        if (!item.data.empty()) item.format = DecodeStreamData(item.data);
+    });
+
+    size_t decodedSize = 0;
+    for (auto& item : items) decodedSize += item.second.data.size();
+    bool fits = ChargeMemory(m_memory.decodedBytes, decodedSize);
+    ReleaseMemory(m_memory.rawBytes, rawSize);
+    ReleaseMemory(m_memory.decodedBytes, decodedSize);
+    if (!fits) {
+        lastError.clear(); // Open успешен, потоки прочитаются по запросу
+        return;
+    }
+
+    // Бюджет считается по декодированным данным: что не влезло - читается лениво
+    for (auto& item : items) {
+        if (!m_streamCache.Fits(item.second.data.size())) continue;
+        m_streamCache.Insert(item.first, std::make_shared<MdDecodedStream>(std::move(item.second)));
+    }
+}
+
+bool MDParser::GetDecodedStream(const std::wstring& fullPath, std::vector<char>& data, MdStreamFormat& format) {
+    MD_TRACE_SCOPE("stream", "stream", fullPath);
+    auto cached = m_streamCache.Find(fullPath);
+    MdProfileCount(cached ? MD_CNT_STREAM_CACHE_HITS : MD_CNT_STREAM_CACHE_MISSES);
+    if (cached) {
+        data = cached->data;
+        format = cached->format;
+        return true;
+    }
+
+    if (!ReadRawStream(fullPath, data)) return false;
+    format = data.empty() ? MD_FMT_RAW : DecodeStreamData(data);
+
+    auto decoded = std::make_shared<MdDecodedStream>();
+    decoded->format = format;
+    decoded->data = data;
+    m_streamCache.Insert(fullPath, decoded);
+    return true;
+}
+
+MdStreamCacheStats MDParser::GetStreamCacheStats() const {
+    return m_streamCache.GetStats();
+}
+
+void MDParser::SetStreamCacheBudget(size_t bytes) {
+    m_streamCache.SetBudget(bytes);
 }
 
 void MDParser::ReadStorage(IStorage* pStorage, std::vector<OLEEntry>& targetList, const std::wstring& parentPath) {
@@ -134,7 +1094,7 @@ void MDParser::ReadStorage(IStorage* pStorage, std::vector<OLEEntry>& targetList
     if (FAILED(pStorage->EnumElements(0, NULL, 0, &pEnum))) return;
 
     STATSTG stat;
-    while (pEnum->Next(1, &stat, NULL) == S_OK) {
+    while (!LoadCancelled() && pEnum->Next(1, &stat, NULL) == S_OK) {
         OLEEntry entry;
         entry.name = stat.pwcsName;
         entry.size = stat.cbSize.LowPart;
@@ -165,141 +1125,571 @@ void MDParser::ReadStorage(IStorage* pStorage, std::vector<OLEEntry>& targetList
 // ПАРСИНГ СТРУКТУРЫ
 // ============================================================================
 
+void MDParser::ReleaseTreeMemory(size_t nodes, size_t nodeBytes, size_t stringBytes) {
+    m_memory.nodes -= (std::min)(nodes, m_memory.nodes);
+    ReleaseMemory(m_memory.nodeBytes, nodeBytes);
+    ReleaseMemory(m_memory.stringBytes, stringBytes);
+}
+
+// Освобождает дерево и карты анализа вместе с их учётом
+void MDParser::DropMetadata() {
+    root.reset();
+    m_editRoot.reset();
+    objectIndex.clear();
+    m_idToType.clear();
+    m_fieldToRef.clear();
+    m_refIndex.Clear();
+    m_model.reset();
+    ReleaseTreeMemory(m_memory.nodes, m_memory.nodeBytes, m_memory.stringBytes);
+    ReleaseMemory(m_memory.indexBytes, m_memory.indexBytes);
+}
+
 void MDParser::SkipWhitespace(const char*& ptr) { 
     while (*ptr && (unsigned char)*ptr <= 32) ptr++; 
 }
 
-std::shared_ptr<MdNode> MDParser::ParseString(const char*& ptr) {
-    SkipWhitespace(ptr); 
+// Присваивание строке с подсчётом выделений: буфер сменился - выделение
+static inline void AssignCounted(std::string& s, const char* begin, const char* end, size_t& allocs) {
+    size_t capacity = s.capacity();
+    s.assign(begin, end);
+    if (s.capacity() != capacity) allocs++;
+}
 
+std::shared_ptr<MdNode> MDParser::ParseString(const char*& ptr) {
     auto node = std::make_shared<MdNode>();
+    m_treeAllocs++; // узел и счётчик ссылок - одним блоком
+
+    const char* wsStart = ptr;
+    SkipWhitespace(ptr); 
+    if (ptr != wsStart) AssignCounted(node->wsBefore, wsStart, ptr, m_treeAllocs);
     
     if (*ptr == '{') {
+        node->kind = MD_LIST;
         ptr++; 
-        SkipWhitespace(ptr); 
+        
+        // Пустой список: пробелы внутри сохраняем в самом узле,
+        // иначе их заберёт первый потомок как wsBefore
+        const char* peek = ptr;
+        SkipWhitespace(peek);
+        if (*peek == '}' || !*peek) {
+            AssignCounted(node->wsClose, ptr, peek, m_treeAllocs);
+            ptr = peek;
+        }
         
         while (*ptr && *ptr != '}') {
             auto child = ParseString(ptr);
-            if (child) node->children.push_back(child);
 
+            wsStart = ptr;
             SkipWhitespace(ptr); 
+            if (ptr != wsStart) {
+                AssignCounted(child->wsAfter, wsStart, ptr, m_treeAllocs);
+                if (!ChargeMemory(m_memory.stringBytes, StringHeapBytes(child->wsAfter))) throw MdMemoryLimitExceeded();
+            }
             
             if (*ptr == ',') {
+                child->flags |= MD_FLAG_COMMA;
                 ptr++; 
             } else if (*ptr != '}') {
                 // Защита от зацикливания
             }
+            size_t capacity = node->children.capacity();
+            node->children.push_back(child);
+            if (node->children.capacity() != capacity) m_treeAllocs++;
         }
         if (*ptr == '}') ptr++; 
+        else node->flags |= MD_FLAG_UNCLOSED;
     } 
     else if (*ptr == '"') {
+        node->kind = MD_STRING;
         ptr++; 
-        std::string val;
-        while (*ptr) {
-            if (*ptr == '"') { 
-                if (*(ptr+1) == '"') { 
-                    val += '"'; 
-                    ptr += 2; 
-                } else { 
-                    ptr++; 
-                    break; 
-                } 
-            } else { 
-                val += *ptr++; 
-            }
+        // Значение копируется кусками между удвоенными кавычками
+        const char* start = ptr;
+        while (*ptr && *ptr != '"') ptr++;
+        AssignCounted(node->value, start, ptr, m_treeAllocs);
+        while (*ptr == '"' && ptr[1] == '"') {
+            start = ptr + 1; // одна кавычка из пары и текст до следующей
+            ptr += 2;
+            while (*ptr && *ptr != '"') ptr++;
+            size_t capacity = node->value.capacity();
+            node->value.append(start, ptr);
+            if (node->value.capacity() != capacity) m_treeAllocs++;
         }
-        node->value = val;
+        if (*ptr == '"') ptr++;
+        else node->flags |= MD_FLAG_UNCLOSED;
     } else {
         // Чтение чисел
-        std::string val;
-        while (*ptr && *ptr != ',' && *ptr != '}' && (unsigned char)*ptr > 32) {
-            val += *ptr++;
-        }
-        node->value = val;
+        node->kind = MD_NUMBER;
+        const char* start = ptr;
+        while (*ptr && *ptr != ',' && *ptr != '}' && (unsigned char)*ptr > 32) ptr++;
+        AssignCounted(node->value, start, ptr, m_treeAllocs);
     }
-    
+
+    // Учёт памяти и проверка предела - по каждому узлу
+    m_memory.nodes++;
+    if (!ChargeMemory(m_memory.nodeBytes, NodeBytes(*node)) ||
+        !ChargeMemory(m_memory.stringBytes, NodeStringBytes(*node))) throw MdMemoryLimitExceeded();
+    if (m_load && ++m_load->ticks % kLoadChunkNodes == 0) LoadCheckpoint(ptr);
     return node;
 }
 
-void MDParser::ScanContainer(std::shared_ptr<MdNode> objectNode, const std::string& typePrefix) {
-    if (objectNode->children.empty()) return;
-    
-    std::string objId = objectNode->children[0]->value;
+// ============================================================================
+// ОБРАТНАЯ ЗАПИСЬ (СЕРИАЛИЗАЦИЯ)
+// ============================================================================
+
+void MDParser::WriteNode(const MdNode* node, std::string& out) {
+    out += node->wsBefore;
+
+    if (node->kind == MD_LIST) {
+        out += '{';
+        if (node->children.empty()) out += node->wsClose;
+        for (auto& child : node->children) {
+            WriteNode(child.get(), out);
+            out += child->wsAfter;
+            if (child->flags & MD_FLAG_COMMA) out += ',';
+        }
+        if (!(node->flags & MD_FLAG_UNCLOSED)) out += '}';
+    }
+    else if (node->kind == MD_STRING) {
+        out += '"';
+        const std::string& val = node->value;
+        size_t start = 0, q;
+        // Кавычки внутри значения удваиваются, остальное копируется кусками
+        while ((q = val.find('"', start)) != std::string::npos) {
+            out.append(val, start, q - start + 1);
+            out += '"';
+            start = q + 1;
+        }
+        out.append(val, start, std::string::npos);
+        if (!(node->flags & MD_FLAG_UNCLOSED)) out += '"';
+    }
+    else {
+        out += node->value;
+    }
+}
+
+std::string MDParser::SerializeNode(const MdNode* node) {
+    std::string out;
+    if (!node) return out;
+    MD_PROFILE_SCOPE(MD_STAGE_SERIALIZE);
+    WriteNode(node, out);
+    return out;
+}
+
+// ============================================================================
+// АНАЛИЗ СТРУКТУРЫ: ТАБЛИЦА РАЗДЕЛОВ
+// ============================================================================
+//
+// Разделы корня и вложенные списки объектов распознаются по таблицам:
+// имя ищется один раз в хеш-таблице интернированных имён, дальше работает
+// обработчик вида раздела. Новый раздел - новая строка таблицы, проход
+// по дереву остаётся одним.
+
+// Вложенные списки объекта
+enum MdListBits {
+    MD_LIST_HEAD     = 0x01, // "Head Fields" - реквизиты шапки документа
+    MD_LIST_TABLE    = 0x02, // "Table Fields" - реквизиты табличной части
+    MD_LIST_PARAMS   = 0x04, // "Params" - реквизиты справочника и журнала расчётов
+    MD_LIST_PROPS    = 0x08, // "Props" - измерения регистра
+    MD_LIST_FIGURES  = 0x10, // "Figures" - ресурсы регистра
+    MD_LIST_FLDS     = 0x20, // "Flds" - реквизиты регистра
+    MD_LIST_ENUMVAL  = 0x40, // "EnumVal" - значения перечисления (объекты, не поля)
+    MD_LIST_FIELDS   = 0x3F  // списки полей со ссылкой в [7]
+};
+
+// Раскладка элементов раздела
+enum MdSectionLayout {
+    MD_SECTION_OBJECTS, // объекты {ID, Имя, Синоним, ..., {"Список", ...}, ...}
+    MD_SECTION_FIELDS   // поля {ID, Имя, Синоним, "", Тип, Длина, Точность, ID ссылки, ...}
+};
+
+struct MdSectionDef {
+    const char* name;
+    const char* prefix;     // тип элементов в m_idToType (NULL - не объекты)
+    MdSectionLayout layout;
+    unsigned lists;         // какие вложенные списки объекта разбирать (MD_LIST_*)
+    unsigned char model;    // вид в модели: MdObjectKind, для раздела полей - MdFieldList
+};
+
+static const MdSectionDef kSections[] = {
+    { "GenJrnlFldDef", NULL, MD_SECTION_FIELDS,  0, MD_FIELD_JOURNAL },                        // графы общего журнала
+    { "Consts",        "CN", MD_SECTION_FIELDS,  0, MD_FIELD_CONST },                          // константы
+    { "SbCnts",        "SC", MD_SECTION_OBJECTS, MD_LIST_PARAMS | MD_LIST_HEAD | MD_LIST_TABLE,
+                                                 MD_OBJ_CATALOG },                             // справочники
+    { "Registers",     "RG", MD_SECTION_OBJECTS, MD_LIST_PROPS | MD_LIST_FIGURES | MD_LIST_FLDS |
+                                                 MD_LIST_HEAD | MD_LIST_TABLE, MD_OBJ_REGISTER }, // регистры
+    { "Documents",     "DT", MD_SECTION_OBJECTS, MD_LIST_HEAD | MD_LIST_TABLE, MD_OBJ_DOCUMENT }, // документы
+    { "CJ",            "CJ", MD_SECTION_OBJECTS, MD_LIST_PARAMS, MD_OBJ_CALC_JOURNAL },        // журналы расчётов
+    { "EnumList",      "EN", MD_SECTION_OBJECTS, MD_LIST_ENUMVAL, MD_OBJ_ENUM },               // перечисления
+    { "Journalisters", "JR", MD_SECTION_OBJECTS, 0, MD_OBJ_JOURNAL },                          // журналы документов
+    { "DocSelRefObj",  "SR", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // графы отбора
+    { "DocNumDef",     "NM", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // нумераторы
+    { "ReportList",    "RP", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // отчёты
+    { "CalcVars",      "CV", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // обработки
+    { "Calendars",     "CL", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // календари
+    { "Algorithms",    "AL", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // виды расчёта
+    { "RecalcRules",   "RR", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // правила перерасчёта
+    { "Groups",        "GR", MD_SECTION_OBJECTS, 0, MD_OBJ_OTHER },                            // группы расчётов
+};
+
+static const struct { const char* name; unsigned bit; unsigned char field; } kLists[] = {
+    { "Head Fields",  MD_LIST_HEAD,    MD_FIELD_HEAD },
+    { "Table Fields", MD_LIST_TABLE,   MD_FIELD_TABLE },
+    { "Params",       MD_LIST_PARAMS,  MD_FIELD_PARAMS },
+    { "Props",        MD_LIST_PROPS,   MD_FIELD_PROPS },
+    { "Figures",      MD_LIST_FIGURES, MD_FIELD_FIGURES },
+    { "Flds",         MD_LIST_FLDS,    MD_FIELD_FLDS },
+    { "EnumVal",      MD_LIST_ENUMVAL, MD_FIELD_ENUMVAL },
+};
+
+// Тип значения перечисления
+static const char* const kEnumValuePrefix = "EV";
+
+// Интернированные имена: имя раздела или списка -> строка таблицы.
+// Таблицы строятся при первом обращении (инициализация static потокобезопасна)
+static const MdSectionDef* FindSectionDef(const std::string& name) {
+    static const std::unordered_map<std::string, const MdSectionDef*> table = []() {
+        std::unordered_map<std::string, const MdSectionDef*> t;
+        for (auto& def : kSections) t[def.name] = &def;
+        return t;
+    }();
+    auto it = table.find(name);
+    return it != table.end() ? it->second : NULL;
+}
+
+// Префиксов полтора десятка - поиск перебором
+const char* MdFindTypePrefix(const MdStrRef& prefix) {
+    auto same = [&](const char* s) { return s && strlen(s) == prefix.len && memcmp(s, prefix.data, prefix.len) == 0; };
+    for (auto& def : kSections) {
+        if (same(def.prefix)) return def.prefix;
+    }
+    return same(kEnumValuePrefix) ? kEnumValuePrefix : NULL;
+}
+
+static unsigned FindListBit(const std::string& name) {
+    static const std::unordered_map<std::string, unsigned> table = []() {
+        std::unordered_map<std::string, unsigned> t;
+        for (auto& list : kLists) t[list.name] = list.bit;
+        return t;
+    }();
+    auto it = table.find(name);
+    return it != table.end() ? it->second : 0;
+}
+
+// Список полей модели по биту списка
+static unsigned char ListField(unsigned bit) {
+    for (auto& list : kLists) {
+        if (list.bit == bit) return list.field;
+    }
+    return MD_FIELD_HEAD;
+}
+
+// Ссылка поля на тип, собранная проходом анализа (тип - значение узла дерева)
+struct MdRefEdge {
+    const std::string* target;
+    MdRefSource source; // индексы в names своей порции
+};
+
+// Объект раздела: узел {ID, ...} и его тип
+struct MdAnalyzeObject {
+    const std::shared_ptr<MdNode>* node;
+    const char* prefix;
+};
+
+// Порция анализа: диапазон элементов одного раздела
+struct MdAnalyzeTask {
+    const MdNode* section;
+    const MdSectionDef* def;
+    size_t begin, end;
+};
+
+// Частичный результат порции: строки - значения узлов дерева, без копий.
+// Порции заполняются независимо и сливаются в карты в порядке порций
+struct MdAnalyzePart {
+    std::vector<MdAnalyzeObject> objects;
+    std::vector<std::pair<const std::string*, const std::string*>> fieldRefs; // ID поля -> ID типа
+    std::vector<MdRefEdge> edges;
+    std::vector<const std::string*> names; // ID полей и владельцев для обратного индекса
+    MdObjectModel model;                   // объекты и поля порции (владельцы - индексы порции)
+};
+
+// Объектов раздела в одной порции
+static const size_t kAnalyzeChunk = 64;
+
+static const std::string kNoValue;
+
+// Значение узла в позиции pos (пусто, если его нет или там список)
+static inline const std::string& ValueAt(const MdNode* node, size_t pos) {
+    if (pos >= node->children.size()) return kNoValue;
+    const MdNode* child = node->children[pos].get();
+    return child->children.empty() ? child->value : kNoValue;
+}
+
+static MdTextSpan AddModelText(MdObjectModel& model, const std::string& value) {
+    MdTextSpan span = { (uint32_t)model.text.size(), (uint32_t)value.size() };
+    model.text += value;
+    return span;
+}
+
+// Поле в модель: {ID, Имя, Синоним, "", Тип, Длина, Точность, ID ссылки, ...}
+static void AddModelField(const MdNode* fieldNode, unsigned char list, uint32_t owner, MdObjectModel& model) {
+    MdFieldInfo field;
+    field.id = MdParseId(ValueAt(fieldNode, MD_POS_ID));
+    if (!field.id) return;
+    field.owner = owner;
+    field.refTarget = MdParseId(ValueAt(fieldNode, MD_POS_REF));
+    field.identifier = AddModelText(model, ValueAt(fieldNode, MD_POS_IDENTIFIER));
+    field.synonym = AddModelText(model, ValueAt(fieldNode, MD_POS_SYNONYM));
+    field.length = MdParseId(ValueAt(fieldNode, MD_POS_LENGTH));
+    field.precision = (uint16_t)MdParseId(ValueAt(fieldNode, MD_POS_PRECISION));
+    field.typeCode = list == MD_FIELD_ENUMVAL ? 0 : ValueAt(fieldNode, MD_POS_TYPE)[0];
+    field.list = list;
+    field.periodic = list == MD_FIELD_PARAMS && ValueAt(fieldNode, MD_POS_PERIODIC) == "1";
+    model.fields.push_back(field);
+}
+
+// Поля list->children[first..]: {ID, ..., [7] ID типа назначения}.
+// Имя поля пишется в names один раз, владельца - при первом его поле
+// (owner - индекс владельца в names или MD_REF_NO_OWNER, пока не записан).
+// Поля пишутся и в модель порции (modelOwner - индекс объекта модели)
+static void ScanFields(const MdNode* list, size_t first, const std::string* ownerId, uint32_t& owner,
+                       unsigned char fieldList, uint32_t modelOwner, MdAnalyzePart& part) {
+    for (size_t i = first; i < list->children.size(); ++i) {
+        const MdNode* fieldNode = list->children[i].get();
+        AddModelField(fieldNode, fieldList, modelOwner, part.model);
+        // Нет позиции - пустое значение: такие поля не ссылаются
+        const std::string& fId = ValueAt(fieldNode, MD_POS_ID);
+        const std::string& fRef = ValueAt(fieldNode, MD_POS_REF);
+        if (!fId.empty() && !fRef.empty() && fRef != "0") {
+            part.fieldRefs.push_back(std::make_pair(&fId, &fRef));
+            if (ownerId && owner == MD_REF_NO_OWNER) {
+                owner = (uint32_t)part.names.size();
+                part.names.push_back(ownerId);
+            }
+            MdRefEdge edge = { &fRef, { (uint32_t)part.names.size(), ownerId ? owner : MD_REF_NO_OWNER } };
+            part.names.push_back(&fId);
+            part.edges.push_back(edge);
+        }
+    }
+}
+
+// Элемент раздела - объект: {ID, ...}
+static void IndexObject(const std::shared_ptr<MdNode>& objectNode, const char* prefix, MdAnalyzePart& part) {
+    if (ValueAt(objectNode.get(), MD_POS_ID).empty()) return;
+    MdAnalyzeObject object = { &objectNode, prefix };
+    part.objects.push_back(object);
+}
+
+// Объект в модель; MD_MODEL_NONE - у объекта нет числового ID
+static uint32_t AddModelObject(const MdNode* objectNode, const MdSectionDef& def, MdObjectModel& model) {
+    MdObjectInfo object;
+    object.id = MdParseId(ValueAt(objectNode, MD_POS_ID));
+    if (!object.id) return MD_MODEL_NONE;
+    object.identifier = AddModelText(model, ValueAt(objectNode, MD_POS_IDENTIFIER));
+    object.synonym = AddModelText(model, ValueAt(objectNode, MD_POS_SYNONYM));
+    object.firstField = (uint32_t)model.fields.size();
+    object.fieldCount = 0;
+    object.prefix = def.prefix;
+    object.kind = def.model;
+    object.periodicity = 0;
+    if (def.model == MD_OBJ_REGISTER) {
+        const std::string& period = ValueAt(objectNode, MD_POS_PERIOD);
+        object.periodicity = (uint8_t)MdParseId(period);
+    }
+    model.objects.push_back(object);
+    return (uint32_t)model.objects.size() - 1;
+}
+
+static void ScanContainer(const std::shared_ptr<MdNode>& objectNode, const MdSectionDef& def, MdAnalyzePart& part) {
+    IndexObject(objectNode, def.prefix, part);
+    uint32_t modelOwner = AddModelObject(objectNode.get(), def, part.model);
+    if (!def.lists || objectNode->children.empty()) return;
+    const std::string& objId = ValueAt(objectNode.get(), MD_POS_ID);
     if (objId.empty()) return;
     
-    m_idToType[objId] = typePrefix;
-    objectIndex[objId] = objectNode; 
-    
+    uint32_t owner = MD_REF_NO_OWNER;
     for (auto& child : objectNode->children) {
         if (child->children.empty()) continue;
         
-        std::string secName = child->children[0]->value;
-        
-        if (secName == "Head Fields" || secName == "Table Fields") {
+        unsigned list = FindListBit(child->children[0]->value) & def.lists;
+        if (list & MD_LIST_FIELDS) {
+            ScanFields(child.get(), 1, &objId, owner, ListField(list), modelOwner, part);
+        } else if (list & MD_LIST_ENUMVAL) {
             for (size_t i = 1; i < child->children.size(); ++i) {
-                auto fieldNode = child->children[i];
-                if (fieldNode->children.size() > 7) {
-                    std::string fId = fieldNode->children[0]->value;
-                    std::string fRef = fieldNode->children[7]->value;
-                    
-                    if (!fId.empty() && !fRef.empty() && fRef != "0") {
-                        m_fieldToRef[fId] = fRef;
-                    }
-                }
+                IndexObject(child->children[i], kEnumValuePrefix, part);
+                AddModelField(child->children[i].get(), MD_FIELD_ENUMVAL, modelOwner, part.model);
             }
         }
     }
+    // Поля объекта в модели идут подряд - от firstField до конца списка
+    if (modelOwner != MD_MODEL_NONE) {
+        MdObjectInfo& object = part.model.objects[modelOwner];
+        object.fieldCount = (uint32_t)part.model.fields.size() - object.firstField;
+    }
+}
+
+static void RunAnalyzeTask(const MdAnalyzeTask& task, MdAnalyzePart& part) {
+    const MdSectionDef& def = *task.def;
+    if (def.layout == MD_SECTION_FIELDS) {
+        if (def.prefix) {
+            for (size_t i = task.begin; i < task.end; ++i) IndexObject(task.section->children[i], def.prefix, part);
+        }
+        uint32_t owner = MD_REF_NO_OWNER;
+        ScanFields(task.section, task.begin, NULL, owner, def.model, MD_MODEL_NONE, part);
+    } else {
+        for (size_t i = task.begin; i < task.end; ++i) ScanContainer(task.section->children[i], def, part);
+    }
+}
+
+// Проход по разделам корня. Разделы делятся на порции (раздел полей -
+// одна порция, объекты - по kAnalyzeChunk), порции разбираются на
+// m_analyzeThreads потоках в свои частичные результаты без общих данных.
+// Слияние идёт в порядке порций, поэтому результат не зависит от числа
+// потоков; карты и обратный индекс сливаются параллельно друг другу.
+// Карты дополняются (очищает их AnalyzeStructure), обратный индекс строится заново
+void MDParser::ScanSections() {
+    std::vector<MdAnalyzeTask> tasks;
+    for (auto& section : root->children) {
+        if (section->children.empty()) continue;
+        
+        const MdSectionDef* def = FindSectionDef(section->children[0]->value);
+        if (!def) continue;
+
+        size_t count = section->children.size();
+        size_t chunk = def->layout == MD_SECTION_FIELDS ? count : kAnalyzeChunk;
+        for (size_t begin = 1; begin < count; begin += chunk) {
+            MdAnalyzeTask task = { section.get(), def, begin, (std::min)(begin + chunk, count) };
+            tasks.push_back(task);
+        }
+    }
+
+    std::vector<MdAnalyzePart> parts(tasks.size());
+    ParallelFor(tasks.size(), m_analyzeThreads, [&](size_t i) { RunAnalyzeTask(tasks[i], parts[i]); });
+
+    // Каждая из пяти частей слияния пишет только в свою структуру
+    std::shared_ptr<MdObjectModel> model = std::make_shared<MdObjectModel>();
+    ParallelFor(5, m_analyzeThreads, [&](size_t what) {
+        switch (what) {
+        case 0:
+            for (auto& part : parts)
+                for (auto& object : part.objects) m_idToType[ValueAt(object.node->get(), MD_POS_ID)] = object.prefix;
+            break;
+        case 1:
+            for (auto& part : parts)
+                for (auto& object : part.objects) objectIndex[ValueAt(object.node->get(), MD_POS_ID)] = *object.node;
+            break;
+        case 2:
+            for (auto& part : parts)
+                for (auto& ref : part.fieldRefs) m_fieldToRef[*ref.first] = *ref.second;
+            break;
+        case 3:
+            BuildRefIndex(parts);
+            break;
+        default:
+            {
+                size_t objects = 0, fields = 0, text = 0;
+                for (auto& part : parts) {
+                    objects += part.model.objects.size();
+                    fields += part.model.fields.size();
+                    text += part.model.text.size();
+                }
+                model->objects.reserve(objects);
+                model->fields.reserve(fields);
+                model->text.reserve(text);
+            }
+            for (auto& part : parts) model->Append(part.model);
+            model->BuildIndex();
+            break;
+        }
+    });
+    // Новая модель, а не правка прежней: её могут читать опубликованные снимки
+    m_model = model;
 }
 
 void MDParser::AnalyzeStructure() {
     if (!root) return;
+    MD_PROFILE_SCOPE(MD_STAGE_ANALYZE);
     
     m_idToType.clear();
     m_fieldToRef.clear();
     objectIndex.clear();
+    ScanSections();
+}
 
-    for (auto& section : root->children) {
-        if (section->children.empty()) continue;
-        
-        std::string secType = section->children[0]->value;
-
-        if (secType == "Documents") {
-            for (size_t i = 1; i < section->children.size(); ++i) 
-                ScanContainer(section->children[i], "DT");
-        }
-        else if (secType == "SbCnts") {
-             for (size_t i = 1; i < section->children.size(); ++i) 
-                ScanContainer(section->children[i], "SC");
-        }
-        else if (secType == "Registers") {
-             for (size_t i = 1; i < section->children.size(); ++i) 
-                ScanContainer(section->children[i], "RG");
-        }
-        else if (secType == "GenJrnlFldDef") {
-             for (size_t i = 1; i < section->children.size(); ++i) {
-                 auto fieldNode = section->children[i];
-                 if (fieldNode->children.size() > 7) {
-                    std::string fId = fieldNode->children[0]->value;
-                    std::string fRef = fieldNode->children[7]->value;
-                    if (!fId.empty() && !fRef.empty() && fRef != "0") {
-                        m_fieldToRef[fId] = fRef;
-                    }
-                 }
-             }
+void MDParser::SetAnalyzeThreads(unsigned threads) {
+    m_analyzeThreads = threads;
+}
+
+// ============================================================================
+// ОБРАТНЫЙ ИНДЕКС ССЫЛОК
+// ============================================================================
+
+size_t MdRefIndex::Find(const std::string& target, const MdRefSource*& begin) const {
+    begin = NULL;
+    auto it = std::lower_bound(targets.begin(), targets.end(), target);
+    if (it == targets.end() || *it != target) return 0;
+    size_t row = (size_t)(it - targets.begin());
+    begin = sources.data() + offsets[row];
+    return offsets[row + 1] - offsets[row];
+}
+
+void MdRefIndex::Clear() {
+    targets.clear();
+    offsets.clear();
+    sources.clear();
+    names.clear();
+}
+
+// Таблицы строк порций склеиваются со сдвигом индексов, рёбра раскладываются
+// построчно по типу назначения. Сортировка устойчивая: внутри строки поля идут
+// в порядке обхода, сгруппированные по владельцу
+void MDParser::BuildRefIndex(std::vector<MdAnalyzePart>& parts) {
+    m_refIndex.Clear();
+    size_t edgeCount = 0, nameCount = 0;
+    for (auto& part : parts) {
+        edgeCount += part.edges.size();
+        nameCount += part.names.size();
+    }
+
+    std::vector<MdRefEdge> edges;
+    edges.reserve(edgeCount);
+    m_refIndex.names.reserve(nameCount);
+    for (auto& part : parts) {
+        uint32_t base = (uint32_t)m_refIndex.names.size();
+        for (auto name : part.names) m_refIndex.names.push_back(*name);
+        for (auto edge : part.edges) {
+            edge.source.field += base;
+            if (edge.source.owner != MD_REF_NO_OWNER) edge.source.owner += base;
+            edges.push_back(edge);
+        }
+    }
+
+    std::stable_sort(edges.begin(), edges.end(), [](const MdRefEdge& a, const MdRefEdge& b) {
+        return *a.target < *b.target;
+    });
+
+    m_refIndex.sources.reserve(edges.size());
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (i == 0 || *edges[i].target != *edges[i - 1].target) {
+            m_refIndex.targets.push_back(*edges[i].target);
+            m_refIndex.offsets.push_back((uint32_t)i);
         }
+        m_refIndex.sources.push_back(edges[i].source);
     }
+    m_refIndex.offsets.push_back((uint32_t)edges.size());
 }
 
 // Публичный метод для дампа узла
 std::wstring MDParser::DumpNodeToText(const MdNode* node) {
     if (!node) return L"";
+    MD_PROFILE_SCOPE(MD_STAGE_DUMP);
     std::wstringstream ss;
     DumpTreeToString(node, 0, ss);
     return ss.str();
 }
 
-// Рекурсивный вывод дерева (внутренний)
-void MDParser::DumpTreeToString(const MdNode* node, int level, std::wstringstream& ss) {
+// Рекурсивный вывод дерева по картам анализа (общий для парсера и снимка MdConfig)
+void DumpMdTree(const MdNode* node, int level, const std::map<std::string, std::string>& idToType,
+                const std::map<std::string, std::string>& fieldToRef, std::wstringstream& ss) {
     if (!node) return;
 
     for(int i=0; i<level; ++i) ss << L"  ";
@@ -317,17 +1707,17 @@ void MDParser::DumpTreeToString(const MdNode* node, int level, std::wstringstrea
     }
 
     if (!node->value.empty()) {
-        auto itType = m_idToType.find(node->value);
-        if (itType != m_idToType.end()) {
+        auto itType = idToType.find(node->value);
+        if (itType != idToType.end()) {
             std::wstring wType(itType->second.begin(), itType->second.end());
             ss << L" // Объект: " << wType;
         }
-        auto itRef = m_fieldToRef.find(node->value);
-        if (itRef != m_fieldToRef.end()) {
+        auto itRef = fieldToRef.find(node->value);
+        if (itRef != fieldToRef.end()) {
             std::wstring wRef(itRef->second.begin(), itRef->second.end());
             ss << L" // Ссылка на тип: " << wRef;
-            auto itRefType = m_idToType.find(itRef->second);
-            if (itRefType != m_idToType.end()) {
+            auto itRefType = idToType.find(itRef->second);
+            if (itRefType != idToType.end()) {
                 std::wstring wRefType(itRefType->second.begin(), itRefType->second.end());
                 ss << L" (" << wRefType << L")";
             }
@@ -337,29 +1727,31 @@ void MDParser::DumpTreeToString(const MdNode* node, int level, std::wstringstrea
     ss << L"\r\n";
 
     for (auto& child : node->children) {
-        DumpTreeToString(child.get(), level + 1, ss);
+        DumpMdTree(child.get(), level + 1, idToType, fieldToRef, ss);
     }
 }
 
+// Рекурсивный вывод дерева (внутренний)
+void MDParser::DumpTreeToString(const MdNode* node, int level, std::wstringstream& ss) {
+    DumpMdTree(node, level, m_idToType, m_fieldToRef, ss);
+}
+
 // ============================================================================
 // ЧТЕНИЕ ПОТОКА И ИНТЕГРАЦИЯ
 // ============================================================================
 
-std::wstring MDParser::ReadStreamText(const std::wstring& fullPath) {
-    if (fullPath.empty() || currentFilePath.empty()) return L"";
-
+bool ReadContainerStream(const std::wstring& filePath, const std::wstring& fullPath, size_t maxSize,
+                         std::vector<char>& data, std::wstring& error) {
+    data.clear();
     std::vector<IStorage*> storageStack;
     IStorage* pRoot = NULL;
     
-    HRESULT hr = StgOpenStorage(currentFilePath.c_str(), NULL, 
-        STGM_READ | STGM_SHARE_DENY_NONE | STGM_DIRECT, NULL, 0, &pRoot);
-    
+    HRESULT hr = OpenContainer(filePath, &pRoot);
+
     if (FAILED(hr)) {
-        hr = StgOpenStorage(currentFilePath.c_str(), NULL, 
-            STGM_READ | STGM_SHARE_DENY_NONE | STGM_TRANSACTED, NULL, 0, &pRoot);
+        error = L"Ошибка: Не удалось открыть файл-контейнер";
+        return false;
     }
-
-    if (FAILED(hr)) return L"Ошибка: Не удалось открыть файл-контейнер";
     storageStack.push_back(pRoot);
 
     std::wstring path = fullPath;
@@ -376,7 +1768,8 @@ std::wstring MDParser::ReadStreamText(const std::wstring& fullPath) {
         
         if (FAILED(hr)) {
             for (auto s : storageStack) s->Release();
-            return L"Ошибка: Не удалось открыть папку [" + folderName + L"]";
+            error = L"Ошибка: Не удалось открыть папку [" + folderName + L"]";
+            return false;
         }
         currStorage = nextStorage;
         storageStack.push_back(currStorage);
@@ -388,99 +1781,375 @@ std::wstring MDParser::ReadStreamText(const std::wstring& fullPath) {
     
     if (FAILED(hr)) {
         for (auto s : storageStack) s->Release();
-        return L"Ошибка открытия потока";
+        error = L"Ошибка открытия потока";
+        return false;
     }
 
-    std::wstring resultText = L"";
+    bool ok = false;
     STATSTG stat;
     hr = pStream->Stat(&stat, STATFLAG_NONAME);
     
     if (SUCCEEDED(hr)) {
         ULONG size = stat.cbSize.LowPart;
-        if (size > 0) {
-            std::vector<char> rawData(size);
+        if (size > maxSize) {
+            error = L"Поток больше свободной памяти в пределах лимита: " + fullPath;
+        } else if (size > 0) {
+            data.resize(size);
             ULONG bytesRead = 0;
-            hr = pStream->Read(rawData.data(), size, &bytesRead);
+            hr = pStream->Read(data.data(), size, &bytesRead);
             
             if (SUCCEEDED(hr) && bytesRead > 0) {
-                if (bytesRead < size) rawData.resize(bytesRead);
+                if (bytesRead < size) data.resize(bytesRead);
+                ok = true;
+            } else { 
+                data.clear();
+                error = L"Ошибка чтения (Read)"; 
+            }
+        } else { ok = true; }
+    } else { error = L"Ошибка получения размера (Stat)"; }
 
-                bool readyToParse = false;
-                
-                // 1. ZLib?
-                if (IsZlib(rawData)) {
-                    if (TryDecompress(rawData)) readyToParse = true;
-                }
-                // 2. ZLib + Offset 8?
-                if (!readyToParse && rawData.size() > 8) {
-                    std::vector<char> copyOffset(rawData.begin() + 8, rawData.end());
-                    if (IsZlib(copyOffset)) {
-                        if (TryDecompress(copyOffset)) {
-                            rawData = copyOffset;
-                            readyToParse = true;
-                        }
-                    }
-                }
-                // 3. Encrypted?
-                if (!readyToParse && rawData.size() > 8 && 
-                    (unsigned char)rawData[0] == 0x25 && (unsigned char)rawData[1] == 0x77) {
-                    std::vector<char> copyEnc = rawData;
-                    ApplyDecrypt(copyEnc, ""); 
-                    if (IsZlib(copyEnc)) {
-                        if (TryDecompress(copyEnc)) {
-                            rawData = copyEnc;
-                            readyToParse = true;
-                        }
-                    }
-                }
-                // 4. Pure Text?
-                if (!readyToParse && FindTextBrace(rawData) != -1) {
-                    readyToParse = true;
-                }
+    pStream->Release();
+    for (int i = (int)storageStack.size() - 1; i >= 0; --i) storageStack[i]->Release();
+    return ok;
+}
+
+bool MDParser::ReadRawStream(const std::wstring& fullPath, std::vector<char>& data) {
+    data.clear();
+    if (fullPath.empty() || currentFilePath.empty()) {
+        lastError = L"Ошибка: файл не открыт";
+        return false;
+    }
+    MD_PROFILE_SCOPE(MD_STAGE_READ);
+
+    bool ok = ReadContainerStream(currentFilePath, fullPath, MemoryHeadroom(), data, lastError);
+    if (ok) {
+        MdProfileCount(MD_CNT_STREAMS_READ);
+        MdProfileCount(MD_CNT_BYTES_READ, data.size());
+    }
+    return ok;
+}
+
+std::wstring MDParser::ReadStreamText(const std::wstring& fullPath) {
+    if (fullPath.empty() || currentFilePath.empty()) return L"";
+
+    std::vector<char> rawData;
+    MdStreamFormat format;
+    if (!GetDecodedStream(fullPath, rawData, format)) return lastError;
+    if (rawData.empty()) return L"<Пустой поток>";
+
+    std::wstring resultText = L"";
+
+    if (format != MD_FMT_RAW) {
+        // Если это поток метаданных, строим временное дерево (загруженное не трогаем)
+        if (fullPath.find(L"Main MetaData Stream") != std::wstring::npos) {
+            int bracePos = FindTextBrace(rawData);
+            if (bracePos == -1) return L"Ошибка: данные распакованы, но не найден корневой элемент '{'";
+
+            rawData.push_back('\0');
+            const char* ptr = rawData.data() + bracePos;
+            MdMemoryStats before = m_memory;
+            std::shared_ptr<MdNode> tree;
+            if (ParseDetached(ptr, tree)) {
+                MD_PROFILE_SCOPE(MD_STAGE_DUMP);
+                std::wstringstream ss;
+                ss << L"=== СТРУКТУРА МЕТАДАННЫХ (PARSED) ===\r\n";
+                DumpTreeToString(tree.get(), 0, ss);
+                resultText = ss.str();
+            } else {
+                resultText = lastError;
+            }
+            ReleaseDetached(tree, before);
+        } else {
+            // Для остальных потоков
+            int wlen = MultiByteToWideChar(1251, 0, rawData.data(), (int)rawData.size(), NULL, 0);
+            if (wlen > 0) {
+                resultText.resize(wlen);
+                MultiByteToWideChar(1251, 0, rawData.data(), (int)rawData.size(), &resultText[0], wlen);
+            }
+        }
+    } else {
+        std::wstringstream ss;
+        ss << L"Неизвестный формат данных (RAW).\r\nHEX: ";
+        size_t dumpLen = (std::min)((size_t)32, rawData.size());
+        for (size_t i = 0; i < dumpLen; ++i) 
+             ss << std::hex << std::setw(2) << std::setfill(L'0') << (unsigned char)rawData[i] << L" ";
+        resultText = ss.str();
+    }
+
+    return resultText;
+}
+
+// Разбор во временное дерево: root и карты анализа не меняются. Дерево
+// входит в пик памяти, пока не снято с учёта ReleaseDetached
+bool MDParser::ParseDetached(const char*& ptr, std::shared_ptr<MdNode>& tree) {
+    try {
+        m_treeAllocs = 0;
+        tree = ParseString(ptr);
+        MdProfileCount(MD_CNT_TREE_ALLOCS, m_treeAllocs);
+        return true;
+    } catch (const MdMemoryLimitExceeded&) {
+    } catch (...) {
+        lastError = L"Ошибка парсинга структуры";
+    }
+    tree.reset();
+    return false;
+}
+
+void MDParser::ReleaseDetached(std::shared_ptr<MdNode>& tree, const MdMemoryStats& before) {
+    tree.reset();
+    ReleaseTreeMemory(m_memory.nodes - before.nodes, m_memory.nodeBytes - before.nodeBytes,
+                      m_memory.stringBytes - before.stringBytes);
+}
+
+bool MDParser::VerifyRoundTrip(const std::wstring& fullPath) {
+    std::vector<char> data;
+    if (!ReadRawStream(fullPath, data)) return false;
+    if (DecodeStreamData(data) == MD_FMT_RAW) {
+        lastError = L"Поток не является текстом 1С";
+        return false;
+    }
+
+    int bracePos = FindTextBrace(data);
+    if (bracePos == -1) {
+        lastError = L"Не найден корневой элемент '{'";
+        return false;
+    }
+
+    data.push_back('\0');
+    const char* begin = data.data() + bracePos;
+    const char* ptr = begin;
+    MdMemoryStats before = m_memory;
+    std::shared_ptr<MdNode> tree;
+    bool parsed = ParseDetached(ptr, tree);
+
+    // Сравниваем с тем участком исходника, который поглотил парсер
+    size_t parsedLen = (size_t)(ptr - begin);
+    std::string out;
+    if (parsed) {
+        out.reserve(parsedLen);
+        WriteNode(tree.get(), out);
+    }
+    ReleaseDetached(tree, before);
+    if (!parsed) return false;
+
+    if (out.size() == parsedLen && memcmp(out.data(), begin, parsedLen) == 0) return true;
+
+    size_t diffPos = 0;
+    size_t common = (std::min)(out.size(), parsedLen);
+    while (diffPos < common && out[diffPos] == begin[diffPos]) ++diffPos;
+    lastError = L"Расхождение при обратной записи, смещение " + std::to_wstring(bracePos + diffPos) + 
+        L" (исходник " + std::to_wstring(parsedLen) + L" байт, запись " + std::to_wstring(out.size()) + L" байт)";
+    return false;
+}
 
-                if (readyToParse) {
-                    // Если это поток метаданных, строим дерево
-                    if (fullPath.find(L"Main MetaData Stream") != std::wstring::npos) {
-                        int bracePos = FindTextBrace(rawData);
-                        if (bracePos != -1) {
-                            const char* ptr = rawData.data() + bracePos;
-                            try {
-                                root = ParseString(ptr);
-                                AnalyzeStructure(); 
-                                
-                                std::wstringstream ss;
-                                ss << L"=== СТРУКТУРА МЕТАДАННЫХ (PARSED) ===\r\n";
-                                DumpTreeToString(root.get(), 0, ss);
-                                resultText = ss.str();
-                            } catch (...) {
-                                resultText = L"Ошибка парсинга структуры";
-                            }
-                        } else {
-                             resultText = L"Ошибка: данные распакованы, но не найден корневой элемент '{'";
-                        }
-                    } else {
-                        // Для остальных потоков
-                        int wlen = MultiByteToWideChar(1251, 0, rawData.data(), (int)rawData.size(), NULL, 0);
-                        if (wlen > 0) {
-                            resultText.resize(wlen);
-                            MultiByteToWideChar(1251, 0, rawData.data(), (int)rawData.size(), &resultText[0], wlen);
-                        }
+
+// ============================================================================
+// ЗАПИСЬ КОНТЕЙНЕРА
+// ============================================================================
+
+void MDParser::SetStreamData(const std::wstring& fullPath, const std::vector<char>& data) {
+    m_pendingStreams[fullPath] = data;
+    m_streamCache.Erase(fullPath);
+}
+
+static std::shared_ptr<MdNode> CloneTree(const MdNode* node) {
+    auto copy = std::make_shared<MdNode>();
+    copy->value = node->value;
+    copy->kind = node->kind;
+    copy->flags = node->flags;
+    copy->wsBefore = node->wsBefore;
+    copy->wsAfter = node->wsAfter;
+    copy->wsClose = node->wsClose;
+    copy->children.reserve(node->children.size());
+    for (auto& child : node->children) copy->children.push_back(CloneTree(child.get()));
+    return copy;
+}
+
+std::shared_ptr<MdNode> MDParser::EditMetadata() {
+    EnsureMetadata();
+    if (!m_editRoot && root) {
+        m_editRoot = CloneTree(root.get());
+        ChargeTreeMemory(m_editRoot.get());
+    }
+    return m_editRoot;
+}
+
+bool MDParser::CommitMetadata() {
+    EnsureMetadata();
+    if (!root) {
+        lastError = L"Дерево метаданных не загружено";
+        return false;
+    }
+    const MdNode* tree = m_editRoot ? m_editRoot.get() : root.get();
+    std::string text = m_metaPrefix;
+    WriteNode(tree, text);
+    text += m_metaSuffix;
+    SetStreamData(kMetaStreamPath, std::vector<char>(text.begin(), text.end()));
+    if (!m_editRoot) return true;
+
+    // Прежнее дерево остаётся у опубликованных снимков; дальнейшая правка -
+    // через новую копию, иначе она менялась бы у только что опубликованного
+    root = m_editRoot;
+    m_editRoot.reset();
+    ReleaseTreeMemory(m_memory.nodes, m_memory.nodeBytes, m_memory.stringBytes);
+    ChargeTreeMemory(root.get());
+    AnalyzeMetadata();
+    return true;
+}
+
+bool MDParser::CopyStorage(IStorage* pSrc, IStorage* pDst, const std::wstring& parentPath,
+                           const std::map<std::wstring, std::vector<char>>& encoded) {
+    IEnumSTATSTG* pEnum = NULL;
+    if (FAILED(pSrc->EnumElements(0, NULL, 0, &pEnum))) {
+        lastError = L"Ошибка перечисления [" + parentPath + L"]";
+        return false;
+    }
+
+    bool ok = true;
+    STATSTG stat;
+    while (ok && pEnum->Next(1, &stat, NULL) == S_OK) {
+        std::wstring name = stat.pwcsName;
+        std::wstring fullPath = parentPath.empty() ? name : parentPath + L"\\" + name;
+        CoTaskMemFree(stat.pwcsName);
+
+        if (stat.type == STGTY_STORAGE) {
+            IStorage* pSrcSub = NULL;
+            IStorage* pDstSub = NULL;
+            if (pSrc->OpenStorage(name.c_str(), NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &pSrcSub) == S_OK &&
+                pDst->CreateStorage(name.c_str(), STGM_CREATE | STGM_READWRITE | STGM_SHARE_EXCLUSIVE, 0, 0, &pDstSub) == S_OK) {
+                pDstSub->SetClass(stat.clsid);
+                ok = CopyStorage(pSrcSub, pDstSub, fullPath, encoded);
+            } else {
+                lastError = L"Ошибка копирования папки [" + fullPath + L"]";
+                ok = false;
+            }
+            if (pDstSub) pDstSub->Release();
+            if (pSrcSub) pSrcSub->Release();
+        }
+        else if (stat.type == STGTY_STREAM) {
+            IStream* pDstStream = NULL;
+            if (FAILED(pDst->CreateStream(name.c_str(), STGM_CREATE | STGM_WRITE | STGM_SHARE_EXCLUSIVE, 0, 0, &pDstStream))) {
+                lastError = L"Ошибка создания потока [" + fullPath + L"]";
+                ok = false;
+                break;
+            }
+
+            auto it = encoded.find(fullPath);
+            if (it != encoded.end()) {
+                // Изменённый поток: уже закодирован
+                ULONG written = 0;
+                if (!it->second.empty() &&
+                    FAILED(pDstStream->Write(it->second.data(), (ULONG)it->second.size(), &written))) {
+                    lastError = L"Ошибка записи потока [" + fullPath + L"]";
+                    ok = false;
+                }
+            } else {
+                // Нетронутый поток: копируем байты без перекодирования
+                IStream* pSrcStream = NULL;
+                if (SUCCEEDED(pSrc->OpenStream(name.c_str(), NULL, STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &pSrcStream))) {
+                    if (FAILED(pSrcStream->CopyTo(pDstStream, stat.cbSize, NULL, NULL))) {
+                        lastError = L"Ошибка копирования потока [" + fullPath + L"]";
+                        ok = false;
                     }
+                    pSrcStream->Release();
                 } else {
-                    std::wstringstream ss;
-                    ss << L"Неизвестный формат данных (RAW).\r\nHEX: ";
-                    size_t dumpLen = (std::min)((size_t)32, rawData.size());
-                    for (size_t i = 0; i < dumpLen; ++i) 
-                         ss << std::hex << std::setw(2) << std::setfill(L'0') << (unsigned char)rawData[i] << L" ";
-                    resultText = ss.str();
+                    lastError = L"Ошибка открытия потока [" + fullPath + L"]";
+                    ok = false;
                 }
+            }
+            pDstStream->Release();
+        }
+    }
+    pEnum->Release();
+    return ok;
+}
 
-            } else { resultText = L"Ошибка чтения (Read)"; }
-        } else { resultText = L"<Пустой поток>"; }
-    } else { resultText = L"Ошибка получения размера (Stat)"; }
+bool MDParser::SaveAs(const std::wstring& outPath, const MdRepackOptions& options) {
+    if (currentFilePath.empty()) {
+        lastError = L"Ошибка: файл не открыт";
+        return false;
+    }
 
-    pStream->Release();
-    for (int i = (int)storageStack.size() - 1; i >= 0; --i) storageStack[i]->Release();
+    // 1. Исходные байты изменённых потоков (нужны для определения формата)
+    struct EncodeJob {
+        const std::wstring* path;
+        const std::vector<char>* plain;
+        std::vector<char> original;
+        std::vector<char> encoded;
+        bool ok;
+    };
+    std::vector<EncodeJob> jobs;
+    jobs.reserve(m_pendingStreams.size());
+    for (auto& pending : m_pendingStreams) {
+        EncodeJob job;
+        job.path = &pending.first;
+        job.plain = &pending.second;
+        job.ok = false;
+        if (!ReadRawStream(pending.first, job.original)) {
+            lastError = L"Изменённый поток не найден в контейнере [" + pending.first + L"]";
+            return false;
+        }
+        jobs.push_back(std::move(job));
+    }
 
-    return resultText;
+    // 2. Сжатие/шифрование изменённых потоков параллельно
+    ParallelFor(jobs.size(), options.threads, [&](size_t i) {
+        EncodeJob& job = jobs[i];
+        try {
+            job.ok = EncodeStreamData(*job.plain, job.original, options.level, options.encrypt, job.encoded);
+        } catch (...) {
+            job.ok = false;
+        }
+        job.original.clear();
+        job.original.shrink_to_fit();
+    });
+
+    std::map<std::wstring, std::vector<char>> encoded;
+    for (auto& job : jobs) {
+        if (!job.ok) {
+            lastError = L"Ошибка сжатия потока [" + *job.path + L"]";
+            return false;
+        }
+        encoded[*job.path].swap(job.encoded);
+    }
+
+    // 3. Запись контейнера. При записи поверх исходного файла пишем во временный.
+    bool inPlace = _wcsicmp(outPath.c_str(), currentFilePath.c_str()) == 0;
+    std::wstring targetPath = inPlace ? outPath + L".tmp" : outPath;
+
+    IStorage* pSrcRoot = NULL;
+    HRESULT hr = OpenContainer(currentFilePath, &pSrcRoot);
+    if (FAILED(hr)) {
+        lastError = L"Ошибка: Не удалось открыть файл-контейнер";
+        return false;
+    }
+
+    IStorage* pDstRoot = NULL;
+    hr = StgCreateDocfile(targetPath.c_str(), 
+        STGM_CREATE | STGM_READWRITE | STGM_SHARE_EXCLUSIVE | STGM_DIRECT, 0, &pDstRoot);
+    if (FAILED(hr)) {
+        pSrcRoot->Release();
+        lastError = L"Не удалось создать файл. Код ошибки: " + std::to_wstring((long)hr);
+        return false;
+    }
+
+    STATSTG rootStat;
+    if (SUCCEEDED(pSrcRoot->Stat(&rootStat, STATFLAG_NONAME))) pDstRoot->SetClass(rootStat.clsid);
+
+    bool ok = CopyStorage(pSrcRoot, pDstRoot, L"", encoded);
+    if (ok) pDstRoot->Commit(STGC_DEFAULT);
+
+    pDstRoot->Release();
+    pSrcRoot->Release();
+
+    if (!ok) {
+        DeleteFileW(targetPath.c_str());
+        return false;
+    }
+    if (inPlace && !MoveFileExW(targetPath.c_str(), outPath.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        lastError = L"Не удалось заменить исходный файл";
+        DeleteFileW(targetPath.c_str());
+        return false;
+    }
+    return true;
 }
\ No newline at end of file
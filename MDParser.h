@@ -7,19 +7,204 @@
  
 #pragma once
 #include <windows.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
 #include <memory>
+#include <atomic>
+#include <thread>
+#include <functional>
 #include <ole2.h>
 #include <sstream>
 
+// Вид узла в исходном тексте
+enum MdNodeKind : unsigned char {
+    MD_LIST   = 0, // {...}
+    MD_STRING = 1, // "..." (кавычки внутри удвоены)
+    MD_NUMBER = 2  // значение без кавычек (числа и прочие токены)
+};
+
+// Флаги форматирования узла
+enum MdNodeFlags : unsigned char {
+    MD_FLAG_COMMA    = 0x01, // после узла в родителе стоит ','
+    MD_FLAG_UNCLOSED = 0x02  // нет закрывающей '}' или '"' (текст оборван)
+};
+
 // Структура узла метаданных (дерево)
 struct MdNode {
     std::string value; // Значение узла (в кодировке 1251)
     std::vector<std::shared_ptr<MdNode>> children;
+
+    // Исходное форматирование (для побайтовой обратной записи)
+    MdNodeKind kind = MD_LIST;
+    unsigned char flags = 0;
+    std::string wsBefore; // пробелы перед токеном
+    std::string wsAfter;  // пробелы после токена (до ',' или '}')
+    std::string wsClose;  // пробелы внутри пустого списка "{ }"
+};
+
+// Число узлов в поддереве (включая сам узел)
+size_t CountNodes(const MdNode* node);
+
+// Формат потока, определённый при декодировании
+enum MdStreamFormat {
+    MD_FMT_RAW = 0,      // неизвестный формат (бинарные данные)
+    MD_FMT_TEXT,         // чистый текст
+    MD_FMT_ZLIB,         // ZLib
+    MD_FMT_ZLIB_OFFSET8, // ZLib после 8-байтового заголовка
+    MD_FMT_ENCRYPTED     // %w + XOR, внутри ZLib
+};
+
+// Порция распаковки готова: produced - байт результата на этот момент.
+// false - прервать распаковку (данные остаются как были)
+typedef std::function<bool(size_t produced)> MdDecodeChunkFn;
+
+// Хелперы декодирования потоков (MDParser.cpp)
+bool IsZlib(const std::vector<char>& data);
+bool TryDecompress(std::vector<char>& data);
+// Распаковка порциями примерно по 1 МБ с вызовом onChunk после каждой
+bool TryDecompress(std::vector<char>& data, const MdDecodeChunkFn& onChunk);
+void ApplyDecrypt(std::vector<char>& data, const std::string& pass);
+int FindTextBrace(const std::vector<char>& data);
+// Определяет формат и распаковывает данные на месте
+MdStreamFormat DecodeStreamData(std::vector<char>& data);
+MdStreamFormat DecodeStreamData(std::vector<char>& data, const MdDecodeChunkFn& onChunk);
+
+// Читает поток контейнера filePath без декодирования. Контейнер открывается на
+// время вызова (COM в потоке должен быть инициализирован); поток больше maxSize не читается
+bool ReadContainerStream(const std::wstring& filePath, const std::wstring& fullPath, size_t maxSize,
+                         std::vector<char>& data, std::wstring& error);
+
+// Хелперы кодирования потоков (обратная сторона декодирования)
+bool TryCompress(std::vector<char>& data, int level);
+void ApplyEncrypt(std::vector<char>& data, const std::vector<char>& header, const std::string& pass);
+// Определяет формат исходного потока по заголовку, без распаковки
+MdStreamFormat DetectStreamFormat(const std::vector<char>& raw);
+// Кодирует данные в формат исходного потока original
+bool EncodeStreamData(const std::vector<char>& plain, const std::vector<char>& original, 
+                      int level, bool encrypt, std::vector<char>& out);
+
+// Параметры пересборки контейнера (SaveAs)
+struct MdRepackOptions {
+    int level = 6;        // уровень сжатия ZLib (0..10)
+    unsigned threads = 0; // потоков для сжатия, 0 = по числу ядер
+    bool encrypt = true;  // сохранять %w-шифрование у зашифрованных потоков
+};
+
+// Параметры открытия контейнера
+struct MdOpenOptions {
+    bool prefetchAll = false;               // сразу декодировать все потоки (параллельно)
+    size_t memoryBudget = (size_t)256 << 20; // предел кеша декодированных потоков, байт
+    unsigned threads = 0;                    // потоков декодирования, 0 = по числу ядер
+};
+
+// Декодированный поток контейнера
+struct MdDecodedStream {
+    MdStreamFormat format;
+    std::vector<char> data;
+};
+
+// Статистика кеша декодированных потоков
+struct MdStreamCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t count;  // потоков в кеше
+    size_t bytes;  // их объём
+    size_t budget;
+};
+
+// Кеш декодированных потоков: ключ - fullPath, вытеснение давно не
+// использованных (LRU) при превышении бюджета в байтах
+class MdStreamCache {
+public:
+    explicit MdStreamCache(size_t budget);
+
+    // Найти поток (считает попадания/промахи, поднимает в начало очереди)
+    std::shared_ptr<const MdDecodedStream> Find(const std::wstring& key);
+    // Добавить; поток больше бюджета не кешируется
+    void Insert(const std::wstring& key, const std::shared_ptr<const MdDecodedStream>& value);
+    void Erase(const std::wstring& key);
+    void Clear();
+    // Вытеснить до объёма bytes, не меняя бюджет (уступить память загрузке)
+    void Trim(size_t bytes) { Evict(bytes); }
+
+    void SetBudget(size_t budget);
+    size_t Budget() const { return m_budget; }
+    size_t Bytes() const { return m_bytes; }
+    // Поместится ли ещё size байт без вытеснения
+    bool Fits(size_t size) const { return m_bytes + size <= m_budget; }
+    MdStreamCacheStats GetStats() const;
+
+private:
+    typedef std::list<std::pair<std::wstring, std::shared_ptr<const MdDecodedStream>>> LruList;
+
+    void Evict(size_t budget);
+
+    LruList m_lru; // начало - последний использованный
+    std::map<std::wstring, LruList::iterator> m_index;
+    size_t m_bytes;
+    size_t m_budget;
+    size_t m_hits, m_misses, m_evictions;
+};
+
+// Память загруженной конфигурации: оценка по размерам структур и буферов, байт
+struct MdMemoryStats {
+    size_t rawBytes;     // буферы прочитанных потоков (во время загрузки)
+    size_t decodedBytes; // декодированные потоки: буферы загрузки + кеш потоков
+    size_t nodes;        // узлов дерева метаданных
+    size_t nodeBytes;    // узлы: MdNode, блоки shared_ptr, векторы потомков
+    size_t stringBytes;  // значения и пробелы узлов вне встроенного буфера строк
+    size_t indexBytes;   // карты анализа (objectIndex, типы, ссылки, обратный индекс)
+    size_t oleBytes;     // дерево элементов контейнера (OLEEntry)
+    size_t total;        // сумма
+    size_t peak;         // максимум total с начала загрузки
+    size_t limit;        // жёсткий предел (0 - без предела)
+};
+
+// Фаза загрузки (Load, LoadAsync)
+enum MdLoadPhase {
+    MD_LOAD_OPEN = 0, // открытие контейнера и обход структуры (или кеш разбора)
+    MD_LOAD_READ,     // чтение потока метаданных
+    MD_LOAD_DECODE,   // расшифровка и распаковка
+    MD_LOAD_PARSE,    // разбор текста
+    MD_LOAD_ANALYZE,  // карты типов и ссылок
+    MD_LOAD_DONE
+};
+
+// Ход загрузки
+struct MdLoadProgress {
+    MdLoadPhase phase;
+    unsigned long long rawBytes;     // поток метаданных в контейнере
+    unsigned long long decodedBytes; // распаковано на текущий момент
+    unsigned long long textBytes;    // текст для разбора (известен с начала разбора)
+    unsigned long long parsedBytes;  // разобрано
+    size_t nodes;                    // узлов построено
+};
+
+// Отмена загрузки: проверяется между порциями обхода, распаковки и разбора
+class MdCancelToken {
+public:
+    MdCancelToken() : m_cancelled(false) {}
+    void Cancel() { m_cancelled = true; }
+    bool IsCancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> m_cancelled;
 };
 
+// Параметры загрузки
+struct MdLoadOptions {
+    MdOpenOptions open;
+    bool useCache = false;  // через кеш разбора, как OpenCached
+    std::wstring cacheDir;  // каталог кеша (пусто - рядом с файлом)
+};
+
+typedef std::function<void(const MdLoadProgress& progress)> MdLoadProgressFn;
+typedef std::function<void(bool ok, const std::wstring& error)> MdLoadDoneFn;
+
 // Структура для отображения в TreeView (файловая система OLE)
 struct OLEEntry {
     std::wstring name;
@@ -29,49 +214,261 @@ struct OLEEntry {
     std::vector<OLEEntry> children;
 };
 
+// Элемент по полному пути (NULL - нет такого)
+const OLEEntry* MdFindEntry(const std::vector<OLEEntry>& entries, const std::wstring& fullPath);
+
+// Поток при обходе контейнера (MDParser::ForEachRawStream): read = false -
+// поток не прочитан (причина в GetLastError), data пуст. data можно забрать;
+// false - прекратить обход
+typedef std::function<bool(const OLEEntry& entry, bool read, std::vector<char>& data)> MdRawStreamFn;
+
+// Поле, ссылающееся на тип (элемент обратного индекса ссылок)
+struct MdRefSource {
+    uint32_t field; // ID поля - индекс в MdRefIndex::names
+    uint32_t owner; // ID объекта-владельца (индекс в names) или MD_REF_NO_OWNER
+};
+
+// Поле без объекта-владельца (графа общего журнала, константа)
+static const uint32_t MD_REF_NO_OWNER = 0xFFFFFFFF;
+
+// Обратный индекс ссылок в сжатом построчном виде (CSR): на тип назначения
+// targets[i] ссылаются поля sources[offsets[i] .. offsets[i + 1]).
+// Строится тем же проходом анализа, что и карта ID поля -> ID типа
+struct MdRefIndex {
+    std::vector<std::string> targets; // ID типов назначения, по возрастанию
+    std::vector<uint32_t> offsets;    // targets.size() + 1 границ строк
+    std::vector<MdRefSource> sources;
+    std::vector<std::string> names;   // ID полей и владельцев (в порядке обхода)
+
+    // Поля, ссылающиеся на target: begin и их число (0 - ссылок нет)
+    size_t Find(const std::string& target, const MdRefSource*& begin) const;
+    const std::string& Name(uint32_t index) const { return names[index]; }
+    void Clear();
+};
+
+class MdSnapshotReader;
+class MdConfig;
+struct MdObjectModel;
+struct MdAnalyzePart;
+
+// Рекурсивный текстовый дамп поддерева с пояснениями типов по картам анализа
+void DumpMdTree(const MdNode* node, int level, const std::map<std::string, std::string>& idToType,
+                const std::map<std::string, std::string>& fieldToRef, std::wstringstream& ss);
+
 class MDParser {
 public:
     MDParser();
     ~MDParser();
 
-    bool Open(const std::wstring& filePath);
+    // prefetchAll: все потоки читаются за один проход по контейнеру и
+    // декодируются на пуле потоков в память (в пределах memoryBudget)
+    bool Open(const std::wstring& filePath, const MdOpenOptions& options = MdOpenOptions());
     void Close();
+
+    // Открытие через кеш разбора: если файл не менялся, дерево, структура OLE
+    // и карты анализа берутся из отображённого в память кеша, иначе файл
+    // разбирается заново и кеш перезаписывается. cacheDir пуст - кеш рядом с файлом.
+    bool OpenCached(const std::wstring& filePath, const std::wstring& cacheDir = L"",
+                    const MdOpenOptions& options = MdOpenOptions());
+
+    // Читает и разбирает "Main MetaData Stream" (без текстового дампа)
+    bool LoadMetadata();
+
+    // === Загрузка с ходом и отменой ===
+    // Open (или кеш разбора) + LoadMetadata. progress вызывается из того же
+    // потока между порциями работы; при отмене или сбое разбора метаданных
+    // конфигурация закрывается (файл без потока метаданных - не сбой)
+    bool Load(const std::wstring& filePath, const MdLoadOptions& options,
+              const std::shared_ptr<MdCancelToken>& cancel, const MdLoadProgressFn& progress);
+    // Load в рабочем потоке; прежняя загрузка отменяется. Пока IsLoading(),
+    // к парсеру обращаются только CancelLoad/WaitLoad. progress и done
+    // вызываются из рабочего потока; после done вызовите WaitLoad
+    void LoadAsync(const std::wstring& filePath, const MdLoadOptions& options,
+                   const MdLoadProgressFn& progress, const MdLoadDoneFn& done);
+    void CancelLoad();
+    void WaitLoad();
+    bool IsLoading() const { return m_loading; }
+    // Разбирает уже декодированный текст потока метаданных (root + анализ).
+    // analyze = false - только дерево, анализ потом через AnalyzeMetadata
+    bool ParseMetadataText(std::vector<char>& data, bool analyze = true);
+    // Строит карты анализа по уже разобранному дереву и публикует снимок.
+    // publish = false - снимок (GetConfig) прежний: замер одного анализа
+    void AnalyzeMetadata(bool publish = true);
+    // Потоков анализа: объекты разделов разбираются порциями параллельно,
+    // результат тот же, что при одном потоке. 1 - без потоков (по умолчанию), 0 - по числу ядер
+    void SetAnalyzeThreads(unsigned threads);
+
+    // Карты анализа: ID объекта -> тип, ID поля -> ID типа назначения
+    const std::map<std::string, std::string>& GetObjectTypes();
+    const std::map<std::string, std::string>& GetFieldRefs();
+    // Обратный индекс: ID типа -> ссылающиеся на него поля и их владельцы
+    const MdRefIndex& GetReverseRefs();
+    // Типизированная модель объектов и полей (MDObjects.h), nullptr - анализа не было
+    std::shared_ptr<const MdObjectModel> GetObjectModel();
+
+    // === Снимки (MDSnapshot.h) ===
+    // Сохранить разобранную конфигурацию в бинарный снимок *.mdsnap
+    bool SaveSnapshot(const std::wstring& snapshotPath);
+    // Открыть снимок вместо .md: запросы работают сразу, исходный файл
+    // нужен только для чтения содержимого потоков
+    bool OpenSnapshot(const std::wstring& snapshotPath);
+    // Открытый снимок или кеш (nullptr, если конфигурация разобрана из .md)
+    std::shared_ptr<MdSnapshotReader> GetSnapshot() const;
+
+    // === Неизменяемый снимок для читателей из любых потоков (MDConfig.h) ===
+    // Последняя завершённая загрузка: публикуется атомарно по окончании
+    // Load, LoadMetadata, ParseMetadataText с анализом, AnalyzeMetadata,
+    // OpenCached и OpenSnapshot. Close снимок не снимает - читатели работают
+    // с прежней конфигурацией, пока не готова следующая. nullptr - ещё ничего не загружено
+    std::shared_ptr<const MdConfig> GetConfig() const;
     
     // Получить корневые элементы OLE (файлы/папки)
     const std::vector<OLEEntry>& GetRootEntries() const;
     
-    // Получить корень распарсенного дерева метаданных (для GUI)
-    std::shared_ptr<MdNode> GetParsedRoot() const;
+    // Получить корень распарсенного дерева метаданных (для GUI).
+    // Дерево общее с опубликованным снимком и только для чтения; правка - через EditMetadata
+    std::shared_ptr<const MdNode> GetParsedRoot();
 
     std::wstring GetLastError() const;
 
-    // Читает поток, определяет формат (ZLib/Crypt), парсит структуру и возвращает текст
+    // Читает поток, определяет формат (ZLib/Crypt), парсит структуру и возвращает текст.
+    // Поток метаданных разбирается во временное дерево: загруженное не меняется
     std::wstring ReadStreamText(const std::wstring& entryParams);
 
     // Генерирует текстовый дамп конкретного узла и его детей (для GUI)
     std::wstring DumpNodeToText(const MdNode* node);
 
+    // Читает поток контейнера без декодирования
+    bool ReadRawStream(const std::wstring& fullPath, std::vector<char>& data);
+    // Все потоки без декодирования за одно открытие контейнера, в порядке
+    // GetRootEntries (ReadRawStream открывает файл заново на каждый поток).
+    // false - контейнер не открылся или fn прервала обход
+    bool ForEachRawStream(const MdRawStreamFn& fn);
+
+    // Декодированный поток: из кеша, иначе чтение, декодирование и запись в кеш
+    bool GetDecodedStream(const std::wstring& fullPath, std::vector<char>& data, MdStreamFormat& format);
+    // Кеш декодированных потоков (бюджет задаётся и в MdOpenOptions)
+    MdStreamCacheStats GetStreamCacheStats() const;
+    void SetStreamCacheBudget(size_t bytes);
+
+    // === Учёт памяти ===
+    // Разбивка занятой памяти и пик с начала загрузки (после Close пик сохраняется)
+    MdMemoryStats GetMemoryStats() const;
+    // Жёсткий предел памяти, байт (0 - без предела). Открытие или разбор,
+    // которые его превысили бы, прерываются с ошибкой и освобождают память
+    void SetMemoryLimit(size_t bytes);
+
+    // Сериализует узел обратно в текст 1С {"...",...} (побайтово как в исходнике)
+    std::string SerializeNode(const MdNode* node);
+
+    // Проверка: разбор потока и обратная запись дают идентичные байты
+    bool VerifyRoundTrip(const std::wstring& fullPath);
+
+    // === Запись ===
+    // Задать новое (декодированное) содержимое потока; применяется при SaveAs
+    void SetStreamData(const std::wstring& fullPath, const std::vector<char>& data);
+    // Копия дерева метаданных для правки (nullptr - дерева нет). Копия своя у
+    // парсера: опубликованные снимки правки не видят. Повторные вызовы до
+    // CommitMetadata возвращают ту же копию
+    std::shared_ptr<MdNode> EditMetadata();
+    // Сериализовать дерево метаданных (правленую копию, если она есть) в
+    // "Main MetaData Stream"; правленое дерево становится текущим, анализ
+    // повторяется и публикуется новый снимок
+    bool CommitMetadata();
+    // Пересобрать контейнер: изменённые потоки сжимаются параллельно,
+    // остальные копируются как есть
+    bool SaveAs(const std::wstring& outPath, const MdRepackOptions& options = MdRepackOptions());
+
 private:
     std::wstring lastError;
     std::wstring currentFilePath;
     std::vector<OLEEntry> rootEntries;
 
     // === Структуры парсера метаданных ===
-    std::shared_ptr<MdNode> root;
+    std::shared_ptr<MdNode> root;                    // общее с MdConfig, не меняется
+    std::shared_ptr<MdNode> m_editRoot;              // копия для правки (EditMetadata)
     std::map<std::string, std::shared_ptr<MdNode>> objectIndex; 
     std::map<std::string, std::string> m_idToType;   // ID объекта -> Тип
     std::map<std::string, std::string> m_fieldToRef; // ID поля -> ID типа назначения
+    MdRefIndex m_refIndex;                           // ID типа назначения -> поля (CSR)
+    std::shared_ptr<const MdObjectModel> m_model;    // объекты и поля (строится заново при анализе)
+    std::string m_metaPrefix; // байты потока метаданных до корневой '{'
+    std::string m_metaSuffix; // байты после закрывающей '}'
+
+    // Снимок, из которого открыта конфигурация (OpenSnapshot или актуальный кеш OpenCached)
+    std::shared_ptr<MdSnapshotReader> m_cache;
+
+    // Опубликованный снимок (читается и подменяется через atomic_load/atomic_store)
+    std::shared_ptr<const MdConfig> m_config;
+
+    // === Кеш декодированных потоков (заполняется и при prefetchAll) ===
+    MdStreamCache m_streamCache;
+
+    // === Учёт памяти (кеш потоков считается отдельно, по m_streamCache) ===
+    MdMemoryStats m_memory;
+    size_t m_treeAllocs; // выделений кучи последним ParseString (MD_CNT_TREE_ALLOCS)
+
+    unsigned m_analyzeThreads; // SetAnalyzeThreads
+
+    // === Загрузка (Load, LoadAsync) ===
+    struct LoadControl;   // состояние текущей загрузки
+    LoadControl* m_load;  // не NULL - идёт Load: отчёты о ходе и точки отмены
+    std::thread m_loadThread;
+    std::shared_ptr<MdCancelToken> m_loadCancel;
+    std::atomic<bool> m_loading;
+
+    // === Изменённые потоки (для SaveAs) ===
+    std::map<std::wstring, std::vector<char>> m_pendingStreams; // fullPath -> новое содержимое
 
     // === Внутренние методы ===
     void ReadStorage(IStorage* pStorage, std::vector<OLEEntry>& targetList, const std::wstring& parentPath);
+    void PrefetchStreams(IStorage* pRoot, const MdOpenOptions& options);
+    void ReadAllStreams(IStorage* pStorage, const std::vector<OLEEntry>& entries, size_t& budget,
+                        std::vector<std::pair<std::wstring, MdDecodedStream>>& items);
+    bool WalkRawStreams(IStorage* pStorage, const std::vector<OLEEntry>& entries, const MdRawStreamFn& fn);
+    bool CopyStorage(IStorage* pSrc, IStorage* pDst, const std::wstring& parentPath,
+                     const std::map<std::wstring, std::vector<char>>& encoded);
     
+    // Снимок открыт: структуры из него, кроме дерева
+    void RestoreCache(const std::shared_ptr<MdSnapshotReader>& cache);
+    // Собирает дерево из снимка при первом обращении
+    void EnsureMetadata();
+    // LoadMetadata, если поток метаданных есть; сбой разбора закрывает файл
+    bool LoadOptionalMetadata();
+    // Собирает неизменяемый снимок текущего состояния и подменяет опубликованный
+    void PublishConfig();
+
+    // Ход загрузки: отчёт, точка отмены в разборе (бросает исключение)
+    void ReportLoad(MdLoadPhase phase);
+    void LoadCheckpoint(const char* ptr);
+    bool LoadCancelled() const;
+
+    // Учёт памяти: false - превышен предел (lastError заполнен)
+    bool ChargeMemory(size_t& field, size_t bytes);
+    void ReleaseMemory(size_t& field, size_t bytes);
+    size_t MemoryHeadroom() const;
+    void ResetMemory(bool keepPeak);
+    void ReleaseTreeMemory(size_t nodes, size_t nodeBytes, size_t stringBytes);
+    void DropMetadata();
+    // Пересчёт по готовым структурам (дерево из снимка, карты, OLE)
+    void ChargeTreeMemory(const MdNode* node);
+    bool UpdateIndexMemory();
+    bool UpdateEntriesMemory();
+
     // Парсинг строки 1С {"...", ...}
     std::shared_ptr<MdNode> ParseString(const char*& ptr);
+    // Разбор во временное дерево (root не меняется) и снятие его с учёта памяти
+    bool ParseDetached(const char*& ptr, std::shared_ptr<MdNode>& tree);
+    void ReleaseDetached(std::shared_ptr<MdNode>& tree, const MdMemoryStats& before);
     void SkipWhitespace(const char*& ptr);
+
+    // Обратная запись узла в текст
+    void WriteNode(const MdNode* node, std::string& out);
     
-    // Анализ структуры после парсинга (заполнение карт типов)
+    // Анализ структуры после парсинга (заполнение карт типов по таблице разделов)
     void AnalyzeStructure();
-    void ScanContainer(std::shared_ptr<MdNode> objectNode, const std::string& typePrefix);
+    void ScanSections();
+    void BuildRefIndex(std::vector<MdAnalyzePart>& parts);
     
     // Рекурсивный вывод дерева в поток (принимает сырой указатель для удобства)
     void DumpTreeToString(const MdNode* node, int level, std::wstringstream& ss);
@@ -0,0 +1,321 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDPipeline.h"
+#include "MDParser.h"
+#include "MDThreads.h"
+#include "MDTrace.h"
+
+namespace {
+
+const wchar_t* const kMetaStream = L"Metadata\\Main MetaData Stream";
+
+double NowMs() {
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+// Файл в работе. Парсер создаётся и уничтожается в потоке Run (баланс
+// CoInitialize); стадии лишь вызывают его методы, не трогающие COM.
+struct FileJob {
+    MDParser parser;
+    MdPipelineFileResult result;
+    std::atomic<long> pending;          // незавершённых единиц работы
+    std::atomic<size_t> decodedBytes;
+    double start;
+};
+
+// Поток контейнера, идущий по конвейеру
+struct StreamItem {
+    FileJob* job;
+    std::wstring path;
+    bool isMeta;
+    std::vector<char> data;
+};
+
+// Счётчики стадии (время - в микросекундах)
+struct StageCounters {
+    std::atomic<unsigned long long> items, bytes, busyUs, stallUs;
+    std::atomic<unsigned> alive;
+
+    StageCounters() : items(0), bytes(0), busyUs(0), stallUs(0), alive(0) {}
+
+    void AddBusy(double startMs) { busyUs += (unsigned long long)((NowMs() - startMs) * 1000.0); }
+};
+
+class Engine {
+public:
+    Engine(const MdPipelineOptions& options, const std::vector<std::wstring>& files,
+           const MdPipeline::FileCallback& onFileDone)
+        : m_files(files), m_onFileDone(onFileDone), m_memoryLimit(options.memoryLimit),
+          m_maxJobs(options.queueCapacity ? options.queueCapacity : 1),
+          m_fileQueue(m_maxJobs), m_doneQueue(m_maxJobs),
+          m_decodeQueue(options.queueCapacity), m_parseQueue(options.queueCapacity),
+          m_analyzeQueue(options.queueCapacity) {}
+
+    void Run(unsigned readThreads, unsigned decodeThreads, unsigned parseThreads, unsigned analyzeThreads) {
+        m_read.alive = readThreads;
+        m_decode.alive = decodeThreads;
+        m_parse.alive = parseThreads;
+        m_analyze.alive = analyzeThreads;
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < readThreads; ++i) threads.emplace_back([this]() { ReadStage(); });
+        for (unsigned i = 0; i < decodeThreads; ++i) threads.emplace_back([this]() { DecodeStage(); });
+        for (unsigned i = 0; i < parseThreads; ++i) threads.emplace_back([this]() { ParseStage(); });
+        for (unsigned i = 0; i < analyzeThreads; ++i) threads.emplace_back([this]() { AnalyzeStage(); });
+        Feed();
+        for (auto& t : threads) t.join();
+    }
+
+    void FillStats(MdPipelineStageStats& s, const StageCounters& c) const {
+        s.items = c.items;
+        s.bytes = c.bytes;
+        s.busyMs = c.busyUs / 1000.0;
+        s.stallMs = c.stallUs / 1000.0;
+    }
+
+    StageCounters m_read, m_decode, m_parse, m_analyze;
+
+private:
+    FileJob* NewJob(const std::wstring& path) {
+        std::unique_ptr<FileJob> job(new FileJob);
+        MdPipelineFileResult& r = job->result;
+        r.path = path;
+        r.ok = false;
+        r.fileSize = 0;
+        r.streams = r.rawBytes = r.decodedBytes = r.nodes = r.objects = r.refs = r.peakMemory = 0;
+        r.ms = 0;
+        job->parser.SetMemoryLimit(m_memoryLimit);
+        job->pending = 0;
+        job->decodedBytes = 0;
+        job->start = 0;
+        return job.release();
+    }
+
+    // Файлы подаются на чтение по мере завершения прежних: в работе не больше
+    // m_maxJobs файлов, и парсеры не создаются заранее на весь список.
+    // Очереди файлов вмещают m_maxJobs, поэтому Push здесь не ждёт
+    void Feed() {
+        size_t next = 0, live = 0;
+        unsigned spins = 0;
+        if (m_files.empty()) m_fileQueue.Close();
+        while (next < m_files.size() || live > 0) {
+            FileJob* job;
+            if (m_doneQueue.TryPop(job)) {
+                delete job;
+                live--;
+                spins = 0;
+            } else if (next < m_files.size() && live < m_maxJobs) {
+                m_fileQueue.Push(NewJob(m_files[next++]));
+                if (next == m_files.size()) m_fileQueue.Close();
+                live++;
+                spins = 0;
+            } else {
+                MdBackoff(spins);
+            }
+        }
+    }
+
+    // Последний поток стадии закрывает её выходную очередь
+    template <class T>
+    static void LeaveStage(StageCounters& stage, MdBoundedQueue<T>& output) {
+        if (--stage.alive == 0) output.Close();
+    }
+
+    template <class T>
+    static void PushTimed(MdBoundedQueue<T>& queue, const T& value, StageCounters& stage) {
+        if (queue.TryPush(value)) return;
+        MD_TRACE_SCOPE("queue", "stall");
+        double start = NowMs();
+        queue.Push(value);
+        stage.stallUs += (unsigned long long)((NowMs() - start) * 1000.0);
+    }
+
+    // Единица работы файла завершена; последняя завершает файл
+    void FinishUnit(FileJob* job) {
+        if (--job->pending != 0) return;
+
+        MdPipelineFileResult& r = job->result;
+        r.decodedBytes = job->decodedBytes;
+        r.ms = NowMs() - job->start;
+        r.ok = r.error.empty();
+        job->parser.Close(); // освобождаем дерево сразу, не дожидаясь конца
+        r.peakMemory = job->parser.GetMemoryStats().peak;
+        if (m_onFileDone) m_onFileDone(r);
+        m_doneQueue.Push(job); // уничтожается в потоке Run
+    }
+
+    // === Стадия 1: чтение потоков контейнера ===
+    void ReadStage() {
+        MdTraceSetThreadName("pipeline: read");
+        CoInitialize(NULL);
+        FileJob* job;
+        while (m_fileQueue.Pop(job)) {
+            MD_TRACE_SCOPE("file", "read", job->result.path);
+            double start = NowMs();
+            job->start = start;
+            job->pending = 1; // держит файл, пока идёт чтение
+
+            MdPipelineFileResult& r = job->result;
+            WIN32_FILE_ATTRIBUTE_DATA attr;
+            if (GetFileAttributesExW(r.path.c_str(), GetFileExInfoStandard, &attr))
+                r.fileSize = ((unsigned long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+
+            if (!job->parser.Open(r.path)) {
+                r.error = job->parser.GetLastError();
+            } else {
+                // Поток метаданных отправляется последним: после этого читатель
+                // больше не обращается к парсеру, и разбор идёт без гонок
+                StreamItem* meta = NULL;
+                if (!ReadStreams(job, meta)) r.error = job->parser.GetLastError();
+                if (meta) {
+                    job->pending++;
+                    PushTimed(m_decodeQueue, meta, m_read);
+                }
+            }
+
+            m_read.items++;
+            m_read.AddBusy(start);
+            FinishUnit(job);
+        }
+        LeaveStage(m_read, m_decodeQueue);
+        CoUninitialize();
+    }
+
+    // Потоки файла - за один проход по контейнеру
+    bool ReadStreams(FileJob* job, StreamItem*& meta) {
+        return job->parser.ForEachRawStream([&](const OLEEntry& entry, bool read, std::vector<char>& data) {
+            job->result.streams++;
+            if (!read) return true;
+            job->result.rawBytes += data.size();
+            m_read.bytes += data.size();
+            if (data.empty()) return true;
+
+            std::unique_ptr<StreamItem> item(new StreamItem);
+            item->job = job;
+            item->path = entry.fullPath;
+            item->isMeta = entry.fullPath == kMetaStream;
+            item->data.swap(data);
+            if (item->isMeta) {
+                meta = item.release();
+            } else {
+                job->pending++;
+                PushTimed(m_decodeQueue, item.release(), m_read);
+            }
+            return true;
+        });
+    }
+
+    // === Стадия 2: расшифровка и распаковка ===
+    void DecodeStage() {
+        MdTraceSetThreadName("pipeline: decode");
+        StreamItem* item;
+        while (m_decodeQueue.Pop(item)) {
+            double start = NowMs();
+            MdStreamFormat format;
+            {
+                MD_TRACE_SCOPE("stream", "decode", item->path);
+                format = DecodeStreamData(item->data);
+            }
+            item->job->decodedBytes += item->data.size();
+            m_decode.items++;
+            m_decode.bytes += item->data.size();
+            m_decode.AddBusy(start);
+
+            if (item->isMeta && format != MD_FMT_RAW) {
+                PushTimed(m_parseQueue, item, m_decode);
+            } else {
+                FileJob* job = item->job;
+                delete item;
+                FinishUnit(job);
+            }
+        }
+        LeaveStage(m_decode, m_parseQueue);
+    }
+
+    // === Стадия 3: разбор текста в дерево ===
+    void ParseStage() {
+        MdTraceSetThreadName("pipeline: parse");
+        StreamItem* item;
+        while (m_parseQueue.Pop(item)) {
+            double start = NowMs();
+            FileJob* job = item->job;
+            bool parsed;
+            {
+                MD_TRACE_SCOPE("file", "parse", job->result.path);
+                parsed = job->parser.ParseMetadataText(item->data, false);
+            }
+            if (!parsed) job->result.error = job->parser.GetLastError();
+            m_parse.items++;
+            m_parse.bytes += item->data.size();
+            delete item;
+            m_parse.AddBusy(start);
+
+            if (parsed) PushTimed(m_analyzeQueue, job, m_parse);
+            else FinishUnit(job);
+        }
+        LeaveStage(m_parse, m_analyzeQueue);
+    }
+
+    // === Стадия 4: анализ структуры ===
+    void AnalyzeStage() {
+        MdTraceSetThreadName("pipeline: analyze");
+        FileJob* job;
+        while (m_analyzeQueue.Pop(job)) {
+            MD_TRACE_SCOPE("file", "analyze", job->result.path);
+            double start = NowMs();
+            MDParser& parser = job->parser;
+            parser.AnalyzeMetadata();
+            job->result.nodes = CountNodes(parser.GetParsedRoot().get());
+            job->result.objects = parser.GetObjectTypes().size();
+            job->result.refs = parser.GetFieldRefs().size();
+            m_analyze.items++;
+            m_analyze.AddBusy(start);
+            FinishUnit(job);
+        }
+        --m_analyze.alive;
+    }
+
+    const std::vector<std::wstring>& m_files;
+    const MdPipeline::FileCallback& m_onFileDone;
+    size_t m_memoryLimit;
+    size_t m_maxJobs;
+
+    MdBoundedQueue<FileJob*> m_fileQueue; // поданные на чтение
+    MdBoundedQueue<FileJob*> m_doneQueue; // завершённые, к уничтожению
+
+    MdBoundedQueue<StreamItem*> m_decodeQueue;
+    MdBoundedQueue<StreamItem*> m_parseQueue;
+    MdBoundedQueue<FileJob*> m_analyzeQueue;
+};
+
+} // namespace
+
+MdPipeline::MdPipeline(const MdPipelineOptions& options) : m_options(options) {}
+
+void MdPipeline::Run(const std::vector<std::wstring>& files, const FileCallback& onFileDone) {
+    unsigned cores = MdDefaultThreads();
+    unsigned readThreads = m_options.readThreads ? m_options.readThreads : 1;
+    unsigned decodeThreads = m_options.decodeThreads ? m_options.decodeThreads : cores;
+    unsigned parseThreads = m_options.parseThreads ? m_options.parseThreads : (cores > 1 ? cores / 2 : 1);
+    unsigned analyzeThreads = m_options.analyzeThreads ? m_options.analyzeThreads : 1;
+
+    // Парсеры создаются в этом потоке и здесь же уничтожаются (Engine::Feed)
+    Engine engine(m_options, files, onFileDone);
+    engine.Run(readThreads, decodeThreads, parseThreads, analyzeThreads);
+
+    m_stats.clear();
+    MdPipelineStageStats s;
+    s.name = L"read";    s.threads = readThreads;    engine.FillStats(s, engine.m_read);    m_stats.push_back(s);
+    s.name = L"decode";  s.threads = decodeThreads;  engine.FillStats(s, engine.m_decode);  m_stats.push_back(s);
+    s.name = L"parse";   s.threads = parseThreads;   engine.FillStats(s, engine.m_parse);   m_stats.push_back(s);
+    s.name = L"analyze"; s.threads = analyzeThreads; engine.FillStats(s, engine.m_analyze); m_stats.push_back(s);
+}
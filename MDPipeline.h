@@ -0,0 +1,78 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+// ============================================================================
+// Конвейерная обработка файлов конфигурации
+// ============================================================================
+//
+//   чтение контейнера -> расшифровка/распаковка -> разбор -> анализ
+//
+// Каждая стадия - свои потоки, стадии связаны ограниченными очередями без
+// блокировок (MdBoundedQueue). Заполненная очередь тормозит предыдущую стадию,
+// поэтому в памяти одновременно находится ограниченное число потоков .md.
+// Чтение, распаковка и разбор разных файлов идут одновременно, и пропускная
+// способность определяется самой медленной стадией, а не их суммой.
+
+// Параметры конвейера (0 - по умолчанию)
+struct MdPipelineOptions {
+    unsigned readThreads = 1;    // чтение контейнеров (диск + COM)
+    unsigned decodeThreads = 0;  // расшифровка и распаковка, по умолчанию - по числу ядер
+    unsigned parseThreads = 0;   // разбор текста метаданных, по умолчанию - половина ядер
+    unsigned analyzeThreads = 1; // анализ структуры
+    size_t queueCapacity = 64;   // емкость каждой очереди (элементов) и предел файлов в работе
+    size_t memoryLimit = 0;      // предел памяти на файл (MDParser::SetMemoryLimit), 0 - без предела
+};
+
+// Результат обработки одного файла
+struct MdPipelineFileResult {
+    std::wstring path;
+    bool ok;
+    std::wstring error;
+    unsigned long long fileSize;
+    size_t streams;
+    size_t rawBytes;
+    size_t decodedBytes;
+    size_t nodes;
+    size_t objects;
+    size_t refs;
+    size_t peakMemory; // пик учтённой памяти парсера (MdMemoryStats::peak)
+    double ms; // от начала чтения до завершения анализа
+};
+
+// Статистика стадии
+struct MdPipelineStageStats {
+    const wchar_t* name;
+    unsigned threads;
+    unsigned long long items;
+    unsigned long long bytes;
+    double busyMs;  // суммарное время работы потоков стадии
+    double stallMs; // ожидание места в следующей очереди (обратное давление)
+};
+
+class MdPipeline {
+public:
+    typedef std::function<void(const MdPipelineFileResult&)> FileCallback;
+
+    explicit MdPipeline(const MdPipelineOptions& options = MdPipelineOptions());
+
+    // Обрабатывает файлы и возвращается, когда все готовы.
+    // onFileDone вызывается из рабочих потоков по мере готовности файлов.
+    void Run(const std::vector<std::wstring>& files, const FileCallback& onFileDone);
+
+    // Статистика последнего запуска: read, decode, parse, analyze
+    const std::vector<MdPipelineStageStats>& GetStageStats() const { return m_stats; }
+
+private:
+    MdPipelineOptions m_options;
+    std::vector<MdPipelineStageStats> m_stats;
+};
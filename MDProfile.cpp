@@ -0,0 +1,90 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDProfile.h"
+#include <stdio.h>
+
+std::atomic<bool> g_mdProfileEnabled(false);
+std::atomic<uint64_t> g_mdStageTicks[MD_STAGE_COUNT];
+std::atomic<uint64_t> g_mdStageCalls[MD_STAGE_COUNT];
+std::atomic<uint64_t> g_mdCounters[MD_CNT_COUNT];
+
+static const char* const kStageNames[MD_STAGE_COUNT] = {
+    "open", "enumerate", "read", "decrypt", "inflate", "deflate",
+    "brace_scan", "parse", "analyze", "serialize", "dump"
+};
+
+static const char* const kCounterNames[MD_CNT_COUNT] = {
+    "streams_read", "bytes_read", "bytes_decrypted", "bytes_inflated", "bytes_parsed",
+    "nodes", "tree_allocs", "stream_cache_hits", "stream_cache_misses",
+    "parse_cache_hits", "parse_cache_misses"
+};
+
+const char* MdProfileStageName(MdProfileStage stage) {
+    return kStageNames[stage];
+}
+
+void MdProfileEnable(bool enable) {
+    g_mdProfileEnabled.store(enable, std::memory_order_relaxed);
+}
+
+void MdProfileReset() {
+    for (int i = 0; i < MD_STAGE_COUNT; ++i) {
+        g_mdStageTicks[i].store(0, std::memory_order_relaxed);
+        g_mdStageCalls[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < MD_CNT_COUNT; ++i) g_mdCounters[i].store(0, std::memory_order_relaxed);
+}
+
+MdProfileStats MdProfileGet() {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    MdProfileStats stats;
+    stats.enabled = MdProfileEnabled();
+    for (int i = 0; i < MD_STAGE_COUNT; ++i) {
+        stats.stages[i].name = kStageNames[i];
+        stats.stages[i].calls = g_mdStageCalls[i].load(std::memory_order_relaxed);
+        stats.stages[i].ms = (double)g_mdStageTicks[i].load(std::memory_order_relaxed) * 1000.0 / (double)freq.QuadPart;
+    }
+    for (int i = 0; i < MD_CNT_COUNT; ++i) {
+        stats.counters[i].name = kCounterNames[i];
+        stats.counters[i].value = g_mdCounters[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+std::string MdProfileToJson() {
+    MdProfileStats stats = MdProfileGet();
+    char buf[128];
+
+    std::string json = "{\n  \"enabled\": ";
+    json += stats.enabled ? "true" : "false";
+    json += ",\n  \"stages\": {";
+    for (int i = 0; i < MD_STAGE_COUNT; ++i) {
+        snprintf(buf, sizeof(buf), "%s\n    \"%s\": {\"calls\": %llu, \"ms\": %.3f}", i ? "," : "",
+            stats.stages[i].name, (unsigned long long)stats.stages[i].calls, stats.stages[i].ms);
+        json += buf;
+    }
+    json += "\n  },\n  \"counters\": {";
+    for (int i = 0; i < MD_CNT_COUNT; ++i) {
+        snprintf(buf, sizeof(buf), "%s\n    \"%s\": %llu", i ? "," : "",
+            stats.counters[i].name, (unsigned long long)stats.counters[i].value);
+        json += buf;
+    }
+    json += "\n  }\n}\n";
+    return json;
+}
+
+bool MdProfileWriteJson(const std::wstring& path) {
+    FILE* f = _wfopen(path.c_str(), L"wb");
+    if (!f) return false;
+    std::string json = MdProfileToJson();
+    bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    fclose(f);
+    return ok;
+}
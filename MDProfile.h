@@ -0,0 +1,134 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <windows.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "MDTrace.h"
+
+// ============================================================================
+// Профилирование: время по стадиям и счётчики
+// ============================================================================
+//
+// Статистика общая на процесс (суммируется по всем MDParser и потокам).
+// Выключено по умолчанию: тогда замер - проверка флагов без обращения
+// к таймеру. С MD_NO_PROFILE замеры исключаются при компиляции.
+// Время стадий включающее: "open" содержит "enumerate" и т.п.
+// При включённой трассировке (MDTrace.h) стадии пишутся и на шкалу времени.
+
+enum MdProfileStage {
+    MD_STAGE_OPEN = 0,   // Open целиком
+    MD_STAGE_ENUMERATE,  // обход структуры OLE
+    MD_STAGE_READ,       // чтение потоков из контейнера
+    MD_STAGE_DECRYPT,    // %w XOR
+    MD_STAGE_INFLATE,    // распаковка ZLib
+    MD_STAGE_DEFLATE,    // сжатие ZLib (SaveAs)
+    MD_STAGE_BRACE_SCAN, // поиск корневой '{'
+    MD_STAGE_PARSE,      // текст -> дерево
+    MD_STAGE_ANALYZE,    // карты типов и ссылок
+    MD_STAGE_SERIALIZE,  // дерево -> текст
+    MD_STAGE_DUMP,       // текстовый дамп для GUI
+    MD_STAGE_COUNT
+};
+
+enum MdProfileCounter {
+    MD_CNT_STREAMS_READ = 0,
+    MD_CNT_BYTES_READ,
+    MD_CNT_BYTES_DECRYPTED,
+    MD_CNT_BYTES_INFLATED,
+    MD_CNT_BYTES_PARSED,
+    MD_CNT_NODES,            // узлов дерева построено
+    MD_CNT_TREE_ALLOCS,      // выделений кучи при разборе: узлы, строки вне SSO, рост списков детей
+    MD_CNT_STREAM_CACHE_HITS,
+    MD_CNT_STREAM_CACHE_MISSES,
+    MD_CNT_PARSE_CACHE_HITS,   // OpenCached: снимок актуален
+    MD_CNT_PARSE_CACHE_MISSES, // OpenCached: полный разбор
+    MD_CNT_COUNT
+};
+
+// Состояние (MDProfile.cpp)
+extern std::atomic<bool> g_mdProfileEnabled;
+extern std::atomic<uint64_t> g_mdStageTicks[MD_STAGE_COUNT];
+extern std::atomic<uint64_t> g_mdStageCalls[MD_STAGE_COUNT];
+extern std::atomic<uint64_t> g_mdCounters[MD_CNT_COUNT];
+
+inline bool MdProfileEnabled() {
+#ifdef MD_NO_PROFILE
+    return false;
+#else
+    return g_mdProfileEnabled.load(std::memory_order_relaxed);
+#endif
+}
+
+inline void MdProfileCount(MdProfileCounter counter, uint64_t n = 1) {
+    if (MdProfileEnabled()) g_mdCounters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+const char* MdProfileStageName(MdProfileStage stage);
+
+// Замер времени области видимости
+class MdProfileScope {
+public:
+    explicit MdProfileScope(MdProfileStage stage) : m_stage(stage), m_start(0) {
+        if (MdProfileEnabled() || MdTraceEnabled()) {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            m_start = now.QuadPart;
+        }
+    }
+
+    ~MdProfileScope() {
+        if (!m_start) return;
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        if (MdProfileEnabled()) {
+            g_mdStageTicks[m_stage].fetch_add((uint64_t)(now.QuadPart - m_start), std::memory_order_relaxed);
+            g_mdStageCalls[m_stage].fetch_add(1, std::memory_order_relaxed);
+        }
+        if (MdTraceEnabled()) MdTraceRecord("stage", MdProfileStageName(m_stage), m_start, now.QuadPart);
+    }
+
+private:
+    MdProfileScope(const MdProfileScope&);
+    MdProfileScope& operator=(const MdProfileScope&);
+
+    MdProfileStage m_stage;
+    int64_t m_start;
+};
+
+#define MD_PROFILE_CONCAT2(a, b) a##b
+#define MD_PROFILE_CONCAT(a, b) MD_PROFILE_CONCAT2(a, b)
+#define MD_PROFILE_SCOPE(stage) MdProfileScope MD_PROFILE_CONCAT(mdProfileScope_, __LINE__)(stage)
+
+// === Управление и чтение ===
+void MdProfileEnable(bool enable);
+void MdProfileReset();
+
+struct MdProfileStageStats {
+    const char* name;
+    uint64_t calls;
+    double ms;
+};
+
+struct MdProfileCounterValue {
+    const char* name;
+    uint64_t value;
+};
+
+struct MdProfileStats {
+    bool enabled;
+    MdProfileStageStats stages[MD_STAGE_COUNT];
+    MdProfileCounterValue counters[MD_CNT_COUNT];
+};
+
+MdProfileStats MdProfileGet();
+
+// {"enabled":..,"stages":{"open":{"calls":..,"ms":..},..},"counters":{..}}
+std::string MdProfileToJson();
+bool MdProfileWriteJson(const std::wstring& path);
@@ -0,0 +1,308 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDQuery.h"
+#include "MDConfig.h"
+#include <string.h>
+#include <algorithm>
+
+// ============================================================================
+// КОМПИЛЯЦИЯ
+// ============================================================================
+
+static void SkipSpaces(const std::string& text, size_t& pos) {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) pos++;
+}
+
+static bool IsStepEnd(const std::string& text, size_t pos) {
+    return pos >= text.size() || text[pos] == '/' || text[pos] == '[' || text[pos] == ' ';
+}
+
+// Имя или значение: "..." (с удвоенными кавычками) или до / [ ] =
+static bool ReadToken(const std::string& text, size_t& pos, std::string& token) {
+    token.clear();
+    SkipSpaces(text, pos);
+    if (pos < text.size() && text[pos] == '"') {
+        for (++pos; pos < text.size(); ++pos) {
+            if (text[pos] == '"') {
+                if (pos + 1 < text.size() && text[pos + 1] == '"') {
+                    token += '"';
+                    pos++;
+                } else {
+                    pos++;
+                    return true;
+                }
+            } else {
+                token += text[pos];
+            }
+        }
+        return false; // нет закрывающей кавычки
+    }
+    size_t start = pos;
+    while (pos < text.size() && !strchr("/[]=", text[pos])) pos++;
+    token.assign(text, start, pos - start);
+    while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) token.pop_back();
+    return !token.empty();
+}
+
+static bool ReadIndex(const std::string& text, size_t& pos, size_t& index) {
+    SkipSpaces(text, pos);
+    size_t start = pos;
+    index = 0;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+        index = index * 10 + (text[pos] - '0');
+        if (index > 0xFFFFFF) return false;
+        pos++;
+    }
+    return pos > start;
+}
+
+bool MdQuery::Fail(const std::wstring& error) {
+    m_steps.clear();
+    m_lastError = error;
+    return false;
+}
+
+bool MdQuery::Compile(const std::wstring& text) {
+    std::string ansi;
+    int len = WideCharToMultiByte(1251, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    if (len > 0) {
+        ansi.resize(len);
+        WideCharToMultiByte(1251, 0, text.c_str(), (int)text.size(), &ansi[0], len, NULL, NULL);
+    }
+    return Compile(ansi);
+}
+
+bool MdQuery::Compile(const std::string& text) {
+    m_steps.clear();
+    m_lastError.clear();
+    m_scanStates = m_indexStates = 0;
+
+    size_t pos = 0;
+    SkipSpaces(text, pos);
+    if (pos < text.size() && text[pos] == '/') pos++;
+
+    for (;;) {
+        // === Шаг ===
+        SkipSpaces(text, pos);
+        if (pos >= text.size() || text[pos] == '/') return Fail(L"Пустой шаг запроса");
+
+        Step step;
+        if (text[pos] == '*' && pos + 1 < text.size() && text[pos + 1] == '*' && IsStepEnd(text, pos + 2)) {
+            step.kind = STEP_DEEP;
+            pos += 2;
+        } else if (text[pos] == '*' && IsStepEnd(text, pos + 1)) {
+            step.kind = STEP_ANY;
+            pos++;
+        } else if (text[pos] == '[') {
+            pos++;
+            step.kind = STEP_INDEX;
+            SkipSpaces(text, pos);
+            if (!ReadIndex(text, pos, step.index)) return Fail(L"Ожидался индекс [n]");
+            SkipSpaces(text, pos);
+            if (pos >= text.size() || text[pos] != ']') return Fail(L"Ожидалась ']'");
+            pos++;
+        } else if (text[pos] == '#') {
+            pos++;
+            step.kind = STEP_ID;
+            if (!m_steps.empty()) return Fail(L"Шаг #ID допустим только первым");
+            if (!ReadToken(text, pos, step.name.text)) return Fail(L"Ожидался ID объекта после '#'");
+            if (step.name.text.find('*') != std::string::npos) return Fail(L"В шаге #ID не бывает '*'");
+        } else {
+            step.kind = STEP_NAME;
+            if (!ReadToken(text, pos, step.name.text)) return Fail(L"Ожидалось имя списка");
+            step.name.glob = step.name.text.find('*') != std::string::npos;
+        }
+        m_steps.push_back(step);
+
+        // === Уточнения: [n] - шаг к ребёнку, [n=значение] и [=значение] - условия ===
+        SkipSpaces(text, pos);
+        while (pos < text.size() && text[pos] == '[') {
+            pos++;
+            SkipSpaces(text, pos);
+            size_t index = 0;
+            bool hasIndex = ReadIndex(text, pos, index);
+            SkipSpaces(text, pos);
+            if (pos < text.size() && text[pos] == '=') {
+                pos++;
+                Step& last = m_steps.back();
+                if (last.kind == STEP_DEEP) return Fail(L"У шага ** не бывает условий");
+                Filter filter;
+                filter.index = hasIndex ? (int)index : -1;
+                // Пустое значение - только в кавычках: [1=""]
+                if (!ReadToken(text, pos, filter.pattern.text)) return Fail(L"Ожидалось значение после '='");
+                filter.pattern.glob = filter.pattern.text.find('*') != std::string::npos;
+                last.filters.push_back(filter);
+            } else if (hasIndex) {
+                Step child;
+                child.kind = STEP_INDEX;
+                child.index = index;
+                m_steps.push_back(child);
+            } else {
+                return Fail(L"Ожидалось [n] или [n=значение]");
+            }
+            SkipSpaces(text, pos);
+            if (pos >= text.size() || text[pos] != ']') return Fail(L"Ожидалась ']'");
+            pos++;
+            SkipSpaces(text, pos);
+        }
+
+        if (pos >= text.size()) break;
+        if (text[pos] != '/') return Fail(L"Ожидался '/' между шагами");
+        pos++;
+    }
+
+    // Состояние k - "узел ждёт шага k", состояние size() - "узел найден"
+    if (m_steps.size() > 63) return Fail(L"Слишком длинный запрос (больше 63 шагов)");
+    for (size_t k = 0; k < m_steps.size(); ++k) {
+        if (m_steps[k].kind == STEP_INDEX) m_indexStates |= 1ull << k;
+        else if (m_steps[k].kind != STEP_ID) m_scanStates |= 1ull << k;
+    }
+    return true;
+}
+
+// ============================================================================
+// ВЫПОЛНЕНИЕ
+// ============================================================================
+
+// '*' - любая последовательность; при несовпадении откат к последней '*'
+bool MdQuery::Pattern::Match(const std::string& value) const {
+    if (!glob) return value == text;
+    size_t p = 0, v = 0, star = std::string::npos, mark = 0;
+    while (v < value.size()) {
+        if (p < text.size() && text[p] == '*') {
+            star = p++;
+            mark = v;
+        } else if (p < text.size() && text[p] == value[v]) {
+            p++;
+            v++;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            v = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < text.size() && text[p] == '*') p++;
+    return p == text.size();
+}
+
+bool MdQuery::Accepts(const Step& step, const MdNode* child) const {
+    for (auto& f : step.filters) {
+        if (f.index < 0) {
+            if (!f.pattern.Match(child->value)) return false;
+        } else if ((size_t)f.index >= child->children.size() || !f.pattern.Match(child->children[f.index]->value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ** может пропустить все уровни: узел, ждущий **, ждёт и следующего шага
+uint64_t MdQuery::Close(uint64_t states) const {
+    for (size_t k = 0; k < m_steps.size(); ++k) {
+        if ((states >> k & 1) && m_steps[k].kind == STEP_DEEP) states |= 1ull << (k + 1);
+    }
+    return states;
+}
+
+// Состояния ребёнка по состояниям родителя
+uint64_t MdQuery::Advance(uint64_t states, const MdNode* child, size_t childIndex) const {
+    bool isList = !child->children.empty();
+    uint64_t next = 0;
+    for (size_t k = 0; k < m_steps.size(); ++k) {
+        if (!(states >> k & 1)) continue;
+        const Step& step = m_steps[k];
+        bool match = false;
+        switch (step.kind) {
+        case STEP_DEEP:
+            if (isList) next |= 1ull << k;
+            break;
+        case STEP_ANY:
+            match = isList;
+            break;
+        case STEP_NAME:
+            match = isList && step.name.Match(child->children[0]->value);
+            break;
+        case STEP_INDEX:
+            match = childIndex == step.index;
+            break;
+        case STEP_ID:
+            break;
+        }
+        if (match && Accepts(step, child)) next |= 1ull << (k + 1);
+    }
+    return next ? Close(next) : 0;
+}
+
+bool MdQuery::Walk(const MdNode* node, uint64_t states, const MdQueryVisitor& visit, size_t& found) const {
+    const uint64_t done = 1ull << m_steps.size();
+    auto visitChild = [&](size_t i) {
+        const MdNode* child = node->children[i].get();
+        uint64_t next = Advance(states, child, i);
+        if (next & done) {
+            found++;
+            if (visit && !visit(child)) return false;
+        }
+        if ((next & ~done) && !child->children.empty()) return Walk(child, next & ~done, visit, found);
+        return true;
+    };
+
+    if (states & m_scanStates) {
+        for (size_t i = 0; i < node->children.size(); ++i) {
+            if (!visitChild(i)) return false;
+        }
+        return true;
+    }
+
+    // Ждут только шаги [n]: берём детей по индексам, не перебирая остальных
+    size_t indexes[64];
+    size_t count = 0;
+    for (size_t k = 0; k < m_steps.size(); ++k) {
+        if ((states & m_indexStates) >> k & 1) indexes[count++] = m_steps[k].index;
+    }
+    std::sort(indexes, indexes + count);
+    count = std::unique(indexes, indexes + count) - indexes;
+    for (size_t j = 0; j < count && indexes[j] < node->children.size(); ++j) {
+        if (!visitChild(indexes[j])) return false;
+    }
+    return true;
+}
+
+size_t MdQuery::ForEach(const MdNode* root, const MdObjectLookup& lookup, const MdQueryVisitor& visit) const {
+    size_t found = 0;
+    if (m_steps.empty() || !root) return 0;
+    const uint64_t done = 1ull << m_steps.size();
+
+    // Начало обхода: корень или объект из индекса
+    const MdNode* start = root;
+    uint64_t states = Close(1);
+    if (m_steps[0].kind == STEP_ID) {
+        start = lookup ? lookup(m_steps[0].name.text) : NULL;
+        if (!start || !Accepts(m_steps[0], start)) return 0;
+        states = Close(2);
+    }
+
+    if (states & done) {
+        found++;
+        if (visit && !visit(start)) return found;
+    }
+    if (states & ~done) Walk(start, states & ~done, visit, found);
+    return found;
+}
+
+size_t MdQuery::Select(const MdNode* root, const MdObjectLookup& lookup, std::vector<const MdNode*>& out) const {
+    return ForEach(root, lookup, [&out](const MdNode* node) {
+        out.push_back(node);
+        return true;
+    });
+}
+
+size_t MdQuery::Select(const MdConfig& config, std::vector<const MdNode*>& out) const {
+    std::shared_ptr<const MdNode> root = config.GetRoot();
+    return Select(root.get(), [&config](const std::string& id) { return config.FindObject(id); }, out);
+}
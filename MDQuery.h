@@ -0,0 +1,96 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "MDParser.h"
+
+class MdConfig;
+
+// ============================================================================
+// Запросы к дереву метаданных по пути
+// ============================================================================
+//
+// Путь - шаги через '/', каждый шаг выбирает детей узлов предыдущего шага:
+//   Раздел, "Head Fields" - список, первый элемент которого равен имени
+//   *                     - любой список (объект, поле, раздел)
+//   **                    - ноль и более уровней списков вглубь
+//   [n]                   - ребёнок с индексом n (список или значение)
+//   #ID                   - объект по ID из индекса анализа (только первым шагом)
+// После шага - уточнения:
+//   [n]                   - перейти к ребёнку n (то же, что шаг /[n])
+//   [n=значение]          - оставить узлы, у которых ребёнок n равен значению
+//   [=значение]           - оставить узлы со своим значением
+// Имена и значения - без кавычек или в кавычках ("" внутри - кавычка),
+// '*' в них - любая последовательность символов. Примеры:
+//   Documents/*/"Head Fields"/*[7]  - тип (ID назначения) каждого реквизита шапки документов
+//   SbCnts/*[0=1001]/Params/*[1]    - имена реквизитов справочника с ID 1001
+//   #1001/**/*[7=1002]              - поля справочника 1001, ссылающиеся на 1002
+//
+// Запрос компилируется один раз в автомат (до 63 шагов): каждому узлу при
+// обходе соответствует множество ещё не пройденных шагов, поэтому дерево
+// обходится за один проход, в ветки без активных шагов обход не спускается,
+// шаги [n] берут ребёнка по индексу. Каждый узел попадает в результат один
+// раз, в порядке обхода дерева. Скомпилированный запрос только читается и
+// может выполняться из нескольких потоков над разными деревьями.
+
+// ID объекта -> его узел (NULL - нет такого)
+typedef std::function<const MdNode*(const std::string& id)> MdObjectLookup;
+// Найденный узел; false - прекратить выполнение
+typedef std::function<bool(const MdNode* node)> MdQueryVisitor;
+
+class MdQuery {
+public:
+    MdQuery() {}
+    // Текст запроса в 1251 (как значения узлов) или в UTF-16
+    bool Compile(const std::string& text);
+    bool Compile(const std::wstring& text);
+    bool IsCompiled() const { return !m_steps.empty(); }
+    const std::wstring& GetLastError() const { return m_lastError; }
+
+    // Выполнение над деревом; без lookup шаг #ID ничего не находит.
+    // Возвращают число найденных узлов
+    size_t ForEach(const MdNode* root, const MdObjectLookup& lookup, const MdQueryVisitor& visit) const;
+    size_t Select(const MdNode* root, const MdObjectLookup& lookup, std::vector<const MdNode*>& out) const;
+    // Над опубликованной конфигурацией (MDParser::GetConfig) с её индексом объектов
+    size_t Select(const MdConfig& config, std::vector<const MdNode*>& out) const;
+
+private:
+    enum StepKind { STEP_NAME, STEP_ANY, STEP_DEEP, STEP_INDEX, STEP_ID };
+
+    // Образец значения: без '*' сравнивается целиком
+    struct Pattern {
+        std::string text;
+        bool glob = false;
+        bool Match(const std::string& value) const;
+    };
+    // Условие [n=значение]; index < 0 - значение самого узла
+    struct Filter {
+        int index;
+        Pattern pattern;
+    };
+    struct Step {
+        StepKind kind;
+        size_t index = 0; // STEP_INDEX
+        Pattern name;     // STEP_NAME, STEP_ID
+        std::vector<Filter> filters;
+    };
+
+    bool Fail(const std::wstring& error);
+    bool Accepts(const Step& step, const MdNode* child) const;
+    uint64_t Close(uint64_t states) const;
+    uint64_t Advance(uint64_t states, const MdNode* child, size_t childIndex) const;
+    bool Walk(const MdNode* node, uint64_t states, const MdQueryVisitor& visit, size_t& found) const;
+
+    std::vector<Step> m_steps;
+    uint64_t m_scanStates = 0;  // шаги, которым нужен перебор всех детей
+    uint64_t m_indexStates = 0; // шаги [n]
+    std::wstring m_lastError;
+};
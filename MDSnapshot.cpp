@@ -0,0 +1,719 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDSnapshot.h"
+#include "MDObjects.h"
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+static_assert(sizeof(MdSnapHeader) == 56, "MdSnapHeader layout");
+static_assert(sizeof(MdSnapSection) == 24, "MdSnapSection layout");
+static_assert(sizeof(MdSnapNode) == 28, "MdSnapNode layout");
+static_assert(sizeof(MdSnapObject) == 12, "MdSnapObject layout");
+static_assert(sizeof(MdSnapOle) == 32, "MdSnapOle layout");
+static_assert(sizeof(MdSnapMeta) == 24, "MdSnapMeta layout");
+static_assert(sizeof(MdSnapModelObject) == 36, "MdSnapModelObject layout");
+static_assert(sizeof(MdSnapModelField) == 40, "MdSnapModelField layout");
+static_assert(sizeof(MdRefSource) == 8, "MdRefSource layout");
+
+// ============================================================================
+// ОТОБРАЖЕНИЕ ФАЙЛА В ПАМЯТЬ
+// ============================================================================
+
+MdMappedFile::MdMappedFile()
+    : m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_data(NULL), m_size(0) {
+}
+
+MdMappedFile::~MdMappedFile() {
+    Close();
+}
+
+bool MdMappedFile::Open(const std::wstring& path) {
+    Close();
+
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m_file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    m_size = (uint64_t)size.QuadPart;
+
+    m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_mapping) {
+        Close();
+        return false;
+    }
+
+    m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MdMappedFile::Close() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_data = NULL;
+    m_mapping = NULL;
+    m_file = INVALID_HANDLE_VALUE;
+    m_size = 0;
+}
+
+// ============================================================================
+// ЧТЕНИЕ СНИМКА
+// ============================================================================
+
+MdSnapshotReader::MdSnapshotReader()
+    : m_header(NULL), m_sections(NULL),
+      m_strings(NULL), m_stringsSize(0), m_atoms(NULL), m_atomCount(0),
+      m_nodes(NULL), m_nodeCount(0), m_objects(NULL), m_objectCount(0),
+      m_refs(NULL), m_refCount(0), m_types(NULL), m_typeCount(0),
+      m_ole(NULL), m_oleCount(0), m_wstrings(NULL), m_wstringsSize(0), m_meta(NULL),
+      m_modelObjects(NULL), m_modelObjectCount(0), m_modelFields(NULL), m_modelFieldCount(0),
+      m_modelText(NULL), m_modelTextSize(0), m_rrefTargets(NULL), m_rrefTargetCount(0),
+      m_rrefOffsets(NULL), m_rrefOffsetCount(0), m_rrefSources(NULL), m_rrefSourceCount(0),
+      m_rrefNames(NULL), m_rrefNameCount(0), m_hasAnalysis(false), m_treeBuilt(false) {
+}
+
+const MdSnapSection* MdSnapshotReader::FindSection(uint32_t id, size_t elemSize) const {
+    for (uint32_t i = 0; i < m_header->sectionCount; ++i) {
+        const MdSnapSection& s = m_sections[i];
+        if (s.id != id) continue;
+        if (s.elemSize != elemSize) return NULL;
+        uint64_t fileSize = m_file.Size();
+        if (s.offset > fileSize || s.count > (fileSize - s.offset) / elemSize) return NULL;
+        return &s;
+    }
+    return NULL;
+}
+
+std::shared_ptr<MdSnapshotReader> MdSnapshotReader::Open(const std::wstring& path, std::wstring* error) {
+    std::shared_ptr<MdSnapshotReader> r(new MdSnapshotReader());
+    std::wstring dummy;
+    std::wstring& err = error ? *error : dummy;
+
+    if (!r->m_file.Open(path)) {
+        err = L"Не удалось открыть снимок";
+        return nullptr;
+    }
+
+    const char* base = r->m_file.Data();
+    uint64_t fileSize = r->m_file.Size();
+    if (fileSize < sizeof(MdSnapHeader)) {
+        err = L"Снимок повреждён (заголовок)";
+        return nullptr;
+    }
+
+    const MdSnapHeader* h = (const MdSnapHeader*)base;
+    if (memcmp(h->magic, "MDSN", 4) != 0) {
+        err = L"Файл не является снимком метаданных";
+        return nullptr;
+    }
+    if (h->endianTag != MD_SNAP_ENDIAN_TAG) {
+        err = L"Неподдерживаемый порядок байт снимка";
+        return nullptr;
+    }
+    if (h->versionMajor != MD_SNAP_VERSION_MAJOR) {
+        err = L"Неподдерживаемая версия снимка: " + std::to_wstring(h->versionMajor);
+        return nullptr;
+    }
+    if (h->fileSize != fileSize ||
+        h->sectionCount > (fileSize - sizeof(MdSnapHeader)) / sizeof(MdSnapSection)) {
+        err = L"Снимок повреждён (размер)";
+        return nullptr;
+    }
+
+    r->m_header = h;
+    r->m_sections = (const MdSnapSection*)(base + sizeof(MdSnapHeader));
+
+    const MdSnapSection* strings = r->FindSection(MD_SNAP_STRINGS, 1);
+    const MdSnapSection* atoms = r->FindSection(MD_SNAP_ATOMS, sizeof(MdSnapAtom));
+    const MdSnapSection* meta = r->FindSection(MD_SNAP_META, sizeof(MdSnapMeta));
+    if (!strings || !atoms || !meta || meta->count != 1 || atoms->count == 0) {
+        err = L"Снимок повреждён (нет обязательных секций)";
+        return nullptr;
+    }
+
+    r->m_strings = base + strings->offset;
+    r->m_stringsSize = strings->count;
+    r->m_atoms = (const MdSnapAtom*)(base + atoms->offset);
+    r->m_atomCount = (uint32_t)atoms->count;
+    r->m_meta = (const MdSnapMeta*)(base + meta->offset);
+
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_NODES, sizeof(MdSnapNode))) {
+        r->m_nodes = (const MdSnapNode*)(base + s->offset);
+        r->m_nodeCount = (uint32_t)s->count;
+    }
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_OBJECTS, sizeof(MdSnapObject))) {
+        r->m_objects = (const MdSnapObject*)(base + s->offset);
+        r->m_objectCount = (uint32_t)s->count;
+    }
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_REFS, sizeof(MdSnapRef))) {
+        r->m_refs = (const MdSnapRef*)(base + s->offset);
+        r->m_refCount = (uint32_t)s->count;
+    }
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_TYPES, sizeof(MdSnapRef))) {
+        r->m_types = (const MdSnapRef*)(base + s->offset);
+        r->m_typeCount = (uint32_t)s->count;
+    }
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_OLE, sizeof(MdSnapOle))) {
+        r->m_ole = (const MdSnapOle*)(base + s->offset);
+        r->m_oleCount = (uint32_t)s->count;
+    }
+    if (const MdSnapSection* s = r->FindSection(MD_SNAP_WSTRINGS, sizeof(WCHAR))) {
+        r->m_wstrings = (const WCHAR*)(base + s->offset);
+        r->m_wstringsSize = s->count;
+    }
+    if (r->m_meta->oleRootCount > r->m_oleCount) {
+        err = L"Снимок повреждён (структура OLE)";
+        return nullptr;
+    }
+
+    const MdSnapSection* objects = r->FindSection(MD_SNAP_MODEL_OBJECTS, sizeof(MdSnapModelObject));
+    const MdSnapSection* fields = r->FindSection(MD_SNAP_MODEL_FIELDS, sizeof(MdSnapModelField));
+    const MdSnapSection* text = r->FindSection(MD_SNAP_MODEL_TEXT, 1);
+    const MdSnapSection* targets = r->FindSection(MD_SNAP_RREF_TARGETS, sizeof(uint32_t));
+    const MdSnapSection* offsets = r->FindSection(MD_SNAP_RREF_OFFSETS, sizeof(uint32_t));
+    const MdSnapSection* sources = r->FindSection(MD_SNAP_RREF_SOURCES, sizeof(MdRefSource));
+    const MdSnapSection* names = r->FindSection(MD_SNAP_RREF_NAMES, sizeof(uint32_t));
+    if (objects && fields && text && targets && offsets && sources && names) {
+        r->m_modelObjects = (const MdSnapModelObject*)(base + objects->offset);
+        r->m_modelObjectCount = (uint32_t)objects->count;
+        r->m_modelFields = (const MdSnapModelField*)(base + fields->offset);
+        r->m_modelFieldCount = (uint32_t)fields->count;
+        r->m_modelText = base + text->offset;
+        r->m_modelTextSize = text->count;
+        r->m_rrefTargets = (const uint32_t*)(base + targets->offset);
+        r->m_rrefTargetCount = (uint32_t)targets->count;
+        r->m_rrefOffsets = (const uint32_t*)(base + offsets->offset);
+        r->m_rrefOffsetCount = (uint32_t)offsets->count;
+        r->m_rrefSources = (const MdRefSource*)(base + sources->offset);
+        r->m_rrefSourceCount = (uint32_t)sources->count;
+        r->m_rrefNames = (const uint32_t*)(base + names->offset);
+        r->m_rrefNameCount = (uint32_t)names->count;
+        // Повреждённый анализ не ошибка: он повторяется по дереву
+        r->m_hasAnalysis = r->CheckAnalysis();
+    }
+    return r;
+}
+
+std::wstring MdSnapshotReader::SourcePath() const {
+    if ((uint64_t)m_meta->sourcePathOff + m_meta->sourcePathLen > m_wstringsSize) return L"";
+    return std::wstring(m_wstrings + m_meta->sourcePathOff, m_meta->sourcePathLen);
+}
+
+MdStrRef MdSnapshotReader::Atom(uint32_t atom) const {
+    MdStrRef ref = { "", 0 };
+    if (atom >= m_atomCount) return ref;
+    const MdSnapAtom& a = m_atoms[atom];
+    if ((uint64_t)a.off + a.len > m_stringsSize) return ref;
+    ref.data = m_strings + a.off;
+    ref.len = a.len;
+    return ref;
+}
+
+int MdSnapshotReader::CompareAtom(uint32_t atom, const std::string& key) const {
+    // Порядок как у std::map<std::string>: побайтово, затем по длине
+    MdStrRef a = Atom(atom);
+    size_t common = (std::min)((size_t)a.len, key.size());
+    int cmp = memcmp(a.data, key.data(), common);
+    if (cmp != 0) return cmp;
+    if (a.len == key.size()) return 0;
+    return a.len < key.size() ? -1 : 1;
+}
+
+const MdSnapObject* MdSnapshotReader::FindObject(const std::string& id) const {
+    size_t lo = 0, hi = m_objectCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = CompareAtom(m_objects[mid].id, id);
+        if (cmp == 0) return &m_objects[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+const MdSnapRef* MdSnapshotReader::FindRef(const MdSnapRef* refs, uint32_t count, const std::string& key) const {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = CompareAtom(refs[mid].key, key);
+        if (cmp == 0) return &refs[mid];
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+bool MdSnapshotReader::FindObjectType(const std::string& id, std::string& type) const {
+    const MdSnapRef* p = FindRef(m_types, m_typeCount, id);
+    if (!p) return false;
+    type = Atom(p->value).str();
+    return true;
+}
+
+bool MdSnapshotReader::FindFieldRef(const std::string& id, std::string& ref) const {
+    const MdSnapRef* p = FindRef(m_refs, m_refCount, id);
+    if (!p) return false;
+    ref = Atom(p->value).str();
+    return true;
+}
+
+void MdSnapshotReader::RestoreOle(uint32_t index, OLEEntry& entry) const {
+    const MdSnapOle& o = m_ole[index];
+    if ((uint64_t)o.nameOff + o.nameLen <= m_wstringsSize) entry.name.assign(m_wstrings + o.nameOff, o.nameLen);
+    if ((uint64_t)o.pathOff + o.pathLen <= m_wstringsSize) entry.fullPath.assign(m_wstrings + o.pathOff, o.pathLen);
+    entry.size = o.size;
+    entry.isFolder = o.isFolder != 0;
+    entry.children.clear();
+    if ((uint64_t)o.firstChild + o.childCount > m_oleCount || o.firstChild <= index) return;
+    entry.children.resize(o.childCount);
+    for (uint32_t i = 0; i < o.childCount; ++i) RestoreOle(o.firstChild + i, entry.children[i]);
+}
+
+void MdSnapshotReader::RestoreEntries(std::vector<OLEEntry>& entries) const {
+    entries.clear();
+    entries.resize(m_meta->oleRootCount);
+    for (uint32_t i = 0; i < m_meta->oleRootCount; ++i) RestoreOle(i, entries[i]);
+}
+
+void MdSnapshotReader::RestoreMaps(std::map<std::string, std::string>& idToType,
+                                   std::map<std::string, std::string>& fieldToRef) const {
+    idToType.clear();
+    fieldToRef.clear();
+    for (uint32_t i = 0; i < m_typeCount; ++i)
+        idToType.emplace_hint(idToType.end(), Atom(m_types[i].key).str(), Atom(m_types[i].value).str());
+    for (uint32_t i = 0; i < m_refCount; ++i)
+        fieldToRef.emplace_hint(fieldToRef.end(), Atom(m_refs[i].key).str(), Atom(m_refs[i].value).str());
+}
+
+// Все индексы и строки модели и обратного индекса - в своих границах
+bool MdSnapshotReader::CheckAnalysis() const {
+    for (uint32_t i = 0; i < m_modelObjectCount; ++i) {
+        const MdSnapModelObject& o = m_modelObjects[i];
+        if ((uint64_t)o.identOff + o.identLen > m_modelTextSize || (uint64_t)o.synOff + o.synLen > m_modelTextSize ||
+            (uint64_t)o.firstField + o.fieldCount > m_modelFieldCount)
+            return false;
+    }
+    for (uint32_t i = 0; i < m_modelFieldCount; ++i) {
+        const MdSnapModelField& f = m_modelFields[i];
+        if ((uint64_t)f.identOff + f.identLen > m_modelTextSize || (uint64_t)f.synOff + f.synLen > m_modelTextSize ||
+            (f.owner != MD_MODEL_NONE && f.owner >= m_modelObjectCount))
+            return false;
+    }
+    if (m_rrefOffsetCount != m_rrefTargetCount + 1 || m_rrefOffsets[0] != 0 ||
+        m_rrefOffsets[m_rrefTargetCount] != m_rrefSourceCount)
+        return false;
+    for (uint32_t i = 0; i < m_rrefTargetCount; ++i) {
+        if (m_rrefOffsets[i] > m_rrefOffsets[i + 1]) return false;
+    }
+    for (uint32_t i = 0; i < m_rrefSourceCount; ++i) {
+        const MdRefSource& src = m_rrefSources[i];
+        if (src.field >= m_rrefNameCount || (src.owner != MD_REF_NO_OWNER && src.owner >= m_rrefNameCount))
+            return false;
+    }
+    return true;
+}
+
+bool MdSnapshotReader::RestoreAnalysis(std::shared_ptr<const MdObjectModel>& model, MdRefIndex& refIndex) const {
+    model.reset();
+    refIndex.Clear();
+    if (!m_hasAnalysis) return false;
+
+    std::shared_ptr<MdObjectModel> m = std::make_shared<MdObjectModel>();
+    m->text.assign(m_modelText, (size_t)m_modelTextSize);
+    m->objects.resize(m_modelObjectCount);
+    for (uint32_t i = 0; i < m_modelObjectCount; ++i) {
+        const MdSnapModelObject& src = m_modelObjects[i];
+        MdObjectInfo& o = m->objects[i];
+        o.id = src.id;
+        o.identifier.offset = src.identOff;
+        o.identifier.length = src.identLen;
+        o.synonym.offset = src.synOff;
+        o.synonym.length = src.synLen;
+        o.firstField = src.firstField;
+        o.fieldCount = src.fieldCount;
+        o.prefix = MdFindTypePrefix(Atom(src.prefix));
+        o.kind = src.kind;
+        o.periodicity = src.periodicity;
+    }
+    m->fields.resize(m_modelFieldCount);
+    for (uint32_t i = 0; i < m_modelFieldCount; ++i) {
+        const MdSnapModelField& src = m_modelFields[i];
+        MdFieldInfo& f = m->fields[i];
+        f.id = src.id;
+        f.owner = src.owner;
+        f.refTarget = src.refTarget;
+        f.identifier.offset = src.identOff;
+        f.identifier.length = src.identLen;
+        f.synonym.offset = src.synOff;
+        f.synonym.length = src.synLen;
+        f.length = src.length;
+        f.precision = src.precision;
+        f.typeCode = src.typeCode;
+        f.list = src.list;
+        f.periodic = src.periodic;
+    }
+    m->BuildIndex();
+    model = m;
+
+    refIndex.targets.reserve(m_rrefTargetCount);
+    for (uint32_t i = 0; i < m_rrefTargetCount; ++i) refIndex.targets.push_back(Atom(m_rrefTargets[i]).str());
+    refIndex.offsets.assign(m_rrefOffsets, m_rrefOffsets + m_rrefOffsetCount);
+    refIndex.sources.assign(m_rrefSources, m_rrefSources + m_rrefSourceCount);
+    refIndex.names.reserve(m_rrefNameCount);
+    for (uint32_t i = 0; i < m_rrefNameCount; ++i) refIndex.names.push_back(Atom(m_rrefNames[i]).str());
+    return true;
+}
+
+void MdSnapshotReader::BuildTree() const {
+    if (!HasRoot()) return;
+    std::vector<std::shared_ptr<MdNode>> nodes(m_nodeCount);
+    for (uint32_t i = 0; i < m_nodeCount; ++i) {
+        const MdSnapNode& src = m_nodes[i];
+        auto node = std::make_shared<MdNode>();
+        MdStrRef v = Atom(src.value);
+        node->value.assign(v.data, v.len);
+        node->kind = (MdNodeKind)src.kind;
+        node->flags = src.flags;
+        if (src.wsBefore) node->wsBefore = Atom(src.wsBefore).str();
+        if (src.wsAfter) node->wsAfter = Atom(src.wsAfter).str();
+        if (src.wsClose) node->wsClose = Atom(src.wsClose).str();
+        nodes[i] = node;
+    }
+    for (uint32_t i = 0; i < m_nodeCount; ++i) {
+        const MdSnapNode& src = m_nodes[i];
+        if ((uint64_t)src.firstChild + src.childCount > m_nodeCount || (src.childCount && src.firstChild <= i)) continue;
+        auto& children = nodes[i]->children;
+        children.reserve(src.childCount);
+        for (uint32_t c = 0; c < src.childCount; ++c) children.push_back(nodes[src.firstChild + c]);
+    }
+    m_objectNodes.resize(m_objectCount);
+    for (uint32_t i = 0; i < m_objectCount; ++i) {
+        if (m_objects[i].node < m_nodeCount) m_objectNodes[i] = nodes[m_objects[i].node];
+    }
+    m_tree = nodes[0];
+}
+
+std::shared_ptr<MdNode> MdSnapshotReader::GetTree() const {
+    std::lock_guard<std::mutex> lock(m_treeLock);
+    if (!m_treeBuilt) {
+        BuildTree();
+        m_treeBuilt = true;
+    }
+    return m_tree;
+}
+
+const MdNode* MdSnapshotReader::ObjectNode(uint32_t i) const {
+    if (i >= m_objectCount || !GetTree()) return NULL;
+    return m_objectNodes[i].get();
+}
+
+const MdNode* MdSnapshotReader::FindObjectNode(const std::string& id) const {
+    const MdSnapObject* o = FindObject(id);
+    return o ? ObjectNode((uint32_t)(o - m_objects)) : NULL;
+}
+
+void MdSnapshotReader::Materialize(std::shared_ptr<MdNode>& root,
+                                   std::map<std::string, std::shared_ptr<MdNode>>& objectIndex) const {
+    objectIndex.clear();
+    root = GetTree();
+    if (!root) return;
+    for (uint32_t i = 0; i < m_objectCount; ++i) {
+        if (m_objectNodes[i]) objectIndex.emplace_hint(objectIndex.end(), Atom(m_objects[i].id).str(), m_objectNodes[i]);
+    }
+}
+
+// ============================================================================
+// ЗАПИСЬ СНИМКА
+// ============================================================================
+
+namespace {
+
+// Таблица атомов: одинаковые строки (значения, ID, пробелы) хранятся один раз
+class AtomTable {
+public:
+    AtomTable() { Add(std::string()); }
+
+    uint32_t Add(const std::string& s) {
+        auto it = m_index.find(s);
+        if (it != m_index.end()) return it->second;
+        MdSnapAtom a;
+        a.off = (uint32_t)m_strings.size();
+        a.len = (uint32_t)s.size();
+        m_strings += s;
+        uint32_t id = (uint32_t)m_atoms.size();
+        m_atoms.push_back(a);
+        m_index.emplace(s, id);
+        return id;
+    }
+
+    const std::string& Strings() const { return m_strings; }
+    const std::vector<MdSnapAtom>& Atoms() const { return m_atoms; }
+
+private:
+    std::string m_strings;
+    std::vector<MdSnapAtom> m_atoms;
+    std::unordered_map<std::string, uint32_t> m_index;
+};
+
+uint32_t AddWString(std::wstring& wblob, const std::wstring& s) {
+    uint32_t off = (uint32_t)wblob.size();
+    wblob += s;
+    return off;
+}
+
+class SnapshotBuilder {
+public:
+    void AddSection(uint32_t id, const void* data, size_t elemSize, size_t count) {
+        while (m_body.size() % 8) m_body += '\0';
+        MdSnapSection s;
+        s.id = id;
+        s.elemSize = (uint32_t)elemSize;
+        s.offset = m_body.size(); // относительно начала тела, поправляется в Finish
+        s.count = count;
+        m_sections.push_back(s);
+        if (count) m_body.append((const char*)data, elemSize * count);
+    }
+
+    template <class T>
+    void AddSection(uint32_t id, const std::vector<T>& items) {
+        AddSection(id, items.empty() ? NULL : items.data(), sizeof(T), items.size());
+    }
+
+    std::string Finish(const MdFileFingerprint& source) {
+        size_t headerSize = sizeof(MdSnapHeader) + m_sections.size() * sizeof(MdSnapSection);
+        size_t bodyStart = (headerSize + 7) & ~(size_t)7;
+        for (auto& s : m_sections) s.offset += bodyStart;
+
+        MdSnapHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "MDSN", 4);
+        h.versionMajor = MD_SNAP_VERSION_MAJOR;
+        h.versionMinor = MD_SNAP_VERSION_MINOR;
+        h.endianTag = MD_SNAP_ENDIAN_TAG;
+        h.fileSize = bodyStart + m_body.size();
+        h.source = source;
+        h.sectionCount = (uint32_t)m_sections.size();
+
+        std::string out;
+        out.reserve((size_t)h.fileSize);
+        out.append((const char*)&h, sizeof(h));
+        if (!m_sections.empty()) out.append((const char*)m_sections.data(), m_sections.size() * sizeof(MdSnapSection));
+        out.resize(bodyStart, '\0');
+        out += m_body;
+        return out;
+    }
+
+private:
+    std::vector<MdSnapSection> m_sections;
+    std::string m_body;
+};
+
+bool WriteWholeFile(const std::wstring& path, const std::string& data) {
+    HANDLE hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) return false;
+
+    bool ok = true;
+    size_t pos = 0;
+    while (ok && pos < data.size()) {
+        DWORD chunk = (DWORD)(std::min)(data.size() - pos, (size_t)(64 << 20));
+        DWORD written = 0;
+        ok = WriteFile(hFile, data.data() + pos, chunk, &written, NULL) && written == chunk;
+        pos += chunk;
+    }
+    CloseHandle(hFile);
+    if (!ok) DeleteFileW(path.c_str());
+    return ok;
+}
+
+} // namespace
+
+bool MdReplaceFile(const std::wstring& path, const std::string& data) {
+    // Пишем во временный файл и подменяем: читатель не увидит половину файла
+    std::wstring tmpPath = path + L".tmp";
+    if (!WriteWholeFile(tmpPath, data)) return false;
+    if (!MoveFileExW(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool MdWriteSnapshot(const std::wstring& path, const MdFileFingerprint& source, const std::wstring& sourcePath,
+                     const MdNode* root, const std::vector<OLEEntry>& entries,
+                     const std::map<std::string, std::shared_ptr<MdNode>>& objectIndex,
+                     const std::map<std::string, std::string>& idToType,
+                     const std::map<std::string, std::string>& fieldToRef,
+                     const MdRefIndex& refIndex, const MdObjectModel* model,
+                     const std::string& metaPrefix, const std::string& metaSuffix) {
+    AtomTable atoms;
+    std::wstring wstrings;
+
+    // Дерево: обход в ширину, дети каждого узла получают соседние индексы
+    std::vector<MdSnapNode> nodes;
+    std::unordered_map<const MdNode*, uint32_t> nodeIds;
+    if (root) {
+        std::vector<const MdNode*> order;
+        order.push_back(root);
+        nodeIds[root] = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            const MdNode* node = order[i];
+            MdSnapNode n;
+            memset(&n, 0, sizeof(n));
+            n.value = atoms.Add(node->value);
+            n.wsBefore = atoms.Add(node->wsBefore);
+            n.wsAfter = atoms.Add(node->wsAfter);
+            n.wsClose = atoms.Add(node->wsClose);
+            n.kind = node->kind;
+            n.flags = node->flags;
+            n.firstChild = (uint32_t)order.size();
+            n.childCount = (uint32_t)node->children.size();
+            for (auto& child : node->children) {
+                nodeIds[child.get()] = (uint32_t)order.size();
+                order.push_back(child.get());
+            }
+            nodes.push_back(n);
+        }
+    }
+
+    // Индексы по ID: std::map уже отсортирован побайтово
+    std::vector<MdSnapObject> objects;
+    objects.reserve(objectIndex.size());
+    for (auto& kv : objectIndex) {
+        MdSnapObject o;
+        o.id = atoms.Add(kv.first);
+        auto itNode = nodeIds.find(kv.second.get());
+        o.node = itNode != nodeIds.end() ? itNode->second : MD_SNAP_NONE;
+        auto itType = idToType.find(kv.first);
+        o.type = itType != idToType.end() ? atoms.Add(itType->second) : MD_SNAP_NONE;
+        objects.push_back(o);
+    }
+
+    std::vector<MdSnapRef> types, refs;
+    types.reserve(idToType.size());
+    for (auto& kv : idToType) {
+        MdSnapRef r = { atoms.Add(kv.first), atoms.Add(kv.second) };
+        types.push_back(r);
+    }
+    refs.reserve(fieldToRef.size());
+    for (auto& kv : fieldToRef) {
+        MdSnapRef r = { atoms.Add(kv.first), atoms.Add(kv.second) };
+        refs.push_back(r);
+    }
+
+    // Модель и обратный индекс: читатель берёт их как есть, без прохода по дереву
+    std::vector<MdSnapModelObject> modelObjects;
+    std::vector<MdSnapModelField> modelFields;
+    std::vector<uint32_t> rrefTargets, rrefNames;
+    if (model) {
+        modelObjects.reserve(model->objects.size());
+        for (auto& o : model->objects) {
+            MdSnapModelObject m;
+            memset(&m, 0, sizeof(m));
+            m.id = o.id;
+            m.identOff = o.identifier.offset;
+            m.identLen = o.identifier.length;
+            m.synOff = o.synonym.offset;
+            m.synLen = o.synonym.length;
+            m.firstField = o.firstField;
+            m.fieldCount = o.fieldCount;
+            m.prefix = atoms.Add(o.prefix ? o.prefix : "");
+            m.kind = o.kind;
+            m.periodicity = o.periodicity;
+            modelObjects.push_back(m);
+        }
+        modelFields.reserve(model->fields.size());
+        for (auto& f : model->fields) {
+            MdSnapModelField m;
+            memset(&m, 0, sizeof(m));
+            m.id = f.id;
+            m.owner = f.owner;
+            m.refTarget = f.refTarget;
+            m.identOff = f.identifier.offset;
+            m.identLen = f.identifier.length;
+            m.synOff = f.synonym.offset;
+            m.synLen = f.synonym.length;
+            m.length = f.length;
+            m.precision = f.precision;
+            m.typeCode = f.typeCode;
+            m.list = f.list;
+            m.periodic = f.periodic;
+            modelFields.push_back(m);
+        }
+        rrefTargets.reserve(refIndex.targets.size());
+        for (auto& target : refIndex.targets) rrefTargets.push_back(atoms.Add(target));
+        rrefNames.reserve(refIndex.names.size());
+        for (auto& name : refIndex.names) rrefNames.push_back(atoms.Add(name));
+    }
+
+    // Структура OLE: в ширину, корневые элементы - первые
+    std::vector<MdSnapOle> ole;
+    std::deque<const OLEEntry*> queue;
+    for (auto& e : entries) queue.push_back(&e);
+    uint32_t nextIndex = (uint32_t)entries.size();
+    while (!queue.empty()) {
+        const OLEEntry* e = queue.front();
+        queue.pop_front();
+        MdSnapOle o;
+        o.nameLen = (uint32_t)e->name.size();
+        o.nameOff = AddWString(wstrings, e->name);
+        o.pathLen = (uint32_t)e->fullPath.size();
+        o.pathOff = AddWString(wstrings, e->fullPath);
+        o.size = e->size;
+        o.isFolder = e->isFolder ? 1 : 0;
+        o.firstChild = nextIndex;
+        o.childCount = (uint32_t)e->children.size();
+        nextIndex += o.childCount;
+        for (auto& c : e->children) queue.push_back(&c);
+        ole.push_back(o);
+    }
+
+    MdSnapMeta meta;
+    memset(&meta, 0, sizeof(meta));
+    meta.hasRoot = root ? 1 : 0;
+    meta.oleRootCount = (uint32_t)entries.size();
+    meta.metaPrefix = atoms.Add(metaPrefix);
+    meta.metaSuffix = atoms.Add(metaSuffix);
+    meta.sourcePathLen = (uint32_t)sourcePath.size();
+    meta.sourcePathOff = AddWString(wstrings, sourcePath);
+
+    SnapshotBuilder builder;
+    builder.AddSection(MD_SNAP_META, &meta, sizeof(meta), 1);
+    builder.AddSection(MD_SNAP_ATOMS, atoms.Atoms());
+    builder.AddSection(MD_SNAP_NODES, nodes);
+    builder.AddSection(MD_SNAP_OBJECTS, objects);
+    builder.AddSection(MD_SNAP_TYPES, types);
+    builder.AddSection(MD_SNAP_REFS, refs);
+    builder.AddSection(MD_SNAP_OLE, ole);
+    if (model) {
+        // Пустой индекс (анализ без ссылок) всё равно хранит границу строк
+        std::vector<uint32_t> offsets = refIndex.offsets;
+        if (offsets.empty()) offsets.push_back(0);
+        builder.AddSection(MD_SNAP_MODEL_OBJECTS, modelObjects);
+        builder.AddSection(MD_SNAP_MODEL_FIELDS, modelFields);
+        builder.AddSection(MD_SNAP_MODEL_TEXT, model->text.data(), 1, model->text.size());
+        builder.AddSection(MD_SNAP_RREF_TARGETS, rrefTargets);
+        builder.AddSection(MD_SNAP_RREF_OFFSETS, offsets);
+        builder.AddSection(MD_SNAP_RREF_SOURCES, refIndex.sources);
+        builder.AddSection(MD_SNAP_RREF_NAMES, rrefNames);
+    }
+    builder.AddSection(MD_SNAP_WSTRINGS, wstrings.data(), sizeof(WCHAR), wstrings.size());
+    builder.AddSection(MD_SNAP_STRINGS, atoms.Strings().data(), 1, atoms.Strings().size());
+    std::string out = builder.Finish(source);
+
+    return MdReplaceFile(path, out);
+}
@@ -0,0 +1,270 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <windows.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "MDParser.h"
+
+// ============================================================================
+// Бинарный снимок разобранной конфигурации (*.mdsnap)
+// ============================================================================
+//
+// Формат стабилен и версионирован, все ссылки - смещения и индексы, поэтому
+// файл используется прямо из отображения в память без десериализации.
+// Порядок байт - little-endian (проверяется по endianTag).
+//
+//   [MdSnapHeader][MdSnapSection x sectionCount][секции, выровнены по 8]
+//
+// Читатель пропускает неизвестные секции; при добавлении секций растёт
+// versionMinor, при несовместимых изменениях - versionMajor.
+
+const uint32_t MD_SNAP_VERSION_MAJOR = 1;
+const uint32_t MD_SNAP_VERSION_MINOR = 1;
+const uint32_t MD_SNAP_ENDIAN_TAG = 0x01020304;
+const uint32_t MD_SNAP_NONE = 0xFFFFFFFF;
+
+// Идентификаторы секций
+enum MdSnapSectionId {
+    MD_SNAP_STRINGS  = 1, // char[]: тела строк-атомов (1251)
+    MD_SNAP_ATOMS    = 2, // MdSnapAtom[]: таблица атомов, атом 0 - пустая строка
+    MD_SNAP_NODES    = 3, // MdSnapNode[]: дерево в порядке обхода в ширину
+    MD_SNAP_OBJECTS  = 4, // MdSnapObject[]: ID объекта -> узел и тип, отсортировано по ID
+    MD_SNAP_REFS     = 5, // MdSnapRef[]: ID поля -> ID типа назначения, отсортировано
+    MD_SNAP_TYPES    = 6, // MdSnapRef[]: ID объекта -> префикс типа, отсортировано
+    MD_SNAP_OLE      = 7, // MdSnapOle[]: структура контейнера, корневые элементы первыми
+    MD_SNAP_WSTRINGS = 8, // WCHAR[]: имена и пути OLE
+    MD_SNAP_META     = 9, // MdSnapMeta: корень, префикс/суффикс потока, исходный файл
+    // Результаты анализа (с версии 1.1; нет - анализ повторяется по дереву)
+    MD_SNAP_MODEL_OBJECTS = 10, // MdSnapModelObject[]: объекты модели (MDObjects.h)
+    MD_SNAP_MODEL_FIELDS  = 11, // MdSnapModelField[]: поля модели
+    MD_SNAP_MODEL_TEXT    = 12, // char[]: идентификаторы и синонимы модели
+    MD_SNAP_RREF_TARGETS  = 13, // uint32_t[]: обратный индекс - атомы типов назначения
+    MD_SNAP_RREF_OFFSETS  = 14, // uint32_t[]: границы строк (targets + 1)
+    MD_SNAP_RREF_SOURCES  = 15, // MdRefSource[]: поля и владельцы
+    MD_SNAP_RREF_NAMES    = 16  // uint32_t[]: атомы ID полей и владельцев
+};
+
+#pragma pack(push, 4)
+
+// Отпечаток исходного файла: размер + время изменения + хеш содержимого
+struct MdFileFingerprint {
+    uint64_t size;
+    uint64_t writeTime;
+    uint64_t contentHash;
+};
+
+struct MdSnapHeader {
+    char     magic[4];        // "MDSN"
+    uint32_t versionMajor;
+    uint32_t versionMinor;
+    uint32_t endianTag;
+    uint64_t fileSize;
+    MdFileFingerprint source; // отпечаток .md, из которого сделан снимок
+    uint32_t sectionCount;
+    uint32_t reserved;
+};
+
+struct MdSnapSection {
+    uint32_t id;
+    uint32_t elemSize; // размер элемента (для проверки совместимости)
+    uint64_t offset;
+    uint64_t count;    // число элементов
+};
+
+struct MdSnapAtom {
+    uint32_t off, len; // в MD_SNAP_STRINGS
+};
+
+struct MdSnapNode {
+    uint32_t value;                      // атом
+    uint32_t firstChild, childCount;
+    uint32_t wsBefore, wsAfter, wsClose; // атомы форматирования
+    uint8_t  kind, flags;
+    uint16_t reserved;
+};
+
+struct MdSnapObject {
+    uint32_t id;   // атом
+    uint32_t node; // индекс узла или MD_SNAP_NONE
+    uint32_t type; // атом префикса типа (DT/SC/RG...) или MD_SNAP_NONE
+};
+
+struct MdSnapRef {
+    uint32_t key, value; // атомы
+};
+
+struct MdSnapOle {
+    uint32_t nameOff, nameLen; // в MD_SNAP_WSTRINGS
+    uint32_t pathOff, pathLen;
+    uint32_t size;
+    uint32_t isFolder;
+    uint32_t firstChild, childCount;
+};
+
+struct MdSnapMeta {
+    uint32_t hasRoot;
+    uint32_t oleRootCount;
+    uint32_t metaPrefix, metaSuffix; // атомы
+    uint32_t sourcePathOff, sourcePathLen; // в MD_SNAP_WSTRINGS
+};
+
+struct MdSnapModelObject {
+    uint32_t id;
+    uint32_t identOff, identLen; // в MD_SNAP_MODEL_TEXT
+    uint32_t synOff, synLen;
+    uint32_t firstField, fieldCount;
+    uint32_t prefix;             // атом префикса типа
+    uint8_t  kind, periodicity;
+    uint16_t reserved;
+};
+
+struct MdSnapModelField {
+    uint32_t id, owner, refTarget;
+    uint32_t identOff, identLen;
+    uint32_t synOff, synLen;
+    uint32_t length;
+    uint16_t precision;
+    char     typeCode;
+    uint8_t  list, periodic;
+    uint8_t  reserved[3];
+};
+
+#pragma pack(pop)
+
+// Ссылка на строку внутри снимка
+struct MdStrRef {
+    const char* data;
+    uint32_t len;
+    std::string str() const { return std::string(data, len); }
+    bool operator==(const std::string& s) const { return s.size() == len && memcmp(s.data(), data, len) == 0; }
+};
+
+// Файл, отображённый в память только для чтения
+class MdMappedFile {
+public:
+    MdMappedFile();
+    ~MdMappedFile();
+
+    bool Open(const std::wstring& path);
+    void Close();
+
+    const char* Data() const { return m_data; }
+    uint64_t Size() const { return m_size; }
+
+private:
+    MdMappedFile(const MdMappedFile&);
+    MdMappedFile& operator=(const MdMappedFile&);
+
+    HANDLE m_file;
+    HANDLE m_mapping;
+    const char* m_data;
+    uint64_t m_size;
+};
+
+// === Чтение ===
+class MdSnapshotReader {
+public:
+    // Открывает и проверяет снимок; nullptr при ошибке (error - причина)
+    static std::shared_ptr<MdSnapshotReader> Open(const std::wstring& path, std::wstring* error = NULL);
+
+    const MdFileFingerprint& Source() const { return m_header->source; }
+    std::wstring SourcePath() const;
+    uint32_t VersionMinor() const { return m_header->versionMinor; }
+
+    // Атомы
+    uint32_t AtomCount() const { return m_atomCount; }
+    MdStrRef Atom(uint32_t atom) const;
+
+    // Узлы (0 - корень)
+    bool HasRoot() const { return m_meta->hasRoot != 0 && m_nodeCount > 0; }
+    uint32_t NodeCount() const { return m_nodeCount; }
+    const MdSnapNode& Node(uint32_t index) const { return m_nodes[index]; }
+    MdStrRef NodeValue(uint32_t index) const { return Atom(m_nodes[index].value); }
+
+    // Индексы по ID (двоичный поиск)
+    const MdSnapObject* FindObject(const std::string& id) const;
+    bool FindObjectType(const std::string& id, std::string& type) const;
+    bool FindFieldRef(const std::string& id, std::string& ref) const;
+    uint32_t ObjectCount() const { return m_objectCount; }
+    const MdSnapObject& Object(uint32_t i) const { return m_objects[i]; }
+
+    // Префикс и суффикс потока метаданных вокруг корня
+    MdStrRef MetaPrefix() const { return Atom(m_meta->metaPrefix); }
+    MdStrRef MetaSuffix() const { return Atom(m_meta->metaSuffix); }
+
+    // Восстановление структур MDParser
+    void RestoreEntries(std::vector<OLEEntry>& entries) const;
+    void RestoreMaps(std::map<std::string, std::string>& idToType,
+                     std::map<std::string, std::string>& fieldToRef) const;
+    // Модель и обратный индекс; false - в снимке их нет (версия 1.0) или они повреждены
+    bool HasAnalysis() const { return m_hasAnalysis; }
+    bool RestoreAnalysis(std::shared_ptr<const MdObjectModel>& model, MdRefIndex& refIndex) const;
+
+    // Дерево строится из узлов снимка при первом обращении и дальше общее:
+    // парсер и MdConfig получают одни и те же узлы (nullptr - дерева нет)
+    std::shared_ptr<MdNode> GetTree() const;
+    // Узел объекта Object(i) или по ID из GetTree (NULL - нет такого)
+    const MdNode* ObjectNode(uint32_t i) const;
+    const MdNode* FindObjectNode(const std::string& id) const;
+    void Materialize(std::shared_ptr<MdNode>& root,
+                     std::map<std::string, std::shared_ptr<MdNode>>& objectIndex) const;
+
+private:
+    MdSnapshotReader();
+    const MdSnapSection* FindSection(uint32_t id, size_t elemSize) const;
+    int CompareAtom(uint32_t atom, const std::string& key) const;
+    const MdSnapRef* FindRef(const MdSnapRef* refs, uint32_t count, const std::string& key) const;
+    void RestoreOle(uint32_t index, OLEEntry& entry) const;
+    void BuildTree() const;
+    bool CheckAnalysis() const;
+
+    MdMappedFile m_file;
+    const MdSnapHeader* m_header;
+    const MdSnapSection* m_sections;
+    const char* m_strings;    uint64_t m_stringsSize;
+    const MdSnapAtom* m_atoms;    uint32_t m_atomCount;
+    const MdSnapNode* m_nodes;    uint32_t m_nodeCount;
+    const MdSnapObject* m_objects; uint32_t m_objectCount;
+    const MdSnapRef* m_refs;      uint32_t m_refCount;
+    const MdSnapRef* m_types;     uint32_t m_typeCount;
+    const MdSnapOle* m_ole;       uint32_t m_oleCount;
+    const WCHAR* m_wstrings;  uint64_t m_wstringsSize;
+    const MdSnapMeta* m_meta;
+    const MdSnapModelObject* m_modelObjects; uint32_t m_modelObjectCount;
+    const MdSnapModelField* m_modelFields;   uint32_t m_modelFieldCount;
+    const char* m_modelText;  uint64_t m_modelTextSize;
+    const uint32_t* m_rrefTargets; uint32_t m_rrefTargetCount;
+    const uint32_t* m_rrefOffsets; uint32_t m_rrefOffsetCount;
+    const MdRefSource* m_rrefSources; uint32_t m_rrefSourceCount;
+    const uint32_t* m_rrefNames;   uint32_t m_rrefNameCount;
+    bool m_hasAnalysis;
+
+    // Дерево (GetTree): узлы объектов - в порядке m_objects
+    mutable std::mutex m_treeLock;
+    mutable bool m_treeBuilt;
+    mutable std::shared_ptr<MdNode> m_tree;
+    mutable std::vector<std::shared_ptr<MdNode>> m_objectNodes;
+};
+
+// === Запись ===
+// Записывает файл целиком: во временный файл, затем замена
+bool MdReplaceFile(const std::wstring& path, const std::string& data);
+
+// Записывает снимок (через временный файл, затем замена)
+bool MdWriteSnapshot(const std::wstring& path, const MdFileFingerprint& source, const std::wstring& sourcePath,
+                     const MdNode* root, const std::vector<OLEEntry>& entries,
+                     const std::map<std::string, std::shared_ptr<MdNode>>& objectIndex,
+                     const std::map<std::string, std::string>& idToType,
+                     const std::map<std::string, std::string>& fieldToRef,
+                     const MdRefIndex& refIndex, const MdObjectModel* model,
+                     const std::string& metaPrefix, const std::string& metaSuffix);
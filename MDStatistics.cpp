@@ -0,0 +1,354 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDStatistics.h"
+#include "MDSnapshot.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* const kFormatNames[MD_STAT_FORMATS] = { "raw", "text", "zlib", "zlib8", "encrypted" };
+
+// ============================================================================
+// РАСПРЕДЕЛЕНИЕ
+// ============================================================================
+
+void MdStatHistogram::Add(uint64_t value) {
+    int bucket = 0;
+    for (uint64_t v = value; v && bucket < kBuckets - 1; v >>= 1) bucket++;
+    buckets[bucket]++;
+    count++;
+    sum += value;
+    if (value > max) max = value;
+}
+
+void MdStatHistogram::Merge(const MdStatHistogram& other) {
+    for (int i = 0; i < kBuckets; ++i) buckets[i] += other.buckets[i];
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max) max = other.max;
+}
+
+void MdStatHistogram::Clear() {
+    count = sum = max = 0;
+    memset(buckets, 0, sizeof(buckets));
+}
+
+uint64_t MdStatHistogram::Percentile(double p) const {
+    if (!count) return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets - 1; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint64_t bound = i ? (1ull << i) - 1 : 0;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+// ============================================================================
+// СБОР
+// ============================================================================
+
+void MdStatistics::AddModel(const MdObjectModel& model) {
+    configs++;
+    objects += model.objects.size();
+
+    // Поля: ссылки - в счётчики объектов (из какого и на какой)
+    std::vector<uint32_t> out(model.objects.size(), 0), in(model.objects.size(), 0);
+    for (auto& field : model.fields) {
+        fields++;
+        if (field.owner == MD_MODEL_NONE) freeFields++;
+        if (!field.refTarget) continue;
+        refFields++;
+        if (field.owner != MD_MODEL_NONE) out[field.owner]++;
+        const MdObjectInfo* target = model.FindObject(field.refTarget);
+        if (target) in[target - model.objects.data()]++;
+        else unresolvedRefs++;
+    }
+
+    // Объекты одного раздела идут подряд - поиск типа в карте один на раздел
+    const char* prefix = NULL;
+    MdStatTypeCounts* type = NULL;
+    for (size_t i = 0; i < model.objects.size(); ++i) {
+        const MdObjectInfo& object = model.objects[i];
+        if (!type || object.prefix != prefix) {
+            prefix = object.prefix;
+            MdStatTypeCounts zero = { 0, 0, 0 };
+            type = &types.emplace(prefix ? prefix : "?", zero).first->second;
+        }
+        type->objects++;
+        type->fields += object.fieldCount;
+        type->refFields += out[i];
+        fieldsPerObject.Add(object.fieldCount);
+        fanOut.Add(out[i]);
+        fanIn.Add(in[i]);
+    }
+}
+
+void MdStatistics::AddStream(MdStreamFormat format, size_t rawBytes, size_t decodedBytes) {
+    MdStatStreamCounts& s = streams[(unsigned)format < (unsigned)MD_STAT_FORMATS ? format : MD_FMT_RAW];
+    s.count++;
+    s.rawBytes += rawBytes;
+    s.decodedBytes += decodedBytes;
+    streamBytes.Add(decodedBytes);
+}
+
+void MdStatistics::Merge(const MdStatistics& other) {
+    configs += other.configs;
+    objects += other.objects;
+    fields += other.fields;
+    freeFields += other.freeFields;
+    refFields += other.refFields;
+    unresolvedRefs += other.unresolvedRefs;
+    for (auto& item : other.types) {
+        MdStatTypeCounts zero = { 0, 0, 0 };
+        MdStatTypeCounts& type = types.emplace(item.first, zero).first->second;
+        type.objects += item.second.objects;
+        type.fields += item.second.fields;
+        type.refFields += item.second.refFields;
+    }
+    fieldsPerObject.Merge(other.fieldsPerObject);
+    fanOut.Merge(other.fanOut);
+    fanIn.Merge(other.fanIn);
+    for (int i = 0; i < MD_STAT_FORMATS; ++i) {
+        streams[i].count += other.streams[i].count;
+        streams[i].rawBytes += other.streams[i].rawBytes;
+        streams[i].decodedBytes += other.streams[i].decodedBytes;
+    }
+    streamBytes.Merge(other.streamBytes);
+}
+
+void MdStatistics::Clear() {
+    configs = objects = fields = freeFields = refFields = unresolvedRefs = 0;
+    types.clear();
+    fieldsPerObject.Clear();
+    fanOut.Clear();
+    fanIn.Clear();
+    memset(streams, 0, sizeof(streams));
+    streamBytes.Clear();
+}
+
+MdStatStreamCounts MdStatistics::StreamTotals() const {
+    MdStatStreamCounts total = { 0, 0, 0 };
+    for (auto& s : streams) {
+        total.count += s.count;
+        total.rawBytes += s.rawBytes;
+        total.decodedBytes += s.decodedBytes;
+    }
+    return total;
+}
+
+// ============================================================================
+// ОТЧЁТ
+// ============================================================================
+
+static std::string ToUtf8(const std::wstring& text) {
+    std::string utf8;
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    if (len > 0) {
+        utf8.resize(len);
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &utf8[0], len, NULL, NULL);
+    }
+    return utf8;
+}
+
+// Во сколько раз поток больше после распаковки
+static double Ratio(const MdStatStreamCounts& s) {
+    return s.rawBytes ? (double)s.decodedBytes / s.rawBytes : 0.0;
+}
+
+// === CSV ===
+
+static void CsvRow(std::string& out, const std::string& config, const char* section, const std::string& key,
+                   const char* metric, const char* value) {
+    out += config;
+    out += ',';
+    out += section;
+    out += ',';
+    out += key;
+    out += ',';
+    out += metric;
+    out += ',';
+    out += value;
+    out += "\r\n";
+}
+
+static void CsvCount(std::string& out, const std::string& config, const char* section, const std::string& key,
+                     const char* metric, uint64_t value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+    CsvRow(out, config, section, key, metric, buf);
+}
+
+static void CsvReal(std::string& out, const std::string& config, const char* section, const std::string& key,
+                    const char* metric, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", value);
+    CsvRow(out, config, section, key, metric, buf);
+}
+
+static void CsvHistogram(std::string& out, const std::string& config, const char* section, const MdStatHistogram& h) {
+    CsvCount(out, config, section, "", "count", h.count);
+    CsvCount(out, config, section, "", "sum", h.sum);
+    CsvReal(out, config, section, "", "mean", h.Mean());
+    CsvCount(out, config, section, "", "max", h.max);
+    CsvCount(out, config, section, "", "p50", h.Percentile(50));
+    CsvCount(out, config, section, "", "p90", h.Percentile(90));
+    CsvCount(out, config, section, "", "p99", h.Percentile(99));
+}
+
+static void CsvStreams(std::string& out, const std::string& config, const std::string& key, const MdStatStreamCounts& s) {
+    CsvCount(out, config, "streams", key, "count", s.count);
+    CsvCount(out, config, "streams", key, "raw_bytes", s.rawBytes);
+    CsvCount(out, config, "streams", key, "decoded_bytes", s.decodedBytes);
+    CsvReal(out, config, "streams", key, "ratio", Ratio(s));
+}
+
+static void CsvStatistics(std::string& out, const std::wstring& name, const MdStatistics& st) {
+    // Путь - в кавычках: в нём бывают запятые
+    std::string config = "\"";
+    for (char c : ToUtf8(name)) {
+        if (c == '"') config += '"';
+        config += c;
+    }
+    config += '"';
+
+    CsvCount(out, config, "summary", "", "configs", st.configs);
+    CsvCount(out, config, "summary", "", "objects", st.objects);
+    CsvCount(out, config, "summary", "", "fields", st.fields);
+    CsvCount(out, config, "summary", "", "free_fields", st.freeFields);
+    CsvCount(out, config, "summary", "", "ref_fields", st.refFields);
+    CsvCount(out, config, "summary", "", "unresolved_refs", st.unresolvedRefs);
+    for (auto& item : st.types) {
+        CsvCount(out, config, "types", item.first, "objects", item.second.objects);
+        CsvCount(out, config, "types", item.first, "fields", item.second.fields);
+        CsvCount(out, config, "types", item.first, "ref_fields", item.second.refFields);
+    }
+    CsvHistogram(out, config, "fields_per_object", st.fieldsPerObject);
+    CsvHistogram(out, config, "fan_out", st.fanOut);
+    CsvHistogram(out, config, "fan_in", st.fanIn);
+    for (int i = 0; i < MD_STAT_FORMATS; ++i) {
+        if (st.streams[i].count) CsvStreams(out, config, kFormatNames[i], st.streams[i]);
+    }
+    CsvStreams(out, config, "all", st.StreamTotals());
+    CsvHistogram(out, config, "stream_bytes", st.streamBytes);
+}
+
+std::string MdStatisticsToCsv(const std::vector<MdStatisticsRow>& rows, const MdStatistics& total) {
+    std::string csv = "config,section,key,metric,value\r\n";
+    for (auto& row : rows) CsvStatistics(csv, row.name, *row.stats);
+    CsvStatistics(csv, L"total", total);
+    return csv;
+}
+
+// === JSON ===
+
+static void JsonString(std::string& out, const std::string& s) {
+    out += '"';
+    for (char ch : s) {
+        unsigned char c = (unsigned char)ch;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+static void JsonHistogram(std::string& out, const char* name, const MdStatHistogram& h) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+        ",\n      \"%s\": {\"count\": %llu, \"sum\": %llu, \"mean\": %.3f, \"max\": %llu, "
+        "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"buckets\": {",
+        name, (unsigned long long)h.count, (unsigned long long)h.sum, h.Mean(), (unsigned long long)h.max,
+        (unsigned long long)h.Percentile(50), (unsigned long long)h.Percentile(90), (unsigned long long)h.Percentile(99));
+    out += buf;
+    // Ключ - нижняя граница корзины, пустые корзины опускаются
+    bool first = true;
+    for (int i = 0; i < MdStatHistogram::kBuckets; ++i) {
+        if (!h.buckets[i]) continue;
+        snprintf(buf, sizeof(buf), "%s\"%llu\": %llu", first ? "" : ", ",
+            i ? 1ull << (i - 1) : 0ull, (unsigned long long)h.buckets[i]);
+        out += buf;
+        first = false;
+    }
+    out += "}}";
+}
+
+static void JsonStreams(std::string& out, const char* name, const MdStatStreamCounts& s, bool first) {
+    char buf[192];
+    snprintf(buf, sizeof(buf), "%s\n        \"%s\": {\"count\": %llu, \"raw_bytes\": %llu, \"decoded_bytes\": %llu, \"ratio\": %.3f}",
+        first ? "" : ",", name, (unsigned long long)s.count, (unsigned long long)s.rawBytes,
+        (unsigned long long)s.decodedBytes, Ratio(s));
+    out += buf;
+}
+
+static void JsonStatistics(std::string& out, const std::wstring* name, const MdStatistics& st) {
+    char buf[256];
+    out += "{";
+    if (name) {
+        out += "\n      \"name\": ";
+        JsonString(out, ToUtf8(*name));
+        out += ",";
+    }
+    snprintf(buf, sizeof(buf),
+        "\n      \"configs\": %llu, \"objects\": %llu, \"fields\": %llu, \"free_fields\": %llu, "
+        "\"ref_fields\": %llu, \"unresolved_refs\": %llu,\n      \"types\": {",
+        (unsigned long long)st.configs, (unsigned long long)st.objects, (unsigned long long)st.fields,
+        (unsigned long long)st.freeFields, (unsigned long long)st.refFields, (unsigned long long)st.unresolvedRefs);
+    out += buf;
+    bool first = true;
+    for (auto& item : st.types) {
+        out += first ? "\n        " : ",\n        ";
+        JsonString(out, item.first);
+        snprintf(buf, sizeof(buf), ": {\"objects\": %llu, \"fields\": %llu, \"ref_fields\": %llu}",
+            (unsigned long long)item.second.objects, (unsigned long long)item.second.fields,
+            (unsigned long long)item.second.refFields);
+        out += buf;
+        first = false;
+    }
+    out += "\n      }";
+    JsonHistogram(out, "fields_per_object", st.fieldsPerObject);
+    JsonHistogram(out, "fan_out", st.fanOut);
+    JsonHistogram(out, "fan_in", st.fanIn);
+
+    out += ",\n      \"streams\": {";
+    JsonStreams(out, "all", st.StreamTotals(), true);
+    for (int i = 0; i < MD_STAT_FORMATS; ++i) {
+        if (st.streams[i].count) JsonStreams(out, kFormatNames[i], st.streams[i], false);
+    }
+    out += "\n      }";
+    JsonHistogram(out, "stream_bytes", st.streamBytes);
+    out += "\n    }";
+}
+
+std::string MdStatisticsToJson(const std::vector<MdStatisticsRow>& rows, const MdStatistics& total) {
+    std::string json = "{\n  \"configs\": [";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        json += i ? ",\n    " : "\n    ";
+        JsonStatistics(json, &rows[i].name, *rows[i].stats);
+    }
+    json += "\n  ],\n  \"total\": ";
+    JsonStatistics(json, NULL, total);
+    json += "\n}\n";
+    return json;
+}
+
+bool MdWriteStatistics(const std::wstring& path, const std::vector<MdStatisticsRow>& rows, const MdStatistics& total) {
+    size_t dot = path.rfind(L'.');
+    bool json = dot != std::wstring::npos && _wcsicmp(path.c_str() + dot, L".json") == 0;
+    return MdReplaceFile(path, json ? MdStatisticsToJson(rows, total) : MdStatisticsToCsv(rows, total));
+}
@@ -0,0 +1,95 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "MDParser.h"
+#include "MDObjects.h"
+
+// ============================================================================
+// Статистика метаданных по конфигурациям и по парку
+// ============================================================================
+//
+// Объекты по типам (SC, DT, RG, ...), реквизиты на объект, ссылки из
+// объекта (fan-out) и на объект (fan-in), потоки по форматам, их размеры и
+// сжатие. Метаданные считаются одним проходом по модели объектов, которую
+// строит анализ (MDObjects.h), - дерево заново не обходится; потоки - по мере
+// чтения при обходе контейнера. Распределения хранятся логарифмическими
+// корзинами, поэтому статистики разных файлов складываются (Merge) в любом
+// порядке и на любом числе потоков, а итог парка не зависит от порядка.
+
+// Распределение неотрицательных величин: корзины 0, 1, 2-3, 4-7, ...
+struct MdStatHistogram {
+    static const int kBuckets = 34; // последняя - от 2^32
+    uint64_t count, sum, max;
+    uint64_t buckets[kBuckets];
+
+    MdStatHistogram() { Clear(); }
+    void Add(uint64_t value);
+    void Merge(const MdStatHistogram& other);
+    void Clear();
+    // Оценка процентиля p (0..100) сверху: граница корзины, но не больше max
+    uint64_t Percentile(double p) const;
+    double Mean() const { return count ? (double)sum / count : 0.0; }
+};
+
+// Объекты одного типа
+struct MdStatTypeCounts {
+    uint64_t objects, fields, refFields;
+};
+
+// Потоки одного формата
+struct MdStatStreamCounts {
+    uint64_t count, rawBytes, decodedBytes;
+};
+
+const int MD_STAT_FORMATS = MD_FMT_ENCRYPTED + 1;
+
+struct MdStatistics {
+    uint64_t configs;
+    uint64_t objects;
+    uint64_t fields;         // все реквизиты, графы и константы
+    uint64_t freeFields;     // без владельца: константы, графы общего журнала
+    uint64_t refFields;      // с типом-ссылкой на объект
+    uint64_t unresolvedRefs; // тип ссылки не найден среди объектов
+    std::map<std::string, MdStatTypeCounts> types; // по префиксу типа
+
+    MdStatHistogram fieldsPerObject;
+    MdStatHistogram fanOut; // полей-ссылок у объекта
+    MdStatHistogram fanIn;  // полей, ссылающихся на объект
+
+    MdStatStreamCounts streams[MD_STAT_FORMATS]; // по MdStreamFormat
+    MdStatHistogram streamBytes;                 // размеры после распаковки
+
+    MdStatistics() { Clear(); }
+
+    // Метаданные конфигурации: один проход по объектам и полям модели
+    void AddModel(const MdObjectModel& model);
+    // Поток контейнера: размер как хранится и после расшифровки/распаковки
+    void AddStream(MdStreamFormat format, size_t rawBytes, size_t decodedBytes);
+    void Merge(const MdStatistics& other);
+    void Clear();
+
+    MdStatStreamCounts StreamTotals() const;
+};
+
+// Строка отчёта: конфигурация (путь) и её статистика
+struct MdStatisticsRow {
+    std::wstring name;
+    const MdStatistics* stats;
+};
+
+// Отчёт в UTF-8: строки по конфигурациям и итог парка (total)
+//   CSV  - длинный формат: config,section,key,metric,value
+//   JSON - {"configs": [...], "total": {...}}
+std::string MdStatisticsToCsv(const std::vector<MdStatisticsRow>& rows, const MdStatistics& total);
+std::string MdStatisticsToJson(const std::vector<MdStatisticsRow>& rows, const MdStatistics& total);
+// Формат по расширению: .json - JSON, иначе CSV
+bool MdWriteStatistics(const std::wstring& path, const std::vector<MdStatisticsRow>& rows, const MdStatistics& total);
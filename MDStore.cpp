@@ -0,0 +1,332 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDStore.h"
+#include <wincrypt.h>
+#include "MDConfig.h"
+#include "MDHash.h"
+#include "MDSnapshot.h"
+#include <stdio.h>
+#include <algorithm>
+
+// ============================================================================
+// КЛЮЧ СОДЕРЖИМОГО
+// ============================================================================
+
+// SHA-256 в CryptoAPI - с Windows Server 2003 SP2 / XP SP3; заголовки SDK
+// под _WIN32_WINNT=0x0502 могут его не объявлять
+#ifndef PROV_RSA_AES
+#define PROV_RSA_AES 24
+#endif
+#ifndef CALG_SHA_256
+#define CALG_SHA_256 0x0000800c
+#endif
+
+// Провайдер CryptoAPI с SHA-256 - один на процесс (0 - недоступен)
+static HCRYPTPROV ShaProvider() {
+    static const HCRYPTPROV provider = []() {
+        HCRYPTPROV p = 0;
+        if (!CryptAcquireContextW(&p, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) p = 0;
+        return p;
+    }();
+    return provider;
+}
+
+bool MdGetContentKey(const void* data, size_t len, MdContentKey& key) {
+    memset(key.digest, 0, sizeof(key.digest));
+    HCRYPTHASH hash = 0;
+    if (!ShaProvider() || !CryptCreateHash(ShaProvider(), CALG_SHA_256, 0, 0, &hash)) return false;
+
+    // CryptHashData принимает DWORD: большие потоки - частями
+    const BYTE* p = (const BYTE*)data;
+    bool ok = true;
+    while (ok && len > 0) {
+        DWORD chunk = (DWORD)(std::min)(len, (size_t)1 << 30);
+        ok = CryptHashData(hash, p, chunk, 0) != 0;
+        p += chunk;
+        len -= chunk;
+    }
+    DWORD size = sizeof(key.digest);
+    ok = ok && CryptGetHashParam(hash, HP_HASHVAL, key.digest, &size, 0) && size == sizeof(key.digest);
+    CryptDestroyHash(hash);
+    if (!ok) memset(key.digest, 0, sizeof(key.digest));
+    return ok;
+}
+
+std::wstring MdContentKey::ToString() const {
+    static const wchar_t* digits = L"0123456789abcdef";
+    std::wstring text(sizeof(digest) * 2, L'0');
+    for (size_t i = 0; i < sizeof(digest); ++i) {
+        text[i * 2] = digits[digest[i] >> 4];
+        text[i * 2 + 1] = digits[digest[i] & 0xF];
+    }
+    return text;
+}
+
+// ============================================================================
+// УЗЛЫ
+// ============================================================================
+
+MdContentStore::MdContentStore()
+    : m_configs(0), m_nodesIn(0), m_nodesStored(0), m_valueBytes(0),
+      m_streamsIn(0), m_streamsStored(0), m_streamBytesIn(0), m_streamBytesStored(0) {}
+
+MdContentStore::~MdContentStore() {}
+
+static uint64_t HashText(const std::string& text) {
+    return text.empty() ? 0 : MdHash64(text.data(), text.size());
+}
+
+// Узел по собственным полям и уже общим детям
+static uint64_t HashNode(const MdNode* node, const std::vector<std::shared_ptr<MdNode>>& children) {
+    using mdhash_detail::Merge;
+    uint64_t h = MdHash64(node->value.data(), node->value.size(), (uint64_t)node->kind * 4 + node->flags + 1);
+    h = Merge(h, HashText(node->wsBefore));
+    h = Merge(h, HashText(node->wsAfter));
+    h = Merge(h, HashText(node->wsClose));
+    for (auto& child : children) h = Merge(h, (uint64_t)(uintptr_t)child.get());
+    return h;
+}
+
+static bool SameNode(const MdNode* stored, const MdNode* node, const std::vector<std::shared_ptr<MdNode>>& children) {
+    if (stored->kind != node->kind || stored->flags != node->flags || stored->value != node->value ||
+        stored->children.size() != children.size() || stored->wsBefore != node->wsBefore ||
+        stored->wsAfter != node->wsAfter || stored->wsClose != node->wsClose) {
+        return false;
+    }
+    for (size_t i = 0; i < children.size(); ++i) {
+        if (stored->children[i] != children[i]) return false;
+    }
+    return true;
+}
+
+// Снизу вверх: к моменту поиска узла его дети уже заменены общими,
+// поэтому одинаковые поддеревья сводятся к одинаковым указателям
+std::shared_ptr<MdNode> MdContentStore::InternNode(const MdNode* node, NodeRemap* remap, Counts& counts) {
+    std::vector<std::shared_ptr<MdNode>> children;
+    children.reserve(node->children.size());
+    for (auto& child : node->children) children.push_back(InternNode(child.get(), remap, counts));
+
+    uint64_t h = HashNode(node, children);
+    counts.nodesIn++;
+
+    std::shared_ptr<MdNode> result;
+    NodeShard& shard = m_nodeShards[(h >> 32) % kShards];
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto range = shard.nodes.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (SameNode(it->second.get(), node, children)) {
+                result = it->second;
+                break;
+            }
+        }
+        if (!result) {
+            result = std::make_shared<MdNode>();
+            result->value = node->value;
+            result->kind = node->kind;
+            result->flags = node->flags;
+            result->wsBefore = node->wsBefore;
+            result->wsAfter = node->wsAfter;
+            result->wsClose = node->wsClose;
+            result->children.swap(children);
+            shard.nodes.emplace(h, result);
+            counts.nodesStored++;
+            counts.valueBytes += node->value.size() + node->wsBefore.size() + node->wsAfter.size() + node->wsClose.size();
+        }
+    }
+
+    if (remap) {
+        auto it = remap->find(node);
+        if (it != remap->end()) it->second = result.get();
+    }
+    return result;
+}
+
+std::shared_ptr<const MdNode> MdContentStore::InternRoot(const MdNode* root, NodeRemap* remap) {
+    if (!root) return nullptr;
+    Counts counts = { 0, 0, 0 };
+    std::shared_ptr<const MdNode> result = InternNode(root, remap, counts);
+    m_nodesIn += counts.nodesIn;
+    m_nodesStored += counts.nodesStored;
+    m_valueBytes += counts.valueBytes;
+    return result;
+}
+
+std::shared_ptr<const MdNode> MdContentStore::InternTree(const std::shared_ptr<const MdNode>& root) {
+    return InternRoot(root.get(), NULL);
+}
+
+std::shared_ptr<const MdConfig> MdContentStore::Intern(const std::shared_ptr<const MdConfig>& config) {
+    if (!config) return nullptr;
+
+    // Узлы объектов - адреса в общем дереве узнаём по ходу замены
+    std::shared_ptr<const MdNode> root = config->GetRoot();
+    std::map<std::string, const MdNode*> objects = config->GetObjectNodes();
+    NodeRemap remap;
+    for (auto& item : objects) remap.emplace(item.second, (const MdNode*)NULL);
+
+    std::shared_ptr<MdConfig> copy(new MdConfig());
+    copy->m_generation = config->m_generation;
+    copy->m_filePath = config->m_filePath;
+    copy->m_entries = config->m_entries;
+    copy->m_root = InternRoot(root.get(), &remap);
+    for (auto& item : objects) {
+        copy->m_objects.emplace_hint(copy->m_objects.end(), item.first, remap[item.second]);
+    }
+    copy->m_idToType = config->m_idToType;
+    copy->m_fieldToRef = config->m_fieldToRef;
+    copy->m_refIndex = config->m_refIndex;
+    copy->m_model = config->m_model; // строки свои, на узлы не ссылается
+    m_configs++;
+    return copy;
+}
+
+// ============================================================================
+// ПОТОКИ
+// ============================================================================
+
+std::shared_ptr<const std::vector<char>> MdContentStore::InternStream(std::vector<char>&& data, MdContentKey* key) {
+    MdContentKey k;
+    bool hashed = MdGetContentKey(data.data(), data.size(), k);
+    if (key) *key = k;
+    m_streamsIn++;
+    m_streamBytesIn += data.size();
+    if (!hashed) {
+        Fail(L"Не удалось вычислить SHA-256 потока (CryptoAPI)");
+        return std::make_shared<const std::vector<char>>(std::move(data));
+    }
+
+    std::shared_ptr<const std::vector<char>> result;
+    StreamShard& shard = m_streamShards[(k.Head() >> 32) % kShards];
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.streams.find(k);
+        if (it != shard.streams.end()) return it->second;
+        result = std::make_shared<const std::vector<char>>(std::move(data));
+        shard.streams.emplace(k, result);
+    }
+    m_streamsStored++;
+    m_streamBytesStored += result->size();
+
+    // Новое содержимое - в каталог, если его там ещё нет (записано раньше)
+    if (!m_dir.empty()) {
+        std::wstring path = m_dir + L"\\" + k.ToString() + L".blob";
+        if (GetFileAttributesW(path.c_str()) == INVALID_FILE_ATTRIBUTES &&
+            !MdReplaceFile(path, std::string(result->begin(), result->end()))) {
+            Fail(L"Не удалось записать поток в хранилище: " + path);
+        }
+    }
+    return result;
+}
+
+bool MdContentStore::SetDirectory(const std::wstring& dir) {
+    m_dir = dir;
+    while (!m_dir.empty() && (m_dir.back() == L'\\' || m_dir.back() == L'/')) m_dir.pop_back();
+    if (m_dir.empty()) return true;
+
+    CreateDirectoryW(m_dir.c_str(), NULL);
+    DWORD attr = GetFileAttributesW(m_dir.c_str());
+    if (attr == INVALID_FILE_ATTRIBUTES || !(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        Fail(L"Не удалось создать каталог хранилища: " + m_dir);
+        m_dir.clear();
+        return false;
+    }
+    return true;
+}
+
+bool MdContentStore::LoadStream(const MdContentKey& key, std::vector<char>& data) const {
+    {
+        const StreamShard& shard = m_streamShards[(key.Head() >> 32) % kShards];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        auto it = shard.streams.find(key);
+        if (it != shard.streams.end()) {
+            data = *it->second;
+            return true;
+        }
+    }
+    if (m_dir.empty()) return false;
+
+    std::wstring path = m_dir + L"\\" + key.ToString() + L".blob";
+    FILE* f = _wfopen(path.c_str(), L"rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data.resize(size > 0 ? (size_t)size : 0);
+    bool ok = size >= 0 && fread(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    // Файл мог быть подменён или повреждён
+    MdContentKey actual;
+    if (!ok || !MdGetContentKey(data.data(), data.size(), actual) || actual != key) {
+        data.clear();
+        Fail(L"Повреждён поток в хранилище: " + path);
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// ОБСЛУЖИВАНИЕ
+// ============================================================================
+
+// Узел, на который ссылается только хранилище, держит своих детей: удаление
+// идёт сверху вниз проходами, пока что-то удаляется
+void MdContentStore::Purge() {
+    for (bool removed = true; removed;) {
+        removed = false;
+        for (auto& shard : m_nodeShards) {
+            std::lock_guard<std::mutex> lock(shard.lock);
+            for (auto it = shard.nodes.begin(); it != shard.nodes.end();) {
+                if (it->second.use_count() == 1) {
+                    const MdNode* node = it->second.get();
+                    m_valueBytes -= node->value.size() + node->wsBefore.size() + node->wsAfter.size() + node->wsClose.size();
+                    m_nodesStored--;
+                    it = shard.nodes.erase(it);
+                    removed = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+    for (auto& shard : m_streamShards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        for (auto it = shard.streams.begin(); it != shard.streams.end();) {
+            if (it->second.use_count() == 1) {
+                m_streamBytesStored -= it->second->size();
+                m_streamsStored--;
+                it = shard.streams.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+MdContentStoreStats MdContentStore::GetStats() const {
+    MdContentStoreStats stats;
+    stats.configs = m_configs;
+    stats.nodesIn = m_nodesIn;
+    stats.nodesStored = m_nodesStored;
+    stats.streamsIn = m_streamsIn;
+    stats.streamsStored = m_streamsStored;
+    stats.streamBytesIn = m_streamBytesIn;
+    stats.streamBytesStored = m_streamBytesStored;
+    stats.valueBytesStored = m_valueBytes;
+    return stats;
+}
+
+void MdContentStore::Fail(const std::wstring& error) const {
+    std::lock_guard<std::mutex> lock(m_errorLock);
+    m_lastError = error;
+}
+
+std::wstring MdContentStore::GetLastError() const {
+    std::lock_guard<std::mutex> lock(m_errorLock);
+    return m_lastError;
+}
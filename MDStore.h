@@ -0,0 +1,139 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "MDParser.h"
+
+class MdConfig;
+
+// ============================================================================
+// Хранилище по содержимому: общие поддеревья и потоки для многих конфигураций
+// ============================================================================
+//
+// Конфигурации, выросшие из одной типовой, совпадают в большинстве объектов
+// и диалогов. Хранилище держит каждое различное поддерево метаданных и
+// каждый различный декодированный поток в одном экземпляре: Intern заменяет
+// дерево конфигурации деревом из общих узлов, InternStream - буфер потока
+// общим буфером. Память под парк конфигураций растёт по объёму различного
+// содержимого, а не по числу конфигураций.
+//
+// Узлы сравниваются целиком, включая форматирование (обратная запись
+// остаётся побайтовой), дети - по указателям уже общих узлов, поэтому
+// сравнение каждого узла дешёвое и точное. Ключ потока - SHA-256 его байт
+// (MdContentKey, CryptoAPI): по ключу потоки отождествляются без сравнения,
+// в памяти и в каталоге. С каталогом (SetDirectory) различные потоки
+// пишутся файлами по ключу, и каталог парка занимает объём различных потоков.
+//
+// Общие узлы не меняются: деревья из хранилища - только для чтения, как
+// дерево MdConfig. Все методы потокобезопасны (таблицы разбиты на части
+// со своими блокировками).
+
+// Ключ содержимого: SHA-256
+struct MdContentKey {
+    uint8_t digest[32];
+
+    bool operator==(const MdContentKey& other) const { return memcmp(digest, other.digest, sizeof(digest)) == 0; }
+    bool operator!=(const MdContentKey& other) const { return !(*this == other); }
+    // Первые 8 байт дайджеста - для хеш-таблиц и выбора части
+    uint64_t Head() const {
+        uint64_t head;
+        memcpy(&head, digest, sizeof(head));
+        return head;
+    }
+    // 64 шестнадцатеричные цифры - имя файла в каталоге хранилища
+    std::wstring ToString() const;
+};
+
+// false - CryptoAPI недоступен (ключ обнулён)
+bool MdGetContentKey(const void* data, size_t len, MdContentKey& key);
+
+struct MdContentStoreStats {
+    uint64_t configs;       // принято конфигураций (Intern)
+    uint64_t nodesIn;       // принято узлов
+    uint64_t nodesStored;   // различных узлов
+    uint64_t streamsIn;
+    uint64_t streamsStored;
+    uint64_t streamBytesIn;
+    uint64_t streamBytesStored;
+    uint64_t valueBytesStored; // значения и форматирование различных узлов
+};
+
+class MdContentStore {
+public:
+    MdContentStore();
+    ~MdContentStore();
+
+    // Копия снимка с деревом из общих узлов; карты и структура контейнера
+    // копируются, FindObject указывает в общее дерево
+    std::shared_ptr<const MdConfig> Intern(const std::shared_ptr<const MdConfig>& config);
+    // Только дерево
+    std::shared_ptr<const MdNode> InternTree(const std::shared_ptr<const MdNode>& root);
+
+    // Декодированный поток: общий буфер для одинакового содержимого
+    // (данные забираются); key - ключ содержимого. Если ключ не вычислен,
+    // поток остаётся своим, key обнулён, причина - в GetLastError
+    std::shared_ptr<const std::vector<char>> InternStream(std::vector<char>&& data, MdContentKey* key = NULL);
+
+    // === Каталог ===
+    // Различные потоки пишутся в dir\<ключ>.blob (один раз на ключ)
+    bool SetDirectory(const std::wstring& dir);
+    const std::wstring& GetDirectory() const { return m_dir; }
+    // Поток из памяти или из каталога
+    bool LoadStream(const MdContentKey& key, std::vector<char>& data) const;
+
+    // Удаляет узлы и потоки, на которые никто, кроме хранилища, не ссылается
+    void Purge();
+
+    MdContentStoreStats GetStats() const;
+    std::wstring GetLastError() const;
+
+private:
+    MdContentStore(const MdContentStore&);
+    MdContentStore& operator=(const MdContentStore&);
+
+    typedef std::unordered_map<const MdNode*, const MdNode*> NodeRemap;
+
+    struct KeyHash {
+        size_t operator()(const MdContentKey& key) const { return (size_t)key.Head(); }
+    };
+    struct NodeShard {
+        std::mutex lock;
+        std::unordered_multimap<uint64_t, std::shared_ptr<MdNode>> nodes; // хеш узла -> узлы
+    };
+    struct StreamShard {
+        mutable std::mutex lock; // LoadStream - const
+        std::unordered_map<MdContentKey, std::shared_ptr<const std::vector<char>>, KeyHash> streams;
+    };
+    static const size_t kShards = 64;
+
+    // Счётчики одного вызова: в общие атомарные - одним сложением
+    struct Counts {
+        uint64_t nodesIn, nodesStored, valueBytes;
+    };
+
+    std::shared_ptr<const MdNode> InternRoot(const MdNode* root, NodeRemap* remap);
+    std::shared_ptr<MdNode> InternNode(const MdNode* node, NodeRemap* remap, Counts& counts);
+    void Fail(const std::wstring& error) const;
+
+    NodeShard m_nodeShards[kShards];
+    StreamShard m_streamShards[kShards];
+    std::wstring m_dir;
+
+    std::atomic<uint64_t> m_configs, m_nodesIn, m_nodesStored, m_valueBytes;
+    std::atomic<uint64_t> m_streamsIn, m_streamsStored, m_streamBytesIn, m_streamBytesStored;
+
+    mutable std::mutex m_errorLock;
+    mutable std::wstring m_lastError;
+};
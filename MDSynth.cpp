@@ -0,0 +1,236 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDSynth.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+namespace {
+
+// Слова в 1251
+const char* const kDocument  = "\xC4\xEE\xEA\xF3\xEC\xE5\xED\xF2";            // Документ
+const char* const kCatalog   = "\xD1\xEF\xF0\xE0\xE2\xEE\xF7\xED\xE8\xEA";    // Справочник
+const char* const kRegister  = "\xD0\xE5\xE3\xE8\xF1\xF2\xF0";                // Регистр
+const char* const kAttribute = "\xD0\xE5\xEA\xE2\xE8\xE7\xE8\xF2";            // Реквизит
+const char* const kSynonym   = "\xD1\xE8\xED\xEE\xED\xE8\xEC";                // Синоним
+const char* const kGoods     = "\xD2\xEE\xE2\xE0\xF0\xFB";                    // Товары
+const char* const kAmount    = "\xD1\xF3\xEC\xEC\xE0";                        // Сумма
+
+const unsigned kIdBase = 1000;
+const unsigned kIdStride = 100; // ID объекта k = base + k*stride, поля - следующие
+
+enum ObjectKind { KIND_CATALOG, KIND_REGISTER, KIND_DOCUMENT };
+
+// Детерминированный генератор (LCG)
+class Rng {
+public:
+    explicit Rng(unsigned seed) : m_state(seed * 2654435761u + 1) {}
+    unsigned Next() {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 8) & 0xFFFFFF;
+    }
+    unsigned Below(unsigned n) { return n ? Next() % n : 0; }
+
+private:
+    unsigned m_state;
+};
+
+class Writer {
+public:
+    Writer(const MdSynthOptions& options, unsigned objectsPerKind, std::string& out)
+        : m_opt(options), m_n(objectsPerKind), m_rng(options.seed), m_out(out) {}
+
+    void Config() {
+        m_out += "{{\"MainDataContDef\",\"";
+        Num(3 * m_n);
+        m_out += "\",\"10000\",\"";
+        Num(kIdBase + 3 * m_n * kIdStride);
+        m_out += "\"},\r\n{\"TaskItem\",{\"1\",\"Synth\",\"\",\"\",\"0\",\"0\",\"1\"}},\r\n";
+
+        m_out += "{\"GenJrnlFldDef\"";
+        for (unsigned j = 0; j < m_opt.journalFields; ++j) {
+            m_out += ",\r\n";
+            Field(10 + j, kAttribute, j);
+        }
+        m_out += "},\r\n";
+
+        Section("SbCnts", KIND_CATALOG);
+        m_out += ",\r\n";
+        Section("Registers", KIND_REGISTER);
+        m_out += ",\r\n";
+        Section("Documents", KIND_DOCUMENT);
+        m_out += "}\r\n";
+    }
+
+    // Один объект каждого вида - для оценки объёма
+    void Sample() {
+        Catalog(0);
+        Register(m_n);
+        Document(2 * m_n);
+    }
+
+private:
+    void Num(unsigned v) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u", v);
+        m_out += buf;
+    }
+
+    void Str(const char* s) { m_out += '"'; m_out += s; m_out += '"'; }
+    void NumStr(unsigned v) { m_out += '"'; Num(v); m_out += '"'; }
+    void Name(const char* base, unsigned n) { m_out += '"'; m_out += base; Num(n); m_out += '"'; }
+
+    unsigned ObjectId(unsigned k) const { return kIdBase + k * kIdStride; }
+
+    // {"ID","Имя","Синоним","","Тип","Длина","Точность","ID ссылки",...}
+    void Field(unsigned id, const char* base, unsigned n) {
+        m_out += '{';
+        NumStr(id);
+        m_out += ',';
+        Name(base, n);
+        m_out += ",\"";
+        m_out += kSynonym;
+        if (m_rng.Below(8) == 0) m_out += " \"\"q\"\"";
+        m_out += "\",\"\",";
+
+        unsigned ref = 0;
+        switch (m_rng.Below(5)) {
+        case 0: Str("S"); m_out += ",\"25\",\"0\""; break;
+        case 1: Str("N"); m_out += ",\"15\",\"2\""; break;
+        case 2: Str("D"); m_out += ",\"0\",\"0\""; break;
+        case 3: Str("B"); m_out += ",\"0\",\"0\""; ref = ObjectId(m_rng.Below(m_n)); break;
+        default: Str("O"); m_out += ",\"0\",\"0\""; ref = ObjectId(2 * m_n + m_rng.Below(m_n)); break;
+        }
+        m_out += ',';
+        NumStr(ref);
+        m_out += ",\"0\",\"0\",\"0\",\"0\"}";
+    }
+
+    void FieldList(const char* name, unsigned baseId, unsigned count, const char* fieldBase) {
+        m_out += ",\r\n{";
+        Str(name);
+        for (unsigned j = 0; j < count; ++j) {
+            m_out += ",\r\n";
+            Field(baseId + j, fieldBase, j);
+        }
+        m_out += '}';
+    }
+
+    void Header(unsigned id, const char* base, unsigned n) {
+        m_out += '{';
+        NumStr(id);
+        m_out += ',';
+        Name(base, n);
+        m_out += ",\"";
+        m_out += kSynonym;
+        m_out += "\",\"\",\"0\",\"1\",\"0\"";
+    }
+
+    void Catalog(unsigned k) {
+        unsigned id = ObjectId(k);
+        Header(id, kCatalog, k);
+        FieldList("Params", id + 1, m_opt.headFields, kAttribute);
+        m_out += '}';
+    }
+
+    void Register(unsigned k) {
+        unsigned id = ObjectId(k);
+        Header(id, kRegister, k);
+        FieldList("Props", id + 1, m_opt.headFields / 2, kAttribute);
+        FieldList("Figures", id + 1 + m_opt.headFields / 2, m_opt.tableFields, kAmount);
+        FieldList("Flds", id + 1 + m_opt.headFields / 2 + m_opt.tableFields, 2, kAttribute);
+        m_out += '}';
+    }
+
+    void Document(unsigned k) {
+        unsigned id = ObjectId(k);
+        Header(id, kDocument, k);
+        FieldList("Head Fields", id + 1, m_opt.headFields, kAttribute);
+        FieldList("Table Fields", id + 1 + m_opt.headFields, m_opt.tableFields, kGoods);
+        m_out += '}';
+    }
+
+    // Объекты вида kind занимают номера [kind*n, (kind+1)*n)
+    void Section(const char* name, ObjectKind kind) {
+        m_out += '{';
+        Str(name);
+        unsigned first = kind * m_n;
+        for (unsigned k = first; k < first + m_n; ++k) {
+            m_out += ",\r\n";
+            if (kind == KIND_CATALOG) Catalog(k);
+            else if (kind == KIND_REGISTER) Register(k);
+            else Document(k);
+        }
+        m_out += '}';
+    }
+
+    const MdSynthOptions& m_opt;
+    unsigned m_n;
+    Rng m_rng;
+    std::string& m_out;
+};
+
+} // namespace
+
+void MdSynthMetadata(const MdSynthOptions& options, std::vector<char>& out) {
+    // Поля нумеруются внутри шага ID объекта
+    MdSynthOptions opt = options;
+    if (opt.headFields + opt.tableFields + 4 > kIdStride) {
+        opt.headFields = kIdStride / 2;
+        opt.tableFields = kIdStride / 2 - 4;
+    }
+
+    // Число объектов подбирается по объёму пробной тройки
+    // (справочник + регистр + документ)
+    std::string sample;
+    {
+        Writer probe(opt, 1, sample);
+        probe.Sample();
+    }
+    size_t perTriple = sample.size() + 6;
+    unsigned n = (unsigned)(options.targetBytes / perTriple);
+    if (n == 0) n = 1;
+
+    std::string text;
+    text.reserve(options.targetBytes + options.targetBytes / 8);
+    Writer writer(opt, n, text);
+    writer.Config();
+    out.assign(text.begin(), text.end());
+}
+
+bool MdSynthEncode(const std::vector<char>& plain, MdStreamFormat format, int level,
+                   unsigned seed, std::vector<char>& out) {
+    out = plain;
+    if (format == MD_FMT_TEXT) return true;
+    if (!TryCompress(out, level)) return false;
+
+    switch (format) {
+    case MD_FMT_ZLIB:
+        return true;
+    case MD_FMT_ZLIB_OFFSET8: {
+        // 8 байт заголовка: размер распакованных данных + резерв
+        unsigned size = (unsigned)plain.size();
+        char header[8] = { 0 };
+        memcpy(header, &size, 4);
+        out.insert(out.begin(), header, header + 8);
+        return true;
+    }
+    case MD_FMT_ENCRYPTED: {
+        // "%w" + 4 байта затравки ключа + 2 байта резерва
+        std::vector<char> header(8, 0);
+        header[0] = 0x25;
+        header[1] = 0x77;
+        unsigned rnd = seed * 2654435761u;
+        memcpy(&header[2], &rnd, 4);
+        ApplyEncrypt(out, header, "");
+        return true;
+    }
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <vector>
+#include "MDParser.h"
+
+// ============================================================================
+// Генератор синтетического "Main MetaData Stream" (для замеров)
+// ============================================================================
+//
+// Текст повторяет форму настоящих конфигураций: секции GenJrnlFldDef, SbCnts,
+// Registers, Documents; у документов "Head Fields"/"Table Fields", в полях
+// ссылочных типов (B/O) в позиции 7 - ID справочника или документа.
+// Имена в 1251, есть удвоенные кавычки и переводы строк, как в исходных файлах.
+// Результат детерминирован для одинаковых параметров.
+
+struct MdSynthOptions {
+    size_t targetBytes = (size_t)1 << 20; // примерный объём текста
+    unsigned seed = 1;
+    unsigned headFields = 12;  // реквизитов шапки / справочника / измерений
+    unsigned tableFields = 8;  // реквизитов табличной части / ресурсов
+    unsigned journalFields = 16;
+};
+
+// Генерирует текст потока метаданных (1251)
+void MdSynthMetadata(const MdSynthOptions& options, std::vector<char>& out);
+
+// Упаковывает текст в формат потока: MD_FMT_TEXT, MD_FMT_ZLIB,
+// MD_FMT_ZLIB_OFFSET8 или MD_FMT_ENCRYPTED (%w)
+bool MdSynthEncode(const std::vector<char>& plain, MdStreamFormat format, int level,
+                   unsigned seed, std::vector<char>& out);
@@ -0,0 +1,478 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDTextIndex.h"
+#include "MDConfig.h"
+#include "MDSnapshot.h"
+#include "MDThreads.h"
+#include "MDHash.h"
+#include <string.h>
+#include <algorithm>
+
+// ============================================================================
+// СВЁРТКА РЕГИСТРА (1251)
+// ============================================================================
+
+// A-Z -> a-z, А-Я -> а-я, Ё -> ё; остальные байты без изменений
+static const unsigned char* FoldTable() {
+    static unsigned char table[256];
+    static bool ready = [] {
+        for (int c = 0; c < 256; ++c) table[c] = (unsigned char)c;
+        for (int c = 'A'; c <= 'Z'; ++c) table[c] = (unsigned char)(c + 32);
+        for (int c = 0xC0; c <= 0xDF; ++c) table[c] = (unsigned char)(c + 32);
+        table[0xA8] = 0xB8;
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+static inline uint32_t Trigram(const unsigned char* fold, const char* p) {
+    return (uint32_t)fold[(unsigned char)p[0]] << 16 | (uint32_t)fold[(unsigned char)p[1]] << 8 |
+           fold[(unsigned char)p[2]];
+}
+
+// Первое вхождение свёрнутого образца начиная с from (npos - нет)
+static size_t FindFolded(const char* text, size_t length, const std::string& pattern, size_t from) {
+    const unsigned char* fold = FoldTable();
+    if (pattern.size() > length) return std::string::npos;
+    unsigned char first = (unsigned char)pattern[0];
+    for (size_t i = from; i + pattern.size() <= length; ++i) {
+        if (fold[(unsigned char)text[i]] != first) continue;
+        size_t j = 1;
+        while (j < pattern.size() && fold[(unsigned char)text[i + j]] == (unsigned char)pattern[j]) j++;
+        if (j == pattern.size()) return i;
+    }
+    return std::string::npos;
+}
+
+// ============================================================================
+// НАПОЛНЕНИЕ
+// ============================================================================
+
+MdTextIndex::MdTextIndex() : m_nodeCount(0) {
+    memset(&m_source, 0, sizeof(m_source));
+}
+
+void MdTextIndex::Clear() {
+    m_text.clear();
+    m_docs.clear();
+    m_locOffsets.clear();
+    m_locations.clear();
+    m_keys.clear();
+    m_offsets.clear();
+    m_postings.clear();
+    m_streams.clear();
+    m_root.reset();
+    m_nodes.clear();
+    m_nodeCount = 0;
+    memset(&m_source, 0, sizeof(m_source));
+    m_valueDocs.clear();
+    m_pending.clear();
+    m_lastError.clear();
+}
+
+bool MdTextIndex::Fail(const std::wstring& error) {
+    m_lastError = error;
+    return false;
+}
+
+uint32_t MdTextIndex::AddDocument(const char* text, size_t length) {
+    Doc doc = { m_text.size(), (uint32_t)length };
+    m_text.append(text, length);
+    m_docs.push_back(doc);
+    return (uint32_t)m_docs.size() - 1;
+}
+
+size_t MdTextIndex::ValueHash::operator()(const std::string* s) const {
+    return (size_t)MdHash64(s->data(), s->size());
+}
+
+// Узлы нумеруются в порядке обхода в глубину (корень - 0)
+void MdTextIndex::AddNodes(const MdNode* node) {
+    uint32_t number = (uint32_t)m_nodes.size();
+    m_nodes.push_back(node);
+    if (!node->value.empty()) {
+        auto it = m_valueDocs.emplace(&node->value, (uint32_t)m_docs.size());
+        if (it.second) AddDocument(node->value.data(), node->value.size());
+        uint32_t doc = it.first->second;
+        Location loc = { MD_TEXT_TREE, number };
+        m_pending.push_back(std::make_pair(doc, loc));
+    }
+    for (auto& child : node->children) AddNodes(child.get());
+}
+
+void MdTextIndex::AddTree(const std::shared_ptr<const MdNode>& root) {
+    if (!root) return;
+    m_root = root;
+    m_nodes.clear();
+    AddNodes(root.get());
+    m_nodeCount = (uint32_t)m_nodes.size();
+}
+
+bool MdTextIndex::AddStream(const std::wstring& fullPath, const std::vector<char>& data) {
+    // Нулевые байты - признак двоичных данных (картинки, формы в бинарном виде)
+    if (data.empty() || data.size() > 0xFFFFFFFFu || memchr(data.data(), 0, data.size())) return false;
+    Location loc = { (uint32_t)m_streams.size(), 0 };
+    m_streams.push_back(fullPath);
+    m_pending.push_back(std::make_pair(AddDocument(data.data(), data.size()), loc));
+    return true;
+}
+
+bool MdTextIndex::AddParser(MDParser& parser) {
+    std::shared_ptr<const MdConfig> config = parser.GetConfig();
+    if (!config) return Fail(L"Конфигурация не загружена");
+    AddTree(config->GetRoot());
+    // Потоки - за один проход по контейнеру
+    bool walked = parser.ForEachRawStream([this](const OLEEntry& entry, bool read, std::vector<char>& data) {
+        if (!read || data.empty() || entry.fullPath == L"Metadata\\Main MetaData Stream") return true; // уже в дереве
+        if (DecodeStreamData(data) != MD_FMT_RAW) AddStream(entry.fullPath, data);
+        return true;
+    });
+    return walked || Fail(parser.GetLastError());
+}
+
+// ============================================================================
+// ПОСТРОЕНИЕ
+// ============================================================================
+
+static const size_t kIndexChunkBytes = 1 << 20; // текста на порцию построения
+static const size_t kIndexShards = 256;         // по первому байту триграммы
+
+void MdTextIndex::Build(unsigned threads) {
+    // === Места документов (CSR), в порядке добавления ===
+    m_locOffsets.assign(m_docs.size() + 1, 0);
+    for (auto& p : m_pending) m_locOffsets[p.first + 1]++;
+    for (size_t i = 0; i < m_docs.size(); ++i) m_locOffsets[i + 1] += m_locOffsets[i];
+    m_locations.resize(m_pending.size());
+    {
+        std::vector<uint32_t> fill(m_locOffsets.begin(), m_locOffsets.end() - 1);
+        for (auto& p : m_pending) m_locations[fill[p.first]++] = p.second;
+    }
+    std::vector<std::pair<uint32_t, Location>>().swap(m_pending);
+    std::unordered_map<const std::string*, uint32_t, ValueHash, ValueEqual>().swap(m_valueDocs);
+
+    // === Порции документов примерно по kIndexChunkBytes ===
+    std::vector<size_t> bounds(1, 0);
+    size_t bytes = 0;
+    for (size_t d = 0; d < m_docs.size(); ++d) {
+        bytes += m_docs[d].length;
+        if (bytes >= kIndexChunkBytes) {
+            bounds.push_back(d + 1);
+            bytes = 0;
+        }
+    }
+    if (bounds.back() != m_docs.size()) bounds.push_back(m_docs.size());
+
+    // Пары (триграмма << 32 | документ) порции, отсортированные и без повторов
+    const unsigned char* fold = FoldTable();
+    std::vector<std::vector<uint64_t>> chunks(bounds.size() - 1);
+    ParallelFor(chunks.size(), threads, [&](size_t c) {
+        std::vector<uint64_t>& pairs = chunks[c];
+        for (size_t d = bounds[c]; d < bounds[c + 1]; ++d) {
+            const char* text = m_text.data() + m_docs[d].offset;
+            size_t length = m_docs[d].length;
+            for (size_t i = 0; i + 3 <= length; ++i) pairs.push_back((uint64_t)Trigram(fold, text + i) << 32 | d);
+        }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    });
+
+    // === Сегменты по первому байту: у каждой порции - подряд идущий диапазон ===
+    struct Shard {
+        std::vector<uint32_t> keys, counts, postings;
+    };
+    std::vector<Shard> shards(kIndexShards);
+    ParallelFor(kIndexShards, threads, [&](size_t s) {
+        std::vector<uint64_t> merged;
+        for (auto& pairs : chunks) {
+            auto lo = std::lower_bound(pairs.begin(), pairs.end(), (uint64_t)s << 48);
+            auto hi = std::lower_bound(lo, pairs.end(), (uint64_t)(s + 1) << 48);
+            merged.insert(merged.end(), lo, hi);
+        }
+        std::sort(merged.begin(), merged.end());
+
+        Shard& shard = shards[s];
+        shard.postings.reserve(merged.size());
+        for (uint64_t pair : merged) {
+            uint32_t key = (uint32_t)(pair >> 32);
+            if (shard.keys.empty() || shard.keys.back() != key) {
+                shard.keys.push_back(key);
+                shard.counts.push_back(0);
+            }
+            shard.counts.back()++;
+            shard.postings.push_back((uint32_t)pair);
+        }
+    });
+    std::vector<std::vector<uint64_t>>().swap(chunks);
+
+    // === Сборка CSR ===
+    m_keys.clear();
+    m_postings.clear();
+    m_offsets.assign(1, 0);
+    for (auto& shard : shards) {
+        m_keys.insert(m_keys.end(), shard.keys.begin(), shard.keys.end());
+        m_postings.insert(m_postings.end(), shard.postings.begin(), shard.postings.end());
+        for (uint32_t count : shard.counts) m_offsets.push_back(m_offsets.back() + count);
+    }
+}
+
+// ============================================================================
+// ПОИСК
+// ============================================================================
+
+size_t MdTextIndex::Search(const std::wstring& text, std::vector<MdTextHit>& hits, size_t maxHits) const {
+    std::string ansi;
+    int len = WideCharToMultiByte(1251, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    if (len > 0) {
+        ansi.resize(len);
+        WideCharToMultiByte(1251, 0, text.c_str(), (int)text.size(), &ansi[0], len, NULL, NULL);
+    }
+    return Search(ansi, hits, maxHits);
+}
+
+size_t MdTextIndex::Search(const std::string& text, std::vector<MdTextHit>& hits, size_t maxHits) const {
+    if (text.empty() || m_locOffsets.empty()) return 0;
+    const unsigned char* fold = FoldTable();
+    std::string pattern(text);
+    for (auto& c : pattern) c = (char)fold[(unsigned char)c];
+
+    // === Кандидаты: пересечение списков триграмм, от самого короткого ===
+    std::vector<uint32_t> candidates;
+    bool all = pattern.size() < 3;
+    if (!all) {
+        std::vector<uint32_t> keys;
+        for (size_t i = 0; i + 3 <= pattern.size(); ++i) keys.push_back(Trigram(fold, pattern.data() + i));
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::vector<std::pair<const uint32_t*, const uint32_t*>> lists;
+        for (uint32_t key : keys) {
+            auto it = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+            if (it == m_keys.end() || *it != key) return 0;
+            size_t k = it - m_keys.begin();
+            lists.push_back(std::make_pair(m_postings.data() + m_offsets[k], m_postings.data() + m_offsets[k + 1]));
+        }
+        std::sort(lists.begin(), lists.end(), [](const std::pair<const uint32_t*, const uint32_t*>& a,
+                                                 const std::pair<const uint32_t*, const uint32_t*>& b) {
+            return a.second - a.first < b.second - b.first;
+        });
+
+        candidates.assign(lists[0].first, lists[0].second);
+        std::vector<uint32_t> next;
+        for (size_t l = 1; l < lists.size() && !candidates.empty(); ++l) {
+            next.clear();
+            std::set_intersection(candidates.begin(), candidates.end(), lists[l].first, lists[l].second,
+                                  std::back_inserter(next));
+            candidates.swap(next);
+        }
+    }
+
+    // === Проверка кандидатов ===
+    size_t found = 0;
+    size_t count = all ? m_docs.size() : candidates.size();
+    for (size_t c = 0; c < count && found < maxHits; ++c) {
+        uint32_t d = all ? (uint32_t)c : candidates[c];
+        const char* docText = m_text.data() + m_docs[d].offset;
+        size_t length = m_docs[d].length;
+        size_t pos = FindFolded(docText, length, pattern, 0);
+        if (pos == std::string::npos) continue;
+
+        for (uint32_t l = m_locOffsets[d]; l < m_locOffsets[d + 1] && found < maxHits; ++l) {
+            const Location& loc = m_locations[l];
+            if (loc.stream == MD_TEXT_TREE) {
+                const MdNode* node = loc.position < m_nodes.size() ? m_nodes[loc.position] : NULL;
+                MdTextHit hit = { MD_TEXT_TREE, loc.position, d, node };
+                hits.push_back(hit);
+                found++;
+                continue;
+            }
+            // Поток: каждое вхождение
+            for (size_t p = pos; p != std::string::npos && found < maxHits; p = FindFolded(docText, length, pattern, p + 1)) {
+                MdTextHit hit = { loc.stream, (uint32_t)p, d, NULL };
+                hits.push_back(hit);
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+std::string MdTextIndex::GetContext(const MdTextHit& hit, size_t radius) const {
+    if (hit.doc >= m_docs.size()) return std::string();
+    const char* text = m_text.data() + m_docs[hit.doc].offset;
+    size_t length = m_docs[hit.doc].length;
+    if (hit.stream == MD_TEXT_TREE) return std::string(text, length);
+
+    size_t begin = hit.position, end = hit.position;
+    while (begin > 0 && hit.position - begin < radius && text[begin - 1] != '\n') begin--;
+    while (end < length && end - hit.position < radius && text[end] != '\r' && text[end] != '\n') end++;
+    return std::string(text + begin, end - begin);
+}
+
+size_t MdTextIndex::GetMemoryBytes() const {
+    size_t bytes = m_text.capacity() + m_docs.capacity() * sizeof(Doc) +
+                   m_locOffsets.capacity() * sizeof(uint32_t) + m_locations.capacity() * sizeof(Location) +
+                   (m_keys.capacity() + m_offsets.capacity() + m_postings.capacity()) * sizeof(uint32_t) +
+                   m_nodes.capacity() * sizeof(const MdNode*);
+    for (auto& name : m_streams) bytes += sizeof(name) + name.capacity() * sizeof(wchar_t);
+    return bytes;
+}
+
+// ============================================================================
+// ХРАНЕНИЕ
+// ============================================================================
+//
+//   [MdTextIndexHeader][тексты][документы][границы мест][места]
+//   [триграммы][границы списков][списки][длины имён потоков][имена потоков]
+// Каждый массив выровнен по 8; порядок байт - little-endian (endianTag).
+
+static const uint32_t MD_TEXT_INDEX_VERSION = 1;
+
+struct MdTextIndexHeader {
+    char     magic[4]; // "MDTX"
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t nodeCount;
+    MdFileFingerprint source;
+    uint64_t textBytes;
+    uint32_t docCount;
+    uint32_t locationCount;
+    uint32_t keyCount;
+    uint32_t postingCount;
+    uint32_t streamCount;
+    uint32_t streamChars;
+};
+
+template <class T>
+static void AppendArray(std::string& out, const T* items, size_t count) {
+    if (count) out.append((const char*)items, count * sizeof(T));
+    out.resize((out.size() + 7) & ~(size_t)7, '\0');
+}
+
+// Читает массив из отображения; false - файл короче, чем обещает заголовок
+template <class T>
+static bool ReadArray(const char* data, uint64_t size, uint64_t& pos, std::vector<T>& items, size_t count) {
+    uint64_t bytes = (uint64_t)count * sizeof(T);
+    if (pos + bytes > size) return false;
+    items.resize(count);
+    if (count) memcpy(&items[0], data + pos, (size_t)bytes);
+    pos = (pos + bytes + 7) & ~(uint64_t)7;
+    return true;
+}
+
+bool MdTextIndex::Save(const std::wstring& path) {
+    if (!m_pending.empty() || m_locOffsets.empty()) return Fail(L"Индекс не построен (Build)");
+
+    std::vector<uint32_t> nameLengths;
+    std::wstring names;
+    for (auto& name : m_streams) {
+        nameLengths.push_back((uint32_t)name.size());
+        names += name;
+    }
+
+    MdTextIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "MDTX", 4);
+    h.version = MD_TEXT_INDEX_VERSION;
+    h.endianTag = MD_SNAP_ENDIAN_TAG;
+    h.nodeCount = m_nodeCount;
+    h.source = m_source;
+    h.textBytes = m_text.size();
+    h.docCount = (uint32_t)m_docs.size();
+    h.locationCount = (uint32_t)m_locations.size();
+    h.keyCount = (uint32_t)m_keys.size();
+    h.postingCount = (uint32_t)m_postings.size();
+    h.streamCount = (uint32_t)m_streams.size();
+    h.streamChars = (uint32_t)names.size();
+
+    std::string out;
+    AppendArray(out, &h, 1);
+    AppendArray(out, m_text.data(), m_text.size());
+    AppendArray(out, m_docs.data(), m_docs.size());
+    AppendArray(out, m_locOffsets.data(), m_locOffsets.size());
+    AppendArray(out, m_locations.data(), m_locations.size());
+    AppendArray(out, m_keys.data(), m_keys.size());
+    AppendArray(out, m_offsets.data(), m_offsets.size());
+    AppendArray(out, m_postings.data(), m_postings.size());
+    AppendArray(out, nameLengths.data(), nameLengths.size());
+    AppendArray(out, names.data(), names.size());
+
+    if (!MdReplaceFile(path, out)) return Fail(L"Не удалось записать индекс: " + path);
+    return true;
+}
+
+bool MdTextIndex::Load(const std::wstring& path) {
+    Clear();
+    MdMappedFile file;
+    if (!file.Open(path)) return Fail(L"Не удалось открыть индекс: " + path);
+    const char* data = file.Data();
+    uint64_t size = file.Size();
+
+    MdTextIndexHeader h;
+    if (size < sizeof(h)) return Fail(L"Файл индекса повреждён");
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, "MDTX", 4) != 0 || h.endianTag != MD_SNAP_ENDIAN_TAG) return Fail(L"Это не файл индекса");
+    if (h.version != MD_TEXT_INDEX_VERSION) return Fail(L"Неподдерживаемая версия индекса");
+
+    uint64_t pos = (sizeof(h) + 7) & ~(uint64_t)7;
+    if (h.textBytes > size || pos + h.textBytes > size) return Fail(L"Файл индекса повреждён");
+    m_text.assign(data + pos, (size_t)h.textBytes);
+    pos = (pos + h.textBytes + 7) & ~(uint64_t)7;
+
+    std::vector<uint32_t> nameLengths;
+    std::vector<wchar_t> names;
+    bool ok = ReadArray(data, size, pos, m_docs, h.docCount) &&
+              ReadArray(data, size, pos, m_locOffsets, (size_t)h.docCount + 1) &&
+              ReadArray(data, size, pos, m_locations, h.locationCount) &&
+              ReadArray(data, size, pos, m_keys, h.keyCount) &&
+              ReadArray(data, size, pos, m_offsets, (size_t)h.keyCount + 1) &&
+              ReadArray(data, size, pos, m_postings, h.postingCount) &&
+              ReadArray(data, size, pos, nameLengths, h.streamCount) &&
+              ReadArray(data, size, pos, names, h.streamChars);
+
+    // Границы должны сходиться, иначе поиск выйдет за массивы
+    ok = ok && m_locOffsets.back() == h.locationCount && m_offsets.back() == h.postingCount;
+    for (size_t d = 0; ok && d < m_docs.size(); ++d) {
+        // Без сложения: offset + length может переполниться
+        ok = m_docs[d].offset <= h.textBytes && m_docs[d].length <= h.textBytes - m_docs[d].offset &&
+             m_locOffsets[d] <= m_locOffsets[d + 1];
+    }
+    for (size_t k = 0; ok && k < m_keys.size(); ++k) ok = m_offsets[k] <= m_offsets[k + 1];
+    for (size_t p = 0; ok && p < m_postings.size(); ++p) ok = m_postings[p] < h.docCount;
+    size_t nameStart = 0;
+    for (size_t s = 0; ok && s < nameLengths.size(); ++s) {
+        ok = nameStart + nameLengths[s] <= names.size();
+        if (ok) m_streams.push_back(std::wstring(names.data() + nameStart, nameLengths[s]));
+        nameStart += nameLengths[s];
+    }
+    for (size_t l = 0; ok && l < m_locations.size(); ++l) {
+        const Location& loc = m_locations[l];
+        ok = loc.stream == MD_TEXT_TREE ? loc.position < h.nodeCount : loc.stream < m_streams.size();
+    }
+    if (!ok) {
+        Clear();
+        return Fail(L"Файл индекса повреждён");
+    }
+    m_nodeCount = h.nodeCount;
+    m_source = h.source;
+    return true;
+}
+
+static void CollectNodes(const MdNode* node, std::vector<const MdNode*>& nodes) {
+    nodes.push_back(node);
+    for (auto& child : node->children) CollectNodes(child.get(), nodes);
+}
+
+bool MdTextIndex::Attach(const std::shared_ptr<const MdNode>& root) {
+    std::vector<const MdNode*> nodes;
+    if (root) CollectNodes(root.get(), nodes);
+    if (nodes.size() != m_nodeCount) return Fail(L"Дерево не совпадает с индексом");
+    m_root = root;
+    m_nodes.swap(nodes);
+    return true;
+}
@@ -0,0 +1,131 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "MDParser.h"
+#include "MDSnapshot.h"
+
+// ============================================================================
+// Полнотекстовый индекс (триграммы) по метаданным и текстовым потокам
+// ============================================================================
+//
+// Документы индекса - различные значения узлов дерева метаданных (одинаковые
+// значения хранятся один раз, у документа - список узлов) и декодированные
+// текстовые потоки контейнера (документ - поток целиком). Для каждой тройки
+// подряд идущих байт (без учёта регистра, 1251) хранится отсортированный
+// список документов, в которых она встречается, - построчно (CSR), как
+// обратный индекс ссылок. Поиск подстроки пересекает списки её триграмм,
+// начиная с самого короткого, и проверяет только оставшихся кандидатов;
+// строки короче трёх символов проверяются по всем документам.
+//
+// Индекс хранит тексты документов, поэтому ищет и без парсера, например
+// после загрузки с диска (Save/Load). Узлы адресуются номером в порядке
+// обхода дерева в глубину; чтобы получить сами узлы, загруженный индекс
+// присоединяют к тому же дереву (Attach).
+
+// Совпадение в значении узла (а не в потоке)
+const uint32_t MD_TEXT_TREE = 0xFFFFFFFF;
+
+struct MdTextHit {
+    uint32_t stream;    // MD_TEXT_TREE или индекс в GetStreamNames()
+    uint32_t position;  // номер узла в обходе дерева или смещение совпадения в потоке, байт
+    uint32_t doc;       // документ индекса (для GetContext)
+    const MdNode* node; // узел, если дерево присоединено, иначе NULL
+};
+
+class MdTextIndex {
+public:
+    MdTextIndex();
+
+    void Clear();
+
+    // === Наполнение (до Build) ===
+    // Значения всех узлов дерева; дерево присоединяется к индексу
+    void AddTree(const std::shared_ptr<const MdNode>& root);
+    // Декодированный поток (текст в 1251); двоичные данные не индексируются
+    bool AddStream(const std::wstring& fullPath, const std::vector<char>& data);
+    // Дерево опубликованной конфигурации и все текстовые потоки контейнера
+    // за один проход по контейнеру (поток метаданных уже есть в дереве)
+    bool AddParser(MDParser& parser);
+    // Строит списки триграмм на threads потоках (0 - по числу ядер)
+    void Build(unsigned threads = 0);
+
+    // === Поиск ===
+    // Подстрока без учёта регистра (латиница и кириллица 1251). Совпадения -
+    // по одному на узел и на каждое вхождение в поток, в порядке документов
+    size_t Search(const std::string& text, std::vector<MdTextHit>& hits, size_t maxHits = (size_t)-1) const;
+    size_t Search(const std::wstring& text, std::vector<MdTextHit>& hits, size_t maxHits = (size_t)-1) const;
+    // Значение узла целиком или строка потока вокруг совпадения (не длиннее 2 * radius)
+    std::string GetContext(const MdTextHit& hit, size_t radius = 60) const;
+
+    const std::vector<std::wstring>& GetStreamNames() const { return m_streams; }
+    size_t GetDocumentCount() const { return m_docs.size(); }
+    size_t GetTrigramCount() const { return m_keys.size(); }
+    // Занято индексом (тексты, документы, списки), байт
+    size_t GetMemoryBytes() const;
+
+    // === Хранение ===
+    // Отпечаток исходного файла (MdGetFileFingerprint) пишется в файл индекса:
+    // по нему видно, что индекс устарел
+    void SetSource(const MdFileFingerprint& source) { m_source = source; }
+    const MdFileFingerprint& GetSource() const { return m_source; }
+    bool Save(const std::wstring& path);
+    bool Load(const std::wstring& path);
+    // Присоединить дерево, по которому строился индекс (проверяется число узлов)
+    bool Attach(const std::shared_ptr<const MdNode>& root);
+
+    const std::wstring& GetLastError() const { return m_lastError; }
+
+private:
+    struct Doc {
+        uint64_t offset; // в m_text
+        uint32_t length;
+    };
+    struct Location {
+        uint32_t stream;   // MD_TEXT_TREE или индекс потока
+        uint32_t position; // номер узла или 0 для потока
+    };
+
+    uint32_t AddDocument(const char* text, size_t length);
+    void AddNodes(const MdNode* node);
+    bool Fail(const std::wstring& error);
+
+    // Тексты документов подряд (как есть, без свёртки регистра)
+    std::string m_text;
+    std::vector<Doc> m_docs;
+    // Документ -> места (CSR)
+    std::vector<uint32_t> m_locOffsets;
+    std::vector<Location> m_locations;
+    // Триграмма -> документы по возрастанию (CSR)
+    std::vector<uint32_t> m_keys;
+    std::vector<uint32_t> m_offsets;
+    std::vector<uint32_t> m_postings;
+    std::vector<std::wstring> m_streams;
+
+    // Присоединённое дерево: номер узла -> узел
+    std::shared_ptr<const MdNode> m_root;
+    std::vector<const MdNode*> m_nodes;
+    uint32_t m_nodeCount;
+    MdFileFingerprint m_source;
+
+    // До Build: значение (строка узла присоединённого дерева) -> документ,
+    // места в порядке добавления
+    struct ValueHash {
+        size_t operator()(const std::string* s) const;
+    };
+    struct ValueEqual {
+        bool operator()(const std::string* a, const std::string* b) const { return *a == *b; }
+    };
+    std::unordered_map<const std::string*, uint32_t, ValueHash, ValueEqual> m_valueDocs;
+    std::vector<std::pair<uint32_t, Location>> m_pending;
+    std::wstring m_lastError;
+};
@@ -0,0 +1,289 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+ 
+#pragma once
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <exception>
+
+// Число рабочих потоков по умолчанию (по числу ядер)
+inline unsigned MdDefaultThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Выполняет fn(i) для всех i из [0, count) на нескольких потоках.
+// Задачи раздаются динамически через атомарный счётчик, поэтому
+// потоки с короткими задачами добирают работу у остальных.
+// threads = 0 -> по числу ядер. Если fn бросила исключение, новые задачи
+// не раздаются, все потоки дожидаются, и первое исключение пробрасывается
+// в вызывающем потоке.
+template <class Fn>
+void ParallelFor(size_t count, unsigned threads, Fn fn) {
+    if (count == 0) return;
+    if (threads == 0) threads = MdDefaultThreads();
+    if (threads > count) threads = (unsigned)count;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    auto worker = [&]() {
+        try {
+            size_t i;
+            while ((i = next.fetch_add(1)) < count) fn(i);
+        } catch (...) {
+            next.store(count); // остальные потоки доделывают текущие задачи и выходят
+            std::lock_guard<std::mutex> lock(errorLock);
+            if (!error) error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    try {
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+    } catch (...) {
+        // Поток не создан: работают уже запущенные и текущий
+    }
+    worker(); // текущий поток тоже работает
+    for (auto& th : pool) th.join();
+    if (error) std::rethrow_exception(error);
+}
+
+// Пул потоков с перехватом задач (work stealing).
+// У каждого потока своя очередь: свои задачи он берёт с конца (LIFO, тёплый кеш),
+// а опустевший поток забирает задачи с начала чужих очередей (FIFO).
+// Задачи, добавленные из рабочего потока, попадают в его собственную очередь.
+class MdWorkStealingPool {
+public:
+    explicit MdWorkStealingPool(unsigned threads = 0) : m_pending(0), m_stop(false), m_next(0) {
+        if (threads == 0) threads = MdDefaultThreads();
+        for (unsigned i = 0; i < threads; ++i) m_queues.emplace_back(new Queue());
+        for (unsigned i = 0; i < threads; ++i) m_threads.emplace_back(&MdWorkStealingPool::WorkerLoop, this, i);
+    }
+
+    ~MdWorkStealingPool() {
+        Wait();
+        {
+            std::lock_guard<std::mutex> lock(m_sleepLock);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& th : m_threads) th.join();
+    }
+
+    unsigned ThreadCount() const { return (unsigned)m_threads.size(); }
+
+    void Submit(std::function<void()> task) {
+        int self = CurrentWorker(this);
+        size_t target = self >= 0 ? (size_t)self : m_next.fetch_add(1) % m_queues.size();
+        m_pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(m_queues[target]->lock);
+            m_queues[target]->tasks.push_back(std::move(task));
+        }
+        std::lock_guard<std::mutex> lock(m_sleepLock);
+        m_wake.notify_one();
+    }
+
+    // Ждёт завершения всех поставленных задач
+    void Wait() {
+        std::unique_lock<std::mutex> lock(m_sleepLock);
+        m_idle.wait(lock, [this]() { return m_pending.load() == 0; });
+    }
+
+private:
+    MdWorkStealingPool(const MdWorkStealingPool&);
+    MdWorkStealingPool& operator=(const MdWorkStealingPool&);
+
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Номер рабочего потока этого пула для текущего потока (-1 - чужой поток)
+    static int CurrentWorker(const MdWorkStealingPool* pool, int set = -2) {
+        static thread_local const MdWorkStealingPool* owner = NULL;
+        static thread_local int index = -1;
+        if (set != -2) {
+            owner = pool;
+            index = set;
+        }
+        return owner == pool ? index : -1;
+    }
+
+    bool TryPop(unsigned self, std::function<void()>& task) {
+        {
+            Queue& own = *m_queues[self];
+            std::lock_guard<std::mutex> lock(own.lock);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < m_queues.size(); ++k) {
+            Queue& victim = *m_queues[(self + k) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(unsigned self) {
+        CurrentWorker(this, (int)self);
+        std::function<void()> task;
+        for (;;) {
+            if (TryPop(self, task)) {
+                try {
+                    task();
+                } catch (...) {
+                    // Исключение задачи не должно убивать поток пула
+                }
+                task = nullptr;
+                if (m_pending.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(m_sleepLock);
+                    m_idle.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_sleepLock);
+            if (m_stop) return;
+            // Задачи могли появиться между TryPop и захватом блокировки:
+            // ждём с таймаутом, чтобы не проспать notify
+            m_wake.wait_for(lock, std::chrono::milliseconds(10));
+            if (m_stop) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_pending;
+    std::mutex m_sleepLock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    bool m_stop;
+    std::atomic<size_t> m_next;
+};
+
+// Ожидание с нарастающей паузой: сначала уступаем квант, затем спим
+inline void MdBackoff(unsigned& spins) {
+    if (++spins < 64) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// Ограниченная очередь без блокировок (MPMC, кольцевой буфер Вьюкова).
+// Емкость округляется до степени двойки. Push при заполненной очереди ждёт
+// (обратное давление на производителя), Pop ждёт данных до Close().
+template <class T>
+class MdBoundedQueue {
+public:
+    explicit MdBoundedQueue(size_t capacity) : m_closed(false) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueuePos.store(0, std::memory_order_relaxed);
+        m_dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    bool TryPush(const T& value) {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false; // очередь полна
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false; // очередь пуста
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Возвращает true, если пришлось ждать освобождения места
+    bool Push(const T& value) {
+        unsigned spins = 0;
+        while (!TryPush(value)) MdBackoff(spins);
+        return spins != 0;
+    }
+
+    // false - очередь закрыта и пуста
+    bool Pop(T& value) {
+        unsigned spins = 0;
+        for (;;) {
+            if (TryPop(value)) return true;
+            if (m_closed.load(std::memory_order_acquire)) return TryPop(value);
+            MdBackoff(spins);
+        }
+    }
+
+    // Производители закончили: потребители доберут остаток и выйдут
+    void Close() { m_closed.store(true, std::memory_order_release); }
+
+private:
+    MdBoundedQueue(const MdBoundedQueue&);
+    MdBoundedQueue& operator=(const MdBoundedQueue&);
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    char m_pad0[64];
+    std::atomic<size_t> m_enqueuePos;
+    char m_pad1[64];
+    std::atomic<size_t> m_dequeuePos;
+    char m_pad2[64];
+    std::atomic<bool> m_closed;
+};
@@ -0,0 +1,191 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#include "MDTrace.h"
+#include <stdio.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+std::atomic<bool> g_mdTraceEnabled(false);
+
+namespace {
+
+const size_t kDetailSize = 96;
+const size_t kInitialEvents = 256; // первая порция буфера потока
+
+struct TraceEvent {
+    int64_t start, end;
+    const char* category;
+    const char* name;
+    char detail[kDetailSize]; // UTF-8, хвост пути
+};
+
+// Буфер одного потока: пишет только владелец. Растёт удвоением по мере
+// записи до capacity и только затем становится кольцом, поэтому короткие
+// потоки (ParallelFor) занимают память по числу своих событий
+struct ThreadBuffer {
+    DWORD tid;
+    std::string threadName;
+    std::vector<TraceEvent> events;
+    size_t capacity; // предел events.size() (MdTraceStart)
+    size_t written;  // всего записано (позиция = written % size)
+};
+
+std::mutex g_registryLock;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+size_t g_eventsPerThread = 65536;
+std::atomic<unsigned> g_generation(0);
+int64_t g_startTicks = 0;
+
+thread_local ThreadBuffer* t_buffer = NULL; // принадлежит g_buffers
+thread_local unsigned t_generation = 0;
+thread_local const char* t_threadName = NULL;
+
+ThreadBuffer* CurrentBuffer() {
+    unsigned generation = g_generation.load(std::memory_order_acquire);
+    if (t_buffer && t_generation == generation) return t_buffer;
+
+    auto buffer = std::make_shared<ThreadBuffer>();
+    buffer->tid = GetCurrentThreadId();
+    buffer->written = 0;
+
+    std::lock_guard<std::mutex> lock(g_registryLock);
+    buffer->capacity = g_eventsPerThread;
+    if (t_threadName) buffer->threadName = t_threadName;
+    g_buffers.push_back(buffer);
+    t_buffer = buffer.get();
+    t_generation = generation;
+    return t_buffer;
+}
+
+// Хвост строки в UTF-8 (конец пути информативнее начала)
+void CopyDetail(char* out, const wchar_t* detail) {
+    out[0] = 0;
+    if (!detail || !*detail) return;
+
+    size_t len = wcslen(detail);
+    const size_t maxChars = kDetailSize / 3 - 1; // до 3 байт UTF-8 на символ
+    const wchar_t* tail = len > maxChars ? detail + len - maxChars : detail;
+    int n = WideCharToMultiByte(CP_UTF8, 0, tail, -1, out, (int)kDetailSize, NULL, NULL);
+    if (n <= 0) out[0] = 0;
+}
+
+void AppendJsonString(std::string& out, const char* s) {
+    out += '"';
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+void MdTraceStart(size_t eventsPerThread) {
+    std::lock_guard<std::mutex> lock(g_registryLock);
+    g_buffers.clear();
+    g_eventsPerThread = eventsPerThread ? eventsPerThread : 1;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    g_startTicks = now.QuadPart;
+
+    g_generation++;
+    g_mdTraceEnabled.store(true, std::memory_order_release);
+}
+
+void MdTraceStop() {
+    g_mdTraceEnabled.store(false, std::memory_order_release);
+}
+
+void MdTraceSetThreadName(const char* name) {
+    t_threadName = name;
+    if (MdTraceEnabled()) CurrentBuffer()->threadName = name;
+}
+
+void MdTraceRecord(const char* category, const char* name, int64_t start, int64_t end, const wchar_t* detail) {
+    if (!MdTraceEnabled()) return;
+    ThreadBuffer* buffer = CurrentBuffer();
+    size_t size = buffer->events.size();
+    if (buffer->written == size && size < buffer->capacity) {
+        size = size ? size * 2 : kInitialEvents;
+        buffer->events.resize(size < buffer->capacity ? size : buffer->capacity);
+    }
+    TraceEvent& e = buffer->events[buffer->written % buffer->events.size()];
+    e.start = start;
+    e.end = end;
+    e.category = category;
+    e.name = name;
+    CopyDetail(e.detail, detail);
+    buffer->written++;
+}
+
+bool MdTraceWrite(const std::wstring& path) {
+    FILE* f = _wfopen(path.c_str(), L"wb");
+    if (!f) return false;
+
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    double usPerTick = 1000000.0 / (double)freq.QuadPart;
+
+    std::lock_guard<std::mutex> lock(g_registryLock);
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char buf[160];
+    for (auto& buffer : g_buffers) {
+        if (!buffer->threadName.empty()) {
+            snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":",
+                first ? "" : ",\n", (unsigned long)buffer->tid);
+            json += buf;
+            AppendJsonString(json, buffer->threadName.c_str());
+            json += "}}";
+            first = false;
+        }
+
+        // Переполненное кольцо: самые старые события затёрты
+        size_t size = buffer->events.size();
+        size_t count = buffer->written < size ? buffer->written : size;
+        size_t begin = buffer->written - count;
+        for (size_t i = begin; i < buffer->written; ++i) {
+            const TraceEvent& e = buffer->events[i % size];
+            snprintf(buf, sizeof(buf), "%s{\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,\"cat\":",
+                first ? "" : ",\n", (unsigned long)buffer->tid,
+                (e.start - g_startTicks) * usPerTick, (e.end - e.start) * usPerTick);
+            json += buf;
+            AppendJsonString(json, e.category);
+            json += ",\"name\":";
+            AppendJsonString(json, e.name);
+            if (e.detail[0]) {
+                json += ",\"args\":{\"detail\":";
+                AppendJsonString(json, e.detail);
+                json += "}";
+            }
+            json += "}";
+            first = false;
+
+            if (json.size() > (1 << 20)) {
+                fwrite(json.data(), 1, json.size(), f);
+                json.clear();
+            }
+        }
+    }
+    json += "\n]}\n";
+    bool ok = fwrite(json.data(), 1, json.size(), f) == json.size();
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,87 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+#pragma once
+#include <windows.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// ============================================================================
+// Трассировка: шкала времени в формате Chrome Trace (about:tracing, Perfetto)
+// ============================================================================
+//
+// Каждый поток пишет события в свой кольцевой буфер (без блокировок); буфер
+// растёт по мере записи до eventsPerThread, затем затираются старые
+// события. Стадии MDProfile попадают в трассу автоматически, файлы и потоки
+// контейнера - через MD_TRACE_SCOPE.
+// MdTraceStart/Stop/Write вызываются, когда рабочие потоки простаивают.
+
+extern std::atomic<bool> g_mdTraceEnabled;
+
+inline bool MdTraceEnabled() {
+#ifdef MD_NO_PROFILE
+    return false;
+#else
+    return g_mdTraceEnabled.load(std::memory_order_relaxed);
+#endif
+}
+
+// Включает запись (старые события сбрасываются)
+void MdTraceStart(size_t eventsPerThread = 65536);
+void MdTraceStop();
+// Записывает JSON {"traceEvents":[...]}
+bool MdTraceWrite(const std::wstring& path);
+
+// Имя текущего потока на шкале времени (статическая строка)
+void MdTraceSetThreadName(const char* name);
+
+// Завершённое событие [start, end) в тиках QueryPerformanceCounter.
+// name - статическая строка, detail (путь файла/потока) может быть пуст.
+void MdTraceRecord(const char* category, const char* name, int64_t start, int64_t end,
+                   const wchar_t* detail = NULL);
+
+// Событие на время области видимости (detail должен жить до её конца)
+class MdTraceScope {
+public:
+    MdTraceScope(const char* category, const char* name, const std::wstring& detail)
+        : m_category(category), m_name(name), m_detail(&detail), m_start(0) {
+        Begin();
+    }
+
+    MdTraceScope(const char* category, const char* name)
+        : m_category(category), m_name(name), m_detail(NULL), m_start(0) {
+        Begin();
+    }
+
+    ~MdTraceScope() {
+        if (!m_start) return;
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        MdTraceRecord(m_category, m_name, m_start, now.QuadPart, m_detail ? m_detail->c_str() : NULL);
+    }
+
+private:
+    void Begin() {
+        if (!MdTraceEnabled()) return;
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        m_start = now.QuadPart;
+    }
+
+    MdTraceScope(const MdTraceScope&);
+    MdTraceScope& operator=(const MdTraceScope&);
+
+    const char* m_category;
+    const char* m_name;
+    const std::wstring* m_detail;
+    int64_t m_start;
+};
+
+#define MD_TRACE_CONCAT2(a, b) a##b
+#define MD_TRACE_CONCAT(a, b) MD_TRACE_CONCAT2(a, b)
+#define MD_TRACE_SCOPE(category, name, ...) MdTraceScope MD_TRACE_CONCAT(mdTraceScope_, __LINE__)(category, name, ##__VA_ARGS__)
@@ -15,6 +15,7 @@
 #include <vector>
 #include <memory> 
 #include "MDParser.h"
+#include "MDConfig.h"
 
 // ID контролов
 #define IDC_TABCONTROL    1000
@@ -26,6 +27,10 @@
 #define IDC_TREEVIEW_META 1006
 #define IDC_HELP_BTN      1007 // НОВЫЙ ID ДЛЯ КНОПКИ СПРАВКИ
 
+// Сообщения от фоновой загрузки: wParam - номер загрузки
+#define WM_APP_LOAD_PROGRESS (WM_APP + 1) // lParam - MdLoadProgress* (освобождает окно)
+#define WM_APP_LOAD_DONE     (WM_APP + 2) // lParam - успех
+
 HINSTANCE g_hInst = NULL;
 HWND g_hMainWnd = NULL;
 HWND g_hTab = NULL;
@@ -41,6 +46,10 @@ HWND g_hHelpBtn = NULL; // Хендл кнопки справки
 
 WCHAR g_szLastPath[MAX_PATH] = { 0 };
 MDParser g_parser;
+std::shared_ptr<const MdConfig> g_config; // отображаемая конфигурация: на неё ссылаются узлы деревьев
+LONG g_loadId = 0; // номер текущей загрузки: сообщения от прежних отбрасываются
+
+const WCHAR* g_szTitle = L"Парсер 1С 7.7 (Professional)";
 
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
 LRESULT CALLBACK HelpWndProc(HWND, UINT, WPARAM, LPARAM); // Процедура окна справки
@@ -50,12 +59,15 @@ void SwitchTab(int index);
 void OnBrowseFile();
 void OnHelp(); // Функция вызова справки
 void GetIniPath(WCHAR* buffer, size_t size);
+void GetCacheDir(WCHAR* buffer, size_t size);
 void LoadSettings();
 void SaveSettings();
 void LoadAndParseFile(const WCHAR* path);
+void OnLoadProgress(const MdLoadProgress& p);
+void OnLoadDone(bool ok);
 
 void FillTreeOLE(HTREEITEM hParent, const std::vector<OLEEntry>& entries);
-void FillTreeMetadata(HTREEITEM hParent, std::shared_ptr<MdNode> node, int index);
+void FillTreeMetadata(HTREEITEM hParent, std::shared_ptr<const MdNode> node, int index);
 void UpdateDetailView(LPNMTREEVIEWW pNM);
 
 // Текст справки
@@ -90,6 +102,8 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
     icex.dwSize = sizeof(INITCOMMONCONTROLSEX);
     icex.dwICC = ICC_TREEVIEW_CLASSES | ICC_TAB_CLASSES;
     InitCommonControlsEx(&icex);
+    // Анализ метаданных - на всех ядрах (до первой загрузки)
+    g_parser.SetAnalyzeThreads(0);
 
     // Регистрация класса главного окна
     WNDCLASSEXW wcex = { 0 };
@@ -114,7 +128,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
     wcexHelp.hIcon = LoadIcon(NULL, IDI_INFORMATION);
     RegisterClassExW(&wcexHelp);
 
-    g_hMainWnd = CreateWindowW(L"OneCParserClass", L"Парсер 1С 7.7 (Professional)", 
+    g_hMainWnd = CreateWindowW(L"OneCParserClass", g_szTitle, 
         WS_OVERLAPPEDWINDOW | WS_CLIPCHILDREN, CW_USEDEFAULT, 0, 900, 600, 
         NULL, NULL, hInstance, NULL);
 
@@ -131,6 +145,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, LPWSTR, int nCmdShow) {
 
     MSG msg;
     while (GetMessageW(&msg, NULL, 0, 0)) {
+        // Esc прерывает фоновую загрузку, в каком бы контроле ни был фокус
+        if (msg.message == WM_KEYDOWN && msg.wParam == VK_ESCAPE && g_parser.IsLoading()) {
+            g_parser.CancelLoad();
+            continue;
+        }
         TranslateMessage(&msg);
         DispatchMessageW(&msg);
     }
@@ -243,7 +262,21 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
         }
         break;
 
+    case WM_APP_LOAD_PROGRESS:
+        {
+            MdLoadProgress* p = (MdLoadProgress*)lParam;
+            if ((LONG)wParam == g_loadId) OnLoadProgress(*p);
+            delete p;
+        }
+        break;
+
+    case WM_APP_LOAD_DONE:
+        if ((LONG)wParam == g_loadId) OnLoadDone(lParam != 0);
+        break;
+
     case WM_DESTROY:
+        g_parser.CancelLoad();
+        g_parser.WaitLoad();
         PostQuitMessage(0);
         break;
 
@@ -400,6 +433,16 @@ void GetIniPath(WCHAR* buffer, size_t size) {
     StringCchCatW(buffer, size, L"parser.ini");
 }
 
+// Каталог кеша разбора - рядом с exe, как и parser.ini
+void GetCacheDir(WCHAR* buffer, size_t size) {
+    if (GetModuleFileNameW(NULL, buffer, (DWORD)size) == 0) {
+        buffer[0] = 0; return;
+    }
+    WCHAR* pLastSlash = wcsrchr(buffer, L'\\');
+    if (pLastSlash) *(pLastSlash + 1) = L'\0';
+    StringCchCatW(buffer, size, L"cache");
+}
+
 void LoadSettings() {
     WCHAR iniPath[MAX_PATH];
     GetIniPath(iniPath, MAX_PATH);
@@ -431,7 +474,7 @@ void FillTreeOLE(HTREEITEM hParent, const std::vector<OLEEntry>& entries) {
     }
 }
 
-void FillTreeMetadata(HTREEITEM hParent, std::shared_ptr<MdNode> node, int index) {
+void FillTreeMetadata(HTREEITEM hParent, std::shared_ptr<const MdNode> node, int index) {
     if (!node) return;
 
     TVINSERTSTRUCTW tvis;
@@ -503,22 +546,93 @@ void FillTreeMetadata(HTREEITEM hParent, std::shared_ptr<MdNode> node, int index
     }
 }
 
+// Открытие и разбор идут в рабочем потоке (MDParser::LoadAsync), окно
+// остаётся отзывчивым: ход загрузки - в заголовке, Esc - отмена.
+// Деревья заполняются по WM_APP_LOAD_DONE, когда рабочий поток завершён.
 void LoadAndParseFile(const WCHAR* path) {
+    // Прежняя загрузка отменяется до очистки деревьев: они ссылаются на данные парсера
+    g_parser.CancelLoad();
+    g_parser.WaitLoad();
+
     TreeView_DeleteAllItems(g_hTreeOLE);
     TreeView_DeleteAllItems(g_hTreeMeta);
     SetWindowTextW(g_hEdit, L"");
-    
-    if (g_parser.Open(path)) {
-        const auto& roots = g_parser.GetRootEntries();
-        FillTreeOLE(TVI_ROOT, roots);
-
-        g_parser.ReadStreamText(L"Metadata\\Main MetaData Stream");
-        auto parsedRoot = g_parser.GetParsedRoot();
-        if (parsedRoot) {
-            FillTreeMetadata(TVI_ROOT, parsedRoot, -1);
-            HTREEITEM hRoot = TreeView_GetRoot(g_hTreeMeta);
-            if (hRoot) TreeView_Expand(g_hTreeMeta, hRoot, TVE_EXPAND);
-        }
+    g_config.reset();
+
+    // Если файл не менялся с прошлого запуска, разбор берётся из кеша
+    WCHAR cacheDir[MAX_PATH];
+    GetCacheDir(cacheDir, MAX_PATH);
+    MdLoadOptions options;
+    options.useCache = true;
+    options.cacheDir = cacheDir;
+
+    LONG id = InterlockedIncrement(&g_loadId);
+    HWND hWnd = g_hMainWnd;
+    auto lastPost = std::make_shared<DWORD>(0);
+
+    // Колбэки вызываются в рабочем потоке: в окно - только через PostMessage,
+    // не чаще раза в 100 мс (смена стадии - всегда)
+    auto progress = [hWnd, id, lastPost](const MdLoadProgress& p) {
+        static const DWORD kInterval = 100;
+        DWORD now = GetTickCount();
+        if (p.phase == MD_LOAD_PARSE && p.parsedBytes && now - *lastPost < kInterval) return;
+        *lastPost = now;
+        MdLoadProgress* copy = new MdLoadProgress(p);
+        if (!PostMessageW(hWnd, WM_APP_LOAD_PROGRESS, (WPARAM)id, (LPARAM)copy)) delete copy;
+    };
+    auto done = [hWnd, id](bool ok, const std::wstring&) {
+        PostMessageW(hWnd, WM_APP_LOAD_DONE, (WPARAM)id, (LPARAM)ok);
+    };
+
+    OnLoadProgress(MdLoadProgress());
+    g_parser.LoadAsync(path, options, progress, done);
+}
+
+void OnLoadProgress(const MdLoadProgress& p) {
+    WCHAR buffer[256];
+    switch (p.phase) {
+    case MD_LOAD_READ:
+        StringCchPrintfW(buffer, 256, L"%s - чтение метаданных... (Esc - отмена)", g_szTitle);
+        break;
+    case MD_LOAD_DECODE:
+        StringCchPrintfW(buffer, 256, L"%s - распаковка: %.1f МБ (Esc - отмена)",
+            g_szTitle, p.decodedBytes / 1048576.0);
+        break;
+    case MD_LOAD_PARSE:
+        StringCchPrintfW(buffer, 256, L"%s - разбор: %u%%, %llu узлов (Esc - отмена)", g_szTitle,
+            p.textBytes ? (unsigned)(p.parsedBytes * 100 / p.textBytes) : 0, (unsigned long long)p.nodes);
+        break;
+    case MD_LOAD_ANALYZE:
+        StringCchPrintfW(buffer, 256, L"%s - анализ структуры... (Esc - отмена)", g_szTitle);
+        break;
+    case MD_LOAD_DONE:
+        StringCchCopyW(buffer, 256, g_szTitle);
+        break;
+    default:
+        StringCchPrintfW(buffer, 256, L"%s - открытие... (Esc - отмена)", g_szTitle);
+        break;
+    }
+    SetWindowTextW(g_hMainWnd, buffer);
+}
+
+void OnLoadDone(bool ok) {
+    g_parser.WaitLoad();
+    SetWindowTextW(g_hMainWnd, g_szTitle);
+    if (!ok) {
+        std::wstring text = L"=== ОШИБКА ЗАГРУЗКИ ===\r\n" + g_parser.GetLastError();
+        SetWindowTextW(g_hEdit, text.c_str());
+        return;
+    }
+
+    g_config = g_parser.GetConfig();
+    if (!g_config) return;
+    FillTreeOLE(TVI_ROOT, g_config->GetRootEntries());
+
+    auto parsedRoot = g_config->GetRoot();
+    if (parsedRoot) {
+        FillTreeMetadata(TVI_ROOT, parsedRoot, -1);
+        HTREEITEM hRoot = TreeView_GetRoot(g_hTreeMeta);
+        if (hRoot) TreeView_Expand(g_hTreeMeta, hRoot, TVE_EXPAND);
     }
 }
 
@@ -540,10 +654,38 @@ void UpdateDetailView(LPNMTREEVIEWW pNM) {
         }
     } 
     else if (pNM->hdr.idFrom == IDC_TREEVIEW_META) {
-        MdNode* pNode = (MdNode*)pNM->itemNew.lParam;
+        const MdNode* pNode = (const MdNode*)pNM->itemNew.lParam;
         if (pNode) {
             std::wstring text = L"=== ФРАГМЕНТ МЕТАДАННЫХ ===\r\n";
-            text += g_parser.DumpNodeToText(pNode);
+            text += g_config->DumpNodeToText(pNode);
+
+            // Для объекта - кто на него ссылается (обратный индекс)
+            const std::string& id = pNode->children.empty() ? std::string() : pNode->children[0]->value;
+            const MdRefSource* refs = NULL;
+            size_t count = 0;
+            if (!id.empty() && g_config->FindObject(id) == pNode) {
+                count = g_config->GetReverseRefs().Find(id, refs);
+            }
+            if (count) {
+                const MdRefIndex& index = g_config->GetReverseRefs();
+                text += L"\r\n=== ССЫЛКИ НА ОБЪЕКТ (" + std::to_wstring((unsigned long long)count) + L") ===\r\n";
+                for (size_t i = 0; i < count; ++i) {
+                    const std::string& field = index.Name(refs[i].field);
+                    text += L"Поле " + std::wstring(field.begin(), field.end());
+                    if (refs[i].owner == MD_REF_NO_OWNER) {
+                        // Без владельца - константа (сама объект) или графа общего журнала
+                        text += g_config->GetObjectTypes().count(field) ? L" (константа)\r\n" : L" (графа общего журнала)\r\n";
+                        continue;
+                    }
+                    const std::string& owner = index.Name(refs[i].owner);
+                    auto itType = g_config->GetObjectTypes().find(owner);
+                    text += L" объекта " + std::wstring(owner.begin(), owner.end());
+                    if (itType != g_config->GetObjectTypes().end()) {
+                        text += L" (" + std::wstring(itType->second.begin(), itType->second.end()) + L")";
+                    }
+                    text += L"\r\n";
+                }
+            }
             SetWindowTextW(g_hEdit, text.c_str());
         }
     }
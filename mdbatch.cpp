@@ -0,0 +1,547 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+// Пакетная обработка: mdbatch [-j N] [--pipeline] [--mem-limit МБ] [--query путь] [--find текст]
+//                              [--index-dir каталог] [--dedup] [--store каталог] [--unused] [--stats f.csv|f.json]
+//                              [--profile f.json] [--trace t.json] <каталог | файл | @список> ...
+// Для каждого .md/.ert: открытие, декодирование всех потоков, разбор и анализ
+// метаданных. По умолчанию файлы обрабатываются целиком на пуле с перехватом
+// задач; --pipeline - конвейер со стадиями (MDPipeline.h). --query выполняет
+// запрос (MDQuery.h) над метаданными каждого файла и выводит найденные узлы,
+// --find ищет текст по полнотекстовому индексу (MDTextIndex.h) файла;
+// с --index-dir индексы сохраняются в каталоге и переиспользуются.
+// --dedup держит метаданные и потоки всех файлов в общем хранилище по
+// содержимому (MDStore.h) и выводит, сколько из них различно. --unused
+// выводит справочники и перечисления, на которые не ссылается ни один
+// документ, регистр или журнал (MDGraph.h). --stats собирает статистику
+// метаданных и потоков каждого файла и всего парка (MDStatistics.h).
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "MDParser.h"
+#include "MDConfig.h"
+#include "MDQuery.h"
+#include "MDTextIndex.h"
+#include "MDStore.h"
+#include "MDGraph.h"
+#include "MDStatistics.h"
+#include "MDCache.h"
+#include "MDThreads.h"
+#include "MDPipeline.h"
+#include "MDProfile.h"
+#include "MDTrace.h"
+
+typedef MdPipelineFileResult FileResult;
+
+// Что делать с каждым файлом помимо разбора
+struct BatchOptions {
+    size_t memoryLimit = 0;
+    const MdQuery* query = NULL; // --query
+    std::wstring find;           // --find
+    std::wstring indexDir;       // --index-dir: пусто - индекс не сохраняется
+    MdContentStore* store = NULL; // --dedup, --store
+    bool unused = false;          // --unused
+};
+
+std::mutex g_outLock;
+std::atomic<unsigned long long> g_queryMatches(0);
+std::atomic<unsigned long long> g_findMatches(0);
+std::atomic<unsigned long long> g_unusedObjects(0);
+
+void Usage();
+void PrintUtf8(FILE* f, const std::wstring& text);
+bool IsConfigFile(const std::wstring& name);
+void CollectFiles(const std::wstring& path, std::vector<std::wstring>& files);
+void ReadFileList(const std::wstring& listPath, std::vector<std::wstring>& files);
+void ProcessFile(const std::wstring& path, const BatchOptions& options, FileResult& r, MdStatistics* stats);
+void RunQuery(const MdQuery& query, const MdConfig& config, const std::wstring& path);
+void RunFind(const MdTextIndex& index, const std::wstring& text, const std::wstring& path);
+void RunUnused(const std::shared_ptr<const MdConfig>& config, const std::wstring& path);
+bool LoadTextIndex(const std::wstring& indexPath, const MdFileFingerprint& fp, MdTextIndex& index);
+void DecodeEntries(MDParser& parser, MdTextIndex* index, MdContentStore* store, MdStatistics* stats,
+                   FileResult& r);
+void PrintResult(const FileResult& r);
+double NowMs();
+
+int wmain(int argc, wchar_t* argv[]) {
+    unsigned threads = 0;
+    bool pipeline = false;
+    BatchOptions batch;
+    std::wstring profilePath;
+    std::wstring tracePath;
+    std::wstring statsPath;
+    MdQuery query;
+    MdContentStore store;
+    bool dedup = false;
+    std::vector<std::wstring> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        if (arg == L"-j" && i + 1 < argc) {
+            threads = (unsigned)_wtoi(argv[++i]);
+        } else if (arg == L"--pipeline") {
+            pipeline = true;
+        } else if (arg == L"--mem-limit" && i + 1 < argc) {
+            batch.memoryLimit = (size_t)_wtoi(argv[++i]) << 20;
+        } else if (arg == L"--query" && i + 1 < argc) {
+            if (!query.Compile(std::wstring(argv[++i]))) {
+                PrintUtf8(stderr, L"Ошибка в запросе: " + query.GetLastError() + L"\n");
+                return 1;
+            }
+        } else if (arg == L"--find" && i + 1 < argc) {
+            batch.find = argv[++i];
+        } else if (arg == L"--index-dir" && i + 1 < argc) {
+            batch.indexDir = argv[++i];
+        } else if (arg == L"--dedup") {
+            dedup = true;
+        } else if (arg == L"--store" && i + 1 < argc) {
+            if (!store.SetDirectory(argv[++i])) {
+                PrintUtf8(stderr, store.GetLastError() + L"\n");
+                return 1;
+            }
+            dedup = true;
+        } else if (arg == L"--unused") {
+            batch.unused = true;
+        } else if (arg == L"--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        } else if (arg == L"--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+            MdProfileEnable(true);
+        } else if (arg == L"--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == L"-h" || arg == L"/?") {
+            Usage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == L'@') {
+            ReadFileList(arg.substr(1), files);
+        } else {
+            CollectFiles(arg, files);
+        }
+    }
+
+    if (files.empty()) {
+        Usage();
+        return 1;
+    }
+    if (pipeline && (query.IsCompiled() || !batch.find.empty() || dedup || batch.unused || !statsPath.empty())) {
+        PrintUtf8(stderr, L"--query, --find, --dedup, --unused и --stats не совместимы с --pipeline\n");
+        return 1;
+    }
+    if (query.IsCompiled()) batch.query = &query;
+    if (dedup) batch.store = &store;
+
+    std::vector<FileResult> results(files.size());
+    // Статистика - своя у каждого файла, без общих счётчиков между потоками
+    std::vector<MdStatistics> fileStats(statsPath.empty() ? 0 : files.size());
+    PrintUtf8(stdout, L"status\tms\tsize\tstreams\tdecoded\tnodes\tobjects\trefs\tpeak_mb\tpath\terror\n");
+
+    if (!tracePath.empty()) MdTraceStart();
+
+    double start = NowMs();
+    unsigned usedThreads = 0;
+    std::vector<MdPipelineStageStats> stages;
+    if (pipeline) {
+        MdPipelineOptions options;
+        options.decodeThreads = threads;
+        options.parseThreads = threads > 1 ? threads / 2 : threads;
+        options.memoryLimit = batch.memoryLimit;
+
+        std::mutex resultsLock;
+        size_t done = 0;
+        MdPipeline engine(options);
+        engine.Run(files, [&](const FileResult& r) {
+            PrintResult(r);
+            std::lock_guard<std::mutex> lock(resultsLock);
+            results[done++] = r;
+        });
+        stages = engine.GetStageStats();
+        for (auto& s : stages) usedThreads += s.threads;
+    } else {
+        MdWorkStealingPool pool(threads);
+        usedThreads = pool.ThreadCount();
+        for (size_t i = 0; i < files.size(); ++i) {
+            pool.Submit([&results, &files, &batch, &fileStats, i]() {
+                MdTraceSetThreadName("worker");
+                ProcessFile(files[i], batch, results[i], fileStats.empty() ? NULL : &fileStats[i]);
+                PrintResult(results[i]);
+            });
+        }
+        pool.Wait();
+    }
+    double elapsed = NowMs() - start;
+
+    // Итог: пропускная способность по файлам и по объёму
+    size_t okCount = 0;
+    unsigned long long totalBytes = 0, decodedBytes = 0, nodes = 0;
+    for (auto& r : results) {
+        if (r.ok) okCount++;
+        totalBytes += r.fileSize;
+        decodedBytes += r.decodedBytes;
+        nodes += r.nodes;
+    }
+    double sec = elapsed > 0 ? elapsed / 1000.0 : 1e-9;
+
+    wchar_t summary[512];
+    swprintf(summary, 512,
+        L"# файлов: %u, ошибок: %u, потоков: %u\n"
+        L"# время: %.2f с, %.1f файлов/с, %.1f МБ/с (исходные), %.1f МБ/с (декодированные), %.0f узлов/с\n",
+        (unsigned)results.size(), (unsigned)(results.size() - okCount), usedThreads,
+        sec, results.size() / sec, totalBytes / 1048576.0 / sec, decodedBytes / 1048576.0 / sec, nodes / sec);
+    PrintUtf8(stdout, summary);
+    if (batch.query) {
+        swprintf(summary, 512, L"# найдено запросом: %llu\n", g_queryMatches.load());
+        PrintUtf8(stdout, summary);
+    }
+    if (!batch.find.empty()) {
+        swprintf(summary, 512, L"# найдено текстом: %llu\n", g_findMatches.load());
+        PrintUtf8(stdout, summary);
+    }
+    if (batch.unused) {
+        swprintf(summary, 512, L"# неиспользуемых объектов: %llu\n", g_unusedObjects.load());
+        PrintUtf8(stdout, summary);
+    }
+    if (batch.store) {
+        // Сколько памяти занял бы парк, если держать различное один раз
+        MdContentStoreStats st = store.GetStats();
+        swprintf(summary, 512,
+            L"# хранилище: конфигураций %llu, узлов %llu из %llu (%.1f%%), потоков %llu из %llu, %.1f МБ из %.1f МБ\n",
+            st.configs, st.nodesStored, st.nodesIn, st.nodesIn ? st.nodesStored * 100.0 / st.nodesIn : 0.0,
+            st.streamsStored, st.streamsIn, st.streamBytesStored / 1048576.0, st.streamBytesIn / 1048576.0);
+        PrintUtf8(stdout, summary);
+        if (!store.GetLastError().empty()) PrintUtf8(stderr, store.GetLastError() + L"\n");
+    }
+
+    if (!statsPath.empty()) {
+        // Итог парка - сумма по файлам; в отчёт - только разобранные файлы
+        MdStatistics total;
+        std::vector<MdStatisticsRow> rows;
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (!results[i].ok) continue;
+            total.Merge(fileStats[i]);
+            MdStatisticsRow row = { results[i].path, &fileStats[i] };
+            rows.push_back(row);
+        }
+        MdStatStreamCounts st = total.StreamTotals();
+        swprintf(summary, 512, L"# статистика: объектов %llu, реквизитов %llu, ссылок %llu, потоков %llu, %.1f МБ -> %.1f МБ (x%.2f)\n",
+            total.objects, total.fields, total.refFields, st.count, st.rawBytes / 1048576.0, st.decodedBytes / 1048576.0,
+            st.rawBytes ? (double)st.decodedBytes / st.rawBytes : 0.0);
+        PrintUtf8(stdout, summary);
+        if (!MdWriteStatistics(statsPath, rows, total)) PrintUtf8(stderr, L"Не удалось записать статистику: " + statsPath + L"\n");
+    }
+
+    // Загрузка стадий конвейера: у самой медленной занятость близка к 100%
+    for (auto& st : stages) {
+        double load = st.threads ? st.busyMs / (elapsed * st.threads) * 100.0 : 0;
+        swprintf(summary, 512, L"# стадия %-7ls потоков: %u, элементов: %llu, %.1f МБ, занято: %.0f мс (%.0f%%), ожидание очереди: %.0f мс\n",
+            st.name, st.threads, st.items, st.bytes / 1048576.0, st.busyMs, load, st.stallMs);
+        PrintUtf8(stdout, summary);
+    }
+
+    if (!tracePath.empty()) {
+        MdTraceStop();
+        if (!MdTraceWrite(tracePath)) PrintUtf8(stderr, L"Не удалось записать трассу: " + tracePath + L"\n");
+    }
+    if (!profilePath.empty() && !MdProfileWriteJson(profilePath))
+        PrintUtf8(stderr, L"Не удалось записать профиль: " + profilePath + L"\n");
+
+    return okCount == results.size() ? 0 : 2;
+}
+
+void Usage() {
+    PrintUtf8(stderr,
+        L"Использование: mdbatch [-j N] [--pipeline] [--mem-limit МБ] [--query путь] [--find текст]\n"
+        L"               [--index-dir каталог] [--dedup] [--store каталог] [--unused] [--stats f.csv|f.json]\n"
+        L"               [--profile f.json] [--trace t.json] <каталог | файл.md | @список.txt> ...\n"
+        L"  каталог      - рекурсивный поиск *.md и *.ert\n"
+        L"  @список.txt  - файл со списком путей (по одному в строке)\n"
+        L"  -j N         - число рабочих потоков (по умолчанию - по числу ядер)\n"
+        L"  --pipeline   - конвейер: чтение, распаковка, разбор и анализ в отдельных\n"
+        L"                 стадиях (-j задаёт потоки распаковки, разбору - половина)\n"
+        L"  --mem-limit МБ - предел памяти на файл: разбор, который его превысил бы,\n"
+        L"                 прерывается с ошибкой; в колонке peak_mb - пик памяти файла\n"
+        L"  --query путь - запрос к метаданным каждого файла (MDQuery.h), например\n"
+        L"                 Documents/*/\"Head Fields\"/*[7]; найденное - строки Q<tab>файл<tab>узел\n"
+        L"  --find текст - поиск подстроки (без учёта регистра) в значениях метаданных и\n"
+        L"                 текстовых потоках; найденное - строки\n"
+        L"                 F<tab>файл<tab>поток или метаданные<tab>текст\n"
+        L"  --index-dir dir - сохранять индексы --find в каталоге dir (.mdtx): при\n"
+        L"                 неизменном файле поиск идёт по индексу без разбора\n"
+        L"  --dedup      - держать метаданные и потоки всех файлов в общем хранилище по\n"
+        L"                 содержимому (одинаковое - один раз) и вывести итог хранилища\n"
+        L"  --store dir  - то же, различные потоки пишутся в каталог dir по ключу\n"
+        L"  --unused     - справочники и перечисления, на которые нет ссылок (в том числе\n"
+        L"                 косвенных) из документов, регистров, журналов и констант;\n"
+        L"                 найденное - строки U<tab>файл<tab>тип<tab>ID<tab>идентификатор\n"
+        L"  --stats f    - статистика по файлам и итог парка: объекты по типам, реквизиты,\n"
+        L"                 ссылки из объектов и на объекты, потоки и сжатие; f.json - JSON,\n"
+        L"                 иначе CSV (config,section,key,metric,value)\n"
+        L"  --profile f  - время по стадиям и счётчики разбора в JSON-файл f\n"
+        L"  --trace f    - шкала времени по потокам в JSON-файл f (about:tracing, Perfetto)\n");
+}
+
+double NowMs() {
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+// Вывод в UTF-8 (корректно и в консоль, и при перенаправлении в файл)
+void PrintUtf8(FILE* f, const std::wstring& text) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    if (len <= 0) return;
+    std::string utf8(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &utf8[0], len, NULL, NULL);
+
+    std::lock_guard<std::mutex> lock(g_outLock);
+    fwrite(utf8.data(), 1, utf8.size(), f);
+    fflush(f);
+}
+
+bool IsConfigFile(const std::wstring& name) {
+    size_t dot = name.rfind(L'.');
+    if (dot == std::wstring::npos) return false;
+    std::wstring ext = name.substr(dot);
+    return _wcsicmp(ext.c_str(), L".md") == 0 || _wcsicmp(ext.c_str(), L".ert") == 0;
+}
+
+void CollectFiles(const std::wstring& path, std::vector<std::wstring>& files) {
+    DWORD attr = GetFileAttributesW(path.c_str());
+    if (attr == INVALID_FILE_ATTRIBUTES) {
+        PrintUtf8(stderr, L"Путь не найден: " + path + L"\n");
+        return;
+    }
+    if (!(attr & FILE_ATTRIBUTE_DIRECTORY)) {
+        files.push_back(path);
+        return;
+    }
+
+    std::wstring dir = path;
+    if (dir[dir.size() - 1] != L'\\') dir += L'\\';
+
+    WIN32_FIND_DATAW fd;
+    HANDLE hFind = FindFirstFileW((dir + L"*").c_str(), &fd);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        std::wstring name = fd.cFileName;
+        if (name == L"." || name == L"..") continue;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) CollectFiles(dir + name, files);
+        else if (IsConfigFile(name)) files.push_back(dir + name);
+    } while (FindNextFileW(hFind, &fd));
+    FindClose(hFind);
+}
+
+void ReadFileList(const std::wstring& listPath, std::vector<std::wstring>& files) {
+    FILE* f = _wfopen(listPath.c_str(), L"rb");
+    if (!f) {
+        PrintUtf8(stderr, L"Не удалось открыть список: " + listPath + L"\n");
+        return;
+    }
+    std::string data;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.append(buf, n);
+    fclose(f);
+
+    // UTF-8 с BOM или без - иначе ANSI
+    UINT cp = CP_ACP;
+    if (data.size() >= 3 && (unsigned char)data[0] == 0xEF && (unsigned char)data[1] == 0xBB && (unsigned char)data[2] == 0xBF) {
+        data.erase(0, 3);
+        cp = CP_UTF8;
+    } else if (MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, data.c_str(), (int)data.size(), NULL, 0) > 0) {
+        cp = CP_UTF8;
+    }
+
+    int wlen = MultiByteToWideChar(cp, 0, data.c_str(), (int)data.size(), NULL, 0);
+    if (wlen <= 0) return;
+    std::wstring text(wlen, L'\0');
+    MultiByteToWideChar(cp, 0, data.c_str(), (int)data.size(), &text[0], wlen);
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(L'\n', pos);
+        if (end == std::wstring::npos) end = text.size();
+        std::wstring line = text.substr(pos, end - pos);
+        while (!line.empty() && (line[line.size() - 1] == L'\r' || line[line.size() - 1] == L' ')) line.erase(line.size() - 1);
+        if (!line.empty()) CollectFiles(line, files);
+        pos = end + 1;
+    }
+}
+
+void PrintResult(const FileResult& r) {
+    wchar_t line[256];
+    swprintf(line, 256, L"%ls\t%.1f\t%llu\t%u\t%u\t%u\t%u\t%u\t%.1f\t",
+        r.ok ? L"OK" : L"ERR", r.ms, r.fileSize, (unsigned)r.streams, (unsigned)r.decodedBytes,
+        (unsigned)r.nodes, (unsigned)r.objects, (unsigned)r.refs, r.peakMemory / 1048576.0);
+    PrintUtf8(stdout, line + r.path + L"\t" + r.error + L"\n");
+}
+
+// Потоки читаются за один проход по контейнеру
+void DecodeEntries(MDParser& parser, MdTextIndex* index, MdContentStore* store, MdStatistics* stats,
+                   FileResult& r) {
+    bool walked = parser.ForEachRawStream([&](const OLEEntry& entry, bool read, std::vector<char>& data) {
+        r.streams++;
+        MD_TRACE_SCOPE("stream", "stream", entry.fullPath);
+        if (!read) return true;
+        r.rawBytes += data.size();
+        if (data.empty()) return true;
+
+        size_t rawSize = data.size();
+        MdStreamFormat format = DecodeStreamData(data);
+        r.decodedBytes += data.size();
+        if (stats) stats->AddStream(format, rawSize, data.size());
+
+        if (format != MD_FMT_RAW && entry.fullPath == L"Metadata\\Main MetaData Stream") {
+            if (!parser.ParseMetadataText(data)) r.error = parser.GetLastError();
+        } else {
+            if (format != MD_FMT_RAW && index) index->AddStream(entry.fullPath, data);
+            // Поток метаданных хранится деревом (MdContentStore::Intern)
+            if (store) store->InternStream(std::move(data));
+        }
+        return true;
+    });
+    if (!walked) r.error = parser.GetLastError();
+}
+
+static std::wstring FromAnsi(const std::string& text) {
+    std::wstring wide;
+    int len = MultiByteToWideChar(1251, 0, text.c_str(), (int)text.size(), NULL, 0);
+    if (len > 0) {
+        wide.resize(len);
+        MultiByteToWideChar(1251, 0, text.c_str(), (int)text.size(), &wide[0], len);
+    }
+    return wide;
+}
+
+// Значение - как есть, список - первым элементом: {Documents, ...}
+static std::wstring NodeText(const MdNode* node) {
+    if (node->children.empty()) return FromAnsi(node->value);
+    return FromAnsi("{" + node->children[0]->value + (node->children.size() > 1 ? ", ...}" : "}"));
+}
+
+// Найденное по файлу выводится одним блоком, не вперемешку с другими потоками
+void RunQuery(const MdQuery& query, const MdConfig& config, const std::wstring& path) {
+    std::vector<const MdNode*> found;
+    query.Select(config, found);
+    if (found.empty()) return;
+    std::wstring text;
+    for (const MdNode* node : found) text += L"Q\t" + path + L"\t" + NodeText(node) + L"\n";
+    PrintUtf8(stdout, text);
+    g_queryMatches += found.size();
+}
+
+void RunFind(const MdTextIndex& index, const std::wstring& text, const std::wstring& path) {
+    std::vector<MdTextHit> hits;
+    index.Search(text, hits);
+    if (hits.empty()) return;
+    std::wstring out;
+    for (auto& hit : hits) {
+        std::wstring where = hit.stream == MD_TEXT_TREE ? L"метаданные" : index.GetStreamNames()[hit.stream];
+        out += L"F\t" + path + L"\t" + where + L"\t" + FromAnsi(index.GetContext(hit)) + L"\n";
+    }
+    PrintUtf8(stdout, out);
+    g_findMatches += hits.size();
+}
+
+void RunUnused(const std::shared_ptr<const MdConfig>& config, const std::wstring& path) {
+    MdDependencyGraph graph;
+    if (!graph.Build(config)) return;
+    std::vector<uint32_t> unused;
+    graph.FindUnused(unused, MD_ROOTS_DEFAULT | MdKindBit(MD_OBJ_CONSTANT));
+    if (unused.empty()) return;
+
+    const MdObjectModel& model = *graph.GetModel();
+    std::wstring out;
+    for (uint32_t i : unused) {
+        const MdObjectInfo& object = model.objects[i];
+        MdStrRef name = model.Text(object.identifier);
+        out += L"U\t" + path + L"\t" + FromAnsi(object.prefix) + L"\t" + std::to_wstring(object.id) + L"\t" +
+               FromAnsi(name.str()) + L"\n";
+    }
+    PrintUtf8(stdout, out);
+    g_unusedObjects += unused.size();
+}
+
+// Сохранённый индекс, если он построен по этой же версии файла
+bool LoadTextIndex(const std::wstring& indexPath, const MdFileFingerprint& fp, MdTextIndex& index) {
+    if (!index.Load(indexPath)) return false;
+    const MdFileFingerprint& src = index.GetSource();
+    return src.size == fp.size && src.writeTime == fp.writeTime && src.contentHash == fp.contentHash;
+}
+
+void ProcessFile(const std::wstring& path, const BatchOptions& options, FileResult& r, MdStatistics* stats) {
+    r.path = path;
+    r.ok = false;
+    r.fileSize = 0;
+    r.streams = r.rawBytes = r.decodedBytes = r.nodes = r.objects = r.refs = r.peakMemory = 0;
+    r.ms = 0;
+
+    MD_TRACE_SCOPE("file", "file", path);
+    double start = NowMs();
+
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attr))
+        r.fileSize = ((unsigned long long)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+
+    // Только поиск текста и индекс актуален - файл не разбирается
+    MdTextIndex index;
+    MdFileFingerprint fp;
+    std::wstring indexPath;
+    if (!options.find.empty() && !options.indexDir.empty()) indexPath = MdGetCachePath(path, options.indexDir, L".mdtx");
+    bool haveFp = !indexPath.empty() && MdGetFileFingerprint(path, fp);
+    if (haveFp && !options.query && !options.store && !options.unused && !stats && LoadTextIndex(indexPath, fp, index)) {
+        RunFind(index, options.find, path);
+        r.ok = true;
+        r.ms = NowMs() - start;
+        return;
+    }
+    index.Clear();
+    MdTextIndex* indexPtr = options.find.empty() ? NULL : &index;
+
+    try {
+        MDParser parser; // COM инициализируется в потоке пула
+        parser.SetMemoryLimit(options.memoryLimit);
+        if (!parser.Open(path)) {
+            r.error = parser.GetLastError();
+        } else {
+            DecodeEntries(parser, indexPtr, options.store, stats, r);
+
+            auto root = parser.GetParsedRoot();
+            r.nodes = CountNodes(root.get());
+            r.objects = parser.GetObjectTypes().size();
+            r.refs = parser.GetFieldRefs().size();
+            r.ok = r.error.empty();
+
+            std::shared_ptr<const MdConfig> config = parser.GetConfig();
+            if (options.query && r.ok && config) RunQuery(*options.query, *config, path);
+            if (options.store && r.ok && config) options.store->Intern(config);
+            if (options.unused && r.ok && config) RunUnused(config, path);
+            if (stats && r.ok && config && config->GetObjectModel()) stats->AddModel(*config->GetObjectModel());
+            if (indexPtr && r.ok) {
+                // Файлы и так обрабатываются параллельно - индекс строится в одном потоке
+                if (config) index.AddTree(config->GetRoot());
+                index.Build(1);
+                if (haveFp) {
+                    index.SetSource(fp);
+                    if (!index.Save(indexPath)) PrintUtf8(stderr, index.GetLastError() + L"\n");
+                }
+                RunFind(index, options.find, path);
+            }
+        }
+        r.peakMemory = parser.GetMemoryStats().peak;
+    } catch (...) {
+        r.error = L"Исключение при обработке";
+    }
+
+    r.ms = NowMs() - start;
+}
@@ -0,0 +1,235 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+// Замеры скорости: mdbench [-s МБ]... [-n повторов] [--seed N] [--no-dump] [--save каталог]
+// Генерирует синтетический поток метаданных (MDSynth.h) заданного объёма,
+// упаковывает его как ZLib, ZLib со смещением 8 и %w, и замеряет каждую
+// стадию отдельно. Для каждой стадии берётся лучшее время из повторов.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "MDParser.h"
+#include "MDSynth.h"
+
+struct StageResult {
+    const wchar_t* stage;
+    const wchar_t* variant;
+    double ms;
+    size_t bytes; // объём входа стадии
+    size_t nodes; // узлов обработано (0 - не применимо)
+};
+
+void Usage();
+void Print(FILE* f, const wchar_t* format, ...);
+double NowMs();
+double BestOf(unsigned repeat, const std::function<void()>& prepare, const std::function<void()>& run);
+void PrintResult(const StageResult& r);
+bool SaveFile(const std::wstring& path, const std::vector<char>& data);
+void RunSize(size_t sizeMb, unsigned repeat, unsigned seed, bool dump, const std::wstring& saveDir);
+
+int wmain(int argc, wchar_t* argv[]) {
+    std::vector<size_t> sizes;
+    unsigned repeat = 3;
+    unsigned seed = 1;
+    bool dump = true;
+    std::wstring saveDir;
+
+    for (int i = 1; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        if (arg == L"-s" && i + 1 < argc) {
+            sizes.push_back((size_t)_wtoi(argv[++i]));
+        } else if (arg == L"-n" && i + 1 < argc) {
+            repeat = (unsigned)_wtoi(argv[++i]);
+        } else if (arg == L"--seed" && i + 1 < argc) {
+            seed = (unsigned)_wtoi(argv[++i]);
+        } else if (arg == L"--no-dump") {
+            dump = false;
+        } else if (arg == L"--save" && i + 1 < argc) {
+            saveDir = argv[++i];
+        } else {
+            Usage();
+            return arg == L"-h" || arg == L"/?" ? 0 : 1;
+        }
+    }
+    if (sizes.empty()) {
+        sizes.push_back(1);
+        sizes.push_back(16);
+    }
+    if (repeat == 0) repeat = 1;
+
+    Print(stdout, L"size_mb\tstage\tvariant\tms\tMB/s\tnodes/s\n");
+    for (size_t mb : sizes) {
+        if (mb == 0 || mb > 1024) {
+            Print(stderr, L"Размер вне диапазона 1..1024 МБ: %u\n", (unsigned)mb);
+            continue;
+        }
+        RunSize(mb, repeat, seed, dump, saveDir);
+    }
+    return 0;
+}
+
+void Usage() {
+    Print(stderr,
+        L"mdbench [-s МБ]... [-n повторов] [--seed N] [--no-dump] [--save каталог]\n"
+        L"  -s МБ        - объём синтетического потока (1..1024, можно несколько раз; по умолчанию 1 и 16)\n"
+        L"  -n N         - повторов каждой стадии, берётся лучшее время (по умолчанию 3)\n"
+        L"  --no-dump    - не замерять текстовый дамп (на больших объёмах он самый тяжёлый)\n"
+        L"  --save dir   - сохранить сгенерированные потоки (text/zlib/offset8/crypt) в каталог\n");
+}
+
+// Вывод в UTF-8 (корректно и в консоль, и при перенаправлении в файл)
+void Print(FILE* f, const wchar_t* format, ...) {
+    wchar_t text[1024];
+    va_list args;
+    va_start(args, format);
+    vswprintf(text, 1024, format, args);
+    va_end(args);
+
+    char utf8[3072];
+    int len = WideCharToMultiByte(CP_UTF8, 0, text, -1, utf8, sizeof(utf8), NULL, NULL);
+    if (len > 1) fwrite(utf8, 1, len - 1, f);
+}
+
+double NowMs() {
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+// prepare (копирование входа) в замер не входит
+double BestOf(unsigned repeat, const std::function<void()>& prepare, const std::function<void()>& run) {
+    double best = 0;
+    for (unsigned i = 0; i < repeat; ++i) {
+        if (prepare) prepare();
+        double start = NowMs();
+        run();
+        double ms = NowMs() - start;
+        if (i == 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+void PrintResult(const StageResult& r) {
+    double sec = r.ms > 0 ? r.ms / 1000.0 : 1e-9;
+    Print(stdout, L"\t%ls\t%ls\t%.2f\t%.1f\t", r.stage, r.variant, r.ms, r.bytes / 1048576.0 / sec);
+    if (r.nodes) Print(stdout, L"%.0f\n", r.nodes / sec);
+    else Print(stdout, L"-\n");
+}
+
+bool SaveFile(const std::wstring& path, const std::vector<char>& data) {
+    FILE* f = _wfopen(path.c_str(), L"wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+    return ok;
+}
+
+void RunSize(size_t sizeMb, unsigned repeat, unsigned seed, bool dump, const std::wstring& saveDir) {
+    MdSynthOptions options;
+    options.targetBytes = sizeMb << 20;
+    options.seed = seed;
+
+    std::vector<char> plain;
+    double genMs = NowMs();
+    MdSynthMetadata(options, plain);
+    genMs = NowMs() - genMs;
+
+    struct Variant {
+        const wchar_t* name;
+        MdStreamFormat format;
+        std::vector<char> data;
+    };
+    Variant variants[] = {
+        { L"text",    MD_FMT_TEXT,         std::vector<char>() },
+        { L"zlib",    MD_FMT_ZLIB,         std::vector<char>() },
+        { L"offset8", MD_FMT_ZLIB_OFFSET8, std::vector<char>() },
+        { L"crypt",   MD_FMT_ENCRYPTED,    std::vector<char>() },
+    };
+
+    std::vector<StageResult> results;
+    results.push_back(StageResult{ L"generate", L"text", genMs, plain.size(), 0 });
+
+    std::vector<char> work;
+    for (auto& v : variants) {
+        double ms = BestOf(repeat, nullptr, [&]() { MdSynthEncode(plain, v.format, 6, seed, v.data); });
+        if (v.format != MD_FMT_TEXT) results.push_back(StageResult{ L"encode", v.name, ms, plain.size(), 0 });
+
+        if (!saveDir.empty()) {
+            CreateDirectoryW(saveDir.c_str(), NULL);
+            wchar_t name[64];
+            swprintf(name, 64, L"\\synth_%umb_%ls.bin", (unsigned)sizeMb, v.name);
+            SaveFile(saveDir + name, v.data);
+        }
+    }
+
+    // === Отдельные примитивы ===
+    double ms = BestOf(repeat, nullptr, [&]() { FindTextBrace(plain); });
+    results.push_back(StageResult{ L"FindTextBrace", L"text", ms, (std::min)((size_t)4096, plain.size()), 0 });
+
+    const std::vector<char>& zlib = variants[1].data;
+    ms = BestOf(repeat, [&]() { work = zlib; }, [&]() { TryDecompress(work); });
+    results.push_back(StageResult{ L"TryDecompress", L"zlib", ms, plain.size(), 0 });
+
+    const std::vector<char>& crypt = variants[3].data;
+    ms = BestOf(repeat, [&]() { work = crypt; }, [&]() { ApplyDecrypt(work, ""); });
+    results.push_back(StageResult{ L"ApplyDecrypt", L"crypt", ms, crypt.size(), 0 });
+
+    // === Полное декодирование каждого варианта (определение формата + распаковка) ===
+    for (auto& v : variants) {
+        ms = BestOf(repeat, [&]() { work = v.data; }, [&]() { DecodeStreamData(work); });
+        results.push_back(StageResult{ L"DecodeStreamData", v.name, ms, plain.size(), 0 });
+    }
+
+    // === Разбор, анализ, дамп ===
+    MDParser parser;
+    // Запас под терминатор и освобождение прошлого дерева - вне замера
+    auto preparePlain = [&]() {
+        parser.Close();
+        work.clear();
+        work.reserve(plain.size() + 1);
+        work.insert(work.end(), plain.begin(), plain.end());
+    };
+    ms = BestOf(repeat, preparePlain, [&]() { parser.ParseMetadataText(work, false); });
+    size_t nodes = CountNodes(parser.GetParsedRoot().get());
+    results.push_back(StageResult{ L"ParseString", L"text", ms, plain.size(), nodes });
+
+    // Один анализ, без публикации снимка
+    ms = BestOf(repeat, nullptr, [&]() { parser.AnalyzeMetadata(false); });
+    results.push_back(StageResult{ L"AnalyzeStructure", L"text", ms, plain.size(), nodes });
+
+    // Тот же анализ на всех ядрах (разделы и порции объектов параллельно)
+    parser.SetAnalyzeThreads(0);
+    ms = BestOf(repeat, nullptr, [&]() { parser.AnalyzeMetadata(false); });
+    parser.SetAnalyzeThreads(1);
+    results.push_back(StageResult{ L"AnalyzeStructure", L"parallel", ms, plain.size(), nodes });
+
+    // Анализ с публикацией снимка (GetConfig): разница с AnalyzeStructure - цена публикации
+    ms = BestOf(repeat, nullptr, [&]() { parser.AnalyzeMetadata(); });
+    results.push_back(StageResult{ L"AnalyzeMetadata", L"publish", ms, plain.size(), nodes });
+
+    if (dump) {
+        std::wstring text;
+        ms = BestOf(repeat, [&]() { text.clear(); }, [&]() { text = parser.DumpNodeToText(parser.GetParsedRoot().get()); });
+        results.push_back(StageResult{ L"DumpTreeToString", L"text", ms, plain.size(), nodes });
+    }
+
+    Print(stdout, L"# %u МБ: %u байт текста, %u узлов, объектов %u, ссылок %u; сжато %u байт\n",
+        (unsigned)sizeMb, (unsigned)plain.size(), (unsigned)nodes,
+        (unsigned)parser.GetObjectTypes().size(), (unsigned)parser.GetFieldRefs().size(), (unsigned)zlib.size());
+    for (auto& r : results) {
+        Print(stdout, L"%u", (unsigned)sizeMb);
+        PrintResult(r);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,144 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+// Сравнение конфигураций: mddiff [--no-streams] [-j N] старая.md новая.md
+// Строит хеши поддеревьев обеих конфигураций (MDDiff.h) и выводит различия
+// строками: знак (+ добавлено, - удалено, * изменено), тип объекта, ID,
+// идентификатор, путь в метаданных; потоки контейнера - строками S.
+// Код возврата: 0 - различий нет, 1 - есть различия, 2 - ошибка.
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "MDParser.h"
+#include "MDDiff.h"
+
+void Usage();
+void PrintUtf8(FILE* f, const std::wstring& text);
+bool BuildTree(const std::wstring& path, bool withStreams, unsigned threads, MdMerkleTree& tree);
+double NowMs();
+
+static std::wstring FromAnsi(const std::string& text) {
+    std::wstring wide;
+    int len = MultiByteToWideChar(1251, 0, text.c_str(), (int)text.size(), NULL, 0);
+    if (len > 0) {
+        wide.resize(len);
+        MultiByteToWideChar(1251, 0, text.c_str(), (int)text.size(), &wide[0], len);
+    }
+    return wide;
+}
+
+int wmain(int argc, wchar_t* argv[]) {
+    bool withStreams = true;
+    unsigned threads = 0;
+    std::vector<std::wstring> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::wstring arg = argv[i];
+        if (arg == L"--no-streams") {
+            withStreams = false;
+        } else if (arg == L"-j" && i + 1 < argc) {
+            threads = (unsigned)_wtoi(argv[++i]);
+        } else if (arg == L"-h" || arg == L"/?") {
+            Usage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == L'-') {
+            Usage();
+            return 2;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2) {
+        Usage();
+        return 2;
+    }
+
+    double start = NowMs();
+    MdMerkleTree oldTree, newTree;
+    if (!BuildTree(files[0], withStreams, threads, oldTree) || !BuildTree(files[1], withStreams, threads, newTree))
+        return 2;
+    double hashed = NowMs();
+
+    std::vector<MdDiffEntry> entries;
+    MdDiffStats stats;
+    bool equal = MdDiff(oldTree, newTree, entries, &stats);
+    double compared = NowMs();
+
+    static const wchar_t kSigns[] = { L'+', L'-', L'*' };
+    size_t counts[3] = { 0, 0, 0 };
+    std::wstring out;
+    for (auto& e : entries) {
+        counts[e.kind]++;
+        out += kSigns[e.kind];
+        if (e.stream) {
+            out += L"\tS\t" + e.streamPath + L"\n";
+            continue;
+        }
+        out += L"\t" + FromAnsi(e.type) + L"\t" + FromAnsi(e.id) + L"\t" + FromAnsi(e.name) +
+               L"\t" + FromAnsi(e.path) + L"\n";
+        if (out.size() > 65536) {
+            PrintUtf8(stdout, out);
+            out.clear();
+        }
+    }
+    PrintUtf8(stdout, out);
+
+    wchar_t summary[512];
+    swprintf(summary, 512,
+             L"# добавлено %u, удалено %u, изменено %u; сравнено узлов %u из %u, потоков %u из %u;"
+             L" хеши %.1f мс, сравнение %.1f мс\n",
+             (unsigned)counts[MD_DIFF_ADDED], (unsigned)counts[MD_DIFF_REMOVED], (unsigned)counts[MD_DIFF_CHANGED],
+             (unsigned)stats.nodesVisited, (unsigned)(oldTree.GetNodeCount() + newTree.GetNodeCount()),
+             (unsigned)stats.streamsVisited, (unsigned)(oldTree.GetStreamCount() + newTree.GetStreamCount()),
+             hashed - start, compared - hashed);
+    PrintUtf8(stderr, summary);
+    return equal ? 0 : 1;
+}
+
+void Usage() {
+    PrintUtf8(stderr,
+        L"Использование: mddiff [--no-streams] [-j N] старая.md новая.md\n"
+        L"  --no-streams - сравнивать только метаданные, без потоков контейнера\n"
+        L"  -j N         - потоков для хеширования (по умолчанию - по числу ядер)\n"
+        L"Строки: знак<tab>тип<tab>ID<tab>идентификатор<tab>путь (+ добавлено, - удалено,\n"
+        L"* изменено), для потоков - знак<tab>S<tab>путь потока\n");
+}
+
+double NowMs() {
+    static LARGE_INTEGER freq = { 0 };
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+// Вывод в UTF-8 (корректно и в консоль, и при перенаправлении в файл)
+void PrintUtf8(FILE* f, const std::wstring& text) {
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), NULL, 0, NULL, NULL);
+    if (len <= 0) return;
+    std::string utf8(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.c_str(), (int)text.size(), &utf8[0], len, NULL, NULL);
+    fwrite(utf8.data(), 1, utf8.size(), f);
+}
+
+// Парсер нужен только на время построения: дерево держит конфигурацию само
+bool BuildTree(const std::wstring& path, bool withStreams, unsigned threads, MdMerkleTree& tree) {
+    MDParser parser;
+    parser.SetAnalyzeThreads(threads);
+    if (!parser.Open(path)) {
+        PrintUtf8(stderr, path + L": " + parser.GetLastError() + L"\n");
+        return false;
+    }
+    if (!tree.Build(parser, withStreams, threads)) {
+        PrintUtf8(stderr, path + L": " + tree.GetLastError() + L"\n");
+        return false;
+    }
+    return true;
+}
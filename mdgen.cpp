@@ -0,0 +1,240 @@
+/*
+ * Project: 1C 7.7 Configuration Parser
+ * Author:  PrS <bigsprut@gmail.com>
+ * GitHub:  https://github.com/bigsprut
+ * License: MIT
+ */
+
+// Генератор контейнеров: mdgen файл.md [--preset имя] [--streams N] [--depth D]
+//   [--fanout F] [--min байт] [--max байт] [--format text|zlib|mixed]
+//   [--fragment] [--seed N] [--metadata файл]
+// Собирает составной файл заданной формы (CFBWriter.h) для замеров обхода и
+// чтения контейнера без настоящих конфигураций. Результат детерминирован для
+// одинаковых параметров. Не использует COM и собирается на любой платформе.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "CFBWriter.h"
+#include "miniz.h"
+
+struct GenOptions {
+    unsigned streams = 1000;
+    unsigned depth = 2;       // уровней хранилищ под корнем
+    unsigned fanout = 8;      // хранилищ на уровне
+    unsigned minSize = 64;    // размер потока до упаковки
+    unsigned maxSize = 65536;
+    int format = 2;           // 0 - текст, 1 - ZLib, 2 - вперемешку
+    bool fragment = false;
+    unsigned seed = 1;
+    std::string metadata;     // готовый поток метаданных (например, из mdbench --save)
+};
+
+// Детерминированный генератор (LCG), как в MDSynth.cpp
+class Rng {
+public:
+    explicit Rng(unsigned seed) : m_state(seed * 2654435761u + 1) {}
+    unsigned Next() {
+        m_state = m_state * 1103515245u + 12345u;
+        return (m_state >> 8) & 0xFFFFFF;
+    }
+    unsigned Below(unsigned n) { return n ? Next() % n : 0; }
+
+private:
+    unsigned m_state;
+};
+
+void Usage();
+bool ApplyPreset(const std::string& name, GenOptions& opt);
+void FillText(unsigned stream, uint64_t offset, char* out, size_t len);
+bool Compress(std::vector<char>& data);
+bool ReadFile(const std::string& path, std::vector<char>& data);
+
+int main(int argc, char* argv[]) {
+    GenOptions opt;
+    std::string outFile;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--preset" && hasValue) {
+            if (!ApplyPreset(argv[++i], opt)) {
+                fprintf(stderr, "Неизвестный шаблон: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--streams" && hasValue) {
+            opt.streams = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--depth" && hasValue) {
+            opt.depth = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--fanout" && hasValue) {
+            opt.fanout = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--min" && hasValue) {
+            opt.minSize = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--max" && hasValue) {
+            opt.maxSize = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--format" && hasValue) {
+            std::string f = argv[++i];
+            opt.format = f == "text" ? 0 : f == "zlib" ? 1 : 2;
+        } else if (arg == "--fragment") {
+            opt.fragment = true;
+        } else if (arg == "--seed" && hasValue) {
+            opt.seed = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (arg == "--metadata" && hasValue) {
+            opt.metadata = argv[++i];
+        } else if (arg[0] != '-' && outFile.empty()) {
+            outFile = arg;
+        } else {
+            Usage();
+            return arg == "-h" || arg == "/?" ? 0 : 1;
+        }
+    }
+    if (outFile.empty()) {
+        Usage();
+        return 1;
+    }
+    if (opt.fanout == 0) opt.fanout = 1;
+    if (opt.maxSize < opt.minSize) opt.maxSize = opt.minSize;
+
+    clock_t start = clock();
+    CfbWriterOptions writerOptions;
+    writerOptions.fragment = opt.fragment;
+    CfbWriter writer(writerOptions);
+
+    // === Поток метаданных: из файла или минимальный корректный ===
+    std::vector<char> meta;
+    if (!opt.metadata.empty()) {
+        if (!ReadFile(opt.metadata, meta)) {
+            fprintf(stderr, "Не удалось прочитать %s\n", opt.metadata.c_str());
+            return 1;
+        }
+    } else {
+        const char* text = "{{\"MainDataContDef\",\"0\",\"10000\",\"0\"},\r\n"
+                           "{\"TaskItem\",{\"1\",\"Gen\",\"\",\"\",\"0\",\"0\",\"1\"}}}\r\n";
+        meta.assign(text, text + strlen(text));
+        Compress(meta);
+    }
+    bool ok = writer.AddStream("Metadata\\Main MetaData Stream", meta);
+
+    // === Потоки по дереву хранилищ ===
+    Rng rng(opt.seed);
+    uint64_t plainBytes = 0, storedBytes = 0;
+    for (unsigned k = 0; ok && k < opt.streams; ++k) {
+        std::string path;
+        char part[32];
+        for (unsigned level = 0; level < opt.depth; ++level) {
+            snprintf(part, sizeof(part), "Dir%u\\", rng.Below(opt.fanout));
+            path += part;
+        }
+        snprintf(part, sizeof(part), "Stream%05u", k);
+        path += part;
+
+        unsigned size = opt.minSize + rng.Below(opt.maxSize - opt.minSize + 1);
+        bool zlib = opt.format == 1 || (opt.format == 2 && rng.Below(2) == 0);
+        plainBytes += size;
+
+        if (zlib) {
+            // Сжатые потоки держатся в памяти: они в разы меньше исходных
+            std::vector<char> data(size);
+            FillText(k, 0, data.data(), size);
+            Compress(data);
+            storedBytes += data.size();
+            ok = writer.AddStream(path, data);
+        } else {
+            // Текст генерируется при записи, файл может быть больше памяти
+            storedBytes += size;
+            ok = writer.AddStream(path, size, [k](uint64_t offset, char* out, size_t len) {
+                FillText(k, offset, out, len);
+            });
+        }
+    }
+
+    if (!ok || !writer.Write(outFile)) {
+        fprintf(stderr, "%s\n", writer.GetLastError().c_str());
+        return 1;
+    }
+
+    const CfbWriterStats& st = writer.GetStats();
+    printf("%s: %u потоков (%u в мини-потоке), %u хранилищ, %.1f МБ\n",
+        outFile.c_str(), st.streams, st.miniStreams, st.storages, st.fileSize / 1048576.0);
+    printf("  секторов %u: FAT %u, DIFAT %u, miniFAT %u, каталог %u%s\n",
+        st.sectors, st.fatSectors, st.difatSectors, st.miniFatSectors, st.dirSectors,
+        opt.fragment ? ", цепочки фрагментированы" : "");
+    printf("  данных %.1f МБ до упаковки, %.1f МБ в потоках, %.0f мс\n",
+        plainBytes / 1048576.0, storedBytes / 1048576.0, (clock() - start) * 1000.0 / CLOCKS_PER_SEC);
+    return 0;
+}
+
+void Usage() {
+    fprintf(stderr,
+        "mdgen файл.md [--preset имя] [--streams N] [--depth D] [--fanout F] [--min байт] [--max байт]\n"
+        "      [--format text|zlib|mixed] [--fragment] [--seed N] [--metadata файл]\n"
+        "  --preset      - many (10000 мелких потоков), deep (вложенность 24), mini (всё в мини-потоке),\n"
+        "                  large (потоки 64 КБ..4 МБ), fragmented (как large, цепочки вразброс)\n"
+        "  --streams N   - число потоков помимо метаданных (по умолчанию 1000)\n"
+        "  --depth D     - уровней хранилищ, --fanout F - хранилищ на уровне (2 и 8)\n"
+        "  --min/--max   - размер потока до упаковки (64..65536; до 4096 - мини-поток)\n"
+        "  --format      - содержимое потоков: текст, ZLib или вперемешку (mixed)\n"
+        "  --fragment    - чередовать сектора потоков (разрывные цепочки FAT)\n"
+        "  --metadata f  - взять Main MetaData Stream из файла (например, mdbench --save)\n"
+        "Параметры после --preset уточняют шаблон.\n");
+}
+
+bool ApplyPreset(const std::string& name, GenOptions& opt) {
+    if (name == "many") {
+        opt.streams = 10000; opt.depth = 2; opt.fanout = 32; opt.minSize = 64; opt.maxSize = 8192;
+    } else if (name == "deep") {
+        opt.streams = 2000; opt.depth = 24; opt.fanout = 2; opt.minSize = 64; opt.maxSize = 16384;
+    } else if (name == "mini") {
+        opt.streams = 5000; opt.depth = 1; opt.fanout = 16; opt.minSize = 16; opt.maxSize = 4095;
+    } else if (name == "large") {
+        opt.streams = 200; opt.depth = 1; opt.fanout = 4; opt.minSize = 65536; opt.maxSize = 4 << 20;
+        opt.format = 0;
+    } else if (name == "fragmented") {
+        ApplyPreset("large", opt);
+        opt.fragment = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Текст из строк фиксированной длины: байт по смещению вычисляется без буфера
+void FillText(unsigned stream, uint64_t offset, char* out, size_t len) {
+    const size_t kLine = 48;
+    char line[kLine + 1];
+    uint64_t current = (uint64_t)-1;
+    for (size_t i = 0; i < len; ++i) {
+        uint64_t pos = offset + i;
+        uint64_t n = pos / kLine;
+        if (n != current) {
+            // {"Stream00001","00000042","Строка   "} в 1251 + CRLF
+            snprintf(line, sizeof(line), "{\"Stream%05u\",\"%08u\",\"\xD1\xF2\xF0\xEE\xEA\xE0%11u\"}\r\n",
+                stream % 100000, (unsigned)(n % 100000000), (unsigned)((n * 2654435761u) % 1000000));
+            current = n;
+        }
+        out[i] = line[pos % kLine];
+    }
+}
+
+bool Compress(std::vector<char>& data) {
+    size_t outSize = 0;
+    int flags = (int)tdefl_create_comp_flags_from_zip_params(6, MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    void* pComp = tdefl_compress_mem_to_heap(data.data(), data.size(), &outSize, flags);
+    if (!pComp) return false;
+    data.assign((char*)pComp, (char*)pComp + outSize);
+    free(pComp);
+    return true;
+}
+
+bool ReadFile(const std::string& path, std::vector<char>& data) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+    return true;
+}